@@ -4,6 +4,8 @@
 #include <memory>
 #include <random>
 #include <iostream>
+#include <thread>
+#include <filesystem>
 
 #ifdef QT_GUI_LIB
 #include <QImage>
@@ -11,19 +13,211 @@
 #endif
 
 #include "../dz_openslide/deepzoom.hpp"
+#include "../dz_openslide/prefetcher.hpp"
 #include "../dz_qupath/deepzoom.hpp"
 #include "../dz_slideio/deepzoom.hpp"
+#include "../dz_common/tilecache.hpp"
+#include "../dz_common/disktilecache.hpp"
+#include "../dz_common/pixelconv.hpp"
+#include "../dz_common/pixelbuffer.hpp"
+#include "../dz_common/resample.hpp"
+#include "../dz_common/slidemetadata.hpp"
+#include "../dz_common/tilepack.hpp"
 
 //#define BENCH_PNG
 //#define BENCH_DZ_QUPATH
 
+// "jpg", "png", "webp", "webp_lossless" or "avif"
+template <typename Generator>
+typename Generator::ImageFormat image_format(std::string const& format)
+{
+    if (format == "png") return Generator::ImageFormat::PNG;
+    if (format == "webp") return Generator::ImageFormat::WEBP;
+    if (format == "webp_lossless") return Generator::ImageFormat::WEBP_LOSSLESS;
+    if (format == "avif") return Generator::ImageFormat::AVIF;
+    return Generator::ImageFormat::JPG;
+}
+
 auto BM_dz_openslide_get_tile = [](benchmark::State& state, std::string const& file_path, int tile_size, int overlap,
                                    std::vector<std::tuple<int, int, int>> const& tiles,
                                    std::string const& format = "jpg", float quality = 0.75f) {
     auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
-                                                 (format == "jpg" ? dz_openslide::DeepZoomGenerator::ImageFormat::JPG :
-                                                                    dz_openslide::DeepZoomGenerator::ImageFormat::PNG),
-                                                 quality);
+                                                 image_format<dz_openslide::DeepZoomGenerator>(format), quality);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto img = slide.get_tile(dz_level, col, row);
+        benchmark::DoNotOptimize(img);
+    }
+};
+
+// same as above, encoding into a reused buffer: pixels come from the per-thread pool, no allocation per tile
+auto BM_dz_openslide_get_tile_span = [](benchmark::State& state, std::string const& file_path, int tile_size,
+                                        int overlap, std::vector<std::tuple<int, int, int>> const& tiles,
+                                        std::string const& format = "jpg", float quality = 0.75f) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 image_format<dz_openslide::DeepZoomGenerator>(format), quality);
+    std::vector<uint8_t> buffer(slide.max_tile_size());
+    auto const allocations = dz_common::PixelBuffer::allocations();
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto size = slide.get_tile(dz_level, col, row, buffer);
+        benchmark::DoNotOptimize(size);
+    }
+    state.counters["pixel_allocations"] =
+        static_cast<double>(dz_common::PixelBuffer::allocations() - allocations);
+};
+
+// a viewer panning through `tiles` behind a prefetcher, one burst of requests per iteration
+auto BM_dz_openslide_get_tile_prefetch = [](benchmark::State& state, std::string const& file_path, int tile_size,
+                                            int overlap,
+                                            std::vector<std::vector<std::tuple<int, int, int>>> const& bursts,
+                                            std::string const& format = "jpg", float quality = 0.75f) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 image_format<dz_openslide::DeepZoomGenerator>(format), quality);
+    slide.set_tile_cache(std::make_shared<dz_common::TileCache>(size_t{256} << 20));
+    dz_openslide::Prefetcher prefetcher(slide);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        for (auto const& [dz_level, col, row] : bursts[i++ % bursts.size()])
+        {
+            auto img = prefetcher.get_tile(dz_level, col, row);
+            benchmark::DoNotOptimize(img);
+        }
+    }
+    auto const stats = prefetcher.stats();
+    state.counters["hit_rate"] = stats.hit_rate();
+    state.counters["accuracy"] = stats.accuracy();
+};
+
+// same as `BM_dz_openslide_get_tile` with blank detection, blank tiles skip the read and the encoding
+auto BM_dz_openslide_get_tile_blank = [](benchmark::State& state, std::string const& file_path, int tile_size,
+                                         int overlap, std::vector<std::tuple<int, int, int>> const& tiles,
+                                         std::string const& format = "jpg", float quality = 0.75f) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 image_format<dz_openslide::DeepZoomGenerator>(format), quality);
+    slide.set_blank_detection();
+    int64_t blank = 0;
+    for (auto const& [dz_level, col, row] : tiles)
+        blank += slide.is_blank(dz_level, col, row);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto img = slide.get_tile(dz_level, col, row);
+        benchmark::DoNotOptimize(img);
+    }
+    state.counters["blank_tiles"] = static_cast<double>(blank);
+};
+
+// same as above but with a shared tile cache in front of `get_tile`, meant to be fed with a repeat-pan workload
+auto BM_dz_openslide_get_tile_cached = [](benchmark::State& state, std::string const& file_path, int tile_size,
+                                          int overlap, std::vector<std::tuple<int, int, int>> const& tiles,
+                                          std::string const& format = "jpg", float quality = 0.75f) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 image_format<dz_openslide::DeepZoomGenerator>(format), quality);
+    auto cache = std::make_shared<dz_common::TileCache>(size_t{64} << 20);
+    slide.set_tile_cache(cache);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto img = slide.get_tile(dz_level, col, row);
+        benchmark::DoNotOptimize(img);
+    }
+    auto const stats = cache->stats();
+    state.counters["hits"] = static_cast<double>(stats.hits);
+    state.counters["misses"] = static_cast<double>(stats.misses);
+    state.counters["evictions"] = static_cast<double>(stats.evictions);
+    state.counters["cached_MB"] = stats.bytes / 1e6;
+};
+
+// same with the disk tier only (the memory cache holds no tile), warmed up first: a restart with a warm disk cache
+auto BM_dz_openslide_get_tile_disk_cached = [](benchmark::State& state, std::string const& file_path, int tile_size,
+                                               int overlap, std::vector<std::tuple<int, int, int>> const& tiles,
+                                               std::string const& format = "jpg", float quality = 0.75f) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 image_format<dz_openslide::DeepZoomGenerator>(format), quality);
+    auto disk_cache = std::make_shared<dz_common::DiskTileCache>(
+        (std::filesystem::temp_directory_path() / "dz_bench_disk_cache").string(), size_t{1} << 30);
+    auto cache = std::make_shared<dz_common::TileCache>(0);
+    cache->set_disk_cache(disk_cache);
+    slide.set_tile_cache(cache);
+    for (auto const& [dz_level, col, row] : tiles)
+        slide.get_tile(dz_level, col, row);
+    disk_cache->reset_stats();
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto img = slide.get_tile(dz_level, col, row);
+        benchmark::DoNotOptimize(img);
+    }
+    auto const stats = disk_cache->stats();
+    state.counters["hits"] = static_cast<double>(stats.hits);
+    state.counters["misses"] = static_cast<double>(stats.misses);
+    state.counters["disk_MB"] = stats.bytes / 1e6;
+};
+
+// same tiles out of an exported pack (only these tiles are written to it): the cost of serving a pre-rendered pyramid
+auto BM_tilepack_get_tile = [](benchmark::State& state, std::string const& file_path, int tile_size, int overlap,
+                               std::vector<std::tuple<int, int, int>> const& tiles) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 dz_openslide::DeepZoomGenerator::ImageFormat::JPG, 0.9f);
+    auto const path = (std::filesystem::temp_directory_path() / "dz_bench.dzpack").string();
+    {
+        dz_common::TilePackWriter writer(path, slide.get_dzi(), "jpg", slide.level_tiles());
+        for (auto const& [dz_level, col, row] : tiles)
+            writer.add(dz_level, col, row, slide.get_tile(dz_level, col, row));
+        if (!writer.finish())
+        {
+            state.SkipWithError("failed to write the pack");
+            return;
+        }
+    }
+    dz_common::TilePack pack(path);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto tile = pack.tile(dz_level, col, row);
+        benchmark::DoNotOptimize(tile);
+    }
+    state.counters["pack_MB"] = pack.size() / 1e6;
+};
+
+// one generator shared by all benchmark threads, `items_per_second` shows how it scales with the thread count
+auto BM_dz_openslide_get_tile_mt = [](benchmark::State& state,
+                                      std::shared_ptr<dz_openslide::DeepZoomGenerator> const& slide,
+                                      std::vector<std::tuple<int, int, int>> const& tiles) {
+    // start each thread at a different place so that they don't read the same tiles in lock step
+    size_t i = static_cast<size_t>(state.thread_index()) * tiles.size() / std::max(1, state.threads());
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto img = slide->get_tile(dz_level, col, row);
+        benchmark::DoNotOptimize(img);
+    }
+    state.SetItemsProcessed(state.iterations());
+};
+
+// low zoom tiles, read from the slide as they are or built from their child tiles (`min_downsample` > 0)
+auto BM_dz_openslide_get_tile_synth = [](benchmark::State& state, std::string const& file_path, int tile_size,
+                                         int overlap, std::vector<std::tuple<int, int, int>> const& tiles,
+                                         double min_downsample) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 dz_openslide::DeepZoomGenerator::ImageFormat::JPG, 0.9f);
+    // fresh for every run, meant to be run for `tiles.size()` iterations so that no tile is asked twice and only
+    // child tiles are reused
+    if (min_downsample > 0)
+    {
+        slide.set_tile_cache(std::make_shared<dz_common::TileCache>(size_t{256} << 20));
+        slide.set_synthesis(min_downsample);
+    }
     size_t i = 0;
     for (auto _ : state)
     {
@@ -33,6 +227,103 @@ auto BM_dz_openslide_get_tile = [](benchmark::State& state, std::string const& f
     }
 };
 
+// one viewport per iteration, either tile by tile or as a single `get_tiles` batch
+auto BM_dz_openslide_get_tiles = [](benchmark::State& state, std::string const& file_path, int tile_size, int overlap,
+                                    std::vector<std::tuple<int, int, int>> const& tiles, bool batch) {
+    auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                 dz_openslide::DeepZoomGenerator::ImageFormat::JPG, 0.9f);
+    for (auto _ : state)
+    {
+        if (batch)
+        {
+            auto imgs = slide.get_tiles(tiles);
+            benchmark::DoNotOptimize(imgs);
+        }
+        else
+        {
+            for (auto const& [dz_level, col, row] : tiles)
+            {
+                auto img = slide.get_tile(dz_level, col, row);
+                benchmark::DoNotOptimize(img);
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * tiles.size());
+};
+
+// the level a viewer starts from: the largest one that fits in a single tile
+template <typename Generator>
+int first_level(Generator const& slide)
+{
+    auto const level_tiles = slide.level_tiles();
+    int level = 0;
+    while (level + 1 < slide.level_count() && level_tiles[level + 1].first * level_tiles[level + 1].second == 1)
+        level++;
+    return level;
+}
+
+// time to first tile: open, DZI and the first tile of a viewer, per iteration
+// with a `metadata_path` all but the first iteration load the levels from the sidecar
+auto BM_dz_openslide_open = [](benchmark::State& state, std::string const& file_path, int tile_size, int overlap,
+                               dz_openslide::DeepZoomGenerator::OpenMode open_mode,
+                               std::string const& metadata_path) {
+    for (auto _ : state)
+    {
+        auto slide = dz_openslide::DeepZoomGenerator(file_path, tile_size, overlap, false,
+                                                     dz_openslide::DeepZoomGenerator::ImageFormat::JPG, 0.9f,
+                                                     open_mode, metadata_path);
+        auto dzi = slide.get_dzi();
+        auto img = slide.get_tile(first_level(slide), 0, 0);
+        benchmark::DoNotOptimize(dzi);
+        benchmark::DoNotOptimize(img);
+    }
+};
+
+// ARGB -> RGB of one tile, the conversion `encode_pixels_to_jpeg`/`encode_pixels_to_png` run before encoding
+auto BM_pixelconv_argb_to_rgb = [](benchmark::State& state, dz_common::PixelConvIsa isa) {
+    auto const used = dz_common::set_pixelconv_isa(isa);
+    if (used != isa)
+    {
+        state.SkipWithError("not supported by this CPU");
+        dz_common::set_pixelconv_isa(dz_common::PixelConvIsa::AVX2);
+        return;
+    }
+    auto const count = static_cast<size_t>(state.range(0)) * state.range(0);
+    std::vector<uint32_t> argb(count);
+    std::mt19937 gen(42);
+    for (auto& p : argb)
+        p = gen() | 0xff000000;
+    std::vector<uint8_t> rgb(count * 3);
+    for (auto _ : state)
+    {
+        dz_common::argb_to_rgb(argb.data(), rgb.data(), count);
+        benchmark::DoNotOptimize(rgb.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * count * 4);
+    dz_common::set_pixelconv_isa(dz_common::PixelConvIsa::AVX2);
+};
+
+// a slide region of a level between two slide levels (4/3 of the tile) down to a tile of `state.range(0)` pixels
+auto BM_resample = [](benchmark::State& state, dz_common::PixelConvIsa isa, dz_common::ResampleFilter filter) {
+    dz_common::set_pixelconv_isa(isa);
+    auto const dst_size = static_cast<int64_t>(state.range(0));
+    auto const src_size = dst_size * 4 / 3;
+    std::vector<uint32_t> src(src_size * src_size);
+    std::mt19937 rng(0);
+    for (auto& p : src)
+        p = 0xff000000u | (rng() & 0x00ffffffu);
+    std::vector<uint32_t> dst(dst_size * dst_size);
+    for (auto _ : state)
+    {
+        dz_common::resample(src.data(), src_size, src_size, src_size, dst.data(), dst_size, dst_size, dst_size,
+                            filter);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * dst_size * dst_size);
+    dz_common::set_pixelconv_isa(dz_common::PixelConvIsa::AVX2);
+};
+
 #ifdef QT_GUI_LIB
 auto BM_dz_openslide_get_tile_qimg = [](benchmark::State& state, std::string const& file_path, int tile_size,
                                         int overlap, std::vector<std::tuple<int, int, int>> const& tiles,
@@ -58,11 +349,10 @@ auto BM_dz_openslide_get_tile_qimg = [](benchmark::State& state, std::string con
 #ifdef BENCH_DZ_QUPATH
 auto BM_dz_qupath_get_tile = [](benchmark::State& state, std::string const& file_path, int tile_size, int overlap,
                                 std::vector<std::tuple<int, int, int>> const& tiles, std::string const& format = "jpg",
-                                float quality = 0.75f) {
+                                float quality = 0.75f, bool native_encoding = true) {
     auto slide = dz_qupath::DeepZoomGenerator(file_path, tile_size, overlap,
-                                              (format == "jpg" ? dz_qupath::DeepZoomGenerator::ImageFormat::JPG :
-                                                                 dz_qupath::DeepZoomGenerator::ImageFormat::PNG),
-                                              quality);
+                                              image_format<dz_qupath::DeepZoomGenerator>(format), quality);
+    slide.set_native_encoding(native_encoding);
     size_t i = 0;
     for (auto _ : state)
     {
@@ -73,13 +363,41 @@ auto BM_dz_qupath_get_tile = [](benchmark::State& state, std::string const& file
 };
 #endif
 
+#ifdef BENCH_DZ_QUPATH
+// as `BM_dz_openslide_get_tile_mt`, every benchmark thread is attached to the JVM on its first tile
+auto BM_dz_qupath_get_tile_mt = [](benchmark::State& state, std::shared_ptr<dz_qupath::DeepZoomGenerator> const& slide,
+                                   std::vector<std::tuple<int, int, int>> const& tiles) {
+    size_t i = static_cast<size_t>(state.thread_index()) * tiles.size() / std::max(1, state.threads());
+    for (auto _ : state)
+    {
+        auto [dz_level, col, row] = tiles[i++ % tiles.size()];
+        auto img = slide->get_tile(dz_level, col, row);
+        benchmark::DoNotOptimize(img);
+    }
+    state.SetItemsProcessed(state.iterations());
+};
+#endif
+
+#ifdef BENCH_DZ_QUPATH
+auto BM_dz_qupath_open = [](benchmark::State& state, std::string const& file_path, int tile_size, int overlap,
+                            dz_qupath::DeepZoomGenerator::OpenMode open_mode) {
+    for (auto _ : state)
+    {
+        auto slide = dz_qupath::DeepZoomGenerator(file_path, tile_size, overlap,
+                                                  dz_qupath::DeepZoomGenerator::ImageFormat::JPG, 0.9f, open_mode);
+        auto dzi = slide.get_dzi();
+        auto img = slide.get_tile(first_level(slide), 0, 0);
+        benchmark::DoNotOptimize(dzi);
+        benchmark::DoNotOptimize(img);
+    }
+};
+#endif
+
 auto BM_dz_slideio_get_tile = [](benchmark::State& state, std::string const& file_path, int tile_size, int overlap,
                                  std::vector<std::tuple<int, int, int>> const& tiles, std::string const& format = "jpg",
                                  float quality = 0.75f) {
     auto slide = dz_slideio::DeepZoomGenerator(file_path, tile_size, overlap,
-                                               (format == "jpg" ? dz_slideio::DeepZoomGenerator::ImageFormat::JPG :
-                                                                  dz_slideio::DeepZoomGenerator::ImageFormat::PNG),
-                                               quality);
+                                               image_format<dz_slideio::DeepZoomGenerator>(format), quality);
     size_t i = 0;
     for (auto _ : state)
     {
@@ -108,6 +426,14 @@ int main(int argc, char* argv[])
 
     constexpr int n = 1 << 10;
     std::vector<std::tuple<int, int, int>> tiles(n);
+    // viewer panning back and forth over a small window of one level
+    std::vector<std::tuple<int, int, int>> pan_tiles;
+    // the window itself, as a viewer requests it on a jump
+    std::vector<std::tuple<int, int, int>> view_tiles;
+    // bursts of a viewer panning to the right over the same level
+    std::vector<std::vector<std::tuple<int, int, int>>> walk_bursts;
+    // every tile of a few low zoom levels, highest level first like a viewer zooming out
+    std::vector<std::tuple<int, int, int>> low_tiles;
     {
         auto slide = dz_openslide::DeepZoomGenerator(filepath, tile_size, overlap);
 
@@ -124,6 +450,33 @@ int main(int argc, char* argv[])
             auto row = rowd(gen);
             tiles[i] = std::make_tuple(dz_level, col, row);
         }
+
+        auto const pan_level = std::max(0, slide.level_count() - 2);
+        auto const [cols, rows] = slide.level_tiles()[pan_level];
+        for (int64_t r = rows / 2; r < std::min(rows, rows / 2 + 4); r++)
+            for (int64_t c = cols / 2; c < std::min(cols, cols / 2 + 8); c++)
+                pan_tiles.emplace_back(pan_level, static_cast<int>(c), static_cast<int>(r));
+        view_tiles = pan_tiles;
+
+        for (auto level = std::max(0, slide.level_count() - 5); level >= std::max(0, slide.level_count() - 8); level--)
+        {
+            auto const [level_cols, level_rows] = slide.level_tiles()[level];
+            for (int64_t r = 0; r < level_rows && low_tiles.size() < 256; r++)
+                for (int64_t c = 0; c < level_cols && low_tiles.size() < 256; c++)
+                    low_tiles.emplace_back(level, static_cast<int>(c), static_cast<int>(r));
+        }
+        // and back
+        auto const forth = pan_tiles;
+        pan_tiles.insert(pan_tiles.end(), forth.rbegin(), forth.rend());
+
+        // the window, then the column it uncovers at every step of a pan to the right
+        walk_bursts.push_back(view_tiles);
+        for (int64_t c = cols / 2 + 8; c < std::min(cols, cols / 2 + 8 + 64); c++)
+        {
+            auto& burst = walk_bursts.emplace_back();
+            for (int64_t r = rows / 2; r < std::min(rows, rows / 2 + 4); r++)
+                burst.emplace_back(pan_level, static_cast<int>(c), static_cast<int>(r));
+        }
     }
 
     // for parsing results: template(<>) + argument(/)
@@ -137,6 +490,142 @@ int main(int argc, char* argv[])
         ->UseRealTime()
         ->Iterations(200)
         ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_span" + name_surfix, BM_dz_openslide_get_tile_span, filepath,
+                                 tile_size, overlap, tiles, "jpg", 0.9f)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_blank" + name_surfix, BM_dz_openslide_get_tile_blank, filepath,
+                                 tile_size, overlap, tiles, "jpg", 0.9f)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_cached" + name_surfix, BM_dz_openslide_get_tile_cached, filepath,
+                                 tile_size, overlap, pan_tiles, "jpg", 0.9f)
+        ->Unit(benchmark::kMicrosecond)
+        ->Arg(static_cast<int>(pan_tiles.size()))
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(2000)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_disk_cached" + name_surfix, BM_dz_openslide_get_tile_disk_cached,
+                                 filepath, tile_size, overlap, pan_tiles, "jpg", 0.9f)
+        ->Unit(benchmark::kMicrosecond)
+        ->Arg(static_cast<int>(pan_tiles.size()))
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(2000)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("tilepack_jpg" + name_surfix, BM_tilepack_get_tile, filepath, tile_size, overlap,
+                                 pan_tiles)
+        ->Unit(benchmark::kMicrosecond)
+        ->Arg(static_cast<int>(pan_tiles.size()))
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(2000)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_prefetch" + name_surfix, BM_dz_openslide_get_tile_prefetch, filepath,
+                                 tile_size, overlap, walk_bursts, "jpg", 0.9f)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(static_cast<int>(walk_bursts.size()))
+        ->UseRealTime()
+        ->Iterations(static_cast<int>(walk_bursts.size()))
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_open_eager" + name_surfix, BM_dz_openslide_open, filepath, tile_size,
+                                 overlap, dz_openslide::DeepZoomGenerator::OpenMode::EAGER, std::string())
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime()
+        ->Iterations(20)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_open_lazy" + name_surfix, BM_dz_openslide_open, filepath, tile_size,
+                                 overlap, dz_openslide::DeepZoomGenerator::OpenMode::LAZY, std::string())
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime()
+        ->Iterations(20)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_open_sidecar" + name_surfix, BM_dz_openslide_open, filepath, tile_size,
+                                 overlap, dz_openslide::DeepZoomGenerator::OpenMode::LAZY,
+                                 dz_common::SlideMetadata::sidecar_path(
+                                     filepath, std::filesystem::temp_directory_path().string()))
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime()
+        ->Iterations(20)
+        ->Repetitions(5);
+    auto const max_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    auto shared_slide = std::make_shared<dz_openslide::DeepZoomGenerator>(
+        filepath, tile_size, overlap, false, dz_openslide::DeepZoomGenerator::ImageFormat::JPG, 0.9f);
+    shared_slide->set_max_handles(max_threads);
+    benchmark::RegisterBenchmark("openslide_jpg_mt" + name_surfix, BM_dz_openslide_get_tile_mt, shared_slide, tiles)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->ThreadRange(1, max_threads)
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_view" + name_surfix, BM_dz_openslide_get_tiles, filepath, tile_size,
+                                 overlap, view_tiles, false)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(static_cast<int>(view_tiles.size()))
+        ->UseRealTime()
+        ->Iterations(20)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_batch" + name_surfix, BM_dz_openslide_get_tiles, filepath, tile_size,
+                                 overlap, view_tiles, true)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(static_cast<int>(view_tiles.size()))
+        ->UseRealTime()
+        ->Iterations(20)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_low" + name_surfix, BM_dz_openslide_get_tile_synth, filepath, tile_size,
+                                 overlap, low_tiles, 0.)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(static_cast<int>(low_tiles.size()))
+        ->UseRealTime()
+        ->Iterations(static_cast<int64_t>(low_tiles.size()))
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("openslide_jpg_low_synth" + name_surfix, BM_dz_openslide_get_tile_synth, filepath,
+                                 tile_size, overlap, low_tiles, 4.)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(static_cast<int>(low_tiles.size()))
+        ->UseRealTime()
+        ->Iterations(static_cast<int64_t>(low_tiles.size()))
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("pixelconv_rgb_scalar" + name_surfix, BM_pixelconv_argb_to_rgb,
+                                 dz_common::PixelConvIsa::SCALAR)
+        ->Unit(benchmark::kMicrosecond)
+        ->Arg(tile_size + overlap * 2)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("pixelconv_rgb_ssse3" + name_surfix, BM_pixelconv_argb_to_rgb,
+                                 dz_common::PixelConvIsa::SSSE3)
+        ->Unit(benchmark::kMicrosecond)
+        ->Arg(tile_size + overlap * 2)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("pixelconv_rgb_avx2" + name_surfix, BM_pixelconv_argb_to_rgb,
+                                 dz_common::PixelConvIsa::AVX2)
+        ->Unit(benchmark::kMicrosecond)
+        ->Arg(tile_size + overlap * 2)
+        ->Repetitions(5);
+    for (auto const& [filter_name, filter] : {std::pair{"area", dz_common::ResampleFilter::AREA},
+                                              std::pair{"bilinear", dz_common::ResampleFilter::BILINEAR},
+                                              std::pair{"lanczos", dz_common::ResampleFilter::LANCZOS}})
+    {
+        benchmark::RegisterBenchmark(std::string("resample_") + filter_name + "_scalar" + name_surfix, BM_resample,
+                                     dz_common::PixelConvIsa::SCALAR, filter)
+            ->Unit(benchmark::kMicrosecond)
+            ->Arg(tile_size + overlap * 2)
+            ->Repetitions(5);
+        benchmark::RegisterBenchmark(std::string("resample_") + filter_name + "_avx2" + name_surfix, BM_resample,
+                                     dz_common::PixelConvIsa::AVX2, filter)
+            ->Unit(benchmark::kMicrosecond)
+            ->Arg(tile_size + overlap * 2)
+            ->Repetitions(5);
+    }
 #ifdef BENCH_PNG
     benchmark::RegisterBenchmark("openslide_png" + name_surfix, BM_dz_openslide_get_tile, filepath, tile_size, overlap,
                                  tiles, "png", 1.f)
@@ -147,6 +636,26 @@ int main(int argc, char* argv[])
         ->Iterations(200)
         ->Repetitions(5);
 #endif
+#ifdef DZ_HAVE_WEBP
+    benchmark::RegisterBenchmark("openslide_webp" + name_surfix, BM_dz_openslide_get_tile, filepath, tile_size, overlap,
+                                 tiles, "webp", 0.9f)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
+#endif
+#ifdef DZ_HAVE_AVIF
+    benchmark::RegisterBenchmark("openslide_avif" + name_surfix, BM_dz_openslide_get_tile, filepath, tile_size, overlap,
+                                 tiles, "avif", 0.9f)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
+#endif
 #ifdef QT_GUI_LIB
     benchmark::RegisterBenchmark("openslide_jpg_q" + name_surfix, BM_dz_openslide_get_tile_qimg, filepath, tile_size,
                                  overlap, tiles, "jpg", 0.9f)
@@ -176,6 +685,43 @@ int main(int argc, char* argv[])
         ->UseRealTime()
         ->Iterations(200)
         ->Repetitions(5);
+    // tiles encoded by ImageIO and copied out of Java byte arrays, as before the native encoders
+    benchmark::RegisterBenchmark("qupath_jpg_imageio" + name_surfix, BM_dz_qupath_get_tile, filepath, tile_size,
+                                 overlap, tiles, "jpg", 0.9f, false)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
+    // a pool of QuPath servers against the single one, which serializes the reads of all threads
+    auto const qupath_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (auto const readers : {qupath_threads, 1})
+    {
+        auto shared_qupath_slide = std::make_shared<dz_qupath::DeepZoomGenerator>(
+            filepath, tile_size, overlap, dz_qupath::DeepZoomGenerator::ImageFormat::JPG, 0.9f);
+        shared_qupath_slide->set_max_readers(readers);
+        benchmark::RegisterBenchmark((readers > 1 ? "qupath_jpg_mt" : "qupath_jpg_mt_single_reader") + name_surfix,
+                                     BM_dz_qupath_get_tile_mt, shared_qupath_slide, tiles)
+            ->Unit(benchmark::kMillisecond)
+            ->Arg(n)
+            ->ThreadRange(1, qupath_threads)
+            ->UseRealTime()
+            ->Iterations(200)
+            ->Repetitions(5);
+    }
+    benchmark::RegisterBenchmark("qupath_open_eager" + name_surfix, BM_dz_qupath_open, filepath, tile_size, overlap,
+                                 dz_qupath::DeepZoomGenerator::OpenMode::EAGER)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime()
+        ->Iterations(20)
+        ->Repetitions(5);
+    benchmark::RegisterBenchmark("qupath_open_lazy" + name_surfix, BM_dz_qupath_open, filepath, tile_size, overlap,
+                                 dz_qupath::DeepZoomGenerator::OpenMode::LAZY)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime()
+        ->Iterations(20)
+        ->Repetitions(5);
 #ifdef BENCH_PNG
     benchmark::RegisterBenchmark("qupath_png" + name_surfix, BM_dz_qupath_get_tile, filepath, tile_size, overlap, tiles,
                                  "png", 1.f)
@@ -204,6 +750,26 @@ int main(int argc, char* argv[])
         ->UseRealTime()
         ->Iterations(200)
         ->Repetitions(5);
+#endif
+#ifdef DZ_HAVE_WEBP
+    benchmark::RegisterBenchmark("slideio_webp" + name_surfix, BM_dz_slideio_get_tile, filepath, tile_size, overlap,
+                                 tiles, "webp", 0.9f)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
+#endif
+#ifdef DZ_HAVE_AVIF
+    benchmark::RegisterBenchmark("slideio_avif" + name_surfix, BM_dz_slideio_get_tile, filepath, tile_size, overlap,
+                                 tiles, "avif", 0.9f)
+        ->Unit(benchmark::kMillisecond)
+        ->Arg(n)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime()
+        ->Iterations(200)
+        ->Repetitions(5);
 #endif
     benchmark::RunSpecifiedBenchmarks();
     benchmark::Shutdown();
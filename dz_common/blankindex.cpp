@@ -0,0 +1,163 @@
+#include "blankindex.hpp"
+#include "pixelconv.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace dz_common;
+
+template <typename Range>
+BlankIndex BlankIndex::_from_picture(int width, int height, int64_t l0_width, int64_t l0_height, int tolerance,
+                                     std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+                                     TileRect const& tile_rect, Range const& range)
+{
+    BlankIndex index;
+    if (width <= 0 || height <= 0 || l0_width <= 0 || l0_height <= 0 || tolerance < 0) return index;
+    index.m_tolerance = std::min(tolerance, 255);
+    for (auto const& [cols, rows] : level_tiles)
+    {
+        index.m_cols.push_back(cols);
+        index.m_levels.emplace_back(static_cast<size_t>(cols * rows), false);
+        index.m_colors.emplace_back(static_cast<size_t>(cols * rows), 0u);
+    }
+
+    auto const scale_x = static_cast<double>(width) / l0_width;
+    auto const scale_y = static_cast<double>(height) / l0_height;
+    // levels are filled in parallel, each by a single thread
+    ThreadPool::shared().parallel_for(level_tiles.size(), [&](size_t l) {
+        auto const dz_level = static_cast<int>(l);
+        auto const [cols, rows] = level_tiles[dz_level];
+        for (int64_t row = 0; row < rows; row++)
+            for (int64_t col = 0; col < cols; col++)
+            {
+                // the tile's area in the picture, a pixel wider on each side for what the downsampling blurred
+                auto const [x, y, w, h] = tile_rect(dz_level, col, row);
+                auto const x0 = std::max<int64_t>(0, static_cast<int64_t>(x * scale_x) - 1);
+                auto const y0 = std::max<int64_t>(0, static_cast<int64_t>(y * scale_y) - 1);
+                auto const x1 = std::min<int64_t>(width, static_cast<int64_t>(std::ceil((x + w) * scale_x)) + 1);
+                auto const y1 = std::min<int64_t>(height, static_cast<int64_t>(std::ceil((y + h) * scale_y)) + 1);
+                if (x1 <= x0 || y1 <= y0) continue;
+
+                uint32_t min = 0xffffffff, max = 0, color = 0;
+                auto uniform = true;
+                for (auto yy = y0; yy < y1 && uniform; yy++)
+                {
+                    range(x0, x1, yy, &min, &max);
+                    uniform = _uniform(min, max, index.m_tolerance, &color);
+                }
+                if (!uniform) continue;
+                auto const i = static_cast<size_t>(row * cols + col);
+                index.m_levels[dz_level][i] = true;
+                index.m_colors[dz_level][i] = color;
+            }
+    });
+    return index;
+}
+
+BlankIndex BlankIndex::from_picture(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                                    int64_t l0_width, int64_t l0_height, int tolerance,
+                                    std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+                                    TileRect const& tile_rect)
+{
+    if (!pixels) return {};
+    // the color bytes of a pixel, x of BGRX is ignored
+    auto const pixel_size = layout == PixelLayout::RGB ? 3 : 4;
+    auto const r = layout == PixelLayout::RGB ? 0 : 2;
+    auto const b = 2 - r;
+    return _from_picture(
+        width, height, l0_width, l0_height, tolerance, level_tiles, tile_rect,
+        [&](int64_t x0, int64_t x1, int64_t y, uint32_t* min, uint32_t* max) {
+            // as opaque ARGB
+            *min |= 0xff000000u;
+            *max |= 0xff000000u;
+            auto const* p = pixels + y * stride + x0 * pixel_size;
+            for (auto x = x0; x < x1; x++, p += pixel_size)
+            {
+                uint32_t const argb = 0xff000000u | uint32_t{p[r]} << 16 | uint32_t{p[1]} << 8 | p[b];
+                for (int c = 0; c < 24; c += 8)
+                {
+                    auto const v = (argb >> c) & 0xff;
+                    if (v < ((*min >> c) & 0xff)) *min = (*min & ~(0xffu << c)) | v << c;
+                    if (v > ((*max >> c) & 0xff)) *max = (*max & ~(0xffu << c)) | v << c;
+                }
+            }
+        });
+}
+
+BlankIndex BlankIndex::from_picture(uint32_t const* pixels, int width, int height, int64_t l0_width,
+                                    int64_t l0_height, int tolerance,
+                                    std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+                                    TileRect const& tile_rect)
+{
+    if (!pixels) return {};
+    return _from_picture(width, height, l0_width, l0_height, tolerance, level_tiles, tile_rect,
+                         [&](int64_t x0, int64_t x1, int64_t y, uint32_t* min, uint32_t* max) {
+                             argb_range(pixels + y * width + x0, static_cast<size_t>(x1 - x0), min, max);
+                         });
+}
+
+bool BlankIndex::uniform(uint32_t const* pixels, size_t count, int tolerance, uint32_t* color)
+{
+    if (!pixels || count == 0 || tolerance < 0) return false;
+    uint32_t min = 0xffffffff, max = 0;
+    argb_range(pixels, count, &min, &max);
+    return _uniform(min, max, std::min(tolerance, 255), color);
+}
+
+bool BlankIndex::_uniform(uint32_t min, uint32_t max, int tolerance, uint32_t* color)
+{
+    uint32_t middle = 0;
+    for (int c = 0; c < 32; c += 8)
+    {
+        auto const lo = (min >> c) & 0xff;
+        auto const hi = (max >> c) & 0xff;
+        if (hi - lo > static_cast<uint32_t>(tolerance)) return false;
+        middle |= ((lo + hi) / 2) << c;
+    }
+    if (color) *color = middle;
+    return true;
+}
+
+bool BlankIndex::empty() const
+{
+    return m_levels.empty();
+}
+
+int BlankIndex::tolerance() const
+{
+    return m_tolerance;
+}
+
+bool BlankIndex::is_blank(int dz_level, int64_t col, int64_t row, uint32_t* color) const
+{
+    if (dz_level < 0 || dz_level >= static_cast<int>(m_levels.size())) return false;
+    auto const cols = m_cols[dz_level];
+    auto const& level = m_levels[dz_level];
+    if (col < 0 || col >= cols || row < 0 || static_cast<size_t>(row * cols + col) >= level.size()) return false;
+    auto const i = static_cast<size_t>(row * cols + col);
+    if (!level[i]) return false;
+    if (color) *color = m_colors[dz_level][i];
+    return true;
+}
+
+BlankTiles::Tile BlankTiles::get(uint32_t color, int64_t width, int64_t height, bool variant,
+                                 std::function<std::vector<uint8_t>()> const& encode)
+{
+    auto const key = std::make_tuple(color, width, height, variant);
+    {
+        std::lock_guard lock(m_mutex);
+        if (auto it = m_tiles.find(key); it != m_tiles.end()) return it->second;
+    }
+    auto tile = std::make_shared<std::vector<uint8_t> const>(encode());
+    std::lock_guard lock(m_mutex);
+    // glass is not perfectly even, keep the number of colors bounded
+    if (m_tiles.size() >= 256) m_tiles.clear();
+    return m_tiles.emplace(key, std::move(tile)).first->second;
+}
+
+void BlankTiles::clear()
+{
+    std::lock_guard lock(m_mutex);
+    m_tiles.clear();
+}
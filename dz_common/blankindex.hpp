@@ -0,0 +1,88 @@
+#pragma once
+
+#include "dz_common/codec.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace dz_common
+{
+    // blank tiles of every deepzoom level of a slide, so that exporters and viewers can skip them: a tile whose area
+    // stays within `tolerance` levels of one color on every channel (glass, or the outside of the scan) is blank.
+    // the bitmaps come from a picture of the whole level 0, usually at the resolution of the lowest slide level;
+    // tissue smaller than a pixel of the picture is not seen.
+    // queries are lookups, the index is immutable once built
+    class BlankIndex
+    {
+    public:
+        // pictures over it are scaled down by the generators
+        static constexpr int64_t max_picture_pixels = int64_t{64} << 20;
+
+        using TileRect = std::function<std::tuple<int64_t, int64_t, int64_t, int64_t>(int dz_level, int64_t col,
+                                                                                       int64_t row)>;
+
+        BlankIndex() = default;
+
+        // `pixels` covers the whole level 0 of `l0_width` x `l0_height`, `stride` is in bytes
+        // `level_tiles` are the <cols, rows> of every deepzoom level, `tile_rect` gives the level 0
+        // <x, y, width, height> of a tile
+        static BlankIndex from_picture(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                                       int64_t l0_width, int64_t l0_height, int tolerance,
+                                       std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+                                       TileRect const& tile_rect);
+        // premultiplied ARGB, as `openslide_read_region` returns it: the alpha is a channel like the others, the
+        // transparent outside of the scan is blank
+        static BlankIndex from_picture(uint32_t const* pixels, int width, int height, int64_t l0_width,
+                                       int64_t l0_height, int tolerance,
+                                       std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+                                       TileRect const& tile_rect);
+
+        // true if no channel of the premultiplied ARGB `pixels` spans more than `tolerance`, `color` gets the middle
+        // of the range
+        static bool uniform(uint32_t const* pixels, size_t count, int tolerance, uint32_t* color);
+
+        bool empty() const;
+        int tolerance() const;
+        // false when unknown: empty index or tile out of the levels
+        // `color` gets the tile's color as premultiplied ARGB, opaque for pictures of RGB or BGRX bytes
+        bool is_blank(int dz_level, int64_t col, int64_t row, uint32_t* color = nullptr) const;
+
+    private:
+        // `range(x0, x1, y, min, max)` folds the per channel range of a row of the picture into `min` and `max`
+        template <typename Range>
+        static BlankIndex _from_picture(int width, int height, int64_t l0_width, int64_t l0_height, int tolerance,
+                                        std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+                                        TileRect const& tile_rect, Range const& range);
+        static bool _uniform(uint32_t min, uint32_t max, int tolerance, uint32_t* color);
+
+    private:
+        int m_tolerance = -1;
+        std::vector<int64_t> m_cols;
+        std::vector<std::vector<bool>> m_levels;
+        std::vector<std::vector<uint32_t>> m_colors; // of the blank tiles
+    };
+
+    // tiles encoded for blank tiles, once per color, size and `variant` (e.g. with or without ICC profile), shared by
+    // every blank tile of a generator
+    // thread-safe
+    class BlankTiles
+    {
+    public:
+        using Tile = std::shared_ptr<std::vector<uint8_t> const>;
+
+        // `encode` makes the tile the first time
+        Tile get(uint32_t color, int64_t width, int64_t height, bool variant,
+                 std::function<std::vector<uint8_t>()> const& encode);
+        void clear();
+
+    private:
+        std::mutex m_mutex;
+        std::map<std::tuple<uint32_t, int64_t, int64_t, bool>, Tile> m_tiles;
+    };
+} // namespace dz_common
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+
+namespace dz_common
+{
+    // multi producer / multi consumer FIFO, `push` blocks while the queue is full
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity) : m_capacity(capacity == 0 ? 1 : capacity)
+        {
+        }
+
+        BoundedQueue(BoundedQueue const&) = delete;
+        BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+        // false if the queue was closed, `value` is dropped then
+        bool push(T value)
+        {
+            std::unique_lock lock(m_mutex);
+            m_not_full.wait(lock, [this]() { return m_closed || m_items.size() < m_capacity; });
+            if (m_closed) return false;
+            m_items.push_back(std::move(value));
+            lock.unlock();
+            m_not_empty.notify_one();
+            return true;
+        }
+
+        // blocks until an item is available, nullopt once the queue is closed and drained
+        std::optional<T> pop()
+        {
+            std::unique_lock lock(m_mutex);
+            m_not_empty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+            if (m_items.empty()) return std::nullopt;
+            auto value = std::move(m_items.front());
+            m_items.pop_front();
+            lock.unlock();
+            m_not_full.notify_one();
+            return value;
+        }
+
+        // wakes up all waiters, items already queued can still be popped
+        void close()
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_closed = true;
+            }
+            m_not_full.notify_all();
+            m_not_empty.notify_all();
+        }
+
+        size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+    private:
+        size_t const m_capacity;
+        std::deque<T> m_items;
+        std::mutex m_mutex;
+        std::condition_variable m_not_full;
+        std::condition_variable m_not_empty;
+        bool m_closed = false;
+    };
+} // namespace dz_common
@@ -0,0 +1,555 @@
+#include "codec.hpp"
+#include "pixelconv.hpp"
+
+#include <cstdio>
+
+extern "C"
+{
+#define XMD_H
+#include <jpeglib.h>
+#ifdef const
+#undef const
+#endif
+#include <png.h>
+#ifdef DZ_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+}
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef DZ_HAVE_WEBP
+#include <webp/encode.h>
+#endif
+#ifdef DZ_HAVE_AVIF
+#include <avif/avif.h>
+#endif
+
+using namespace dz_common;
+
+namespace
+{
+#ifdef DZ_HAVE_TURBOJPEG
+    // TurboJPEG compressor and output buffer of the calling thread, reused for every tile it encodes
+    class TurboJpegEncoder
+    {
+    public:
+        TurboJpegEncoder() : m_handle(tjInitCompress()) {}
+        ~TurboJpegEncoder()
+        {
+            if (m_buffer) tjFree(m_buffer);
+            if (m_handle) tjDestroy(m_handle);
+        }
+        TurboJpegEncoder(TurboJpegEncoder const&) = delete;
+        TurboJpegEncoder& operator=(TurboJpegEncoder const&) = delete;
+
+        static TurboJpegEncoder& local()
+        {
+            thread_local TurboJpegEncoder encoder;
+            return encoder;
+        }
+
+        // premultiplied ARGB is BGRX (little endian) or XRGB (big endian) in memory
+        static int argb_pixel_format()
+        {
+            return std::endian::native == std::endian::little ? TJPF_BGRX : TJPF_XRGB;
+        }
+
+        static int pixel_format(PixelLayout layout)
+        {
+            return layout == PixelLayout::RGB ? TJPF_RGB : TJPF_BGRX;
+        }
+
+        // `stride` is in bytes, `pixel_format` a `TJPF`
+        std::vector<uint8_t> encode(uint8_t const* pixels, int width, int height, int stride, int pixel_format,
+                                    int quality)
+        {
+            auto const encoded = _encode(pixels, width, height, stride, pixel_format, quality);
+            return std::vector<uint8_t>(encoded.begin(), encoded.end());
+        }
+
+        // into `dest`, 0 if it is too small
+        size_t encode(uint8_t const* pixels, int width, int height, int stride, int pixel_format, int quality,
+                      std::span<uint8_t> dest)
+        {
+            if (!m_handle) return 0;
+            // TJFLAG_NOREALLOC takes the buffer to be `tjBufSize` bytes whatever `*size` says, a smaller `dest`
+            // could be overrun: go through the own buffer then
+            auto const capacity = tjBufSize(width, height, _subsampling(quality));
+            if (capacity == static_cast<unsigned long>(-1)) return 0;
+            if (dest.size() < capacity)
+            {
+                auto const encoded = _encode(pixels, width, height, stride, pixel_format, quality);
+                if (encoded.empty() || encoded.size() > dest.size()) return 0;
+                std::memcpy(dest.data(), encoded.data(), encoded.size());
+                return encoded.size();
+            }
+            auto* buffer = dest.data();
+            auto size = static_cast<unsigned long>(dest.size());
+            return _compress(pixels, width, height, stride, pixel_format, quality, &buffer, &size) ? size : 0;
+        }
+
+    private:
+        // same choice as the libjpeg path: 4:2:0 unless the quality is very high
+        static int _subsampling(int quality)
+        {
+            return quality > 90 ? TJSAMP_444 : TJSAMP_420;
+        }
+
+        // into the own buffer, grown to `tjBufSize`, valid until the next call
+        std::span<uint8_t const> _encode(uint8_t const* pixels, int width, int height, int stride, int pixel_format,
+                                         int quality)
+        {
+            if (!m_handle) return {};
+            auto const capacity = tjBufSize(width, height, _subsampling(quality));
+            if (capacity == static_cast<unsigned long>(-1)) return {};
+            if (capacity > m_capacity)
+            {
+                if (m_buffer) tjFree(m_buffer);
+                m_buffer = tjAlloc(static_cast<int>(capacity));
+                m_capacity = m_buffer ? capacity : 0;
+                if (!m_buffer) return {};
+            }
+
+            auto* buffer = m_buffer;
+            auto size = m_capacity;
+            if (!_compress(pixels, width, height, stride, pixel_format, quality, &buffer, &size)) return {};
+            return {buffer, size};
+        }
+
+        bool _compress(uint8_t const* pixels, int width, int height, int stride, int pixel_format, int quality,
+                       unsigned char** buffer, unsigned long* size)
+        {
+            if (tjCompress2(m_handle, pixels, width, stride, height, pixel_format, buffer, size,
+                            _subsampling(quality), quality, TJFLAG_NOREALLOC) != 0)
+            {
+                printf("Failed to encode JPEG: %s\n", tjGetErrorStr2(m_handle));
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        tjhandle m_handle = nullptr;
+        unsigned char* m_buffer = nullptr;
+        unsigned long m_capacity = 0;
+    };
+#endif
+
+    // RGB scanline scratch of the calling thread, shared by the libjpeg and libpng encoders
+    uint8_t* rgb_row(int width)
+    {
+        thread_local std::vector<uint8_t> row;
+        if (row.size() < static_cast<size_t>(width) * 3) row.resize(static_cast<size_t>(width) * 3);
+        return row.data();
+    }
+
+    // RGB scanline `j` of premultiplied ARGB pixels
+    auto argb_rows(uint32_t const* pixels, int width)
+    {
+        return [pixels, width, rgb = rgb_row(width)](int j) -> uint8_t const* {
+            dz_common::argb_to_rgb(pixels + static_cast<size_t>(j) * width, rgb, width);
+            return rgb;
+        };
+    }
+
+    // RGB scanline `j` of `layout` bytes, `stride` apart
+    auto byte_rows(uint8_t const* pixels, int width, int stride, PixelLayout layout)
+    {
+        return [pixels, width, stride, layout, rgb = rgb_row(width)](int j) -> uint8_t const* {
+            auto const* src = pixels + static_cast<size_t>(j) * stride;
+            if (layout == PixelLayout::RGB) return src;
+            for (int i = 0; i < width; i++, src += 4)
+            {
+                rgb[i * 3] = src[2];
+                rgb[i * 3 + 1] = src[1];
+                rgb[i * 3 + 2] = src[0];
+            }
+            return rgb;
+        };
+    }
+
+    // libjpeg compression into `*buffer` of `*size` bytes, `rows(j)` gives the RGB scanline `j`
+    // libjpeg mallocs a buffer of its own when `*buffer` is null, and switches to one when it is too small
+    template <typename Rows>
+    void compress_jpeg(Rows rows, int width, int height, int quality, std::vector<uint8_t> const& icc_profile,
+                       bool optimize_coding, unsigned char** buffer, unsigned long* size)
+    {
+        jpeg_compress_struct cinfo;
+        jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_compress(&cinfo);
+
+        jpeg_mem_dest(&cinfo, buffer, size);
+
+        cinfo.image_width = width;
+        cinfo.image_height = height;
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&cinfo);
+        // an extra pass for ~5% smaller files, at ~20-30% more encoding time
+        cinfo.optimize_coding = optimize_coding ? TRUE : FALSE;
+        jpeg_set_quality(&cinfo, quality, TRUE);
+        // disable chroma subsampling for very high quality
+        if (quality > 90)
+        {
+            cinfo.comp_info[0].v_samp_factor = 1;
+            cinfo.comp_info[0].h_samp_factor = 1;
+        }
+
+        jpeg_start_compress(&cinfo, TRUE);
+
+        if (!icc_profile.empty())
+            jpeg_write_icc_profile(&cinfo, reinterpret_cast<const JOCTET*>(icc_profile.data()),
+                                   static_cast<unsigned int>(icc_profile.size()));
+
+        for (int j = 0; j < height; j++)
+        {
+            JSAMPROW row_ptr = const_cast<JSAMPROW>(rows(j));
+            jpeg_write_scanlines(&cinfo, &row_ptr, 1);
+        }
+
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+    }
+
+    // libpng compression, the encoded bytes go to `write` with `io` as its io pointer
+    bool compress_png(uint32_t const* pixels, int width, int height, int compression_level,
+                      std::vector<uint8_t> const& icc_profile, void* io, png_rw_ptr write)
+    {
+        png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        if (!png_ptr) return false;
+        png_infop info_ptr = png_create_info_struct(png_ptr);
+        if (!info_ptr)
+        {
+            png_destroy_write_struct(&png_ptr, NULL);
+            return false;
+        }
+        auto* rgb = rgb_row(width);
+        if (setjmp(png_jmpbuf(png_ptr)))
+        {
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+            return false;
+        }
+
+        // since the argb_bytes is premultiplied ARGB, we can just discard the alpha and convert it to RGB
+        png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_set_compression_level(png_ptr, compression_level);
+
+#ifdef PNG_iCCP_SUPPORTED
+        if (!icc_profile.empty())
+        {
+            png_set_iCCP(png_ptr, info_ptr, "ICC Profile", PNG_COMPRESSION_TYPE_DEFAULT, icc_profile.data(),
+                         icc_profile.size());
+        }
+#endif
+
+        png_set_write_fn(png_ptr, io, write, nullptr);
+
+        png_write_info(png_ptr, info_ptr);
+        png_set_packing(png_ptr);
+
+        for (int j = 0; j < height; j++)
+        {
+            dz_common::argb_to_rgb(pixels + j * width, rgb, width);
+            png_write_row(png_ptr, rgb);
+        }
+
+        png_write_end(png_ptr, info_ptr);
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        return true;
+    }
+
+    // `compress_png` output into a caller's buffer
+    struct PngSpanWriter
+    {
+        std::span<uint8_t> dest;
+        size_t size = 0;
+    };
+
+    void png_span_write(png_structp png_ptr, png_bytep data, png_size_t length)
+    {
+        auto* writer = static_cast<PngSpanWriter*>(png_get_io_ptr(png_ptr));
+        if (length > writer->dest.size() - writer->size) png_error(png_ptr, "output buffer too small");
+        std::memcpy(writer->dest.data() + writer->size, data, length);
+        writer->size += length;
+    }
+
+#ifdef DZ_HAVE_WEBP
+    // `writer` gets the encoded bytes in pieces
+    bool webp_encode(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout, float quality,
+                     bool lossless, int method, WebPWriterFunction writer, void* custom_ptr)
+    {
+        WebPConfig config;
+        if (!WebPConfigInit(&config)) return false;
+        config.lossless = lossless ? 1 : 0;
+        config.quality = std::clamp(quality, 0.f, 100.f);
+        config.method = std::clamp(method, 0, 6);
+        // tiles are encoded in parallel already
+        config.thread_level = 0;
+        if (!WebPValidateConfig(&config)) return false;
+
+        WebPPicture picture;
+        if (!WebPPictureInit(&picture)) return false;
+        picture.use_argb = lossless ? 1 : 0;
+        picture.width = width;
+        picture.height = height;
+        auto const imported = layout == PixelLayout::RGB ? WebPPictureImportRGB(&picture, pixels, stride)
+                                                         : WebPPictureImportBGRX(&picture, pixels, stride);
+        if (!imported)
+        {
+            WebPPictureFree(&picture);
+            return false;
+        }
+
+        picture.writer = writer;
+        picture.custom_ptr = custom_ptr;
+        auto const ok = WebPEncode(&config, &picture) != 0;
+        if (!ok && picture.error_code != VP8_ENC_ERROR_BAD_WRITE)
+            printf("Failed to encode WebP: error %d\n", static_cast<int>(picture.error_code));
+        WebPPictureFree(&picture);
+        return ok;
+    }
+
+    struct SpanWriter
+    {
+        std::span<uint8_t> dest;
+        size_t size = 0;
+    };
+
+    int span_write(uint8_t const* data, size_t size, WebPPicture const* picture)
+    {
+        auto* writer = static_cast<SpanWriter*>(picture->custom_ptr);
+        if (size > writer->dest.size() - writer->size) return 0;
+        std::memcpy(writer->dest.data() + writer->size, data, size);
+        writer->size += size;
+        return 1;
+    }
+#endif
+
+#ifdef DZ_HAVE_AVIF
+    // `output` must be freed with `avifRWDataFree` whatever the result
+    bool avif_encode(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout, int quality,
+                     int speed, avifRWData* output)
+    {
+        quality = std::clamp(quality, 0, 100);
+        auto* image = avifImageCreate(static_cast<uint32_t>(width), static_cast<uint32_t>(height), 8,
+                                      quality > 90 ? AVIF_PIXEL_FORMAT_YUV444 : AVIF_PIXEL_FORMAT_YUV420);
+        if (!image) return false;
+
+        avifRGBImage rgb;
+        avifRGBImageSetDefaults(&rgb, image);
+        rgb.format = layout == PixelLayout::RGB ? AVIF_RGB_FORMAT_RGB : AVIF_RGB_FORMAT_BGRA;
+        rgb.ignoreAlpha = AVIF_TRUE;
+        rgb.pixels = const_cast<uint8_t*>(pixels);
+        rgb.rowBytes = static_cast<uint32_t>(stride);
+
+        auto ok = false;
+        auto* encoder = avifEncoderCreate();
+        if (encoder && avifImageRGBToYUV(image, &rgb) == AVIF_RESULT_OK)
+        {
+#if AVIF_VERSION_MAJOR >= 1
+            encoder->quality = quality;
+#else
+            encoder->minQuantizer = encoder->maxQuantizer = (100 - quality) * AVIF_QUANTIZER_WORST_QUALITY / 100;
+#endif
+            encoder->speed = std::clamp(speed, AVIF_SPEED_SLOWEST, AVIF_SPEED_FASTEST);
+            // tiles are encoded in parallel already
+            encoder->maxThreads = 1;
+            auto const result = avifEncoderWrite(encoder, image, output);
+            ok = result == AVIF_RESULT_OK;
+            if (!ok) printf("Failed to encode AVIF: %s\n", avifResultToString(result));
+        }
+        if (encoder) avifEncoderDestroy(encoder);
+        avifImageDestroy(image);
+        return ok;
+    }
+#endif
+} // namespace
+
+std::vector<uint8_t> dz_common::encode_jpeg(std::span<uint32_t const> pixels, int width, int height, int quality,
+                                             std::vector<uint8_t> const& icc_profile, bool optimize_coding)
+{
+#ifdef DZ_HAVE_TURBOJPEG
+    // the TurboJPEG API has no ICC profile or optimized Huffman tables (before 3.0), those go through libjpeg
+    if (icc_profile.empty() && !optimize_coding)
+        return TurboJpegEncoder::local().encode(reinterpret_cast<uint8_t const*>(pixels.data()), width, height,
+                                                width * 4, TurboJpegEncoder::argb_pixel_format(), quality);
+#endif
+
+    unsigned char* mem_buffer = nullptr;
+    unsigned long encoded_size = 0;
+    compress_jpeg(argb_rows(pixels.data(), width), width, height, quality, icc_profile, optimize_coding, &mem_buffer,
+                  &encoded_size);
+
+    std::vector<uint8_t> res(mem_buffer, mem_buffer + encoded_size);
+
+    free(mem_buffer);
+
+    return res;
+}
+
+size_t dz_common::encode_jpeg(std::span<uint32_t const> pixels, int width, int height, std::span<uint8_t> dest,
+                              int quality, std::vector<uint8_t> const& icc_profile, bool optimize_coding)
+{
+#ifdef DZ_HAVE_TURBOJPEG
+    if (icc_profile.empty() && !optimize_coding)
+        return TurboJpegEncoder::local().encode(reinterpret_cast<uint8_t const*>(pixels.data()), width, height,
+                                                width * 4, TurboJpegEncoder::argb_pixel_format(), quality, dest);
+#endif
+
+    auto* buffer = dest.data();
+    auto size = static_cast<unsigned long>(dest.size());
+    compress_jpeg(argb_rows(pixels.data(), width), width, height, quality, icc_profile, optimize_coding, &buffer,
+                  &size);
+    // libjpeg moved to a buffer of its own, `dest` is too small
+    if (buffer != dest.data())
+    {
+        free(buffer);
+        return 0;
+    }
+    return size;
+}
+
+std::vector<uint8_t> dz_common::encode_jpeg(uint8_t const* pixels, int width, int height, int stride,
+                                             PixelLayout layout, int quality)
+{
+#ifdef DZ_HAVE_TURBOJPEG
+    return TurboJpegEncoder::local().encode(pixels, width, height, stride, TurboJpegEncoder::pixel_format(layout),
+                                            quality);
+#else
+    unsigned char* mem_buffer = nullptr;
+    unsigned long encoded_size = 0;
+    compress_jpeg(byte_rows(pixels, width, stride, layout), width, height, quality, {}, false, &mem_buffer,
+                  &encoded_size);
+
+    std::vector<uint8_t> res(mem_buffer, mem_buffer + encoded_size);
+
+    free(mem_buffer);
+
+    return res;
+#endif
+}
+
+std::vector<uint8_t> dz_common::encode_png(std::span<uint32_t const> pixels, int width, int height,
+                                            int compression_level, std::vector<uint8_t> const& icc_profile)
+{
+    std::vector<uint8_t> buffer;
+    buffer.reserve(static_cast<size_t>(width) * height * 4);
+    auto write_callback = [](png_structp png_ptr, png_bytep data, png_size_t length) {
+        auto* p = static_cast<std::vector<uint8_t>*>(png_get_io_ptr(png_ptr));
+        p->insert(p->end(), data, data + length);
+    };
+    if (!compress_png(pixels.data(), width, height, compression_level, icc_profile, &buffer, write_callback))
+        return {};
+
+    buffer.shrink_to_fit();
+
+    return buffer;
+}
+
+size_t dz_common::encode_png(std::span<uint32_t const> pixels, int width, int height, std::span<uint8_t> dest,
+                             int compression_level, std::vector<uint8_t> const& icc_profile)
+{
+    PngSpanWriter writer{dest};
+    return compress_png(pixels.data(), width, height, compression_level, icc_profile, &writer, png_span_write)
+               ? writer.size
+               : 0;
+}
+
+bool dz_common::webp_available()
+{
+#ifdef DZ_HAVE_WEBP
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool dz_common::avif_available()
+{
+#ifdef DZ_HAVE_AVIF
+    return true;
+#else
+    return false;
+#endif
+}
+
+size_t dz_common::max_webp_avif_size(int64_t width, int64_t height)
+{
+    // raw RGBA and room for the containers
+    return static_cast<size_t>(width) * height * 4 + 4096;
+}
+
+std::vector<uint8_t> dz_common::encode_webp(uint8_t const* pixels, int width, int height, int stride,
+                                            PixelLayout layout, float quality, bool lossless, int method)
+{
+#ifdef DZ_HAVE_WEBP
+    WebPMemoryWriter writer;
+    WebPMemoryWriterInit(&writer);
+    std::vector<uint8_t> res;
+    if (webp_encode(pixels, width, height, stride, layout, quality, lossless, method, WebPMemoryWrite, &writer))
+        res.assign(writer.mem, writer.mem + writer.size);
+    WebPMemoryWriterClear(&writer);
+    return res;
+#else
+    (void)pixels, (void)width, (void)height, (void)stride, (void)layout, (void)quality, (void)lossless, (void)method;
+    printf("WebP encoding is not available, build with libwebp\n");
+    return {};
+#endif
+}
+
+size_t dz_common::encode_webp(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                              float quality, bool lossless, int method, std::span<uint8_t> dest)
+{
+#ifdef DZ_HAVE_WEBP
+    SpanWriter writer{dest};
+    return webp_encode(pixels, width, height, stride, layout, quality, lossless, method, span_write, &writer)
+               ? writer.size
+               : 0;
+#else
+    (void)dest;
+    return encode_webp(pixels, width, height, stride, layout, quality, lossless, method).size();
+#endif
+}
+
+std::vector<uint8_t> dz_common::encode_avif(uint8_t const* pixels, int width, int height, int stride,
+                                            PixelLayout layout, int quality, int speed)
+{
+#ifdef DZ_HAVE_AVIF
+    avifRWData output = AVIF_DATA_EMPTY;
+    std::vector<uint8_t> res;
+    if (avif_encode(pixels, width, height, stride, layout, quality, speed, &output))
+        res.assign(output.data, output.data + output.size);
+    avifRWDataFree(&output);
+    return res;
+#else
+    (void)pixels, (void)width, (void)height, (void)stride, (void)layout, (void)quality, (void)speed;
+    printf("AVIF encoding is not available, build with libavif\n");
+    return {};
+#endif
+}
+
+size_t dz_common::encode_avif(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                              int quality, int speed, std::span<uint8_t> dest)
+{
+#ifdef DZ_HAVE_AVIF
+    // libavif always writes into its own buffer
+    avifRWData output = AVIF_DATA_EMPTY;
+    size_t size = 0;
+    if (avif_encode(pixels, width, height, stride, layout, quality, speed, &output) && output.size <= dest.size())
+    {
+        std::memcpy(dest.data(), output.data, output.size);
+        size = output.size;
+    }
+    avifRWDataFree(&output);
+    return size;
+#else
+    (void)dest;
+    return encode_avif(pixels, width, height, stride, layout, quality, speed).size();
+#endif
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <span>
+
+namespace dz_common
+{
+    // tile encoders shared by all generators
+    // JPEG/PNG take ARGB_Premultiplied pixels (`uint32_t` 0xAARRGGBB, as `openslide_read_region` returns them) and
+    // drop the alpha. WebP/AVIF are optional (`DZ_HAVE_WEBP`, `DZ_HAVE_AVIF`), without them the encoders return empty
+    // bytes, and do not embed ICC profiles
+
+    // byte order of the pixels handed to the encoders
+    enum class PixelLayout : int
+    {
+        RGB = 0, // r, g, b
+        BGRX,    // b, g, r, x: premultiplied ARGB `uint32_t` as laid out on little endian hosts, x is ignored
+    };
+
+    // with libjpeg-turbo's TurboJPEG API available (`DZ_HAVE_TURBOJPEG`) tiles without ICC profile and optimized
+    // Huffman tables are compressed straight from the ARGB buffer with a per-thread compressor
+    // 4:4:4 chroma above quality 90, 4:2:0 below
+    std::vector<uint8_t> encode_jpeg(std::span<uint32_t const> pixels, int width, int height, int quality,
+                                     std::vector<uint8_t> const& icc_profile = {}, bool optimize_coding = false);
+    // `layout` bytes, `stride` apart, for readers that hand out RGB (slideio); same encoders, no ICC profile
+    std::vector<uint8_t> encode_jpeg(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                                     int quality);
+    // `compression_level` [0, 9], zlib's
+    std::vector<uint8_t> encode_png(std::span<uint32_t const> pixels, int width, int height, int compression_level = 3,
+                                    std::vector<uint8_t> const& icc_profile = {});
+    // into `dest`, returning the encoded size, 0 on failure or if `dest` is too small
+    size_t encode_jpeg(std::span<uint32_t const> pixels, int width, int height, std::span<uint8_t> dest, int quality,
+                       std::vector<uint8_t> const& icc_profile = {}, bool optimize_coding = false);
+    size_t encode_png(std::span<uint32_t const> pixels, int width, int height, std::span<uint8_t> dest,
+                      int compression_level = 3, std::vector<uint8_t> const& icc_profile = {});
+
+    bool webp_available();
+    bool avif_available();
+    // generous upper bound of the WebP/AVIF size of a `width` x `height` image, neither library documents one
+    size_t max_webp_avif_size(int64_t width, int64_t height);
+
+    // `quality` [0, 100]: visual quality, or compression effort when `lossless`
+    // `method` [0, 6]: speed/size trade-off, 0 is the fastest
+    std::vector<uint8_t> encode_webp(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                                     float quality, bool lossless, int method);
+    // into `dest`, returns the encoded size, 0 on failure or if `dest` is too small
+    size_t encode_webp(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout, float quality,
+                       bool lossless, int method, std::span<uint8_t> dest);
+    // `quality` [0, 100], `speed` [0, 10]: 10 is the fastest
+    // 4:4:4 chroma above quality 90, 4:2:0 below, like the JPEG encoders
+    std::vector<uint8_t> encode_avif(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                                     int quality, int speed);
+    size_t encode_avif(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout, int quality,
+                       int speed, std::span<uint8_t> dest);
+} // namespace dz_common
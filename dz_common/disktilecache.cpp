@@ -0,0 +1,568 @@
+#include "disktilecache.hpp"
+#include "slidemetadata.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace dz_common;
+
+struct DiskTileCache::IndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t clean; // 1 once flushed by the destructor, 0 while open
+    uint64_t slot_count;
+    uint64_t reserved[5];
+};
+
+struct DiskTileCache::Slot
+{
+    uint64_t hash; // 0: empty
+    uint64_t segment;
+    uint64_t offset; // of the record
+    uint32_t size;   // of the tile
+    uint32_t key_size;
+};
+
+// append-only file of records: <RecordHeader, key, tile>
+struct DiskTileCache::Segment
+{
+    uint64_t id = 0;
+    int fd = -1;
+    uint64_t size = 0;    // bytes written or reserved
+    uint64_t records = 0; // index slots pointing into it
+    bool dirty = false;
+
+    ~Segment()
+    {
+#ifndef _WIN32
+        if (fd >= 0) close(fd);
+#endif
+    }
+};
+
+namespace
+{
+    constexpr char index_magic[8] = {'D', 'Z', 'T', 'C', 'I', 'N', 'D', 'X'};
+    constexpr uint32_t index_version = 1;
+    constexpr uint32_t record_magic = 0x52545a44; // "DZTR"
+    constexpr uint32_t max_key_size = 4096;
+    constexpr uint32_t max_tile_size = 64u << 20;
+
+    struct RecordHeader
+    {
+        uint32_t magic;
+        uint32_t key_size;
+        uint32_t size; // of the tile
+        uint32_t crc;  // of the key and the tile
+        uint64_t hash; // of the key
+    };
+
+    std::array<uint32_t, 256> const crc_table = []() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            auto c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    uint32_t crc32(std::span<uint8_t const> bytes, uint32_t crc = 0)
+    {
+        crc = ~crc;
+        for (auto const byte : bytes)
+            crc = crc_table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    std::span<uint8_t const> as_bytes(std::string const& s)
+    {
+        return {reinterpret_cast<uint8_t const*>(s.data()), s.size()};
+    }
+
+    uint64_t key_hash(std::string const& key)
+    {
+        auto const hash = SlideMetadata::hash(as_bytes(key));
+        return hash ? hash : 1;
+    }
+
+    std::string segment_name(uint64_t id)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.seg", static_cast<unsigned long long>(id));
+        return name;
+    }
+
+#ifndef _WIN32
+    bool pread_full(int fd, void* data, size_t size, uint64_t offset)
+    {
+        auto* bytes = static_cast<uint8_t*>(data);
+        while (size > 0)
+        {
+            auto const n = pread(fd, bytes, size, static_cast<off_t>(offset));
+            if (n <= 0) return false;
+            bytes += n;
+            size -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+#endif
+} // namespace
+
+DiskTileCache::DiskTileCache(std::string directory, size_t capacity_bytes)
+    : m_directory(std::move(directory)), m_capacity(capacity_bytes),
+      m_segment_bytes(std::clamp(capacity_bytes / 16, size_t{1} << 20, size_t{256} << 20))
+{
+    std::lock_guard lock(m_mutex);
+    if (!_open())
+    {
+        printf("Failed to open disk tile cache: %s\n", m_directory.c_str());
+        _close();
+    }
+}
+
+DiskTileCache::~DiskTileCache()
+{
+    std::lock_guard lock(m_mutex);
+    _close();
+}
+
+bool DiskTileCache::is_open() const
+{
+    return m_slots != nullptr;
+}
+
+#ifndef _WIN32
+bool DiskTileCache::_open()
+{
+    std::error_code ec;
+    std::filesystem::create_directories(m_directory, ec);
+    auto const index_path = (std::filesystem::path(m_directory) / "index").string();
+    m_index_fd = ::open(index_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_index_fd < 0) return false;
+    if (flock(m_index_fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        printf("Disk tile cache in use by another process: %s\n", m_directory.c_str());
+        return false;
+    }
+
+    // ~2 KiB per tile at most, at least 64Ki slots
+    m_slot_count = std::bit_ceil(std::max<uint64_t>(uint64_t{1} << 16, m_capacity / 2048));
+    m_map_size = sizeof(IndexHeader) + m_slot_count * sizeof(Slot);
+    IndexHeader header{};
+    struct stat st{};
+    auto const clean = fstat(m_index_fd, &st) == 0 && static_cast<size_t>(st.st_size) == m_map_size &&
+                       pread_full(m_index_fd, &header, sizeof(header), 0) &&
+                       std::memcmp(header.magic, index_magic, sizeof(index_magic)) == 0 &&
+                       header.version == index_version && header.slot_count == m_slot_count && header.clean == 1;
+    // a fresh, zeroed index for a rebuild
+    if (!clean && (ftruncate(m_index_fd, 0) != 0 || ftruncate(m_index_fd, static_cast<off_t>(m_map_size)) != 0))
+        return false;
+    m_map = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_index_fd, 0);
+    if (m_map == MAP_FAILED)
+    {
+        m_map = nullptr;
+        return false;
+    }
+    m_header = static_cast<IndexHeader*>(m_map);
+    m_slots = reinterpret_cast<Slot*>(static_cast<uint8_t*>(m_map) + sizeof(IndexHeader));
+
+    for (auto const& entry : std::filesystem::directory_iterator(m_directory, ec))
+    {
+        auto const name = entry.path().filename().string();
+        if (entry.path().extension() != ".seg") continue;
+        auto const id = std::strtoull(name.c_str(), nullptr, 16);
+        if (auto segment = _open_segment(id, false); segment) m_segments.emplace(id, std::move(segment));
+    }
+
+    if (clean)
+    {
+        for (uint64_t i = 0; i < m_slot_count; i++)
+            m_entries += m_slots[i].hash != 0;
+        _compact();
+    }
+    else
+    {
+        std::memcpy(m_header->magic, index_magic, sizeof(index_magic));
+        m_header->version = index_version;
+        m_header->slot_count = m_slot_count;
+        uint64_t recovered = 0;
+        for (auto const& [id, segment] : m_segments)
+            recovered += _scan(*segment, id == m_segments.rbegin()->first);
+        m_recovered = recovered;
+    }
+    for (auto const& [id, segment] : m_segments)
+        m_bytes += segment->size;
+
+    // dirty until `_close`
+    m_header->clean = 0;
+    msync(m_map, sizeof(IndexHeader), MS_SYNC);
+    while (m_bytes > m_capacity && !m_segments.empty())
+        _evict_oldest();
+    return true;
+}
+
+void DiskTileCache::_close()
+{
+    if (m_map)
+    {
+        auto flushed = true;
+        for (auto const& [id, segment] : m_segments)
+            if (segment->dirty) flushed = fsync(segment->fd) == 0 && flushed;
+        flushed = msync(m_map, m_map_size, MS_SYNC) == 0 && flushed;
+        // only a fully flushed index is trusted at the next open
+        if (flushed)
+        {
+            m_header->clean = 1;
+            msync(m_map, sizeof(IndexHeader), MS_SYNC);
+        }
+        munmap(m_map, m_map_size);
+    }
+    m_map = nullptr;
+    m_header = nullptr;
+    m_slots = nullptr;
+    m_segments.clear();
+    if (m_index_fd >= 0) close(m_index_fd);
+    m_index_fd = -1;
+}
+
+std::shared_ptr<DiskTileCache::Segment> DiskTileCache::_open_segment(uint64_t id, bool create)
+{
+    auto const path = (std::filesystem::path(m_directory) / segment_name(id)).string();
+    auto segment = std::make_shared<Segment>();
+    segment->id = id;
+    segment->fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    struct stat st{};
+    if (segment->fd < 0 || fstat(segment->fd, &st) != 0)
+    {
+        printf("Failed to open disk tile cache segment: %s\n", path.c_str());
+        return nullptr;
+    }
+    segment->size = static_cast<uint64_t>(st.st_size);
+    return segment;
+}
+
+uint64_t DiskTileCache::_scan(Segment& segment, bool verify)
+{
+    uint64_t records = 0, offset = 0;
+    std::vector<uint8_t> record;
+    while (offset < segment.size)
+    {
+        RecordHeader header{};
+        auto valid = offset + sizeof(header) <= segment.size &&
+                     pread_full(segment.fd, &header, sizeof(header), offset) && header.magic == record_magic &&
+                     header.key_size <= max_key_size && header.size <= max_tile_size &&
+                     offset + sizeof(header) + header.key_size + header.size <= segment.size;
+        if (valid && verify)
+        {
+            record.resize(header.key_size + header.size);
+            valid = pread_full(segment.fd, record.data(), record.size(), offset + sizeof(header)) &&
+                    crc32(record) == header.crc;
+        }
+        if (!valid)
+        {
+            // torn or never written: whatever follows is not trusted either
+            printf("Disk tile cache segment %s cut at %llu\n", segment_name(segment.id).c_str(),
+                   static_cast<unsigned long long>(offset));
+            if (ftruncate(segment.fd, static_cast<off_t>(offset)) == 0) segment.size = offset;
+            break;
+        }
+        if (!_insert(Slot{.hash = header.hash,
+                          .segment = segment.id,
+                          .offset = offset,
+                          .size = header.size,
+                          .key_size = header.key_size}))
+            break;
+        records++;
+        offset += sizeof(header) + header.key_size + header.size;
+    }
+    return records;
+}
+
+std::optional<std::vector<uint8_t>> DiskTileCache::get(TileKey const& key)
+{
+    auto const full_key = is_open() ? _key(key) : std::string();
+    if (full_key.empty())
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    auto const hash = key_hash(full_key);
+
+    Slot slot{};
+    std::shared_ptr<Segment> segment;
+    {
+        std::lock_guard lock(m_mutex);
+        if (auto const* found = _find(hash); found)
+        {
+            slot = *found;
+            segment = m_segments.at(slot.segment);
+        }
+    }
+    // read outside of the lock, `segment` keeps the file open even if it is evicted meanwhile
+    if (segment && slot.key_size == full_key.size())
+    {
+        RecordHeader header{};
+        std::string record_key(slot.key_size, '\0');
+        std::vector<uint8_t> tile(slot.size);
+        iovec parts[3] = {{&header, sizeof(header)}, {record_key.data(), record_key.size()}, {tile.data(), tile.size()}};
+        auto const expected = sizeof(header) + record_key.size() + tile.size();
+        if (preadv(segment->fd, parts, 3, static_cast<off_t>(slot.offset)) == static_cast<ssize_t>(expected) &&
+            header.magic == record_magic && header.hash == hash && header.size == slot.size &&
+            record_key == full_key && crc32(tile, crc32(as_bytes(record_key))) == header.crc)
+        {
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return tile;
+        }
+    }
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+}
+
+void DiskTileCache::put(TileKey const& key, std::span<uint8_t const> tile)
+{
+    auto const full_key = is_open() ? _key(key) : std::string();
+    if (full_key.empty() || tile.empty() || tile.size() > max_tile_size || full_key.size() > max_key_size) return;
+
+    RecordHeader const header{.magic = record_magic,
+                              .key_size = static_cast<uint32_t>(full_key.size()),
+                              .size = static_cast<uint32_t>(tile.size()),
+                              .crc = crc32(tile, crc32(as_bytes(full_key))),
+                              .hash = key_hash(full_key)};
+    auto const record_size = sizeof(header) + full_key.size() + tile.size();
+    if (record_size > m_segment_bytes) return;
+
+    std::shared_ptr<Segment> segment;
+    uint64_t offset = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_segments.empty() || m_segments.rbegin()->second->size + record_size > m_segment_bytes)
+        {
+            auto const id = m_segments.empty() ? 1 : m_segments.rbegin()->first + 1;
+            auto next = _open_segment(id, true);
+            if (!next) return;
+            m_segments.emplace(id, std::move(next));
+        }
+        segment = m_segments.rbegin()->second;
+        offset = segment->size;
+        segment->size += record_size;
+        segment->dirty = true;
+        m_bytes += record_size;
+        // never the segment being appended to
+        while (m_bytes > m_capacity && m_segments.size() > 1)
+            _evict_oldest();
+    }
+
+    // written outside of the lock into the reserved range, indexed once complete
+    iovec parts[3] = {{const_cast<RecordHeader*>(&header), sizeof(header)},
+                      {const_cast<char*>(full_key.data()), full_key.size()},
+                      {const_cast<uint8_t*>(tile.data()), tile.size()}};
+    if (pwritev(segment->fd, parts, 3, static_cast<off_t>(offset)) != static_cast<ssize_t>(record_size))
+    {
+        printf("Failed to write disk tile cache segment: %s\n", segment_name(segment->id).c_str());
+        return;
+    }
+
+    std::lock_guard lock(m_mutex);
+    // a full index first drops its dead slots, then makes room by dropping the oldest segments, like a full disk
+    // budget
+    while (m_entries >= m_slot_count / 4 * 3 && (m_stale > 0 || m_segments.size() > 1))
+    {
+        if (m_stale > 0)
+            _compact();
+        else
+            _evict_oldest();
+    }
+    // evicted while being written
+    if (!m_segments.contains(segment->id)) return;
+    if (_insert(Slot{.hash = header.hash,
+                     .segment = segment->id,
+                     .offset = offset,
+                     .size = header.size,
+                     .key_size = header.key_size}))
+        m_insertions.fetch_add(1, std::memory_order_relaxed);
+}
+#else
+bool DiskTileCache::_open()
+{
+    return false;
+}
+
+void DiskTileCache::_close()
+{
+}
+
+std::shared_ptr<DiskTileCache::Segment> DiskTileCache::_open_segment(uint64_t, bool)
+{
+    return nullptr;
+}
+
+uint64_t DiskTileCache::_scan(Segment&, bool)
+{
+    return 0;
+}
+
+std::optional<std::vector<uint8_t>> DiskTileCache::get(TileKey const&)
+{
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+}
+
+void DiskTileCache::put(TileKey const&, std::span<uint8_t const>)
+{
+}
+#endif
+
+bool DiskTileCache::contains(TileKey const& key) const
+{
+    auto const full_key = is_open() ? _key(key) : std::string();
+    if (full_key.empty()) return false;
+    std::lock_guard lock(m_mutex);
+    return _find(key_hash(full_key)) != nullptr;
+}
+
+std::string const& DiskTileCache::directory() const
+{
+    return m_directory;
+}
+
+size_t DiskTileCache::capacity() const
+{
+    return m_capacity;
+}
+
+DiskTileCache::Stats DiskTileCache::stats() const
+{
+    Stats s;
+    s.hits = m_hits.load(std::memory_order_relaxed);
+    s.misses = m_misses.load(std::memory_order_relaxed);
+    s.insertions = m_insertions.load(std::memory_order_relaxed);
+    s.evictions = m_evictions.load(std::memory_order_relaxed);
+    s.recovered = m_recovered.load(std::memory_order_relaxed);
+    std::lock_guard lock(m_mutex);
+    s.entries = m_entries - m_stale;
+    s.bytes = m_bytes;
+    s.segments = m_segments.size();
+    return s;
+}
+
+void DiskTileCache::reset_stats()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_insertions = 0;
+    m_evictions = 0;
+    m_recovered = 0;
+}
+
+std::string DiskTileCache::_key(TileKey const& key) const
+{
+    // `slide` is the path, possibly followed by `?<generator options>`
+    auto const options = key.slide.find('?');
+    auto const path = key.slide.substr(0, options);
+    std::string stamp;
+    {
+        std::lock_guard lock(m_stamps_mutex);
+        auto it = m_stamps.find(path);
+        if (it == m_stamps.end())
+        {
+            auto const file = FileStamp::of(path);
+            it = m_stamps
+                     .emplace(path, file.path.empty() ? std::string()
+                                                      : file.path + "|" + std::to_string(file.size) + "|" +
+                                                            std::to_string(file.mtime))
+                     .first;
+        }
+        stamp = it->second;
+    }
+    if (stamp.empty()) return {};
+    if (options != std::string::npos) stamp += key.slide.substr(options);
+    return stamp + "|" + std::to_string(key.format) + "|" + std::to_string(key.quality) + "|" +
+           std::to_string(key.tile_size) + "|" + std::to_string(key.overlap) + "|" + std::to_string(key.dz_level) +
+           "|" + std::to_string(key.col) + "|" + std::to_string(key.row) + "|" + std::to_string(key.icc);
+}
+
+DiskTileCache::Slot const* DiskTileCache::_find(uint64_t hash) const
+{
+    if (!m_slots) return nullptr;
+    auto const mask = m_slot_count - 1;
+    for (auto i = hash & mask;; i = (i + 1) & mask)
+    {
+        auto const& slot = m_slots[i];
+        if (slot.hash == 0) return nullptr;
+        if (slot.hash == hash) return m_segments.contains(slot.segment) ? &slot : nullptr;
+    }
+}
+
+bool DiskTileCache::_insert(Slot const& slot)
+{
+    auto const mask = m_slot_count - 1;
+    for (auto i = slot.hash & mask;; i = (i + 1) & mask)
+    {
+        auto& current = m_slots[i];
+        if (current.hash == slot.hash)
+        {
+            if (auto const it = m_segments.find(current.segment); it != m_segments.end())
+                it->second->records--;
+            else
+                m_stale--;
+            current = slot;
+            m_segments.at(slot.segment)->records++;
+            return true;
+        }
+        if (current.hash == 0)
+        {
+            // keep probe sequences short, a quarter of the table stays empty
+            if (m_entries >= m_slot_count / 4 * 3) return false;
+            current = slot;
+            m_entries++;
+            m_segments.at(slot.segment)->records++;
+            return true;
+        }
+    }
+}
+
+void DiskTileCache::_compact()
+{
+    std::vector<Slot> live;
+    live.reserve(m_entries);
+    for (uint64_t i = 0; i < m_slot_count; i++)
+        if (m_slots[i].hash != 0 && m_segments.contains(m_slots[i].segment)) live.push_back(m_slots[i]);
+    std::memset(static_cast<void*>(m_slots), 0, m_slot_count * sizeof(Slot));
+    m_entries = 0;
+    m_stale = 0;
+    for (auto const& [id, segment] : m_segments)
+        segment->records = 0;
+    for (auto const& slot : live)
+        _insert(slot);
+}
+
+void DiskTileCache::_evict_oldest()
+{
+    auto const it = m_segments.begin();
+    m_bytes -= it->second->size;
+    // its slots are dead (`_find` skips them) until the table is rebuilt, once they are half of it
+    m_stale += it->second->records;
+    std::error_code ec;
+    std::filesystem::remove(std::filesystem::path(m_directory) / segment_name(it->first), ec);
+    m_segments.erase(it);
+    m_evictions.fetch_add(1, std::memory_order_relaxed);
+    if (m_stale > 0 && m_stale * 2 >= m_entries) _compact();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "dz_common/tilecache.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dz_common
+{
+    // persistent tier below `TileCache`: encoded tiles survive restarts, so that slides viewed again days later are
+    // served without decoding a single pixel.
+    // tiles are appended to segment files of `capacity_bytes / 16` (1 to 256 MiB) in `directory`, and whole segments
+    // are deleted, oldest first, when the cache outgrows `capacity_bytes`. an open addressing table of
+    // <key hash, segment, offset, size> lives in an mmap'ed index file. keys include the size and modification time
+    // of the slide file (stat'ed once per slide and cache), so a replaced slide misses instead of serving stale tiles.
+    // crash safety: the index is marked dirty while the cache is open, and clean once the segments and the index are
+    // flushed by the destructor. a dirty index is rebuilt from the segments at the next open: every record carries its
+    // key and a CRC, the newest segment is checked record by record and cut at the first torn one, the older ones
+    // are walked by their headers: records are written outside of the lock, so a crash can tear records of any
+    // segment still being written, and `get` checks the CRC of every record it reads, a torn one is a miss.
+    // a directory is used by one process at a time. POSIX only, `is_open` is false elsewhere.
+    // all methods are thread-safe
+    class DiskTileCache
+    {
+    public:
+        struct Stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t insertions = 0;
+            uint64_t evictions = 0; // segments deleted
+            uint64_t recovered = 0; // records indexed by a rebuild at open
+            size_t entries = 0;
+            size_t bytes = 0; // segment bytes on disk, records of replaced tiles included
+            size_t segments = 0;
+        };
+
+        explicit DiskTileCache(std::string directory, size_t capacity_bytes = size_t{10} << 30);
+        ~DiskTileCache();
+
+        DiskTileCache(DiskTileCache const&) = delete;
+        DiskTileCache& operator=(DiskTileCache const&) = delete;
+
+        // false if the directory cannot be used (or is used by another process), nothing is cached then
+        bool is_open() const;
+
+        // the tile, nullopt if it is not cached or its record is unreadable
+        std::optional<std::vector<uint8_t>> get(TileKey const& key);
+        // appends the tile, a tile put again replaces the previous one
+        // tiles of slides that cannot be stat'ed are not cached
+        void put(TileKey const& key, std::span<uint8_t const> tile);
+        // index lookup only, without reading nor counting
+        bool contains(TileKey const& key) const;
+
+        std::string const& directory() const;
+        size_t capacity() const;
+        Stats stats() const;
+        void reset_stats();
+
+    private:
+        struct Segment;
+        struct Slot;
+        struct IndexHeader;
+
+        // persistent identity of the tile: the stamp of the slide file and the generator parameters
+        // empty if the slide cannot be stat'ed
+        std::string _key(TileKey const& key) const;
+        bool _open();
+        void _close();
+        std::shared_ptr<Segment> _open_segment(uint64_t id, bool create);
+        // indexes the records of `segment`, cut at the first invalid one, full CRC checks with `verify`
+        uint64_t _scan(Segment& segment, bool verify);
+        Slot const* _find(uint64_t hash) const;
+        bool _insert(Slot const& slot);
+        // rebuilds the table without the slots of deleted segments
+        void _compact();
+        void _evict_oldest();
+
+    private:
+        std::string m_directory;
+        size_t m_capacity = 0;
+        size_t m_segment_bytes = 0;
+
+        int m_index_fd = -1;
+        void* m_map = nullptr;
+        size_t m_map_size = 0;
+        IndexHeader* m_header = nullptr;
+        Slot* m_slots = nullptr;
+        uint64_t m_slot_count = 0;
+
+        mutable std::mutex m_mutex;
+        std::map<uint64_t, std::shared_ptr<Segment>> m_segments; // by id, the last one is appended to
+        size_t m_bytes = 0;
+        size_t m_entries = 0; // occupied slots, the dead ones included
+        size_t m_stale = 0;   // slots pointing into deleted segments
+
+        mutable std::mutex m_stamps_mutex;
+        mutable std::unordered_map<std::string, std::string> m_stamps; // slide path -> "path|size|mtime"
+
+        std::atomic<uint64_t> m_hits{0};
+        std::atomic<uint64_t> m_misses{0};
+        std::atomic<uint64_t> m_insertions{0};
+        std::atomic<uint64_t> m_evictions{0};
+        std::atomic<uint64_t> m_recovered{0};
+    };
+} // namespace dz_common
@@ -0,0 +1,201 @@
+#include "downsample.hpp"
+
+#include <initializer_list>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace dz_common;
+
+namespace
+{
+    // sum of the four 8-bit channels of up to 4 pixels, 10 bits per channel
+    struct ChannelSum
+    {
+        uint32_t ag = 0; // a, g in bits 16..25, 0..9
+        uint32_t rb = 0; // r, b in bits 16..25, 0..9
+
+        void add(uint32_t p)
+        {
+            ag += (p >> 8) & 0x00ff00ff;
+            rb += p & 0x00ff00ff;
+        }
+
+        uint32_t average(uint32_t count) const
+        {
+            auto const half = (count / 2) * 0x00010001;
+            auto div = [count](uint32_t v) {
+                return ((v >> 16) / count) << 16 | ((v & 0xffff) / count);
+            };
+            return div(ag + half) << 8 | div(rb + half);
+        }
+    };
+} // namespace
+
+void dz_common::reduce_2x2(uint32_t const* src, int64_t width, int64_t height, int64_t src_stride, uint32_t* dst,
+                           int64_t dst_stride)
+{
+    auto const dst_width = (width + 1) / 2;
+    auto const dst_height = (height + 1) / 2;
+    for (int64_t y = 0; y < dst_height; y++)
+    {
+        auto const* row0 = src + 2 * y * src_stride;
+        auto const* row1 = (2 * y + 1 < height) ? row0 + src_stride : nullptr;
+        auto* out = dst + y * dst_stride;
+
+        // full 2x2 blocks
+        int64_t x = 0;
+        if (row1)
+        {
+            for (; 2 * x + 1 < width; x++)
+            {
+                ChannelSum sum;
+                sum.add(row0[2 * x]);
+                sum.add(row0[2 * x + 1]);
+                sum.add(row1[2 * x]);
+                sum.add(row1[2 * x + 1]);
+                out[x] = sum.average(4);
+            }
+        }
+        // odd edges
+        for (; x < dst_width; x++)
+        {
+            ChannelSum sum;
+            uint32_t count = 0;
+            for (auto const* row : {row0, row1})
+            {
+                if (!row) continue;
+                sum.add(row[2 * x]);
+                count++;
+                if (2 * x + 1 < width)
+                {
+                    sum.add(row[2 * x + 1]);
+                    count++;
+                }
+            }
+            out[x] = sum.average(count);
+        }
+    }
+}
+
+namespace
+{
+    // contribution of source pixels to one destination pixel along one axis
+    struct Taps
+    {
+        int64_t first = 0;          // first source index
+        std::vector<float> weights; // normalized
+    };
+
+    // separable filter: `taps[x]` for the horizontal pass, `taps[y]` for the vertical one
+    void filter_separable(uint32_t const* src, int64_t src_width, int64_t src_height, int64_t src_stride,
+                          std::vector<Taps> const& h_taps, std::vector<Taps> const& v_taps, uint32_t* dst,
+                          int64_t dst_stride)
+    {
+        auto const dst_width = static_cast<int64_t>(h_taps.size());
+        auto const dst_height = static_cast<int64_t>(v_taps.size());
+        // horizontal pass, 4 floats per pixel in ARGB byte order (b, g, r, a)
+        std::vector<float> tmp(dst_width * src_height * 4);
+        for (int64_t y = 0; y < src_height; y++)
+        {
+            auto const* row = src + y * src_stride;
+            auto* out = tmp.data() + y * dst_width * 4;
+            for (int64_t x = 0; x < dst_width; x++)
+            {
+                auto const& taps = h_taps[x];
+                float acc[4] = {};
+                for (size_t k = 0; k < taps.weights.size(); k++)
+                {
+                    auto const sx = std::clamp<int64_t>(taps.first + static_cast<int64_t>(k), 0, src_width - 1);
+                    auto const p = row[sx];
+                    auto const w = taps.weights[k];
+                    for (int c = 0; c < 4; c++)
+                        acc[c] += w * ((p >> (8 * c)) & 0xff);
+                }
+                std::copy_n(acc, 4, out + x * 4);
+            }
+        }
+        // vertical pass
+        for (int64_t y = 0; y < dst_height; y++)
+        {
+            auto const& taps = v_taps[y];
+            auto* out = dst + y * dst_stride;
+            for (int64_t x = 0; x < dst_width; x++)
+            {
+                float acc[4] = {};
+                for (size_t k = 0; k < taps.weights.size(); k++)
+                {
+                    auto const sy = std::clamp<int64_t>(taps.first + static_cast<int64_t>(k), 0, src_height - 1);
+                    auto const* p = tmp.data() + (sy * dst_width + x) * 4;
+                    auto const w = taps.weights[k];
+                    for (int c = 0; c < 4; c++)
+                        acc[c] += w * p[c];
+                }
+                auto const a = std::clamp(static_cast<int>(std::lround(acc[3])), 0, 255);
+                uint32_t pixel = static_cast<uint32_t>(a) << 24;
+                for (int c = 0; c < 3; c++)
+                    pixel |= static_cast<uint32_t>(std::clamp(static_cast<int>(std::lround(acc[c])), 0, a)) << (8 * c);
+                out[x] = pixel;
+            }
+        }
+    }
+
+    float lanczos3(float x)
+    {
+        constexpr float pi = 3.14159265358979f;
+        if (x == 0.f) return 1.f;
+        if (x <= -3.f || x >= 3.f) return 0.f;
+        auto const px = pi * x;
+        return 3.f * std::sin(px) * std::sin(px / 3.f) / (px * px);
+    }
+
+    // output i is centered on source 2i + 1, i.e. between source pixels 2i and 2i + 1
+    std::vector<Taps> lanczos_2x_taps(int64_t dst_size)
+    {
+        std::vector<float> weights;
+        float sum = 0.f;
+        for (int k = -5; k <= 6; k++)
+        {
+            weights.push_back(lanczos3((k - 0.5f) / 2.f));
+            sum += weights.back();
+        }
+        for (auto& w : weights)
+            w /= sum;
+
+        std::vector<Taps> taps(dst_size);
+        for (int64_t i = 0; i < dst_size; i++)
+            taps[i] = Taps{2 * i - 5, weights};
+        return taps;
+    }
+
+    std::vector<Taps> area_taps(int64_t src_size, int64_t dst_size)
+    {
+        std::vector<Taps> taps(dst_size);
+        auto const scale = static_cast<double>(src_size) / dst_size;
+        for (int64_t i = 0; i < dst_size; i++)
+        {
+            auto const begin = i * scale;
+            auto const end = std::min((i + 1) * scale, static_cast<double>(src_size));
+            auto& t = taps[i];
+            t.first = static_cast<int64_t>(begin);
+            for (auto s = t.first; s < end; s++)
+                t.weights.push_back(
+                    static_cast<float>((std::min<double>(s + 1, end) - std::max<double>(s, begin)) / scale));
+        }
+        return taps;
+    }
+} // namespace
+
+void dz_common::reduce_2x2_lanczos(uint32_t const* src, int64_t width, int64_t height, int64_t src_stride,
+                                   uint32_t* dst, int64_t dst_stride)
+{
+    filter_separable(src, width, height, src_stride, lanczos_2x_taps((width + 1) / 2),
+                     lanczos_2x_taps((height + 1) / 2), dst, dst_stride);
+}
+
+void dz_common::resize_area(uint32_t const* src, int64_t src_width, int64_t src_height, int64_t src_stride,
+                            uint32_t* dst, int64_t dst_width, int64_t dst_height, int64_t dst_stride)
+{
+    filter_separable(src, src_width, src_height, src_stride, area_taps(src_width, dst_width),
+                     area_taps(src_height, dst_height), dst, dst_stride);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+namespace dz_common
+{
+    // halves an ARGB image by averaging 2x2 blocks (per 8-bit channel, rounded)
+    // the destination is ceil(width / 2) x ceil(height / 2), the last column/row averages what is left of an odd edge
+    // strides are in pixels
+    void reduce_2x2(uint32_t const* src, int64_t width, int64_t height, int64_t src_stride, uint32_t* dst,
+                    int64_t dst_stride);
+
+    // same geometry as `reduce_2x2` but filtered with a Lanczos-3 kernel (12 taps per axis), sharper than the box
+    // pixels outside of the source are the replicated edge; premultiplied colors are clamped to their alpha
+    void reduce_2x2_lanczos(uint32_t const* src, int64_t width, int64_t height, int64_t src_stride, uint32_t* dst,
+                            int64_t dst_stride);
+
+    // resizes an ARGB image to any smaller (or equal) size, every destination pixel is the area weighted average of
+    // the source pixels it covers
+    void resize_area(uint32_t const* src, int64_t src_width, int64_t src_height, int64_t src_stride, uint32_t* dst,
+                     int64_t dst_width, int64_t dst_height, int64_t dst_stride);
+} // namespace dz_common
@@ -0,0 +1,150 @@
+#include "pixelbuffer.hpp"
+
+#include <array>
+#include <atomic>
+#include <new>
+#include <utility>
+
+using namespace dz_common;
+
+namespace
+{
+    // allocations are rounded up to 64 KiB, so that tiles of slightly different sizes share buffers
+    constexpr size_t granularity = size_t{16} << 10;
+
+    std::atomic<uint64_t> allocation_count{0};
+
+    uint32_t* allocate(size_t capacity)
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<uint32_t*>(
+            ::operator new(capacity * sizeof(uint32_t), std::align_val_t{PixelBuffer::alignment}));
+    }
+
+    void deallocate(uint32_t* data)
+    {
+        ::operator delete(data, std::align_val_t{PixelBuffer::alignment});
+    }
+
+    struct Block
+    {
+        uint32_t* data = nullptr;
+        size_t capacity = 0;
+    };
+
+    // fixed size, so that the list itself never allocates
+    struct FreeList
+    {
+        std::array<Block, PixelBuffer::max_free_per_thread> blocks;
+        size_t count = 0;
+
+        ~FreeList();
+
+        void clear()
+        {
+            for (size_t i = 0; i < count; i++)
+                deallocate(blocks[i].data);
+            count = 0;
+        }
+    };
+
+    // buffers released while the thread exits, after its list is gone, are freed right away
+    thread_local bool free_list_destroyed = false;
+
+    FreeList::~FreeList()
+    {
+        clear();
+        free_list_destroyed = true;
+    }
+
+    FreeList* local_free_list()
+    {
+        if (free_list_destroyed) return nullptr;
+        thread_local FreeList list;
+        return &list;
+    }
+} // namespace
+
+PixelBuffer::PixelBuffer(size_t count)
+{
+    if (count == 0) return;
+    m_size = count;
+
+    // the smallest free block that fits
+    if (auto* list = local_free_list(); list)
+    {
+        size_t best = list->count;
+        for (size_t i = 0; i < list->count; i++)
+            if (list->blocks[i].capacity >= count &&
+                (best == list->count || list->blocks[i].capacity < list->blocks[best].capacity))
+                best = i;
+        if (best != list->count)
+        {
+            m_data = list->blocks[best].data;
+            m_capacity = list->blocks[best].capacity;
+            list->blocks[best] = list->blocks[--list->count];
+            return;
+        }
+    }
+
+    m_capacity = (count + granularity - 1) / granularity * granularity;
+    m_data = allocate(m_capacity);
+}
+
+PixelBuffer::~PixelBuffer()
+{
+    release();
+}
+
+PixelBuffer::PixelBuffer(PixelBuffer&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)),
+      m_capacity(std::exchange(other.m_capacity, 0))
+{
+}
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_capacity = std::exchange(other.m_capacity, 0);
+    }
+    return *this;
+}
+
+void PixelBuffer::release()
+{
+    if (!m_data) return;
+    Block block{std::exchange(m_data, nullptr), std::exchange(m_capacity, 0)};
+    m_size = 0;
+
+    auto* list = local_free_list();
+    if (!list)
+    {
+        deallocate(block.data);
+        return;
+    }
+    if (list->count < list->blocks.size())
+    {
+        list->blocks[list->count++] = block;
+        return;
+    }
+    // full: keep the larger buffers, they fit more requests
+    size_t smallest = 0;
+    for (size_t i = 1; i < list->count; i++)
+        if (list->blocks[i].capacity < list->blocks[smallest].capacity) smallest = i;
+    if (list->blocks[smallest].capacity < block.capacity) std::swap(list->blocks[smallest], block);
+    deallocate(block.data);
+}
+
+uint64_t PixelBuffer::allocations()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void PixelBuffer::trim()
+{
+    if (auto* list = local_free_list(); list) list->clear();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+
+namespace dz_common
+{
+    // reusable pixel storage for tile reads and encoding, so that steady-state tile serving does not hit the heap
+    // storage is uninitialised and 64-byte aligned. each thread keeps a small free list of its own: a buffer goes
+    // back to the list of the thread that releases it (which need not be the one that acquired it), without locking
+    class PixelBuffer
+    {
+    public:
+        // alignment of `data()`
+        static constexpr size_t alignment = 64;
+        // free buffers kept per thread, extra ones are freed
+        static constexpr size_t max_free_per_thread = 8;
+
+        PixelBuffer() = default;
+        // at least `count` pixels, from the calling thread's free list if one is large enough
+        explicit PixelBuffer(size_t count);
+        ~PixelBuffer();
+
+        PixelBuffer(PixelBuffer const&) = delete;
+        PixelBuffer& operator=(PixelBuffer const&) = delete;
+
+        PixelBuffer(PixelBuffer&& other) noexcept;
+        PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+
+        uint32_t* data() { return m_data; }
+        uint32_t const* data() const { return m_data; }
+        // pixels asked for, the storage may be larger
+        size_t size() const { return m_size; }
+        size_t capacity() const { return m_capacity; }
+        bool empty() const { return m_size == 0; }
+
+        std::span<uint32_t> pixels() { return {m_data, m_size}; }
+        std::span<uint32_t const> pixels() const { return {m_data, m_size}; }
+        operator std::span<uint32_t const>() const { return pixels(); }
+
+        uint32_t* begin() { return m_data; }
+        uint32_t* end() { return m_data + m_size; }
+        uint32_t const* begin() const { return m_data; }
+        uint32_t const* end() const { return m_data + m_size; }
+
+        // hands the storage back to the calling thread's free list, the buffer is empty afterwards
+        void release();
+
+        // heap allocations made for pixel buffers since start, for checking that pooling works
+        static uint64_t allocations();
+        // frees the calling thread's free list
+        static void trim();
+
+    private:
+        uint32_t* m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_capacity = 0;
+    };
+} // namespace dz_common
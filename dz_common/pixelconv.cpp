@@ -0,0 +1,411 @@
+#include "pixelconv.hpp"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DZ_PIXELCONV_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC always allows the intrinsics, GCC/Clang need the functions using them to be compiled for the target
+#if defined(_MSC_VER) && !defined(__clang__)
+#define DZ_TARGET(isa)
+#else
+#define DZ_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace dz_common;
+
+namespace
+{
+    struct Kernels
+    {
+        void (*argb_to_rgb)(uint32_t const*, uint8_t*, size_t);
+        void (*argb_to_rgba)(uint32_t const*, uint8_t*, size_t);
+        void (*argb_to_bgrx)(uint32_t const*, uint8_t*, size_t);
+        void (*argb_to_argb_bytes)(uint32_t const*, uint8_t*, size_t);
+        void (*argb_range)(uint32_t const*, size_t, uint32_t*, uint32_t*);
+    };
+
+    // scalar, also used for the tails of the SIMD kernels
+
+    void argb_to_rgb_scalar(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            auto const p = src[i];
+            dst[0] = static_cast<uint8_t>(p >> 16);
+            dst[1] = static_cast<uint8_t>(p >> 8);
+            dst[2] = static_cast<uint8_t>(p);
+            dst += 3;
+        }
+    }
+
+    inline uint8_t unpremultiply(uint32_t c, uint32_t a)
+    {
+        auto const v = (c * 255 + a / 2) / a;
+        return static_cast<uint8_t>(v > 255 ? 255 : v);
+    }
+
+    void argb_to_rgba_scalar(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            auto const p = src[i];
+            auto const a = p >> 24;
+            if (a == 255)
+            {
+                dst[0] = static_cast<uint8_t>(p >> 16);
+                dst[1] = static_cast<uint8_t>(p >> 8);
+                dst[2] = static_cast<uint8_t>(p);
+            }
+            else if (a == 0)
+            {
+                dst[0] = dst[1] = dst[2] = 0;
+            }
+            else
+            {
+                dst[0] = unpremultiply((p >> 16) & 0xff, a);
+                dst[1] = unpremultiply((p >> 8) & 0xff, a);
+                dst[2] = unpremultiply(p & 0xff, a);
+            }
+            dst[3] = static_cast<uint8_t>(a);
+            dst += 4;
+        }
+    }
+
+    void argb_to_bgrx_scalar(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            auto const p = src[i];
+            dst[0] = static_cast<uint8_t>(p);
+            dst[1] = static_cast<uint8_t>(p >> 8);
+            dst[2] = static_cast<uint8_t>(p >> 16);
+            dst[3] = 0xff;
+            dst += 4;
+        }
+    }
+
+    void argb_to_argb_bytes_scalar(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            auto const p = src[i];
+            dst[0] = static_cast<uint8_t>(p >> 24);
+            dst[1] = static_cast<uint8_t>(p >> 16);
+            dst[2] = static_cast<uint8_t>(p >> 8);
+            dst[3] = static_cast<uint8_t>(p);
+            dst += 4;
+        }
+    }
+
+    void argb_range_scalar(uint32_t const* src, size_t count, uint32_t* min, uint32_t* max)
+    {
+        uint32_t lo[4], hi[4];
+        for (int c = 0; c < 4; c++)
+        {
+            lo[c] = (*min >> (8 * c)) & 0xff;
+            hi[c] = (*max >> (8 * c)) & 0xff;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            auto const p = src[i];
+            for (int c = 0; c < 4; c++)
+            {
+                auto const v = (p >> (8 * c)) & 0xff;
+                lo[c] = v < lo[c] ? v : lo[c];
+                hi[c] = v > hi[c] ? v : hi[c];
+            }
+        }
+        *min = lo[0] | lo[1] << 8 | lo[2] << 16 | lo[3] << 24;
+        *max = hi[0] | hi[1] << 8 | hi[2] << 16 | hi[3] << 24;
+    }
+
+    constexpr Kernels scalar_kernels{argb_to_rgb_scalar, argb_to_rgba_scalar, argb_to_bgrx_scalar,
+                                     argb_to_argb_bytes_scalar, argb_range_scalar};
+
+#ifdef DZ_PIXELCONV_X86
+    // x86 is little endian: a pixel is b, g, r, a in memory
+
+    // SSSE3, 4 pixels per step
+
+    DZ_TARGET("ssse3") void argb_to_rgb_ssse3(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const mask = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        size_t i = 0;
+        // every store writes 16 bytes for 12 useful ones, keep it inside `dst`
+        for (; i + 6 <= count; i += 4)
+        {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(v, mask));
+        }
+        argb_to_rgb_scalar(src + i, dst + i * 3, count - i);
+    }
+
+    DZ_TARGET("ssse3") void argb_to_rgba_ssse3(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        auto const alpha = _mm_set1_epi32(static_cast<int>(0xff000000u));
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+            // only opaque blocks are a pure shuffle
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha), alpha)) == 0xffff)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_shuffle_epi8(v, mask));
+            else
+                argb_to_rgba_scalar(src + i, dst + i * 4, 4);
+        }
+        argb_to_rgba_scalar(src + i, dst + i * 4, count - i);
+    }
+
+    DZ_TARGET("ssse3") void argb_to_bgrx_ssse3(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const alpha = _mm_set1_epi32(static_cast<int>(0xff000000u));
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_or_si128(v, alpha));
+        }
+        argb_to_bgrx_scalar(src + i, dst + i * 4, count - i);
+    }
+
+    DZ_TARGET("ssse3") void argb_to_argb_bytes_ssse3(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_shuffle_epi8(v, mask));
+        }
+        argb_to_argb_bytes_scalar(src + i, dst + i * 4, count - i);
+    }
+
+    DZ_TARGET("ssse3") void argb_range_ssse3(uint32_t const* src, size_t count, uint32_t* min, uint32_t* max)
+    {
+        // bytewise min/max keep the channels apart, the 4 lanes are folded at the end
+        auto lo = _mm_set1_epi32(static_cast<int>(*min));
+        auto hi = _mm_set1_epi32(static_cast<int>(*max));
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+            lo = _mm_min_epu8(lo, v);
+            hi = _mm_max_epu8(hi, v);
+        }
+        lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+        lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+        hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+        hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+        *min = static_cast<uint32_t>(_mm_cvtsi128_si32(lo));
+        *max = static_cast<uint32_t>(_mm_cvtsi128_si32(hi));
+        argb_range_scalar(src + i, count - i, min, max);
+    }
+
+    constexpr Kernels ssse3_kernels{argb_to_rgb_ssse3, argb_to_rgba_ssse3, argb_to_bgrx_ssse3,
+                                    argb_to_argb_bytes_ssse3, argb_range_ssse3};
+
+    // AVX2, 8 pixels per step, `vpshufb` works per 128-bit lane
+
+    DZ_TARGET("avx2") void argb_to_rgb_avx2(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const mask = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, //
+                                           2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        // 12 useful bytes per lane, moved next to each other
+        auto const pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+        size_t i = 0;
+        // every store writes 32 bytes for 24 useful ones
+        for (; i + 11 <= count; i += 8)
+        {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i));
+            auto const rgb = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), pack);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 3), rgb);
+        }
+        argb_to_rgb_ssse3(src + i, dst + i * 3, count - i);
+    }
+
+    DZ_TARGET("avx2") void argb_to_rgba_avx2(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, //
+                                           2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        auto const alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i));
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(v, alpha), alpha)) == -1)
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_shuffle_epi8(v, mask));
+            else
+                argb_to_rgba_scalar(src + i, dst + i * 4, 8);
+        }
+        argb_to_rgba_scalar(src + i, dst + i * 4, count - i);
+    }
+
+    DZ_TARGET("avx2") void argb_to_bgrx_avx2(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_or_si256(v, alpha));
+        }
+        argb_to_bgrx_scalar(src + i, dst + i * 4, count - i);
+    }
+
+    DZ_TARGET("avx2") void argb_to_argb_bytes_avx2(uint32_t const* src, uint8_t* dst, size_t count)
+    {
+        auto const mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, //
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_shuffle_epi8(v, mask));
+        }
+        argb_to_argb_bytes_scalar(src + i, dst + i * 4, count - i);
+    }
+
+    DZ_TARGET("avx2") void argb_range_avx2(uint32_t const* src, size_t count, uint32_t* min, uint32_t* max)
+    {
+        auto lo = _mm256_set1_epi32(static_cast<int>(*min));
+        auto hi = _mm256_set1_epi32(static_cast<int>(*max));
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + i));
+            lo = _mm256_min_epu8(lo, v);
+            hi = _mm256_max_epu8(hi, v);
+        }
+        auto lo128 = _mm_min_epu8(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+        auto hi128 = _mm_max_epu8(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+        lo128 = _mm_min_epu8(lo128, _mm_shuffle_epi32(lo128, _MM_SHUFFLE(1, 0, 3, 2)));
+        lo128 = _mm_min_epu8(lo128, _mm_shuffle_epi32(lo128, _MM_SHUFFLE(2, 3, 0, 1)));
+        hi128 = _mm_max_epu8(hi128, _mm_shuffle_epi32(hi128, _MM_SHUFFLE(1, 0, 3, 2)));
+        hi128 = _mm_max_epu8(hi128, _mm_shuffle_epi32(hi128, _MM_SHUFFLE(2, 3, 0, 1)));
+        *min = static_cast<uint32_t>(_mm_cvtsi128_si32(lo128));
+        *max = static_cast<uint32_t>(_mm_cvtsi128_si32(hi128));
+        argb_range_scalar(src + i, count - i, min, max);
+    }
+
+    constexpr Kernels avx2_kernels{argb_to_rgb_avx2, argb_to_rgba_avx2, argb_to_bgrx_avx2, argb_to_argb_bytes_avx2,
+                                   argb_range_avx2};
+
+    PixelConvIsa cpu_isa()
+    {
+#ifdef _MSC_VER
+        int info[4] = {};
+        __cpuid(info, 0);
+        auto const max_leaf = info[0];
+        __cpuid(info, 1);
+        auto const ssse3 = (info[2] & (1 << 9)) != 0;
+        // AVX2 also needs the OS to save the ymm registers
+        auto const osxsave_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+        auto avx2 = false;
+        if (max_leaf >= 7 && osxsave_avx && (_xgetbv(0) & 0x6) == 0x6)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#else
+        __builtin_cpu_init();
+        auto const ssse3 = __builtin_cpu_supports("ssse3") != 0;
+        auto const avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+        if (avx2) return PixelConvIsa::AVX2;
+        if (ssse3) return PixelConvIsa::SSSE3;
+        return PixelConvIsa::SCALAR;
+    }
+#else
+    PixelConvIsa cpu_isa()
+    {
+        return PixelConvIsa::SCALAR;
+    }
+#endif
+
+    Kernels const* kernels_for(PixelConvIsa isa)
+    {
+#ifdef DZ_PIXELCONV_X86
+        if (isa == PixelConvIsa::AVX2) return &avx2_kernels;
+        if (isa == PixelConvIsa::SSSE3) return &ssse3_kernels;
+#endif
+        return &scalar_kernels;
+    }
+
+    struct Dispatch
+    {
+        PixelConvIsa const supported = cpu_isa();
+        std::atomic<PixelConvIsa> isa{supported};
+        std::atomic<Kernels const*> kernels{kernels_for(supported)};
+    };
+
+    Dispatch& dispatch()
+    {
+        static Dispatch d;
+        return d;
+    }
+
+    Kernels const& kernels()
+    {
+        return *dispatch().kernels.load(std::memory_order_relaxed);
+    }
+} // namespace
+
+void dz_common::argb_to_rgb(uint32_t const* src, uint8_t* dst, size_t count)
+{
+    kernels().argb_to_rgb(src, dst, count);
+}
+
+void dz_common::argb_to_rgba(uint32_t const* src, uint8_t* dst, size_t count)
+{
+    kernels().argb_to_rgba(src, dst, count);
+}
+
+void dz_common::argb_to_bgrx(uint32_t const* src, uint8_t* dst, size_t count)
+{
+    kernels().argb_to_bgrx(src, dst, count);
+}
+
+void dz_common::argb_to_argb_bytes(uint32_t const* src, uint8_t* dst, size_t count)
+{
+    kernels().argb_to_argb_bytes(src, dst, count);
+}
+
+void dz_common::argb_range(uint32_t const* src, size_t count, uint32_t* min, uint32_t* max)
+{
+    kernels().argb_range(src, count, min, max);
+}
+
+PixelConvIsa dz_common::pixelconv_isa()
+{
+    return dispatch().isa.load(std::memory_order_relaxed);
+}
+
+PixelConvIsa dz_common::set_pixelconv_isa(PixelConvIsa isa)
+{
+    auto& d = dispatch();
+    if (static_cast<int>(isa) > static_cast<int>(d.supported)) isa = d.supported;
+    d.isa.store(isa, std::memory_order_relaxed);
+    d.kernels.store(kernels_for(isa), std::memory_order_relaxed);
+    return isa;
+}
+
+char const* dz_common::pixelconv_isa_name(PixelConvIsa isa)
+{
+    switch (isa)
+    {
+    case PixelConvIsa::AVX2:
+        return "avx2";
+    case PixelConvIsa::SSSE3:
+        return "ssse3";
+    case PixelConvIsa::SCALAR:
+        break;
+    }
+    return "scalar";
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace dz_common
+{
+    // conversions of premultiplied ARGB pixels (`uint32_t` 0xAARRGGBB, as returned by `openslide_read_region`)
+    // to packed bytes. all of them convert `count` pixels, `src` and `dst` need no alignment and must not overlap.
+    // the fastest kernel set the CPU supports (AVX2, SSSE3, scalar) is picked on first use, the output is the same
+    // byte for byte whichever runs
+
+    // r, g, b: alpha dropped, which is the right thing for opaque tiles
+    void argb_to_rgb(uint32_t const* src, uint8_t* dst, size_t count);
+    // r, g, b, a: colors un-premultiplied (rounded), fully transparent pixels become 0, 0, 0, 0
+    void argb_to_rgba(uint32_t const* src, uint8_t* dst, size_t count);
+    // b, g, r, 0xff: the layout TurboJPEG/WebP take as BGRX/BGRA
+    void argb_to_bgrx(uint32_t const* src, uint8_t* dst, size_t count);
+    // a, r, g, b
+    void argb_to_argb_bytes(uint32_t const* src, uint8_t* dst, size_t count);
+    // per channel minimum and maximum of `count` pixels, folded into `*min` and `*max` so that several rows can be
+    // scanned in a row: start from 0xffffffff and 0. a tile is uniform when no channel spans more than a few levels
+    void argb_range(uint32_t const* src, size_t count, uint32_t* min, uint32_t* max);
+
+    enum class PixelConvIsa : int
+    {
+        SCALAR = 0,
+        SSSE3,
+        AVX2
+    };
+
+    // kernel set in use
+    PixelConvIsa pixelconv_isa();
+    // forces a kernel set (capped to what the CPU supports) and returns the one in use, meant for tests and benchmarks
+    PixelConvIsa set_pixelconv_isa(PixelConvIsa isa);
+    char const* pixelconv_isa_name(PixelConvIsa isa);
+} // namespace dz_common
@@ -0,0 +1,444 @@
+#include "resample.hpp"
+#include "pixelconv.hpp"
+#include "pixelbuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DZ_RESAMPLE_X86
+#include <immintrin.h>
+#endif
+
+// see pixelconv.cpp
+#if defined(_MSC_VER) && !defined(__clang__)
+#define DZ_TARGET(isa)
+#else
+#define DZ_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace dz_common;
+
+namespace
+{
+    constexpr int precision_bits = 14;
+    constexpr int32_t one = 1 << precision_bits;
+    constexpr int32_t rounding = 1 << (precision_bits - 1);
+
+    // contributions of the source pixels to the destination pixels along one axis
+    // destination pixel `i` is the sum of `count[i]` weights times the source pixels from `first[i]` on
+    struct Coefficients
+    {
+        std::vector<int64_t> first;
+        std::vector<int> count;
+        std::vector<int16_t> weights; // `stride` per destination pixel
+        int stride = 0;
+        std::vector<double> window; // scratch
+
+        void compute(int64_t src_size, int64_t dst_size, ResampleFilter filter);
+        int16_t const* weights_of(int64_t i) const { return weights.data() + i * stride; }
+    };
+
+    double triangle(double x)
+    {
+        x = std::abs(x);
+        return x < 1. ? 1. - x : 0.;
+    }
+
+    double lanczos3(double x)
+    {
+        constexpr double pi = 3.14159265358979323846;
+        if (x == 0.) return 1.;
+        if (x <= -3. || x >= 3.) return 0.;
+        auto const px = pi * x;
+        return 3. * std::sin(px) * std::sin(px / 3.) / (px * px);
+    }
+
+    void Coefficients::compute(int64_t src_size, int64_t dst_size, ResampleFilter filter)
+    {
+        auto const scale = static_cast<double>(src_size) / static_cast<double>(dst_size);
+        // downscaling widens the filter to cover all source pixels
+        auto const filter_scale = std::max(scale, 1.);
+        auto const support = filter == ResampleFilter::LANCZOS    ? 3. * filter_scale
+                             : filter == ResampleFilter::BILINEAR ? filter_scale
+                                                                  : 0.5 * scale + 1.;
+        stride = static_cast<int>(std::ceil(support)) * 2 + 2;
+        first.resize(dst_size);
+        count.resize(dst_size);
+        weights.assign(static_cast<size_t>(dst_size) * stride, 0);
+        window.resize(stride);
+
+        for (int64_t i = 0; i < dst_size; i++)
+        {
+            auto const center = (static_cast<double>(i) + 0.5) * scale;
+            auto lo = std::max<int64_t>(0, static_cast<int64_t>(std::floor(center - support + 0.5)));
+            auto hi = std::min<int64_t>(src_size, static_cast<int64_t>(std::floor(center + support + 0.5)));
+            hi = std::min<int64_t>(hi, lo + stride);
+
+            auto sum = 0.;
+            for (auto s = lo; s < hi; s++)
+            {
+                double w = 0.;
+                if (filter == ResampleFilter::AREA)
+                {
+                    auto const begin = i * scale, end = (i + 1) * scale;
+                    w = std::max(0., std::min<double>(s + 1, end) - std::max<double>(s, begin));
+                }
+                else
+                {
+                    auto const x = (static_cast<double>(s) + 0.5 - center) / filter_scale;
+                    w = filter == ResampleFilter::LANCZOS ? lanczos3(x) : triangle(x);
+                }
+                window[s - lo] = w;
+                sum += w;
+            }
+
+            // to fixed point, the rounding error goes to the largest weight so that the weights sum to exactly `one`
+            auto* w = weights.data() + i * stride;
+            auto n = static_cast<int>(hi - lo);
+            if (sum == 0.)
+            {
+                // nothing in reach, take the nearest pixel
+                lo = std::clamp<int64_t>(static_cast<int64_t>(center), 0, src_size - 1);
+                n = 1;
+                window[0] = sum = 1.;
+            }
+            int32_t total = 0;
+            int largest = 0;
+            for (int k = 0; k < n; k++)
+            {
+                w[k] = static_cast<int16_t>(std::lround(window[k] / sum * one));
+                total += w[k];
+                if (std::abs(w[k]) > std::abs(w[largest])) largest = k;
+            }
+            w[largest] = static_cast<int16_t>(w[largest] + one - total);
+
+            // zero weights at both ends are wasted taps
+            int begin = 0;
+            while (begin < n - 1 && w[begin] == 0)
+                begin++;
+            while (n - 1 > begin && w[n - 1] == 0)
+                n--;
+            if (begin > 0) std::memmove(w, w + begin, (n - begin) * sizeof(int16_t));
+            first[i] = lo + begin;
+            count[i] = n - begin;
+        }
+    }
+
+    inline uint8_t clamp_channel(int32_t acc)
+    {
+        return static_cast<uint8_t>(std::clamp(acc >> precision_bits, 0, 255));
+    }
+
+    // scalar, also used for the tails of the SIMD kernels
+
+    // rows [y0, y1) of `src` into `dst` (whose row 0 is source row `y0`)
+    void horizontal_scalar(uint32_t const* src, int64_t src_stride, int64_t y0, int64_t y1, Coefficients const& h,
+                           uint32_t* dst, int64_t dst_stride)
+    {
+        auto const dst_width = static_cast<int64_t>(h.first.size());
+        for (auto y = y0; y < y1; y++)
+        {
+            auto const* row = src + y * src_stride;
+            auto* out = dst + (y - y0) * dst_stride;
+            for (int64_t x = 0; x < dst_width; x++)
+            {
+                auto const* p = row + h.first[x];
+                auto const* w = h.weights_of(x);
+                int32_t acc[4] = {rounding, rounding, rounding, rounding};
+                for (int k = 0; k < h.count[x]; k++)
+                    for (int c = 0; c < 4; c++)
+                        acc[c] += w[k] * static_cast<int32_t>((p[k] >> (8 * c)) & 0xff);
+                uint32_t pixel = 0;
+                for (int c = 0; c < 4; c++)
+                    pixel |= static_cast<uint32_t>(clamp_channel(acc[c])) << (8 * c);
+                out[x] = pixel;
+            }
+        }
+    }
+
+    // columns [x0, x1) of all destination rows, `src` row 0 is source row `y0`
+    void vertical_scalar(uint32_t const* src, int64_t src_stride, int64_t y0, Coefficients const& v, int64_t x0,
+                         int64_t x1, uint32_t* dst, int64_t dst_stride)
+    {
+        auto const dst_height = static_cast<int64_t>(v.first.size());
+        for (int64_t y = 0; y < dst_height; y++)
+        {
+            auto const* rows = src + (v.first[y] - y0) * src_stride;
+            auto const* w = v.weights_of(y);
+            auto* out = dst + y * dst_stride;
+            for (auto x = x0; x < x1; x++)
+            {
+                int32_t acc[4] = {rounding, rounding, rounding, rounding};
+                for (int k = 0; k < v.count[y]; k++)
+                {
+                    auto const p = rows[k * src_stride + x];
+                    for (int c = 0; c < 4; c++)
+                        acc[c] += w[k] * static_cast<int32_t>((p >> (8 * c)) & 0xff);
+                }
+                uint32_t pixel = 0;
+                for (int c = 0; c < 4; c++)
+                    pixel |= static_cast<uint32_t>(clamp_channel(acc[c])) << (8 * c);
+                out[x] = pixel;
+            }
+        }
+    }
+
+    // premultiplied colors cannot exceed their alpha, negative lobes can push them over
+    void clamp_to_alpha_scalar(uint32_t* pixels, int64_t count)
+    {
+        for (int64_t i = 0; i < count; i++)
+        {
+            auto const p = pixels[i];
+            auto const a = p >> 24;
+            uint32_t pixel = p & 0xff000000;
+            for (int c = 0; c < 3; c++)
+                pixel |= std::min((p >> (8 * c)) & 0xff, a) << (8 * c);
+            pixels[i] = pixel;
+        }
+    }
+
+    struct Kernels
+    {
+        void (*horizontal)(uint32_t const*, int64_t, int64_t, int64_t, Coefficients const&, uint32_t*, int64_t);
+        void (*vertical)(uint32_t const*, int64_t, int64_t, Coefficients const&, int64_t, int64_t, uint32_t*,
+                         int64_t);
+        void (*clamp_to_alpha)(uint32_t*, int64_t);
+    };
+
+    constexpr Kernels scalar_kernels{horizontal_scalar, vertical_scalar, clamp_to_alpha_scalar};
+
+#ifdef DZ_RESAMPLE_X86
+    // weights `k` and `k + 1` in every 32-bit lane, the operand of `madd` against channel pairs
+    DZ_TARGET("avx2") inline __m128i weight_pair(int16_t const* w)
+    {
+        int32_t pair;
+        std::memcpy(&pair, w, sizeof(pair));
+        return _mm_set1_epi32(pair);
+    }
+
+    // `rows` rows at once, so that the weights are loaded once per destination pixel
+    template <int rows>
+    DZ_TARGET("avx2")
+    void horizontal_rows_avx2(uint32_t const* const* src_rows, uint32_t* const* dst_rows, Coefficients const& h)
+    {
+        // b0 b1 g0 g1 r0 r1 a0 a1 | b2 b3 g2 g3 r2 r3 a2 a3: channel pairs of adjacent pixels
+        auto const pairs = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+        auto const round = _mm_set1_epi32(rounding);
+        auto const dst_width = static_cast<int64_t>(h.first.size());
+        for (int64_t x = 0; x < dst_width; x++)
+        {
+            auto const first = h.first[x];
+            auto const* w = h.weights_of(x);
+            auto const n = h.count[x];
+            int k = 0;
+            // 4 taps per step, two in each 128-bit lane
+            __m256i acc4[rows];
+            for (int r = 0; r < rows; r++)
+                acc4[r] = _mm256_setzero_si256();
+            for (; k + 4 <= n; k += 4)
+            {
+                auto const ww =
+                    _mm256_inserti128_si256(_mm256_castsi128_si256(weight_pair(w + k)), weight_pair(w + k + 2), 1);
+                for (int r = 0; r < rows; r++)
+                {
+                    auto const* p = reinterpret_cast<__m128i const*>(src_rows[r] + first + k);
+                    auto const px = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadu_si128(p), pairs));
+                    acc4[r] = _mm256_add_epi32(acc4[r], _mm256_madd_epi16(px, ww));
+                }
+            }
+            __m128i acc[rows];
+            for (int r = 0; r < rows; r++)
+                acc[r] = _mm_add_epi32(_mm256_castsi256_si128(acc4[r]), _mm256_extracti128_si256(acc4[r], 1));
+            for (; k + 2 <= n; k += 2)
+            {
+                auto const ww = weight_pair(w + k);
+                for (int r = 0; r < rows; r++)
+                {
+                    auto const* p = reinterpret_cast<__m128i const*>(src_rows[r] + first + k);
+                    auto const px = _mm_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadl_epi64(p), pairs));
+                    acc[r] = _mm_add_epi32(acc[r], _mm_madd_epi16(px, ww));
+                }
+            }
+            if (k < n)
+            {
+                // channels zero-extended to 32 bits, the upper halves multiply a zero weight
+                auto const ww = _mm_set1_epi32(static_cast<uint16_t>(w[k]));
+                for (int r = 0; r < rows; r++)
+                {
+                    auto const px = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(src_rows[r][first + k])));
+                    acc[r] = _mm_add_epi32(acc[r], _mm_madd_epi16(px, ww));
+                }
+            }
+            for (int r = 0; r < rows; r++)
+                acc[r] = _mm_srai_epi32(_mm_add_epi32(acc[r], round), precision_bits);
+            if constexpr (rows == 4)
+            {
+                auto const packed = _mm_packus_epi16(_mm_packs_epi32(acc[0], acc[1]), _mm_packs_epi32(acc[2], acc[3]));
+                dst_rows[0][x] = static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+                dst_rows[1][x] = static_cast<uint32_t>(_mm_extract_epi32(packed, 1));
+                dst_rows[2][x] = static_cast<uint32_t>(_mm_extract_epi32(packed, 2));
+                dst_rows[3][x] = static_cast<uint32_t>(_mm_extract_epi32(packed, 3));
+            }
+            else
+            {
+                for (int r = 0; r < rows; r++)
+                {
+                    auto const packed = _mm_packus_epi16(_mm_packs_epi32(acc[r], acc[r]), _mm_setzero_si128());
+                    dst_rows[r][x] = static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+                }
+            }
+        }
+    }
+
+    DZ_TARGET("avx2")
+    void horizontal_avx2(uint32_t const* src, int64_t src_stride, int64_t y0, int64_t y1, Coefficients const& h,
+                         uint32_t* dst, int64_t dst_stride)
+    {
+        auto y = y0;
+        for (; y + 4 <= y1; y += 4)
+        {
+            uint32_t const* src_rows[4];
+            uint32_t* dst_rows[4];
+            for (int r = 0; r < 4; r++)
+            {
+                src_rows[r] = src + (y + r) * src_stride;
+                dst_rows[r] = dst + (y + r - y0) * dst_stride;
+            }
+            horizontal_rows_avx2<4>(src_rows, dst_rows, h);
+        }
+        for (; y < y1; y++)
+        {
+            uint32_t const* src_row = src + y * src_stride;
+            uint32_t* dst_row = dst + (y - y0) * dst_stride;
+            horizontal_rows_avx2<1>(&src_row, &dst_row, h);
+        }
+    }
+
+    DZ_TARGET("avx2")
+    void vertical_avx2(uint32_t const* src, int64_t src_stride, int64_t y0, Coefficients const& v, int64_t x0,
+                       int64_t x1, uint32_t* dst, int64_t dst_stride)
+    {
+        auto const dst_height = static_cast<int64_t>(v.first.size());
+        auto const zero = _mm256_setzero_si256();
+        auto const round = _mm256_set1_epi32(rounding);
+        int64_t x_simd = x0;
+        for (int64_t y = 0; y < dst_height; y++)
+        {
+            auto const* rows = src + (v.first[y] - y0) * src_stride;
+            auto const* w = v.weights_of(y);
+            auto const n = v.count[y];
+            auto* out = dst + y * dst_stride;
+            auto x = x0;
+            // 8 pixels per step, rows interleaved in pairs so that `madd` sums two taps per channel
+            for (; x + 8 <= x1; x += 8)
+            {
+                auto acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+                for (int k = 0; k < n; k += 2)
+                {
+                    auto const r0 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rows + k * src_stride + x));
+                    auto const r1 =
+                        k + 1 < n ? _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rows + (k + 1) * src_stride + x))
+                                  : zero;
+                    auto const ww = _mm256_broadcastsi128_si256(
+                        k + 1 < n ? weight_pair(w + k) : _mm_set1_epi32(static_cast<uint16_t>(w[k])));
+                    auto const lo = _mm256_unpacklo_epi8(r0, r1);
+                    auto const hi = _mm256_unpackhi_epi8(r0, r1);
+                    acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), ww));
+                    acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), ww));
+                    acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), ww));
+                    acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), ww));
+                }
+                // pixels 0, 1, 2, 3 | 4, 5, 6, 7 back in order
+                auto const p01 = _mm256_packs_epi32(_mm256_srai_epi32(acc0, precision_bits),
+                                                    _mm256_srai_epi32(acc1, precision_bits));
+                auto const p23 = _mm256_packs_epi32(_mm256_srai_epi32(acc2, precision_bits),
+                                                    _mm256_srai_epi32(acc3, precision_bits));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_packus_epi16(p01, p23));
+            }
+            x_simd = x;
+        }
+        if (x_simd < x1) vertical_scalar(src, src_stride, y0, v, x_simd, x1, dst, dst_stride);
+    }
+
+    DZ_TARGET("avx2") void clamp_to_alpha_avx2(uint32_t* pixels, int64_t count)
+    {
+        auto const alpha = _mm256_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15, //
+                                            3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+        int64_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto* p = reinterpret_cast<__m256i*>(pixels + i);
+            auto const v = _mm256_loadu_si256(p);
+            _mm256_storeu_si256(p, _mm256_min_epu8(v, _mm256_shuffle_epi8(v, alpha)));
+        }
+        clamp_to_alpha_scalar(pixels + i, count - i);
+    }
+
+    constexpr Kernels avx2_kernels{horizontal_avx2, vertical_avx2, clamp_to_alpha_avx2};
+#endif
+
+    Kernels const& kernels()
+    {
+#ifdef DZ_RESAMPLE_X86
+        if (pixelconv_isa() == PixelConvIsa::AVX2) return avx2_kernels;
+#endif
+        return scalar_kernels;
+    }
+
+    // coefficients of the calling thread, reused so that resampling tiles does not allocate once warm
+    struct Scratch
+    {
+        Coefficients h;
+        Coefficients v;
+    };
+} // namespace
+
+void dz_common::resample(uint32_t const* src, int64_t src_width, int64_t src_height, int64_t src_stride, uint32_t* dst,
+                         int64_t dst_width, int64_t dst_height, int64_t dst_stride, ResampleFilter filter)
+{
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) return;
+    if (src_width == dst_width && src_height == dst_height)
+    {
+        for (int64_t y = 0; y < dst_height; y++)
+            std::copy_n(src + y * src_stride, dst_width, dst + y * dst_stride);
+        return;
+    }
+
+    thread_local Scratch scratch;
+    auto const& k = kernels();
+    auto& h = scratch.h;
+    auto& v = scratch.v;
+
+    if (src_height == dst_height)
+    {
+        h.compute(src_width, dst_width, filter);
+        k.horizontal(src, src_stride, 0, src_height, h, dst, dst_stride);
+    }
+    else if (src_width == dst_width)
+    {
+        v.compute(src_height, dst_height, filter);
+        k.vertical(src, src_stride, 0, v, 0, dst_width, dst, dst_stride);
+    }
+    else
+    {
+        h.compute(src_width, dst_width, filter);
+        v.compute(src_height, dst_height, filter);
+        // only the source rows the vertical pass reaches
+        auto y0 = src_height, y1 = int64_t{0};
+        for (size_t i = 0; i < v.first.size(); i++)
+        {
+            y0 = std::min(y0, v.first[i]);
+            y1 = std::max(y1, v.first[i] + v.count[i]);
+        }
+        PixelBuffer tmp(dst_width * (y1 - y0));
+        k.horizontal(src, src_stride, y0, y1, h, tmp.data(), dst_width);
+        k.vertical(tmp.data(), dst_width, y0, v, 0, dst_width, dst, dst_stride);
+    }
+
+    if (filter == ResampleFilter::LANCZOS)
+        for (int64_t y = 0; y < dst_height; y++)
+            k.clamp_to_alpha(dst + y * dst_stride, dst_width);
+}
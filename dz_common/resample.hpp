@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+namespace dz_common
+{
+    // separable resampling of premultiplied ARGB images to any size, with 14-bit fixed-point weights
+    // the kernel set follows `pixelconv_isa()`: AVX2 or scalar, the output is the same byte for byte whichever runs.
+    // filter windows are clipped to the image and renormalized, so edges need no padding and a uniform image stays
+    // uniform
+
+    enum class ResampleFilter : int
+    {
+        AREA = 0, // every destination pixel is the area weighted average of the source pixels it covers
+        BILINEAR, // triangle filter, widened to the downscaling ratio
+        LANCZOS   // Lanczos-3, widened to the downscaling ratio, sharper; colors are clamped to their alpha
+    };
+
+    // strides are in pixels, `src` and `dst` must not overlap
+    void resample(uint32_t const* src, int64_t src_width, int64_t src_height, int64_t src_stride, uint32_t* dst,
+                  int64_t dst_width, int64_t dst_height, int64_t dst_stride, ResampleFilter filter);
+} // namespace dz_common
@@ -0,0 +1,200 @@
+#include "slidemetadata.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+using namespace dz_common;
+
+namespace
+{
+    constexpr char magic[8] = {'D', 'Z', 'S', 'L', 'M', 'E', 'T', 'A'};
+    constexpr uint32_t version = 1;
+    constexpr uint32_t max_levels = 64;
+    constexpr uint32_t max_string = 4096;
+
+    template <typename T> void write_value(std::ofstream& out, T value)
+    {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    template <typename T> bool read_value(std::ifstream& in, T& value)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    void write_string(std::ofstream& out, std::string const& value)
+    {
+        write_value(out, static_cast<uint32_t>(value.size()));
+        out.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    bool read_string(std::ifstream& in, std::string& value)
+    {
+        uint32_t size = 0;
+        if (!read_value(in, size) || size > max_string) return false;
+        value.resize(size);
+        return static_cast<bool>(in.read(value.data(), size));
+    }
+
+    // deepzoom levels of a level 0 of `width` x `height`: halved down to 1x1
+    size_t dz_level_count(int64_t width, int64_t height)
+    {
+        size_t count = 1;
+        for (; width > 1 || height > 1; count++)
+        {
+            width = std::max(int64_t{1}, (width + 1) / 2);
+            height = std::max(int64_t{1}, (height + 1) / 2);
+        }
+        return count;
+    }
+} // namespace
+
+FileStamp FileStamp::of(std::string const& path)
+{
+    std::error_code ec;
+    auto absolute = std::filesystem::absolute(path, ec);
+    if (ec) return {};
+    auto const size = std::filesystem::file_size(absolute, ec);
+    if (ec) return {};
+    auto const mtime = std::filesystem::last_write_time(absolute, ec);
+    if (ec) return {};
+    return FileStamp{.path = absolute.string(),
+                     .size = static_cast<uint64_t>(size),
+                     .mtime = static_cast<int64_t>(mtime.time_since_epoch().count())};
+}
+
+bool SlideMetadata::empty() const
+{
+    return level_dimensions.empty();
+}
+
+SlideMetadata SlideMetadata::load(std::string const& path, FileStamp const& stamp, bool limit_bounds)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return {};
+
+    SlideMetadata metadata;
+    char file_magic[sizeof(magic)] = {};
+    uint32_t file_version = 0, levels = 0, dz_levels = 0;
+    uint8_t file_limit_bounds = 0;
+    if (!in.read(file_magic, sizeof(file_magic)) || std::memcmp(file_magic, magic, sizeof(magic)) != 0 ||
+        !read_value(in, file_version) || file_version != version || !read_string(in, metadata.stamp.path) ||
+        !read_value(in, metadata.stamp.size) || !read_value(in, metadata.stamp.mtime) ||
+        !read_value(in, file_limit_bounds))
+    {
+        printf("Invalid slide metadata: %s\n", path.c_str());
+        return {};
+    }
+    // written for an older version of the slide, or another one: silently stale
+    metadata.limit_bounds = file_limit_bounds != 0;
+    if (metadata.stamp != stamp || metadata.limit_bounds != limit_bounds) return {};
+
+    if (!read_value(in, levels) || levels == 0 || levels > max_levels)
+    {
+        printf("Invalid slide metadata: %s\n", path.c_str());
+        return {};
+    }
+    metadata.level_dimensions.resize(levels);
+    metadata.level_downsamples.resize(levels);
+    auto valid = true;
+    for (auto& [width, height] : metadata.level_dimensions)
+        valid = valid && read_value(in, width) && read_value(in, height) && width > 0 && height > 0;
+    for (auto& downsample : metadata.level_downsamples)
+        valid = valid && read_value(in, downsample) && downsample > 0.;
+    valid = valid && read_value(in, dz_levels) &&
+            dz_levels == dz_level_count(metadata.level_dimensions[0].first, metadata.level_dimensions[0].second);
+    if (valid)
+    {
+        metadata.preferred_levels.resize(dz_levels);
+        for (auto& level : metadata.preferred_levels)
+            valid = valid && read_value(in, level) && level >= 0 && level < static_cast<int>(levels);
+    }
+    valid = valid && read_value(in, metadata.l0_offset.first) && read_value(in, metadata.l0_offset.second) &&
+            read_value(in, metadata.mpp) && read_string(in, metadata.background_color) &&
+            read_value(in, metadata.icc_profile_size) && read_value(in, metadata.icc_profile_hash);
+    if (!valid)
+    {
+        printf("Truncated slide metadata: %s\n", path.c_str());
+        return {};
+    }
+    return metadata;
+}
+
+bool SlideMetadata::save(std::string const& path) const
+{
+    if (empty()) return false;
+    auto const temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out)
+        {
+            printf("Failed to write slide metadata: %s\n", path.c_str());
+            return false;
+        }
+
+        out.write(magic, sizeof(magic));
+        write_value(out, version);
+        write_string(out, stamp.path);
+        write_value(out, stamp.size);
+        write_value(out, stamp.mtime);
+        write_value(out, static_cast<uint8_t>(limit_bounds));
+        write_value(out, static_cast<uint32_t>(level_dimensions.size()));
+        for (auto const& [width, height] : level_dimensions)
+        {
+            write_value(out, width);
+            write_value(out, height);
+        }
+        for (auto const downsample : level_downsamples)
+            write_value(out, downsample);
+        write_value(out, static_cast<uint32_t>(preferred_levels.size()));
+        for (auto const level : preferred_levels)
+            write_value(out, static_cast<int32_t>(level));
+        write_value(out, l0_offset.first);
+        write_value(out, l0_offset.second);
+        write_value(out, mpp);
+        write_string(out, background_color);
+        write_value(out, icc_profile_size);
+        write_value(out, icc_profile_hash);
+        if (!out)
+        {
+            printf("Failed to write slide metadata: %s\n", path.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, path, ec);
+    if (ec)
+    {
+        printf("Failed to write slide metadata: %s\n", path.c_str());
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    return true;
+}
+
+std::string SlideMetadata::sidecar_path(std::string const& slide_path, std::string const& directory)
+{
+    if (directory.empty()) return slide_path + ".dzmeta";
+    std::error_code ec;
+    auto const absolute = std::filesystem::absolute(slide_path, ec).string();
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.dzmeta",
+             static_cast<unsigned long long>(
+                 hash({reinterpret_cast<uint8_t const*>(absolute.data()), absolute.size()})));
+    return (std::filesystem::path(directory) / name).string();
+}
+
+uint64_t SlideMetadata::hash(std::span<uint8_t const> bytes)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (auto const byte : bytes)
+    {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dz_common
+{
+    // which file a sidecar was written for: a slide replaced in place gets another size or modification time
+    struct FileStamp
+    {
+        std::string path; // absolute
+        uint64_t size = 0;
+        int64_t mtime = 0; // ticks of the filesystem clock
+
+        bool operator==(FileStamp const&) const = default;
+
+        // empty path if the file cannot be stat'ed
+        static FileStamp of(std::string const& path);
+    };
+
+    // generator state computed from a slide's headers, kept in a small binary sidecar so that the next open (e.g. a
+    // server restart) skips the header scan and the property reads: formats like MRXS or NDPI spend most of their cold
+    // latency there. the levels are the generator's, so they depend on `limit_bounds`, which is part of the key
+    struct SlideMetadata
+    {
+        FileStamp stamp;
+        bool limit_bounds = false;
+        std::vector<std::pair<int64_t, int64_t>> level_dimensions; // slide levels, within the bounds if limited
+        std::vector<double> level_downsamples;
+        std::vector<int> preferred_levels;           // slide level of each deepzoom level, lowest resolution first
+        std::pair<int64_t, int64_t> l0_offset{0, 0}; // of the bounds
+        double mpp = 0.;
+        std::string background_color;
+        uint64_t icc_profile_size = 0;
+        uint64_t icc_profile_hash = 0; // `hash` of the profile
+
+        bool empty() const;
+
+        // what `save` wrote, empty if the file is missing, invalid or was written for another file or `limit_bounds`
+        static SlideMetadata load(std::string const& path, FileStamp const& stamp, bool limit_bounds);
+        // written to a temporary file renamed over `path`, so that readers never see a partial sidecar
+        bool save(std::string const& path) const;
+        // next to the slide, or in `directory` (e.g. when the slides are read-only) named after the slide's path
+        static std::string sidecar_path(std::string const& slide_path, std::string const& directory = {});
+        // FNV-1a
+        static uint64_t hash(std::span<uint8_t const> bytes);
+    };
+} // namespace dz_common
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dz_common
+{
+    // open slides (generators, or anything holding them) by path, shared between threads.
+    // a slide is opened on first use by the thread asking for it, the threads asking meanwhile wait for that open
+    // instead of opening it again (single flight). opened slides stay in an LRU list; when the handles or bytes they
+    // account for exceed the limits, the least recently used ones nobody else holds are dropped (closed). slides in
+    // use are never dropped, so the limits can be exceeded while they are. failed opens are not remembered.
+    // all methods are thread-safe
+    template <typename T>
+    class SlideRegistry
+    {
+    public:
+        // what an open slide costs, as told by the opener
+        struct Footprint
+        {
+            size_t handles = 1; // file descriptors / library handles
+            size_t bytes = 0;   // memory held while open (caches, level tables, indices)
+        };
+
+        struct Limits
+        {
+            size_t max_handles = 256;
+            size_t max_bytes = size_t{4} << 30;
+        };
+
+        struct Stats
+        {
+            uint64_t hits = 0;      // `get` of an open slide
+            uint64_t misses = 0;    // `get` that opened the slide
+            uint64_t waits = 0;     // `get` that waited for another thread's open
+            uint64_t failures = 0;  // opens that returned nullptr
+            uint64_t evictions = 0; // slides dropped to stay within the limits
+            double open_ms_total = 0.;
+            double open_ms_max = 0.;
+            size_t open = 0; // slides currently held
+            size_t handles = 0;
+            size_t bytes = 0;
+
+            double open_ms_mean() const { return misses ? open_ms_total / misses : 0.; }
+        };
+
+        // opens `path`, nullptr on failure, and fills in its footprint (one handle, no bytes if left alone)
+        using Opener = std::function<std::shared_ptr<T>(std::string const& path, Footprint& footprint)>;
+
+        explicit SlideRegistry(Opener opener) : SlideRegistry(std::move(opener), Limits{})
+        {
+        }
+
+        SlideRegistry(Opener opener, Limits limits) : m_opener(std::move(opener)), m_limits(limits)
+        {
+        }
+
+        SlideRegistry(SlideRegistry const&) = delete;
+        SlideRegistry& operator=(SlideRegistry const&) = delete;
+
+        // the open slide, opening it if needed, nullptr if it cannot be opened
+        // what the opener throws is rethrown, to the threads waiting for that open as well
+        std::shared_ptr<T> get(std::string const& path)
+        {
+            std::unique_lock lock(m_mutex);
+            if (auto const it = m_entries.find(path); it != m_entries.end())
+            {
+                auto& entry = it->second;
+                if (entry.value)
+                {
+                    m_stats.hits++;
+                    m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+                    return entry.value;
+                }
+                // being opened by another thread
+                m_stats.waits++;
+                auto pending = entry.pending;
+                lock.unlock();
+                return pending.get();
+            }
+
+            std::promise<std::shared_ptr<T>> promise;
+            m_entries[path].pending = promise.get_future().share();
+            lock.unlock();
+
+            Footprint footprint;
+            auto const start = std::chrono::steady_clock::now();
+            std::shared_ptr<T> value;
+            try
+            {
+                value = m_opener(path, footprint);
+            }
+            catch (...)
+            {
+                // a failed open, but the waiting threads get the exception too
+                lock.lock();
+                m_stats.failures++;
+                m_entries.erase(path);
+                lock.unlock();
+                promise.set_exception(std::current_exception());
+                throw;
+            }
+            auto const open_ms =
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::vector<std::shared_ptr<T>> evicted;
+            lock.lock();
+            if (value)
+            {
+                auto& entry = m_entries[path];
+                entry.value = value;
+                entry.pending = {};
+                entry.footprint = footprint;
+                m_lru.push_front(path);
+                entry.lru = m_lru.begin();
+                m_stats.misses++;
+                m_stats.open_ms_total += open_ms;
+                m_stats.open_ms_max = std::max(m_stats.open_ms_max, open_ms);
+                m_stats.handles += footprint.handles;
+                m_stats.bytes += footprint.bytes;
+                evicted = _evict();
+            }
+            else
+            {
+                m_stats.failures++;
+                m_entries.erase(path);
+            }
+            lock.unlock();
+            promise.set_value(value);
+            // evicted slides are closed here, outside of the lock, unless the last holder is elsewhere
+            evicted.clear();
+            return value;
+        }
+
+        // the slide if it is open, without opening it nor touching the LRU order
+        std::shared_ptr<T> peek(std::string const& path) const
+        {
+            std::lock_guard lock(m_mutex);
+            auto const it = m_entries.find(path);
+            return it == m_entries.end() ? nullptr : it->second.value;
+        }
+
+        // drops the slide, holders keep it open until they release it
+        void erase(std::string const& path)
+        {
+            std::shared_ptr<T> value;
+            std::lock_guard lock(m_mutex);
+            auto const it = m_entries.find(path);
+            if (it == m_entries.end() || !it->second.value) return;
+            value = _drop(it);
+        }
+
+        // drops all open slides, opens in progress complete
+        void clear()
+        {
+            std::vector<std::shared_ptr<T>> values;
+            std::lock_guard lock(m_mutex);
+            for (auto it = m_entries.begin(); it != m_entries.end();)
+            {
+                auto const next = std::next(it);
+                if (it->second.value) values.push_back(_drop(it));
+                it = next;
+            }
+        }
+
+        Limits limits() const
+        {
+            return m_limits;
+        }
+
+        Stats stats() const
+        {
+            std::lock_guard lock(m_mutex);
+            auto stats = m_stats;
+            stats.open = m_lru.size();
+            return stats;
+        }
+
+        void reset_stats()
+        {
+            std::lock_guard lock(m_mutex);
+            auto const handles = m_stats.handles;
+            auto const bytes = m_stats.bytes;
+            m_stats = {};
+            m_stats.handles = handles;
+            m_stats.bytes = bytes;
+        }
+
+    private:
+        struct Entry
+        {
+            std::shared_ptr<T> value;                      // null while being opened
+            std::shared_future<std::shared_ptr<T>> pending; // valid while being opened
+            Footprint footprint;
+            typename std::list<std::string>::iterator lru;
+        };
+
+        using Entries = std::unordered_map<std::string, Entry>;
+
+        // removes an open slide and returns it, so that it is released out of the lock
+        std::shared_ptr<T> _drop(typename Entries::iterator it)
+        {
+            auto value = std::move(it->second.value);
+            m_stats.handles -= it->second.footprint.handles;
+            m_stats.bytes -= it->second.footprint.bytes;
+            m_lru.erase(it->second.lru);
+            m_entries.erase(it);
+            return value;
+        }
+
+        // least recently used slides held by nobody else, until within the limits
+        std::vector<std::shared_ptr<T>> _evict()
+        {
+            std::vector<std::shared_ptr<T>> evicted;
+            for (auto lru = m_lru.end(); lru != m_lru.begin() && _over_limits();)
+            {
+                --lru;
+                auto const it = m_entries.find(*lru);
+                if (it->second.value.use_count() > 1) continue;
+                lru = std::next(lru); // `_drop` erases the current node
+                evicted.push_back(_drop(it));
+                m_stats.evictions++;
+            }
+            return evicted;
+        }
+
+        bool _over_limits() const
+        {
+            return m_stats.handles > m_limits.max_handles || m_stats.bytes > m_limits.max_bytes;
+        }
+
+    private:
+        Opener m_opener;
+        Limits m_limits;
+        mutable std::mutex m_mutex;
+        Entries m_entries;
+        std::list<std::string> m_lru; // open slides, most recently used first
+        Stats m_stats;
+    };
+} // namespace dz_common
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <type_traits>
+
+namespace dz_common
+{
+    // fixed size pool of worker threads
+    class ThreadPool
+    {
+    public:
+        // 0 means `std::thread::hardware_concurrency()`
+        explicit ThreadPool(size_t threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(ThreadPool const&) = delete;
+        ThreadPool& operator=(ThreadPool const&) = delete;
+
+        size_t size() const;
+        // process wide pool, created on first use
+        static ThreadPool& shared();
+
+        template <typename F>
+        auto submit(F&& f) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+        {
+            using R = std::invoke_result_t<std::decay_t<F>>;
+            auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+            auto future = task->get_future();
+            _push([task]() { (*task)(); });
+            return future;
+        }
+
+        // calls `f(i)` for i in [0, n) on the pool and returns once all calls are done
+        // the calling thread takes part in the work, so it is safe to call from inside a pool task
+        // a call that throws does not stop the others, the first exception is rethrown once they are all done
+        template <typename F>
+        void parallel_for(size_t n, F&& f)
+        {
+            if (n == 0) return;
+            if (n == 1 || size() <= 1)
+            {
+                for (size_t i = 0; i < n; i++)
+                    f(i);
+                return;
+            }
+
+            struct State
+            {
+                std::atomic<size_t> next{0};
+                std::atomic<size_t> done{0};
+                std::mutex mutex;
+                std::condition_variable cv;
+                std::exception_ptr error; // the first one, under `mutex`
+            };
+            auto state = std::make_shared<State>();
+            auto work = [state, n, &f]() {
+                for (size_t i; (i = state->next.fetch_add(1)) < n;)
+                {
+                    try
+                    {
+                        f(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard lock(state->mutex);
+                        if (!state->error) state->error = std::current_exception();
+                    }
+                    if (state->done.fetch_add(1) + 1 == n)
+                    {
+                        std::lock_guard lock(state->mutex);
+                        state->cv.notify_all();
+                    }
+                }
+            };
+            // helpers that start after all items are taken return immediately and never touch `f`
+            auto const helpers = std::min(n, size()) - 1;
+            for (size_t i = 0; i < helpers; i++)
+                _push(work);
+            work();
+
+            std::unique_lock lock(state->mutex);
+            state->cv.wait(lock, [&]() { return state->done.load() == n; });
+            if (state->error) std::rethrow_exception(state->error);
+        }
+
+    private:
+        void _push(std::function<void()> task);
+        void _run();
+
+    private:
+        std::vector<std::thread> m_workers;
+        std::deque<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_stop = false;
+    };
+} // namespace dz_common
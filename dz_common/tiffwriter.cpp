@@ -0,0 +1,305 @@
+#include "tiffwriter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+using namespace dz_common;
+
+namespace
+{
+    constexpr uint16_t tag_new_subfile_type = 254;
+    constexpr uint16_t tag_image_width = 256;
+    constexpr uint16_t tag_image_length = 257;
+    constexpr uint16_t tag_bits_per_sample = 258;
+    constexpr uint16_t tag_compression = 259;
+    constexpr uint16_t tag_photometric = 262;
+    constexpr uint16_t tag_samples_per_pixel = 277;
+    constexpr uint16_t tag_x_resolution = 282;
+    constexpr uint16_t tag_y_resolution = 283;
+    constexpr uint16_t tag_planar_configuration = 284;
+    constexpr uint16_t tag_resolution_unit = 296;
+    constexpr uint16_t tag_tile_width = 322;
+    constexpr uint16_t tag_tile_length = 323;
+    constexpr uint16_t tag_tile_offsets = 324;
+    constexpr uint16_t tag_tile_byte_counts = 325;
+    constexpr uint16_t tag_ycbcr_subsampling = 530;
+    constexpr uint16_t tag_icc_profile = 34675;
+
+    constexpr uint16_t type_short = 3;
+    constexpr uint16_t type_long = 4;
+    constexpr uint16_t type_rational = 5;
+    constexpr uint16_t type_undefined = 7;
+    constexpr uint16_t type_long8 = 16;
+
+    constexpr uint16_t compression_jpeg = 7;
+    constexpr uint16_t photometric_ycbcr = 6;
+    constexpr uint16_t resolution_unit_centimeter = 3;
+
+    template <typename T> void write_value(std::ofstream& out, T value)
+    {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    // an entry whose values fit in its 8 bytes, stored there
+    template <typename T> TiffWriter::Entry inline_entry(uint16_t tag, uint16_t type, std::span<T const> values)
+    {
+        TiffWriter::Entry entry{tag, type, values.size(), 0};
+        std::memcpy(&entry.value, values.data(), std::min(values.size_bytes(), sizeof(entry.value)));
+        return entry;
+    }
+
+    template <typename T> TiffWriter::Entry inline_entry(uint16_t tag, uint16_t type, T value)
+    {
+        return inline_entry(tag, type, std::span<T const>(&value, 1));
+    }
+
+    // <horizontal, vertical> sampling factors of the first component, from the SOF segment of a JPEG stream
+    // 4:2:0 is <2, 2>, 4:4:4 <1, 1>; <0, 0> if the stream cannot be parsed
+    std::pair<uint16_t, uint16_t> jpeg_subsampling(std::span<uint8_t const> jpeg)
+    {
+        size_t i = 2;
+        if (jpeg.size() < 4 || jpeg[0] != 0xff || jpeg[1] != 0xd8) return {0, 0};
+        while (i + 4 <= jpeg.size())
+        {
+            if (jpeg[i] != 0xff) return {0, 0};
+            auto const marker = jpeg[i + 1];
+            if (marker == 0xff)
+            {
+                i++;
+                continue;
+            }
+            auto const length = static_cast<size_t>(jpeg[i + 2] << 8 | jpeg[i + 3]);
+            // SOF0-SOF15 but DHT, JPG and DAC
+            if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+            {
+                // marker, length, precision, height, width, components, then <id, sampling, table> per component
+                if (i + 12 > jpeg.size() || length < 11) return {0, 0};
+                auto const sampling = jpeg[i + 11];
+                return {static_cast<uint16_t>(sampling >> 4), static_cast<uint16_t>(sampling & 0x0f)};
+            }
+            if (marker == 0xda) return {0, 0}; // scan data before any SOF
+            i += 2 + length;
+        }
+        return {0, 0};
+    }
+} // namespace
+
+TiffWriter::TiffWriter(std::string path, std::vector<std::pair<int64_t, int64_t>> const& page_dimensions,
+                       int64_t tile_size)
+    : m_path(std::move(path)), m_temporary(m_path + ".tmp"), m_tile_size(tile_size)
+{
+    auto valid = !page_dimensions.empty() && tile_size >= 16 && tile_size % 16 == 0 && tile_size <= 65535;
+    for (auto const& [width, height] : page_dimensions)
+        valid = valid && width > 0 && height > 0 && width <= UINT32_MAX && height <= UINT32_MAX;
+    if (!valid)
+    {
+        printf("Invalid TIFF pyramid parameters: %s\n", m_path.c_str());
+        return;
+    }
+    for (auto const& [width, height] : page_dimensions)
+    {
+        auto& page = m_pages.emplace_back();
+        page.width = width;
+        page.height = height;
+        auto const cols = (width + tile_size - 1) / tile_size;
+        auto const rows = (height + tile_size - 1) / tile_size;
+        page.offsets.assign(cols * rows, 0);
+        page.sizes.assign(cols * rows, 0);
+        m_page_tiles.emplace_back(cols, rows);
+    }
+
+    m_out.open(m_temporary, std::ios::binary | std::ios::trunc);
+    if (!m_out)
+    {
+        printf("Failed to write TIFF: %s\n", m_path.c_str());
+        return;
+    }
+    // little endian BigTIFF, the offset of the first page directory is written by `finish`
+    m_out.write("II", 2);
+    write_value(m_out, uint16_t{43});
+    write_value(m_out, uint16_t{8});
+    write_value(m_out, uint16_t{0});
+    write_value(m_out, uint64_t{0});
+    m_end = 16;
+    if (!m_out)
+    {
+        printf("Failed to write TIFF: %s\n", m_path.c_str());
+        m_out.close();
+    }
+}
+
+TiffWriter::~TiffWriter()
+{
+    if (m_finished) return;
+    if (m_out.is_open()) m_out.close();
+    std::error_code ec;
+    std::filesystem::remove(m_temporary, ec);
+}
+
+bool TiffWriter::is_open() const
+{
+    return m_out.is_open() && !m_finished;
+}
+
+void TiffWriter::set_icc_profile(std::vector<uint8_t> icc_profile)
+{
+    // the header of a profile alone is 128 bytes
+    if (icc_profile.size() > 128) m_icc_profile = std::move(icc_profile);
+}
+
+void TiffWriter::set_mpp(double mpp)
+{
+    m_mpp = mpp;
+}
+
+int TiffWriter::page_count() const
+{
+    return static_cast<int>(m_pages.size());
+}
+
+std::vector<std::pair<int64_t, int64_t>> const& TiffWriter::page_tiles() const
+{
+    return m_page_tiles;
+}
+
+bool TiffWriter::add(int page, int64_t col, int64_t row, std::span<uint8_t const> jpeg)
+{
+    if (!is_open() || page < 0 || page >= static_cast<int>(m_pages.size()) || jpeg.empty()) return false;
+    auto const [cols, rows] = m_page_tiles[page];
+    if (col < 0 || col >= cols || row < 0 || row >= rows) return false;
+
+    m_out.write(reinterpret_cast<char const*>(jpeg.data()), static_cast<std::streamsize>(jpeg.size()));
+    if (!m_out)
+    {
+        printf("Failed to write TIFF: %s\n", m_path.c_str());
+        return false;
+    }
+    auto& target = m_pages[page];
+    if (target.subsampling.first == 0) target.subsampling = jpeg_subsampling(jpeg);
+    target.offsets[row * cols + col] = m_end;
+    target.sizes[row * cols + col] = jpeg.size();
+    m_end += jpeg.size();
+    return true;
+}
+
+bool TiffWriter::finish()
+{
+    if (!is_open()) return false;
+
+    // the tile tables and the ICC profile after the tiles, then the directories, 8 byte aligned
+    auto const align = [this]() {
+        for (; m_end % 8 != 0; m_end++)
+            write_value(m_out, uint8_t{0});
+    };
+    align();
+    uint64_t icc_profile = 0;
+    if (!m_icc_profile.empty())
+    {
+        icc_profile = m_end;
+        m_out.write(reinterpret_cast<char const*>(m_icc_profile.data()),
+                    static_cast<std::streamsize>(m_icc_profile.size()));
+        m_end += m_icc_profile.size();
+        align();
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> tables; // <offsets, sizes> of every page
+    for (auto const& page : m_pages)
+    {
+        auto const bytes = page.offsets.size() * sizeof(uint64_t);
+        auto& [offsets, sizes] = tables.emplace_back(0, 0);
+        if (page.offsets.size() == 1) continue;
+        offsets = m_end;
+        m_out.write(reinterpret_cast<char const*>(page.offsets.data()), static_cast<std::streamsize>(bytes));
+        sizes = m_end + bytes;
+        m_out.write(reinterpret_cast<char const*>(page.sizes.data()), static_cast<std::streamsize>(bytes));
+        m_end += 2 * bytes;
+    }
+
+    auto const first = m_end;
+    for (size_t i = 0; i < m_pages.size(); i++)
+    {
+        // a directory is its entry count, the entries and the offset of the next one
+        auto const entries = _entries(m_pages[i], tables[i].first, tables[i].second, i == 0 ? icc_profile : 0);
+        auto const size = sizeof(uint64_t) + entries.size() * 20 + sizeof(uint64_t);
+        write_value(m_out, static_cast<uint64_t>(entries.size()));
+        for (auto const& entry : entries)
+        {
+            write_value(m_out, entry.tag);
+            write_value(m_out, entry.type);
+            write_value(m_out, entry.count);
+            write_value(m_out, entry.value);
+        }
+        write_value(m_out, static_cast<uint64_t>(i + 1 < m_pages.size() ? m_end + size : 0));
+        m_end += size;
+    }
+    m_out.seekp(8);
+    write_value(m_out, first);
+    m_out.close();
+    if (m_out.fail())
+    {
+        printf("Failed to write TIFF: %s\n", m_path.c_str());
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(m_temporary, m_path, ec);
+    if (ec)
+    {
+        printf("Failed to write TIFF %s: %s\n", m_path.c_str(), ec.message().c_str());
+        return false;
+    }
+    m_finished = true;
+    return true;
+}
+
+std::vector<TiffWriter::Entry> TiffWriter::_entries(Page const& page, uint64_t offsets, uint64_t sizes,
+                                                    uint64_t icc_profile) const
+{
+    uint16_t const bits[3] = {8, 8, 8};
+    // tiles that could not be parsed are assumed 4:2:0, the encoders' default
+    auto const subsampling = page.subsampling.first != 0 ? page.subsampling : std::pair<uint16_t, uint16_t>{2, 2};
+    uint16_t const ycbcr_subsampling[2] = {subsampling.first, subsampling.second};
+    // pixels per centimeter, as a rational of 1/1000; reduced pages have larger pixels, by their downsample
+    auto const& base = m_pages.front();
+    auto const pixels_per_cm = [&](int64_t size, int64_t base_size) {
+        return m_mpp > 0. ? static_cast<uint32_t>(std::lround(1e7 / m_mpp * size / base_size)) : 0u;
+    };
+    uint32_t const x_resolution[2] = {pixels_per_cm(page.width, base.width), 1000u};
+    uint32_t const y_resolution[2] = {pixels_per_cm(page.height, base.height), 1000u};
+    auto const reduced = &page != &m_pages.front();
+
+    // ascending tags, as TIFF wants them
+    std::vector<Entry> entries;
+    entries.push_back(inline_entry(tag_new_subfile_type, type_long, static_cast<uint32_t>(reduced ? 1 : 0)));
+    entries.push_back(inline_entry(tag_image_width, type_long, static_cast<uint32_t>(page.width)));
+    entries.push_back(inline_entry(tag_image_length, type_long, static_cast<uint32_t>(page.height)));
+    entries.push_back(inline_entry(tag_bits_per_sample, type_short, std::span<uint16_t const>(bits)));
+    entries.push_back(inline_entry(tag_compression, type_short, compression_jpeg));
+    entries.push_back(inline_entry(tag_photometric, type_short, photometric_ycbcr));
+    entries.push_back(inline_entry(tag_samples_per_pixel, type_short, uint16_t{3}));
+    if (m_mpp > 0.)
+    {
+        entries.push_back(inline_entry(tag_x_resolution, type_rational, std::span<uint32_t const>(x_resolution)));
+        entries.push_back(inline_entry(tag_y_resolution, type_rational, std::span<uint32_t const>(y_resolution)));
+    }
+    entries.push_back(inline_entry(tag_planar_configuration, type_short, uint16_t{1}));
+    if (m_mpp > 0.) entries.push_back(inline_entry(tag_resolution_unit, type_short, resolution_unit_centimeter));
+    entries.push_back(inline_entry(tag_tile_width, type_long, static_cast<uint32_t>(m_tile_size)));
+    entries.push_back(inline_entry(tag_tile_length, type_long, static_cast<uint32_t>(m_tile_size)));
+    // a single tile is stored in the entries themselves
+    if (page.offsets.size() == 1)
+    {
+        entries.push_back(inline_entry(tag_tile_offsets, type_long8, page.offsets[0]));
+        entries.push_back(inline_entry(tag_tile_byte_counts, type_long8, page.sizes[0]));
+    }
+    else
+    {
+        entries.push_back(Entry{tag_tile_offsets, type_long8, page.offsets.size(), offsets});
+        entries.push_back(Entry{tag_tile_byte_counts, type_long8, page.sizes.size(), sizes});
+    }
+    entries.push_back(inline_entry(tag_ycbcr_subsampling, type_short, std::span<uint16_t const>(ycbcr_subsampling)));
+    if (icc_profile) entries.push_back(Entry{tag_icc_profile, type_undefined, m_icc_profile.size(), icc_profile});
+    return entries;
+}
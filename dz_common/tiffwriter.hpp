@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dz_common
+{
+    // a pyramidal BigTIFF of JPEG tiles, what `vips tiffsave --tile --pyramid --compression jpeg --bigtiff` writes and
+    // what openslide (generic tiled TIFF), QuPath or vips read: one page per level, largest first, each a grid of
+    // `tile_size` square tiles (edge tiles padded to the full size), each tile a complete JPEG stream
+    //
+    // tiles are appended as they come, in any order, by one thread; the page directories and their tile tables are
+    // written by `finish`, which then renames the temporary file over `path`
+    class TiffWriter
+    {
+    public:
+        // `page_dimensions` <width, height> of every page, largest first; `tile_size` a multiple of 16
+        TiffWriter(std::string path, std::vector<std::pair<int64_t, int64_t>> const& page_dimensions,
+                   int64_t tile_size);
+        // removes the temporary file if `finish` was not called
+        ~TiffWriter();
+
+        TiffWriter(TiffWriter const&) = delete;
+        TiffWriter& operator=(TiffWriter const&) = delete;
+
+        bool is_open() const;
+
+        // an entry of a page directory, `value` holds the values themselves if they fit, their offset otherwise
+        struct Entry
+        {
+            uint16_t tag = 0;
+            uint16_t type = 0;
+            uint64_t count = 0;
+            uint64_t value = 0;
+        };
+
+        // embedded in the first page (profiles of 128 bytes or less are not valid and ignored), call before `finish`
+        void set_icc_profile(std::vector<uint8_t> icc_profile);
+        // resolution of the first page (written in pixels per centimeter), of the others scaled by their downsample
+        // unknown if 0
+        void set_mpp(double mpp);
+
+        // `jpeg` a complete JPEG stream of `tile_size` x `tile_size` pixels, the chroma subsampling of every page is
+        // taken from its first tile; false if the tile is out of the grid or could not be written
+        bool add(int page, int64_t col, int64_t row, std::span<uint8_t const> jpeg);
+        // writes the page directories and moves the file to `path`
+        bool finish();
+
+        int page_count() const;
+        // <cols, rows> of every page
+        std::vector<std::pair<int64_t, int64_t>> const& page_tiles() const;
+
+    private:
+        struct Page
+        {
+            int64_t width = 0;
+            int64_t height = 0;
+            std::pair<uint16_t, uint16_t> subsampling{0, 0}; // 0 until the first tile
+            std::vector<uint64_t> offsets;
+            std::vector<uint64_t> sizes;
+        };
+
+        // `offsets`, `sizes` and `icc_profile` where these were written, 0 for none
+        std::vector<Entry> _entries(Page const& page, uint64_t offsets, uint64_t sizes, uint64_t icc_profile) const;
+
+    private:
+        std::string m_path;
+        std::string m_temporary;
+        std::ofstream m_out;
+        int64_t m_tile_size = 0;
+        std::vector<Page> m_pages;
+        std::vector<std::pair<int64_t, int64_t>> m_page_tiles;
+        std::vector<uint8_t> m_icc_profile;
+        double m_mpp = 0.;
+        uint64_t m_end = 0;
+        bool m_finished = false;
+    };
+} // namespace dz_common
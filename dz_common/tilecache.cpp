@@ -0,0 +1,186 @@
+#include "tilecache.hpp"
+#include "disktilecache.hpp"
+
+#include <algorithm>
+#include <functional>
+
+using namespace dz_common;
+
+namespace
+{
+    inline void hash_combine(size_t& seed, size_t v)
+    {
+        seed ^= v + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+    }
+} // namespace
+
+size_t TileKeyHash::operator()(TileKey const& key) const
+{
+    size_t seed = std::hash<std::string>{}(key.slide);
+    hash_combine(seed, std::hash<int>{}(key.format));
+    hash_combine(seed, std::hash<float>{}(key.quality));
+    hash_combine(seed, std::hash<int64_t>{}(key.tile_size));
+    hash_combine(seed, std::hash<int>{}(key.overlap));
+    hash_combine(seed, std::hash<int>{}(key.dz_level));
+    hash_combine(seed, std::hash<int64_t>{}(key.col));
+    hash_combine(seed, std::hash<int64_t>{}(key.row));
+    hash_combine(seed, std::hash<bool>{}(key.icc));
+    return seed;
+}
+
+TileCache::TileCache(size_t capacity_bytes, size_t shards)
+    : m_capacity(capacity_bytes), m_shard_count(std::max(size_t{1}, shards))
+{
+    m_shards = std::make_unique<Shard[]>(m_shard_count);
+    m_shard_capacity = m_capacity / m_shard_count;
+}
+
+TileCache::~TileCache() = default;
+
+std::optional<std::vector<uint8_t>> TileCache::get(TileKey const& key)
+{
+    Value value;
+    {
+        auto& shard = _shard(key);
+        std::lock_guard lock(shard.mutex);
+        if (auto it = shard.map.find(key); it != shard.map.end())
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            value = it->second->second;
+        }
+    }
+    if (!value)
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        if (!m_disk_cache || key.format == TileKey::pixels_format) return std::nullopt;
+        auto tile = m_disk_cache->get(key);
+        if (tile) _insert(key, *tile);
+        return tile;
+    }
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    // copy outside of the lock, the entry may be evicted meanwhile but `value` keeps it alive
+    return *value;
+}
+
+void TileCache::put(TileKey const& key, std::vector<uint8_t> tile)
+{
+    if (m_disk_cache && key.format != TileKey::pixels_format) m_disk_cache->put(key, tile);
+    _insert(key, std::move(tile));
+}
+
+void TileCache::_insert(TileKey const& key, std::vector<uint8_t> tile)
+{
+    auto const size = tile.size();
+    if (size > m_shard_capacity) return;
+
+    auto value = std::make_shared<std::vector<uint8_t> const>(std::move(tile));
+    auto& shard = _shard(key);
+    std::lock_guard lock(shard.mutex);
+    if (auto it = shard.map.find(key); it != shard.map.end())
+    {
+        shard.bytes -= it->second->second->size();
+        it->second->second = std::move(value);
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    }
+    else
+    {
+        shard.lru.emplace_front(key, std::move(value));
+        shard.map.emplace(key, shard.lru.begin());
+    }
+    shard.bytes += size;
+    m_insertions.fetch_add(1, std::memory_order_relaxed);
+    _evict(shard, m_shard_capacity);
+}
+
+bool TileCache::contains(TileKey const& key) const
+{
+    {
+        auto& shard = _shard(key);
+        std::lock_guard lock(shard.mutex);
+        if (shard.map.contains(key)) return true;
+    }
+    return m_disk_cache && key.format != TileKey::pixels_format && m_disk_cache->contains(key);
+}
+
+void TileCache::erase(TileKey const& key)
+{
+    auto& shard = _shard(key);
+    std::lock_guard lock(shard.mutex);
+    if (auto it = shard.map.find(key); it != shard.map.end())
+    {
+        shard.bytes -= it->second->second->size();
+        shard.lru.erase(it->second);
+        shard.map.erase(it);
+    }
+}
+
+void TileCache::clear()
+{
+    for (size_t i = 0; i < m_shard_count; i++)
+    {
+        auto& shard = m_shards[i];
+        std::lock_guard lock(shard.mutex);
+        shard.map.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
+
+void TileCache::set_disk_cache(std::shared_ptr<DiskTileCache> disk_cache)
+{
+    m_disk_cache = std::move(disk_cache);
+}
+
+std::shared_ptr<DiskTileCache> TileCache::disk_cache() const
+{
+    return m_disk_cache;
+}
+
+size_t TileCache::capacity() const
+{
+    return m_capacity;
+}
+
+TileCache::Stats TileCache::stats() const
+{
+    Stats s;
+    s.hits = m_hits.load(std::memory_order_relaxed);
+    s.misses = m_misses.load(std::memory_order_relaxed);
+    s.insertions = m_insertions.load(std::memory_order_relaxed);
+    s.evictions = m_evictions.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < m_shard_count; i++)
+    {
+        auto& shard = m_shards[i];
+        std::lock_guard lock(shard.mutex);
+        s.entries += shard.map.size();
+        s.bytes += shard.bytes;
+    }
+    return s;
+}
+
+void TileCache::reset_stats()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_insertions = 0;
+    m_evictions = 0;
+}
+
+TileCache::Shard& TileCache::_shard(TileKey const& key) const
+{
+    // use the high bits, the low bits are already used by the shard's own hash map
+    auto h = TileKeyHash{}(key);
+    return m_shards[(h >> 32 ^ h) % m_shard_count];
+}
+
+void TileCache::_evict(Shard& shard, size_t capacity)
+{
+    while (shard.bytes > capacity && !shard.lru.empty())
+    {
+        auto& [key, value] = shard.lru.back();
+        shard.bytes -= value->size();
+        shard.map.erase(key);
+        shard.lru.pop_back();
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <unordered_map>
+
+namespace dz_common
+{
+    class DiskTileCache;
+
+    // identity of an encoded tile
+    // two generators opened on the same slide with the same parameters produce the same key,
+    // so they can share one `TileCache`
+    struct TileKey
+    {
+        // `format` of raw ARGB pixel tiles, cached by generators that build tiles out of other tiles
+        static constexpr int pixels_format = -1;
+
+        std::string slide;     // slide path
+        int format = 0;        // generator's `ImageFormat`
+        float quality = 0.f;   // encoding quality [0, 1]
+        int64_t tile_size = 0; // tile size without overlap
+        int overlap = 0;       // tile overlap
+        int dz_level = 0;
+        int64_t col = 0;
+        int64_t row = 0;
+        bool icc = false; // ICC profile asked for, embedded if the slide has one
+
+        bool operator==(TileKey const&) const = default;
+    };
+
+    struct TileKeyHash
+    {
+        size_t operator()(TileKey const& key) const;
+    };
+
+    // byte-bounded, sharded LRU cache of encoded tiles, safe to share between threads and generators
+    // each shard owns `capacity_bytes / shards` bytes and its own lock, so lookups of different tiles rarely contend
+    class TileCache
+    {
+    public:
+        struct Stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t insertions = 0;
+            uint64_t evictions = 0;
+            size_t entries = 0;
+            size_t bytes = 0; // payload bytes currently held
+        };
+
+        explicit TileCache(size_t capacity_bytes = size_t{256} << 20, size_t shards = 16);
+        ~TileCache();
+
+        TileCache(TileCache const&) = delete;
+        TileCache& operator=(TileCache const&) = delete;
+
+        // returns a copy of the cached tile and marks it as most recently used
+        // a miss falls through to the disk tier, whose tile is brought back in memory
+        std::optional<std::vector<uint8_t>> get(TileKey const& key);
+        // inserts or replaces the tile, evicting least recently used tiles of the same shard if needed
+        // tiles larger than a whole shard are not cached in memory; encoded tiles are written through to the disk tier
+        void put(TileKey const& key, std::vector<uint8_t> tile);
+        // lookup without touching the LRU order or the counters, the disk tier included
+        bool contains(TileKey const& key) const;
+        // memory only
+        void erase(TileKey const& key);
+        void clear();
+
+        // persistent tier below the memory one, for encoded tiles (raw pixel tiles stay in memory), nullptr for none
+        // not thread-safe itself, call it before handing the cache to other threads
+        void set_disk_cache(std::shared_ptr<DiskTileCache> disk_cache);
+        std::shared_ptr<DiskTileCache> disk_cache() const;
+
+        size_t capacity() const;
+        Stats stats() const;
+        void reset_stats();
+
+    private:
+        using Value = std::shared_ptr<std::vector<uint8_t> const>;
+        using LRUList = std::list<std::pair<TileKey, Value>>;
+
+        struct Shard
+        {
+            mutable std::mutex mutex;
+            LRUList lru; // front is the most recently used
+            std::unordered_map<TileKey, LRUList::iterator, TileKeyHash> map;
+            size_t bytes = 0;
+        };
+
+        Shard& _shard(TileKey const& key) const;
+        void _insert(TileKey const& key, std::vector<uint8_t> tile);
+        void _evict(Shard& shard, size_t capacity);
+
+    private:
+        size_t m_capacity = 0;
+        size_t m_shard_capacity = 0;
+        std::unique_ptr<Shard[]> m_shards;
+        size_t m_shard_count = 0;
+        std::shared_ptr<DiskTileCache> m_disk_cache;
+
+        std::atomic<uint64_t> m_hits{0};
+        std::atomic<uint64_t> m_misses{0};
+        std::atomic<uint64_t> m_insertions{0};
+        std::atomic<uint64_t> m_evictions{0};
+    };
+} // namespace dz_common
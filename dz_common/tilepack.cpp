@@ -0,0 +1,327 @@
+#include "tilepack.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace dz_common;
+
+namespace
+{
+    constexpr char magic[8] = {'D', 'Z', 'T', 'L', 'P', 'A', 'C', 'K'};
+    constexpr uint32_t version = 1;
+    constexpr uint32_t max_levels = 64;
+    constexpr uint32_t max_string = 1 << 16;
+    constexpr int64_t max_tiles_per_side = int64_t{1} << 31;
+
+    template <typename T> void write_value(std::ofstream& out, T value)
+    {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    void write_string(std::ofstream& out, std::string const& value)
+    {
+        write_value(out, static_cast<uint32_t>(value.size()));
+        out.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    // reads the header out of the mapped file
+    class Cursor
+    {
+    public:
+        Cursor(uint8_t const* data, uint64_t size) : m_data(data), m_size(size)
+        {
+        }
+
+        template <typename T> bool read(T& value)
+        {
+            if (m_size - m_position < sizeof(T)) return false;
+            std::memcpy(&value, m_data + m_position, sizeof(T));
+            m_position += sizeof(T);
+            return true;
+        }
+
+        bool read(std::string& value)
+        {
+            uint32_t size = 0;
+            if (!read(size) || size > max_string || m_size - m_position < size) return false;
+            value.assign(reinterpret_cast<char const*>(m_data + m_position), size);
+            m_position += size;
+            return true;
+        }
+
+        uint64_t position() const { return m_position; }
+
+    private:
+        uint8_t const* m_data;
+        uint64_t m_size;
+        uint64_t m_position = 0;
+    };
+
+    // index of the first tile of every level, the total at the end
+    std::vector<uint64_t> level_first(std::vector<std::pair<int64_t, int64_t>> const& level_tiles)
+    {
+        std::vector<uint64_t> first{0};
+        for (auto const& [cols, rows] : level_tiles)
+            first.push_back(first.back() + static_cast<uint64_t>(cols) * static_cast<uint64_t>(rows));
+        return first;
+    }
+} // namespace
+
+TilePackWriter::TilePackWriter(std::string path, std::string const& dzi, std::string const& extension,
+                               std::vector<std::pair<int64_t, int64_t>> const& level_tiles)
+    : m_path(std::move(path)), m_temporary(m_path + ".tmp"), m_level_tiles(level_tiles)
+{
+    auto valid = !m_level_tiles.empty() && m_level_tiles.size() <= max_levels && dzi.size() <= max_string &&
+                 extension.size() <= max_string;
+    for (auto const& [cols, rows] : m_level_tiles)
+        valid = valid && cols > 0 && rows > 0 && cols < max_tiles_per_side && rows < max_tiles_per_side;
+    if (!valid)
+    {
+        printf("Invalid tile pack parameters: %s\n", m_path.c_str());
+        return;
+    }
+    m_level_first = level_first(m_level_tiles);
+    auto const tile_count = m_level_first.back();
+    m_index.assign(tile_count * 2, 0);
+
+    m_out.open(m_temporary, std::ios::binary | std::ios::trunc);
+    if (!m_out)
+    {
+        printf("Failed to write tile pack: %s\n", m_path.c_str());
+        return;
+    }
+    // the index is 8 byte aligned, so that the reader can use it in place
+    auto const header_size = sizeof(magic) + 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t) +
+                             extension.size() + dzi.size() + 2 * sizeof(int64_t) * m_level_tiles.size();
+    m_index_offset = (header_size + 7) / 8 * 8;
+    m_out.write(magic, sizeof(magic));
+    write_value(m_out, version);
+    write_value(m_out, static_cast<uint32_t>(m_level_tiles.size()));
+    write_value(m_out, tile_count);
+    write_value(m_out, m_index_offset);
+    write_string(m_out, extension);
+    write_string(m_out, dzi);
+    for (auto const& [cols, rows] : m_level_tiles)
+    {
+        write_value(m_out, cols);
+        write_value(m_out, rows);
+    }
+    for (auto i = header_size; i < m_index_offset; i++)
+        write_value(m_out, uint8_t{0});
+    // the index is written over the zeros by `finish`
+    std::vector<char> const zeros(size_t{1} << 16, 0);
+    for (uint64_t left = tile_count * 2 * sizeof(uint64_t); left > 0 && m_out;)
+    {
+        auto const chunk = std::min<uint64_t>(left, zeros.size());
+        m_out.write(zeros.data(), static_cast<std::streamsize>(chunk));
+        left -= chunk;
+    }
+    m_end = m_index_offset + tile_count * 2 * sizeof(uint64_t);
+    if (!m_out)
+    {
+        printf("Failed to write tile pack: %s\n", m_path.c_str());
+        m_out.close();
+    }
+}
+
+TilePackWriter::~TilePackWriter()
+{
+    if (m_finished) return;
+    if (m_out.is_open()) m_out.close();
+    std::error_code ec;
+    std::filesystem::remove(m_temporary, ec);
+}
+
+bool TilePackWriter::is_open() const
+{
+    return m_out.is_open() && !m_finished;
+}
+
+bool TilePackWriter::add(int dz_level, int64_t col, int64_t row, std::span<uint8_t const> tile)
+{
+    if (!is_open() || dz_level < 0 || dz_level >= static_cast<int>(m_level_tiles.size())) return false;
+    auto const [cols, rows] = m_level_tiles[dz_level];
+    if (col < 0 || col >= cols || row < 0 || row >= rows) return false;
+
+    m_out.write(reinterpret_cast<char const*>(tile.data()), static_cast<std::streamsize>(tile.size()));
+    if (!m_out)
+    {
+        printf("Failed to write tile pack: %s\n", m_path.c_str());
+        return false;
+    }
+    auto const i = m_level_first[dz_level] + static_cast<uint64_t>(row) * cols + col;
+    m_index[i * 2] = m_end;
+    m_index[i * 2 + 1] = tile.size();
+    m_end += tile.size();
+    return true;
+}
+
+bool TilePackWriter::finish()
+{
+    if (!is_open()) return false;
+    m_out.seekp(static_cast<std::streamoff>(m_index_offset));
+    m_out.write(reinterpret_cast<char const*>(m_index.data()),
+                static_cast<std::streamsize>(m_index.size() * sizeof(uint64_t)));
+    m_out.close();
+    if (m_out.fail())
+    {
+        printf("Failed to write tile pack: %s\n", m_path.c_str());
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(m_temporary, m_path, ec);
+    if (ec)
+    {
+        printf("Failed to write tile pack %s: %s\n", m_path.c_str(), ec.message().c_str());
+        return false;
+    }
+    m_finished = true;
+    return true;
+}
+
+TilePack::TilePack(std::string const& path)
+{
+#ifndef _WIN32
+    auto const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        printf("Failed to open tile pack: %s\n", path.c_str());
+        return;
+    }
+    struct stat st = {};
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        auto* map = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            m_data = static_cast<uint8_t const*>(map);
+            m_size = static_cast<uint64_t>(st.st_size);
+            // viewers jump around, readahead would mostly load tiles nobody asked for
+            ::madvise(map, m_size, MADV_RANDOM);
+        }
+    }
+    ::close(fd);
+#else
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (in)
+    {
+        m_buffer.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        if (in.read(reinterpret_cast<char*>(m_buffer.data()), static_cast<std::streamsize>(m_buffer.size())))
+        {
+            m_data = m_buffer.data();
+            m_size = m_buffer.size();
+        }
+    }
+#endif
+    if (!m_data)
+    {
+        printf("Failed to open tile pack: %s\n", path.c_str());
+        return;
+    }
+    if (!_parse())
+    {
+        printf("Invalid tile pack: %s\n", path.c_str());
+        _close();
+    }
+}
+
+TilePack::~TilePack()
+{
+    _close();
+}
+
+void TilePack::_close()
+{
+#ifndef _WIN32
+    if (m_data) ::munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_buffer.clear();
+    m_index = nullptr;
+}
+
+bool TilePack::_parse()
+{
+    Cursor cursor(m_data, m_size);
+    char file_magic[sizeof(magic)] = {};
+    uint32_t file_version = 0, levels = 0;
+    uint64_t index_offset = 0;
+    if (!cursor.read(file_magic) || std::memcmp(file_magic, magic, sizeof(magic)) != 0 ||
+        !cursor.read(file_version) || file_version != version || !cursor.read(levels) || levels == 0 ||
+        levels > max_levels || !cursor.read(m_tile_count) || !cursor.read(index_offset) ||
+        !cursor.read(m_extension) || !cursor.read(m_dzi))
+        return false;
+    m_level_tiles.resize(levels);
+    for (auto& [cols, rows] : m_level_tiles)
+    {
+        if (!cursor.read(cols) || !cursor.read(rows) || cols <= 0 || rows <= 0 || cols >= max_tiles_per_side ||
+            rows >= max_tiles_per_side)
+            return false;
+    }
+    m_level_first = level_first(m_level_tiles);
+    if (m_level_first.back() != m_tile_count || index_offset % 8 != 0 || index_offset < cursor.position() ||
+        index_offset > m_size || (m_size - index_offset) / (2 * sizeof(uint64_t)) < m_tile_count)
+        return false;
+    m_index = reinterpret_cast<uint64_t const*>(m_data + index_offset);
+    return true;
+}
+
+bool TilePack::is_open() const
+{
+    return m_index != nullptr;
+}
+
+std::string const& TilePack::dzi() const
+{
+    return m_dzi;
+}
+
+std::string const& TilePack::extension() const
+{
+    return m_extension;
+}
+
+int TilePack::level_count() const
+{
+    return static_cast<int>(m_level_tiles.size());
+}
+
+std::vector<std::pair<int64_t, int64_t>> const& TilePack::level_tiles() const
+{
+    return m_level_tiles;
+}
+
+uint64_t TilePack::tile_count() const
+{
+    return m_tile_count;
+}
+
+uint64_t TilePack::size() const
+{
+    return m_size;
+}
+
+std::span<uint8_t const> TilePack::tile(int dz_level, int64_t col, int64_t row) const
+{
+    if (!m_index || dz_level < 0 || dz_level >= static_cast<int>(m_level_tiles.size())) return {};
+    auto const [cols, rows] = m_level_tiles[dz_level];
+    if (col < 0 || col >= cols || row < 0 || row >= rows) return {};
+    auto const i = m_level_first[dz_level] + static_cast<uint64_t>(row) * cols + col;
+    auto const offset = m_index[i * 2];
+    auto const size = m_index[i * 2 + 1];
+    // entries are only checked when used: validating millions of them at open would read the whole index
+    if (size == 0 || offset > m_size || size > m_size - offset) return {};
+    return {m_data + offset, static_cast<size_t>(size)};
+}
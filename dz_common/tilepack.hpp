@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dz_common
+{
+    // a whole DeepZoom pyramid in a single file, instead of one file per tile: a header with the DZI and the tile grid
+    // of every level, a dense index of <offset, size> per tile (levels lowest resolution first, tiles row by row),
+    // then the encoded tiles back to back. the index position of a tile follows from the grid, so a lookup is a few
+    // multiplications and one index read
+    //
+    // written tile by tile in any order by one thread, to a temporary file renamed over `path` by `finish`, so that
+    // readers never see a partial pack
+    class TilePackWriter
+    {
+    public:
+        // `level_tiles` are <cols, rows> of every deepzoom level, `extension` that of the tile urls without the dot
+        TilePackWriter(std::string path, std::string const& dzi, std::string const& extension,
+                       std::vector<std::pair<int64_t, int64_t>> const& level_tiles);
+        // removes the temporary file if `finish` was not called
+        ~TilePackWriter();
+
+        TilePackWriter(TilePackWriter const&) = delete;
+        TilePackWriter& operator=(TilePackWriter const&) = delete;
+
+        bool is_open() const;
+
+        // false if the tile is out of the grid or could not be written; a tile added again replaces the previous one
+        // (its bytes stay in the file)
+        bool add(int dz_level, int64_t col, int64_t row, std::span<uint8_t const> tile);
+        // writes the index and moves the pack to `path`, tiles never added are empty
+        bool finish();
+
+    private:
+        std::string m_path;
+        std::string m_temporary;
+        std::ofstream m_out;
+        std::vector<std::pair<int64_t, int64_t>> m_level_tiles;
+        std::vector<uint64_t> m_level_first; // index of the first tile of every level
+        std::vector<uint64_t> m_index;       // <offset, size> pairs
+        uint64_t m_index_offset = 0;
+        uint64_t m_end = 0;
+        bool m_finished = false;
+    };
+
+    // a pack written by `TilePackWriter`, mmap'ed read-only (read into memory on Windows): tiles are spans of the
+    // mapping, served without a copy nor a lock. thread-safe
+    class TilePack
+    {
+    public:
+        explicit TilePack(std::string const& path);
+        ~TilePack();
+
+        TilePack(TilePack const&) = delete;
+        TilePack& operator=(TilePack const&) = delete;
+
+        // false if the file is missing or not a valid pack
+        bool is_open() const;
+
+        std::string const& dzi() const;
+        std::string const& extension() const;
+        int level_count() const;
+        std::vector<std::pair<int64_t, int64_t>> const& level_tiles() const;
+        uint64_t tile_count() const;
+        // bytes of the file
+        uint64_t size() const;
+
+        // the encoded tile, valid as long as the pack; empty if it is out of the grid or was never written
+        std::span<uint8_t const> tile(int dz_level, int64_t col, int64_t row) const;
+
+    private:
+        bool _parse();
+        void _close();
+
+    private:
+        uint8_t const* m_data = nullptr;
+        uint64_t m_size = 0;
+        std::vector<uint8_t> m_buffer; // the file, where it is not mapped
+        std::string m_dzi;
+        std::string m_extension;
+        std::vector<std::pair<int64_t, int64_t>> m_level_tiles;
+        std::vector<uint64_t> m_level_first;
+        uint64_t m_tile_count = 0;
+        uint64_t const* m_index = nullptr; // <offset, size> pairs
+    };
+} // namespace dz_common
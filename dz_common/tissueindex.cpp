@@ -0,0 +1,273 @@
+#include "tissueindex.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace dz_common;
+
+namespace
+{
+    constexpr char magic[8] = {'D', 'Z', 'T', 'I', 'S', 'S', 'U', 'E'};
+    constexpr uint32_t version = 1;
+
+    // the threshold maximizing the between-class variance of `histogram`
+    int otsu(std::array<uint64_t, 256> const& histogram)
+    {
+        uint64_t total = 0;
+        double sum = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            total += histogram[i];
+            sum += static_cast<double>(i) * histogram[i];
+        }
+        if (total == 0) return 255;
+
+        uint64_t below = 0;
+        double below_sum = 0, best_variance = -1;
+        int best = 0;
+        for (int t = 0; t < 256; t++)
+        {
+            below += histogram[t];
+            below_sum += static_cast<double>(t) * histogram[t];
+            if (below == 0) continue;
+            if (below == total) break;
+            auto const above = total - below;
+            auto const mean_below = below_sum / below;
+            auto const mean_above = (sum - below_sum) / above;
+            auto const difference = mean_below - mean_above;
+            auto const variance = static_cast<double>(below) * static_cast<double>(above) * difference * difference;
+            if (variance > best_variance)
+            {
+                best_variance = variance;
+                best = t;
+            }
+        }
+        return best;
+    }
+
+    template <typename T> void write_value(std::ofstream& out, T value)
+    {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    template <typename T> bool read_value(std::ifstream& in, T& value)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+} // namespace
+
+TissueIndex TissueIndex::from_thumbnail(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                                        int64_t l0_width, int64_t l0_height)
+{
+    TissueIndex index;
+    if (!pixels || width <= 0 || height <= 0 || l0_width <= 0 || l0_height <= 0) return index;
+
+    // 255 - min(r, g, b), -1 for background
+    std::vector<int16_t> scores(static_cast<size_t>(width) * height);
+    std::array<uint64_t, 256> histogram{};
+    for (int y = 0; y < height; y++)
+    {
+        auto const* row = pixels + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < width; x++)
+        {
+            int16_t score = -1;
+            if (layout == PixelLayout::RGB)
+                score = static_cast<int16_t>(255 - std::min({row[x * 3], row[x * 3 + 1], row[x * 3 + 2]}));
+            else if (row[x * 4 + 3] != 0)
+                score = static_cast<int16_t>(255 - std::min({row[x * 4], row[x * 4 + 1], row[x * 4 + 2]}));
+            scores[static_cast<size_t>(y) * width + x] = score;
+            if (score >= 0) histogram[score]++;
+        }
+    }
+
+    index.m_width = width;
+    index.m_height = height;
+    index.m_l0_width = l0_width;
+    index.m_l0_height = l0_height;
+    index.m_threshold = std::max(otsu(histogram), min_threshold);
+
+    // thresholded and dilated by a pixel, rows first then columns
+    std::vector<uint8_t> rows(scores.size());
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            uint8_t tissue = 0;
+            for (auto xx = std::max(0, x - 1); xx <= std::min(width - 1, x + 1) && !tissue; xx++)
+                tissue = scores[static_cast<size_t>(y) * width + xx] > index.m_threshold;
+            rows[static_cast<size_t>(y) * width + x] = tissue;
+        }
+    index.m_mask.resize(scores.size());
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            uint8_t tissue = 0;
+            for (auto yy = std::max(0, y - 1); yy <= std::min(height - 1, y + 1) && !tissue; yy++)
+                tissue = rows[static_cast<size_t>(yy) * width + x];
+            index.m_mask[static_cast<size_t>(y) * width + x] = tissue;
+        }
+
+    index._build_table();
+    return index;
+}
+
+TissueIndex TissueIndex::load(std::string const& path)
+{
+    TissueIndex index;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return index;
+
+    char file_magic[sizeof(magic)] = {};
+    uint32_t file_version = 0;
+    int32_t width = 0, height = 0, threshold = 0;
+    int64_t l0_width = 0, l0_height = 0;
+    if (!in.read(file_magic, sizeof(file_magic)) || std::memcmp(file_magic, magic, sizeof(magic)) != 0 ||
+        !read_value(in, file_version) || file_version != version || !read_value(in, l0_width) ||
+        !read_value(in, l0_height) || !read_value(in, width) || !read_value(in, height) ||
+        !read_value(in, threshold) || width <= 0 || height <= 0 || l0_width <= 0 || l0_height <= 0)
+    {
+        printf("Invalid tissue index: %s\n", path.c_str());
+        return index;
+    }
+
+    // bit packed mask, row major
+    auto const count = static_cast<size_t>(width) * height;
+    std::vector<uint8_t> bits((count + 7) / 8);
+    if (!in.read(reinterpret_cast<char*>(bits.data()), static_cast<std::streamsize>(bits.size())))
+    {
+        printf("Truncated tissue index: %s\n", path.c_str());
+        return index;
+    }
+
+    index.m_width = width;
+    index.m_height = height;
+    index.m_l0_width = l0_width;
+    index.m_l0_height = l0_height;
+    index.m_threshold = threshold;
+    index.m_mask.resize(count);
+    for (size_t i = 0; i < count; i++)
+        index.m_mask[i] = (bits[i / 8] >> (i % 8)) & 1;
+    index._build_table();
+    return index;
+}
+
+bool TissueIndex::save(std::string const& path) const
+{
+    if (empty()) return false;
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        printf("Failed to write tissue index: %s\n", path.c_str());
+        return false;
+    }
+
+    out.write(magic, sizeof(magic));
+    write_value(out, version);
+    write_value(out, m_l0_width);
+    write_value(out, m_l0_height);
+    write_value(out, static_cast<int32_t>(m_width));
+    write_value(out, static_cast<int32_t>(m_height));
+    write_value(out, static_cast<int32_t>(m_threshold));
+    std::vector<uint8_t> bits((m_mask.size() + 7) / 8, 0);
+    for (size_t i = 0; i < m_mask.size(); i++)
+        bits[i / 8] |= static_cast<uint8_t>(m_mask[i] << (i % 8));
+    out.write(reinterpret_cast<char const*>(bits.data()), static_cast<std::streamsize>(bits.size()));
+    return static_cast<bool>(out);
+}
+
+std::string TissueIndex::sidecar_path(std::string const& slide_path)
+{
+    return slide_path + ".tissue";
+}
+
+bool TissueIndex::empty() const
+{
+    return m_mask.empty();
+}
+
+std::pair<int64_t, int64_t> TissueIndex::l0_dimensions() const
+{
+    return {m_l0_width, m_l0_height};
+}
+
+std::pair<int, int> TissueIndex::mask_dimensions() const
+{
+    return {m_width, m_height};
+}
+
+int TissueIndex::threshold() const
+{
+    return m_threshold;
+}
+
+double TissueIndex::tissue_fraction() const
+{
+    if (empty()) return 0;
+    return static_cast<double>(m_table.back()) / m_mask.size();
+}
+
+bool TissueIndex::intersects(int64_t x, int64_t y, int64_t width, int64_t height) const
+{
+    if (empty()) return true;
+    // the mask pixels the rectangle touches
+    auto const scale_x = static_cast<double>(m_width) / m_l0_width;
+    auto const scale_y = static_cast<double>(m_height) / m_l0_height;
+    auto const x0 = std::clamp<int64_t>(static_cast<int64_t>(std::floor(x * scale_x)), 0, m_width);
+    auto const y0 = std::clamp<int64_t>(static_cast<int64_t>(std::floor(y * scale_y)), 0, m_height);
+    auto const x1 = std::clamp<int64_t>(static_cast<int64_t>(std::ceil((x + width) * scale_x)), 0, m_width);
+    auto const y1 = std::clamp<int64_t>(static_cast<int64_t>(std::ceil((y + height) * scale_y)), 0, m_height);
+    if (x1 <= x0 || y1 <= y0) return false;
+
+    auto const stride = static_cast<size_t>(m_width) + 1;
+    auto const at = [&](int64_t xx, int64_t yy) { return m_table[static_cast<size_t>(yy) * stride + xx]; };
+    return at(x1, y1) - at(x0, y1) - at(x1, y0) + at(x0, y0) > 0;
+}
+
+void TissueIndex::index_levels(
+    std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+    std::function<std::tuple<int64_t, int64_t, int64_t, int64_t>(int dz_level, int64_t col, int64_t row)> const&
+        tile_rect)
+{
+    m_cols.clear();
+    m_levels.clear();
+    if (empty()) return;
+    for (int dz_level = 0; dz_level < static_cast<int>(level_tiles.size()); dz_level++)
+    {
+        auto const [cols, rows] = level_tiles[dz_level];
+        m_cols.push_back(cols);
+        auto& level = m_levels.emplace_back(static_cast<size_t>(cols * rows), false);
+        for (int64_t row = 0; row < rows; row++)
+            for (int64_t col = 0; col < cols; col++)
+            {
+                auto const [x, y, width, height] = tile_rect(dz_level, col, row);
+                level[static_cast<size_t>(row * cols + col)] = intersects(x, y, width, height);
+            }
+    }
+}
+
+bool TissueIndex::has_tissue(int dz_level, int64_t col, int64_t row) const
+{
+    if (dz_level < 0 || dz_level >= static_cast<int>(m_levels.size())) return true;
+    auto const cols = m_cols[dz_level];
+    auto const& level = m_levels[dz_level];
+    if (col < 0 || col >= cols || row < 0 || static_cast<size_t>(row * cols + col) >= level.size()) return true;
+    return level[static_cast<size_t>(row * cols + col)];
+}
+
+void TissueIndex::_build_table()
+{
+    auto const stride = static_cast<size_t>(m_width) + 1;
+    m_table.assign(stride * (static_cast<size_t>(m_height) + 1), 0);
+    for (int y = 0; y < m_height; y++)
+    {
+        uint32_t row_sum = 0;
+        for (int x = 0; x < m_width; x++)
+        {
+            row_sum += m_mask[static_cast<size_t>(y) * m_width + x];
+            m_table[(y + 1) * stride + x + 1] = m_table[y * stride + x + 1] + row_sum;
+        }
+    }
+}
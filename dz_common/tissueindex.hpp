@@ -0,0 +1,73 @@
+#pragma once
+
+#include "dz_common/codec.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace dz_common
+{
+    // tissue mask of a slide and which deepzoom tiles intersect it, so that export, prefetch and sampling can skip
+    // glass without reading it.
+    // the mask comes from a thumbnail of the whole level 0: pixels are scored with 255 - min(r, g, b), high for dark
+    // and for stained (saturated) pixels, low for glass, and Otsu's threshold of the scores splits the two. the mask
+    // is dilated by a pixel so that tissue on the border of a thumbnail pixel is not lost.
+    // tile queries are lookups in a bitmap per deepzoom level, rectangle queries go through a summed area table
+    class TissueIndex
+    {
+    public:
+        // longest side of the thumbnails the generators read
+        static constexpr int thumbnail_size = 1024;
+        // lower thresholds are raised to it, so that a slide of glass only does not come out half tissue
+        static constexpr int min_threshold = 24;
+
+        TissueIndex() = default;
+
+        // `pixels` covers the whole level 0 of `l0_width` x `l0_height`, `stride` is in bytes
+        // BGRX pixels with a zero alpha (premultiplied, so all zero: outside of the scanned area) are background
+        static TissueIndex from_thumbnail(uint8_t const* pixels, int width, int height, int stride, PixelLayout layout,
+                                          int64_t l0_width, int64_t l0_height);
+        // the mask written by `save`, empty if the file is missing or invalid
+        static TissueIndex load(std::string const& path);
+        bool save(std::string const& path) const;
+        // where a slide's index is kept by convention: next to it
+        static std::string sidecar_path(std::string const& slide_path);
+
+        bool empty() const;
+        // <width, height>
+        std::pair<int64_t, int64_t> l0_dimensions() const;
+        std::pair<int, int> mask_dimensions() const;
+        int threshold() const;
+        // fraction of the mask that is tissue
+        double tissue_fraction() const;
+
+        // any tissue within the level 0 rectangle; true if the index is empty
+        bool intersects(int64_t x, int64_t y, int64_t width, int64_t height) const;
+
+        // bitmaps of the tiles of every deepzoom level, `level_tiles` are <cols, rows>
+        // `tile_rect` gives the level 0 <x, y, width, height> of a tile
+        void index_levels(std::vector<std::pair<int64_t, int64_t>> const& level_tiles,
+                          std::function<std::tuple<int64_t, int64_t, int64_t, int64_t>(int dz_level, int64_t col,
+                                                                                        int64_t row)> const& tile_rect);
+        // does the tile intersect tissue, true when unknown: empty index or levels not indexed
+        bool has_tissue(int dz_level, int64_t col, int64_t row) const;
+
+    private:
+        void _build_table();
+
+    private:
+        int m_width = 0;
+        int m_height = 0;
+        int64_t m_l0_width = 0;
+        int64_t m_l0_height = 0;
+        int m_threshold = 0;
+        std::vector<uint8_t> m_mask;   // 1: tissue, row major
+        std::vector<uint32_t> m_table; // summed area of `m_mask`, (width + 1) x (height + 1)
+        std::vector<int64_t> m_cols;
+        std::vector<std::vector<bool>> m_levels;
+    };
+} // namespace dz_common
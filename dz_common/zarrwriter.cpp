@@ -0,0 +1,292 @@
+#include "zarrwriter.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef DZ_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace dz_common;
+
+namespace
+{
+    constexpr int64_t channels = 3;
+    // a chunk must fit in a Blosc frame, which holds less than 2GB
+    constexpr int64_t max_chunk_size = 16384;
+
+    std::string format_double(double value)
+    {
+        char buffer[32];
+        auto const [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        return ec == std::errc() ? std::string(buffer, end) : "0";
+    }
+
+    bool write_file(std::filesystem::path const& path, std::string const& content)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << content;
+        if (!out) printf("Failed to write %s\n", path.string().c_str());
+        return static_cast<bool>(out);
+    }
+
+#ifdef DZ_HAVE_ZSTD
+    constexpr int zstd_level = 5;
+
+    void put_u32(uint8_t* dest, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            dest[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    // what numcodecs' Blosc(cname="zstd", shuffle=NOSHUFFLE) writes for bytes, as a single block: the 16 byte header,
+    // the start of the block, the size of its zstd stream and the stream. a chunk zstd does not shrink is stored as
+    // a plain copy after the header
+    std::vector<uint8_t> blosc_zstd(std::vector<uint8_t> const& raw)
+    {
+        constexpr size_t header_size = 16;
+        constexpr uint8_t format_version = 2, zstd_format_version = 1;
+        constexpr uint8_t flag_memcpyed = 0x02, flag_no_split = 0x10, compressor_zstd = 4 << 5;
+
+        auto const block_start = header_size + sizeof(uint32_t);
+        auto const bound = ZSTD_compressBound(raw.size());
+        std::vector<uint8_t> frame(block_start + sizeof(uint32_t) + bound);
+        auto const size = ZSTD_compress(frame.data() + block_start + sizeof(uint32_t), bound, raw.data(), raw.size(),
+                                        zstd_level);
+        uint8_t flags = flag_no_split | compressor_zstd;
+        if (!ZSTD_isError(size) && size < raw.size())
+        {
+            put_u32(frame.data() + header_size, static_cast<uint32_t>(block_start));
+            put_u32(frame.data() + block_start, static_cast<uint32_t>(size));
+            frame.resize(block_start + sizeof(uint32_t) + size);
+        }
+        else
+        {
+            flags |= flag_memcpyed;
+            frame.resize(header_size + raw.size());
+            std::memcpy(frame.data() + header_size, raw.data(), raw.size());
+        }
+        frame[0] = format_version;
+        frame[1] = zstd_format_version;
+        frame[2] = flags;
+        frame[3] = 1; // type size
+        put_u32(frame.data() + 4, static_cast<uint32_t>(raw.size()));
+        put_u32(frame.data() + 8, static_cast<uint32_t>(raw.size())); // block size
+        put_u32(frame.data() + 12, static_cast<uint32_t>(frame.size()));
+        return frame;
+    }
+#endif
+} // namespace
+
+ZarrWriter::ZarrWriter(std::string path, std::vector<std::pair<int64_t, int64_t>> const& level_dimensions,
+                       int64_t chunk_size, double mpp)
+    : m_path(std::move(path)), m_temporary(m_path + ".tmp"), m_chunk_size(chunk_size),
+      m_mpp(std::isfinite(mpp) && mpp > 0. ? mpp : 0.), m_dimensions(level_dimensions)
+{
+    auto valid = !m_dimensions.empty() && chunk_size > 0 && chunk_size <= max_chunk_size;
+    for (auto const& [width, height] : m_dimensions)
+        valid = valid && width > 0 && height > 0;
+    if (!valid)
+    {
+        printf("Invalid OME-Zarr parameters: %s\n", m_path.c_str());
+        return;
+    }
+    std::error_code ec;
+    if (std::filesystem::exists(m_path, ec))
+    {
+        printf("Failed to write OME-Zarr %s: it already exists\n", m_path.c_str());
+        return;
+    }
+    // leftovers of an interrupted export
+    std::filesystem::remove_all(m_temporary, ec);
+
+    // a directory per row of chunks, made up front so that `add` only writes files
+    for (size_t level = 0; level < m_dimensions.size(); level++)
+    {
+        auto const [width, height] = m_dimensions[level];
+        auto const cols = (width + chunk_size - 1) / chunk_size;
+        auto const rows = (height + chunk_size - 1) / chunk_size;
+        m_chunks.emplace_back(cols, rows);
+        for (int64_t row = 0; row < rows; row++)
+        {
+            auto const directory = std::filesystem::path(m_temporary) / std::to_string(level) / "0" /
+                                   std::to_string(row);
+            std::filesystem::create_directories(directory, ec);
+            if (ec)
+            {
+                printf("Failed to create directory %s: %s\n", directory.string().c_str(), ec.message().c_str());
+                std::filesystem::remove_all(m_temporary, ec);
+                return;
+            }
+        }
+    }
+    m_open = true;
+}
+
+ZarrWriter::~ZarrWriter()
+{
+    if (!m_open || m_finished) return;
+    std::error_code ec;
+    std::filesystem::remove_all(m_temporary, ec);
+}
+
+bool ZarrWriter::is_open() const
+{
+    return m_open && !m_finished;
+}
+
+int ZarrWriter::level_count() const
+{
+    return static_cast<int>(m_dimensions.size());
+}
+
+std::vector<std::pair<int64_t, int64_t>> const& ZarrWriter::level_chunks() const
+{
+    return m_chunks;
+}
+
+std::vector<uint8_t> ZarrWriter::encode_chunk(std::span<uint32_t const> pixels, int64_t width, int64_t height) const
+{
+    if (width <= 0 || height <= 0 || width > m_chunk_size || height > m_chunk_size ||
+        pixels.size() < static_cast<size_t>(width * height))
+        return {};
+    auto const plane = m_chunk_size * m_chunk_size;
+    std::vector<uint8_t> raw(channels * plane, 0);
+    for (int64_t y = 0; y < height; y++)
+    {
+        auto const* src = pixels.data() + y * width;
+        auto* r = raw.data() + y * m_chunk_size;
+        auto* g = r + plane;
+        auto* b = g + plane;
+        for (int64_t x = 0; x < width; x++)
+        {
+            r[x] = static_cast<uint8_t>(src[x] >> 16);
+            g[x] = static_cast<uint8_t>(src[x] >> 8);
+            b[x] = static_cast<uint8_t>(src[x]);
+        }
+    }
+#ifdef DZ_HAVE_ZSTD
+    return blosc_zstd(raw);
+#else
+    return raw;
+#endif
+}
+
+bool ZarrWriter::add(int level, int64_t col, int64_t row, std::span<uint8_t const> chunk)
+{
+    if (!is_open() || level < 0 || level >= level_count() || chunk.empty()) return false;
+    auto const [cols, rows] = m_chunks[level];
+    if (col < 0 || col >= cols || row < 0 || row >= rows) return false;
+
+    auto const path = std::filesystem::path(m_temporary) / std::to_string(level) / "0" / std::to_string(row) /
+                      std::to_string(col);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<char const*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+    if (!out) printf("Failed to write %s\n", path.string().c_str());
+    return static_cast<bool>(out);
+}
+
+bool ZarrWriter::finish()
+{
+    if (!is_open()) return false;
+    auto const root = std::filesystem::path(m_temporary);
+    auto ok = true;
+    for (auto level = 0; level < level_count(); level++)
+        ok = ok && write_file(root / std::to_string(level) / ".zarray", _array_metadata(level));
+    ok = ok && write_file(root / ".zgroup", "{\n    \"zarr_format\": 2\n}\n");
+    ok = ok && write_file(root / ".zattrs", _group_attributes());
+    if (!ok) return false;
+
+    std::error_code ec;
+    std::filesystem::rename(m_temporary, m_path, ec);
+    if (ec)
+    {
+        printf("Failed to write OME-Zarr %s: %s\n", m_path.c_str(), ec.message().c_str());
+        return false;
+    }
+    m_finished = true;
+    return true;
+}
+
+std::string ZarrWriter::_array_metadata(int level) const
+{
+    auto const [width, height] = m_dimensions[level];
+#ifdef DZ_HAVE_ZSTD
+    auto const compressor = std::string(R"({"id": "blosc", "cname": "zstd", "clevel": )") +
+                            std::to_string(zstd_level) + R"(, "shuffle": 0, "blocksize": 0})";
+#else
+    auto const compressor = std::string("null");
+#endif
+    auto const chunk = std::to_string(m_chunk_size);
+    return "{\n"
+           "    \"zarr_format\": 2,\n"
+           "    \"shape\": [3, " +
+           std::to_string(height) + ", " + std::to_string(width) +
+           "],\n"
+           "    \"chunks\": [3, " +
+           chunk + ", " + chunk +
+           "],\n"
+           "    \"dtype\": \"|u1\",\n"
+           "    \"compressor\": " +
+           compressor +
+           ",\n"
+           "    \"fill_value\": 0,\n"
+           "    \"order\": \"C\",\n"
+           "    \"filters\": null,\n"
+           "    \"dimension_separator\": \"/\"\n"
+           "}\n";
+}
+
+std::string ZarrWriter::_group_attributes() const
+{
+    // every level is a 2x2 average of the one above: twice the pixel size
+    auto const unit = m_mpp > 0. ? std::string(R"(, "unit": "micrometer")") : std::string();
+    std::string datasets;
+    for (auto level = 0; level < level_count(); level++)
+    {
+        auto const scale = format_double(std::ldexp(m_mpp > 0. ? m_mpp : 1., level));
+        if (level > 0) datasets += ",\n";
+        datasets += "                {\"path\": \"" + std::to_string(level) +
+                    R"(", "coordinateTransformations": [{"type": "scale", "scale": [1, )" + scale + ", " + scale +
+                    "]}]}";
+    }
+    std::string omero_channels;
+    for (auto const& [label, color] : {std::pair{"R", "FF0000"}, {"G", "00FF00"}, {"B", "0000FF"}})
+    {
+        if (!omero_channels.empty()) omero_channels += ",\n";
+        omero_channels += std::string("            {\"label\": \"") + label + "\", \"color\": \"" + color +
+                    R"(", "active": true, "window": {"min": 0, "max": 255, "start": 0, "end": 255}})";
+    }
+    return "{\n"
+           "    \"multiscales\": [\n"
+           "        {\n"
+           "            \"version\": \"0.4\",\n"
+           "            \"axes\": [\n"
+           "                {\"name\": \"c\", \"type\": \"channel\"},\n"
+           "                {\"name\": \"y\", \"type\": \"space\"" +
+           unit +
+           "},\n"
+           "                {\"name\": \"x\", \"type\": \"space\"" +
+           unit +
+           "}\n"
+           "            ],\n"
+           "            \"datasets\": [\n" +
+           datasets +
+           "\n"
+           "            ],\n"
+           "            \"type\": \"mean\"\n"
+           "        }\n"
+           "    ],\n"
+           "    \"omero\": {\n"
+           "        \"channels\": [\n" +
+           omero_channels +
+           "\n"
+           "        ],\n"
+           "        \"rdefs\": {\"model\": \"color\"}\n"
+           "    }\n"
+           "}\n";
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dz_common
+{
+    // a multiscale OME-Zarr image (NGFF 0.4 metadata in a zarr v2 directory store) that analysis pipelines read as
+    // chunked arrays: one `uint8` array of shape <c=3, y, x> per level, largest first, in `<level>/`, each chunked in
+    // <3, `chunk_size`, `chunk_size`> files `<level>/0/<row>/<col>`. chunks are Blosc frames of zstd streams when
+    // zstd is available (`DZ_HAVE_ZSTD`), raw bytes otherwise
+    //
+    // the store is written to `<path>.tmp` and renamed to `path` by `finish`, after the metadata, so that readers
+    // never see a partial store; `path` must not exist
+    class ZarrWriter
+    {
+    public:
+        // `level_dimensions` <width, height> of every level, largest first, each half the one before (rounded up)
+        // `mpp` microns per pixel of the first level, the levels are scaled in pixels if 0
+        ZarrWriter(std::string path, std::vector<std::pair<int64_t, int64_t>> const& level_dimensions,
+                   int64_t chunk_size, double mpp = 0.);
+        // removes the temporary store if `finish` was not called
+        ~ZarrWriter();
+
+        ZarrWriter(ZarrWriter const&) = delete;
+        ZarrWriter& operator=(ZarrWriter const&) = delete;
+
+        bool is_open() const;
+
+        // the bytes of the chunk file of `width` x `height` ARGB_Premultiplied pixels (at most `chunk_size` a side):
+        // R, G and B planes of the full chunk size, alpha dropped and padding 0, compressed. thread-safe
+        std::vector<uint8_t> encode_chunk(std::span<uint32_t const> pixels, int64_t width, int64_t height) const;
+        // stores a chunk `encode_chunk` returned, false if it is out of the grid or could not be written
+        // thread-safe, every chunk is a file of its own
+        bool add(int level, int64_t col, int64_t row, std::span<uint8_t const> chunk);
+        // writes the metadata and moves the store to `path`
+        bool finish();
+
+        int level_count() const;
+        // <cols, rows> of chunks of every level
+        std::vector<std::pair<int64_t, int64_t>> const& level_chunks() const;
+
+    private:
+        std::string _array_metadata(int level) const;
+        std::string _group_attributes() const;
+
+    private:
+        std::string m_path;
+        std::string m_temporary;
+        int64_t m_chunk_size = 0;
+        double m_mpp = 0.;
+        std::vector<std::pair<int64_t, int64_t>> m_dimensions;
+        std::vector<std::pair<int64_t, int64_t>> m_chunks;
+        bool m_open = false;
+        bool m_finished = false;
+    };
+} // namespace dz_common
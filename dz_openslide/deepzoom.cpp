@@ -1,17 +1,23 @@
 #include "deepzoom.hpp"
+#include "dz_common/tilecache.hpp"
+#include "dz_common/threadpool.hpp"
+#include "dz_common/downsample.hpp"
+#include "dz_common/pixelconv.hpp"
+#include "dz_common/codec.hpp"
+#include "dz_common/resample.hpp"
+#include "dz_common/slidemetadata.hpp"
+#include "dz_common/blankindex.hpp"
 
 extern "C"
 {
-#define XMD_H
-#include <jpeglib.h>
-#ifdef const
-#undef const
-#endif
-#include <png.h>
 #include <openslide.h>
 }
 
 #include <memory>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
 #include <numeric>
 #include <cmath>
 #include <algorithm>
@@ -20,50 +26,196 @@ extern "C"
 
 using namespace dz_openslide;
 
-DeepZoomGenerator::DeepZoomGenerator(std::string filepath, int tile_size, int overlap, bool limit_bounds,
-                                     ImageFormat format, float quality)
-    : m_tile_size(tile_size), m_overlap(overlap), m_limit_bounds(limit_bounds), m_format(format),
-      m_quality(std ::clamp(quality, 0.f, 1.f))
+namespace
 {
-    m_slide = openslide_open(filepath.c_str());
-    if (!m_slide)
+    std::vector<uint8_t> const no_icc_profile;
+
+    // premultiplied ARGB as the BGRX bytes the WebP/AVIF encoders take, only converted on big endian hosts
+    uint8_t const* as_bgrx(std::span<uint32_t const> pixels, dz_common::PixelBuffer& converted)
     {
-        printf("Failed to open slide: %s\n", openslide_get_error(m_slide));
-        return;
+        if constexpr (std::endian::native == std::endian::big)
+        {
+            converted = dz_common::PixelBuffer(pixels.size());
+            auto* bytes = reinterpret_cast<uint8_t*>(converted.data());
+            dz_common::argb_to_bgrx(pixels.data(), bytes, pixels.size());
+            return bytes;
+        }
+        return reinterpret_cast<uint8_t const*>(pixels.data());
     }
+} // namespace
 
-    if (auto mpp_x = openslide_get_property_value(m_slide, OPENSLIDE_PROPERTY_NAME_MPP_X); mpp_x)
-        if (auto mpp_y = openslide_get_property_value(m_slide, OPENSLIDE_PROPERTY_NAME_MPP_Y); mpp_y)
-            m_mpp = (std::strtod(mpp_x, nullptr) + std::strtod(mpp_y, nullptr)) / 2.;
+// bounded pool of `openslide_t` handles on the same slide
+// handles are opened lazily up to `max_handles` (the generator's own handle counts as the first one)
+// and share a single `openslide` tile cache, so memory does not grow with the pool size
+class DeepZoomGenerator::HandlePool
+{
+public:
+    class Lease
+    {
+    public:
+        Lease(HandlePool* pool, _openslide* handle) : m_pool(pool), m_handle(handle) {}
+        ~Lease()
+        {
+            if (m_pool) m_pool->_release(m_handle);
+        }
+        Lease(Lease const&) = delete;
+        Lease& operator=(Lease const&) = delete;
 
-    m_levels = openslide_get_level_count(m_slide);
-    m_l_dimensions.reserve(m_levels);
-    int64_t w = -1, h = -1;
-    for (auto l = 0; l < m_levels; l++)
+        _openslide* get() const { return m_handle; }
+
+    private:
+        HandlePool* m_pool = nullptr;
+        _openslide* m_handle = nullptr;
+    };
+
+    HandlePool(std::string filepath, _openslide* primary, int max_handles)
+        : m_filepath(std::move(filepath)), m_max_handles(std::max(1, max_handles))
     {
-        openslide_get_level_dimensions(m_slide, l, &w, &h);
-        m_l_dimensions.push_back({w, h});
+        m_cache = openslide_cache_create(size_t{64} << 20);
+        openslide_set_cache(primary, m_cache);
+        m_idle.push_back(primary);
+        m_opened = 1;
     }
 
-    if (m_limit_bounds)
+    ~HandlePool()
     {
-        if (auto const* p = openslide_get_property_value(m_slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_X); p)
-            m_l0_offset.first = std::strtol(p, nullptr, 10);
-        if (auto const* p = openslide_get_property_value(m_slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_Y); p)
-            m_l0_offset.second = std::strtol(p, nullptr, 10);
+        m_owned.clear();
+        if (m_cache) openslide_cache_release(m_cache);
+    }
+
+    int max_handles() const { return m_max_handles; }
 
-        auto l0_lim = m_l_dimensions[0];
-        std::pair<double, double> size_scale{1., 1.};
-        if (auto const* p = openslide_get_property_value(m_slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_WIDTH); p)
-            size_scale.first = std::strtol(p, nullptr, 10) / static_cast<double>(l0_lim.first);
-        if (auto const* p = openslide_get_property_value(m_slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_HEIGHT); p)
-            size_scale.second = std::strtol(p, nullptr, 10) / static_cast<double>(l0_lim.second);
+    Lease acquire()
+    {
+        std::unique_lock lock(m_mutex);
+        while (true)
+        {
+            if (!m_idle.empty())
+            {
+                auto* handle = m_idle.back();
+                m_idle.pop_back();
+                return Lease(this, handle);
+            }
+            if (m_opened < m_max_handles)
+            {
+                m_opened++;
+                lock.unlock();
+                // opening may take a while, do it outside of the lock
+                std::unique_ptr<_openslide, SlideCloser> handle(openslide_open(m_filepath.c_str()));
+                if (handle && !openslide_get_error(handle.get()))
+                {
+                    openslide_set_cache(handle.get(), m_cache);
+                    lock.lock();
+                    m_owned.push_back(std::move(handle));
+                    return Lease(this, m_owned.back().get());
+                }
+                printf("Failed to open extra handle for: %s\n", m_filepath.c_str());
+                lock.lock();
+                // do not retry, fall back to waiting for the existing handles
+                m_max_handles = --m_opened;
+                continue;
+            }
+            m_cv.wait(lock);
+        }
+    }
 
-        for (auto& d : m_l_dimensions)
+private:
+    void _release(_openslide* handle)
+    {
         {
-            d.first = static_cast<int64_t>(std::ceil(d.first * size_scale.first));
-            d.second = static_cast<int64_t>(std::ceil(d.second * size_scale.second));
+            std::lock_guard lock(m_mutex);
+            m_idle.push_back(handle);
         }
+        m_cv.notify_one();
+    }
+
+private:
+    std::string m_filepath;
+    int m_max_handles = 1;
+    int m_opened = 0;
+    _openslide_cache* m_cache = nullptr;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<_openslide*> m_idle;
+    std::vector<std::unique_ptr<_openslide, SlideCloser>> m_owned;
+};
+
+// blank detection: the bitmap, published once the slide is scanned (the scan may run while tiles are being served,
+// when the slide is opened after the generator), and the tiles encoded for the blank ones
+struct DeepZoomGenerator::Blank
+{
+    int tolerance = 0;
+    dz_common::BlankIndex index;
+    std::atomic<bool> scanned{false};
+    dz_common::BlankTiles tiles;
+
+    bool blank(int dz_level, int64_t col, int64_t row, uint32_t* color) const
+    {
+        return scanned.load(std::memory_order_acquire) && index.is_blank(dz_level, col, row, color);
+    }
+};
+
+DeepZoomGenerator::DeepZoomGenerator(std::string filepath, int tile_size, int overlap, bool limit_bounds,
+                                     ImageFormat format, float quality, OpenMode open_mode,
+                                     std::string const& metadata_path)
+    : m_filepath(filepath), m_tile_size(tile_size), m_overlap(overlap), m_limit_bounds(limit_bounds),
+      m_format(format), m_quality(std ::clamp(quality, 0.f, 1.f))
+{
+    auto const stamp = metadata_path.empty() ? dz_common::FileStamp{} : dz_common::FileStamp::of(m_filepath);
+    auto const sidecar = stamp.path.empty() ? dz_common::SlideMetadata{}
+                                            : dz_common::SlideMetadata::load(metadata_path, stamp, m_limit_bounds);
+    if (!sidecar.empty())
+    {
+        m_levels = static_cast<int>(sidecar.level_dimensions.size());
+        m_l_dimensions = sidecar.level_dimensions;
+        m_level_downsamples = sidecar.level_downsamples;
+        m_preferred_slide_levels = sidecar.preferred_levels;
+        m_l0_offset = sidecar.l0_offset;
+        std::call_once(*m_metadata_once, [&]() {
+            m_metadata = Metadata{.mpp = sidecar.mpp,
+                                  .background_color = sidecar.background_color,
+                                  .icc_profile_size = sidecar.icc_profile_size,
+                                  .icc_profile_hash = sidecar.icc_profile_hash};
+        });
+    }
+    else
+    {
+        auto* slide = _slide();
+        if (!slide) return;
+
+        m_levels = openslide_get_level_count(slide);
+        m_l_dimensions.reserve(m_levels);
+        int64_t w = -1, h = -1;
+        for (auto l = 0; l < m_levels; l++)
+        {
+            openslide_get_level_dimensions(slide, l, &w, &h);
+            m_l_dimensions.push_back({w, h});
+        }
+
+        if (m_limit_bounds)
+        {
+            if (auto const* p = openslide_get_property_value(slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_X); p)
+                m_l0_offset.first = std::strtol(p, nullptr, 10);
+            if (auto const* p = openslide_get_property_value(slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_Y); p)
+                m_l0_offset.second = std::strtol(p, nullptr, 10);
+
+            auto l0_lim = m_l_dimensions[0];
+            std::pair<double, double> size_scale{1., 1.};
+            if (auto const* p = openslide_get_property_value(slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_WIDTH); p)
+                size_scale.first = std::strtol(p, nullptr, 10) / static_cast<double>(l0_lim.first);
+            if (auto const* p = openslide_get_property_value(slide, OPENSLIDE_PROPERTY_NAME_BOUNDS_HEIGHT); p)
+                size_scale.second = std::strtol(p, nullptr, 10) / static_cast<double>(l0_lim.second);
+
+            for (auto& d : m_l_dimensions)
+            {
+                d.first = static_cast<int64_t>(std::ceil(d.first * size_scale.first));
+                d.second = static_cast<int64_t>(std::ceil(d.second * size_scale.second));
+            }
+        }
+
+        m_level_downsamples.reserve(m_levels);
+        for (auto l = 0; l < m_levels; l++)
+            m_level_downsamples.push_back(openslide_get_level_downsample(slide, l));
     }
 
     m_dzl_dimensions.push_back(m_l_dimensions[0]);
@@ -80,39 +232,52 @@ DeepZoomGenerator::DeepZoomGenerator(std::string filepath, int tile_size, int ov
 
     std::vector<double> level_0_dz_downsamples;
     level_0_dz_downsamples.reserve(m_dz_levels);
-    m_preferred_slide_levels.reserve(m_dz_levels);
     for (auto l = 0; l < m_dz_levels; l++)
+        level_0_dz_downsamples.push_back(std::pow(2, (m_dz_levels - l - 1)));
+    if (sidecar.empty())
     {
-        auto d = std::pow(2, (m_dz_levels - l - 1));
-        level_0_dz_downsamples.push_back(d);
-        m_preferred_slide_levels.push_back(openslide_get_best_level_for_downsample(m_slide, d));
+        m_preferred_slide_levels.reserve(m_dz_levels);
+        for (auto const d : level_0_dz_downsamples)
+            m_preferred_slide_levels.push_back(openslide_get_best_level_for_downsample(m_slide.get(), d));
     }
 
-    m_level_downsamples.reserve(m_levels);
-    for (auto l = 0; l < m_levels; l++)
-        m_level_downsamples.push_back(openslide_get_level_downsample(m_slide, l));
-
     m_level_dz_downsamples.reserve(m_dz_levels);
     for (auto l = 0; l < m_dz_levels; l++)
         m_level_dz_downsamples.push_back(level_0_dz_downsamples[l] / m_level_downsamples[m_preferred_slide_levels[l]]);
 
-    if (auto bg_color = openslide_get_property_value(m_slide, OPENSLIDE_PROPERTY_NAME_BACKGROUND_COLOR); bg_color)
-        m_background_color = std::string("#") + bg_color;
-    m_icc_profile = _get_icc_profile();
+    if (sidecar.empty() && !stamp.path.empty())
+    {
+        // the sidecar needs the metadata whatever `open_mode`
+        auto const& metadata = _metadata();
+        dz_common::SlideMetadata{.stamp = stamp,
+                                 .limit_bounds = m_limit_bounds,
+                                 .level_dimensions = m_l_dimensions,
+                                 .level_downsamples = m_level_downsamples,
+                                 .preferred_levels = m_preferred_slide_levels,
+                                 .l0_offset = m_l0_offset,
+                                 .mpp = metadata.mpp,
+                                 .background_color = metadata.background_color,
+                                 .icc_profile_size = metadata.icc_profile_size,
+                                 .icc_profile_hash = metadata.icc_profile_hash}
+            .save(metadata_path);
+    }
+    else if (open_mode == OpenMode::EAGER)
+        _metadata();
 }
 
-DeepZoomGenerator::~DeepZoomGenerator()
+DeepZoomGenerator::~DeepZoomGenerator() = default;
+
+DeepZoomGenerator::DeepZoomGenerator(DeepZoomGenerator&&) noexcept = default;
+DeepZoomGenerator& DeepZoomGenerator::operator=(DeepZoomGenerator&&) noexcept = default;
+
+void DeepZoomGenerator::SlideCloser::operator()(_openslide* slide) const
 {
-    if (m_slide)
-    {
-        openslide_close(m_slide);
-        m_slide = nullptr;
-    }
+    if (slide) openslide_close(slide);
 }
 
 bool DeepZoomGenerator::is_valid() const
 {
-    return m_slide != nullptr;
+    return m_dz_levels > 0;
 }
 
 int DeepZoomGenerator::level_count() const
@@ -132,60 +297,317 @@ std::vector<std::pair<int64_t, int64_t>> DeepZoomGenerator::level_dimensions() c
 
 int64_t DeepZoomGenerator::tile_count() const
 {
-    return std::reduce(m_t_dimensions.cbegin(), m_t_dimensions.cend(), int64_t{1},
-                       [](auto s, auto const& d) { return s + d.first * d.second; });
+    return std::accumulate(m_t_dimensions.cbegin(), m_t_dimensions.cend(), int64_t{0},
+                           [](auto s, auto const& d) { return s + d.first * d.second; });
 }
 
 std::tuple<int64_t, int64_t, std::vector<uint32_t>> dz_openslide::DeepZoomGenerator::get_tile_pixels(int dz_level,
                                                                                                      int col,
                                                                                                      int row) const
 {
-    auto const& [l0_location, slide_level, l_size] = get_tile_coordinates(dz_level, col, row);
+    auto const& [width, height, buf] = get_tile_pixel_buffer(dz_level, col, row);
+    return std::make_tuple(width, height, std::vector<uint32_t>(buf.begin(), buf.end()));
+}
+
+std::tuple<int64_t, int64_t, dz_common::PixelBuffer> DeepZoomGenerator::get_tile_pixel_buffer(int dz_level, int col,
+                                                                                              int row) const
+{
+    if (uint32_t color = 0; m_blank && m_blank->blank(dz_level, col, row, &color))
+    {
+        auto const [width, height] = _pixel_dimensions(dz_level, col, row);
+        dz_common::PixelBuffer buf(width * height);
+        std::fill(buf.begin(), buf.end(), color);
+        return std::make_tuple(width, height, std::move(buf));
+    }
+
+    if (_is_synthesized(dz_level))
+    {
+        auto const [width, height] = get_tile_dimensions(dz_level, col, row);
+        return std::make_tuple(width, height, _synthesize_tile_pixels(dz_level, col, row));
+    }
+
+    auto const& [coordinates, z_size] = _get_tile_info(dz_level, col, row);
+    auto const& [l0_location, slide_level, l_size] = coordinates;
     auto const& [width, height] = l_size;
     auto const& [xx, yy] = l0_location;
 
-    std::vector<uint32_t> buf(width * height);
-    openslide_read_region(m_slide, buf.data(), xx, yy, slide_level, width, height);
-    return std::make_tuple(width, height, std::move(buf));
+    // openslide writes every pixel, no need to clear it
+    dz_common::PixelBuffer buf(width * height);
+    _read_region(buf.data(), xx, yy, slide_level, width, height);
+    if (!m_resize_tiles) return std::make_tuple(width, height, std::move(buf));
+    return std::make_tuple(z_size.first, z_size.second,
+                           _resize_region(std::move(buf), width, height, z_size.first, z_size.second));
 }
 
 std::tuple<int64_t, int64_t, std::vector<uint8_t>> DeepZoomGenerator::get_tile_bytes(int dz_level, int col,
                                                                                      int row) const
 {
-    auto const& [width, height, buf] = get_tile_pixels(dz_level, col, row);
+    auto const& [width, height, buf] = get_tile_pixel_buffer(dz_level, col, row);
 
     // https://openslide.org/docs/premultiplied-argb/
-    std::vector<uint8_t> data;
-    data.reserve(width * height * 4);
-    uint32_t p = 0;
-    for (int64_t i = 0; i < width * height; i++)
+    std::vector<uint8_t> data(buf.size() * 4);
+    dz_common::argb_to_argb_bytes(buf.data(), data.data(), buf.size());
+    return std::make_tuple(width, height, std::move(data));
+}
+
+std::vector<uint8_t> DeepZoomGenerator::get_tile(int dz_level, int col, int row, bool with_icc_profile) const
+{
+    if (auto tile = _blank_tile(dz_level, col, row, with_icc_profile); tile) return *tile;
+    if (!m_tile_cache) return _render_tile(dz_level, col, row, with_icc_profile);
+
+    auto const key = _tile_key(dz_level, col, row, with_icc_profile);
+    if (auto tile = m_tile_cache->get(key); tile) return std::move(*tile);
+
+    auto tile = _render_tile(dz_level, col, row, with_icc_profile);
+    if (!tile.empty()) m_tile_cache->put(key, tile);
+    return tile;
+}
+
+size_t DeepZoomGenerator::get_tile(int dz_level, int col, int row, std::span<uint8_t> dest, bool with_icc_profile) const
+{
+    if (auto tile = _blank_tile(dz_level, col, row, with_icc_profile); tile)
     {
-        p = buf[i];
-        if constexpr (std::endian::native == std::endian::big)
+        if (tile->size() > dest.size()) return 0;
+        std::copy(tile->cbegin(), tile->cend(), dest.begin());
+        return tile->size();
+    }
+    if (!m_tile_cache)
+    {
+        auto const& [width, height, pixels] = get_tile_pixel_buffer(dz_level, col, row);
+        return encode_tile(pixels, width, height, dest, with_icc_profile);
+    }
+
+    auto const key = _tile_key(dz_level, col, row, with_icc_profile);
+    if (auto tile = m_tile_cache->get(key); tile)
+    {
+        if (tile->size() > dest.size()) return 0;
+        std::copy(tile->cbegin(), tile->cend(), dest.begin());
+        return tile->size();
+    }
+
+    auto const& [width, height, pixels] = get_tile_pixel_buffer(dz_level, col, row);
+    auto const size = encode_tile(pixels, width, height, dest, with_icc_profile);
+    if (size > 0) m_tile_cache->put(key, std::vector<uint8_t>(dest.begin(), dest.begin() + size));
+    return size;
+}
+
+std::vector<std::vector<uint8_t>> DeepZoomGenerator::get_tiles(std::span<std::tuple<int, int, int> const> tiles,
+                                                               bool with_icc_profile) const
+{
+    std::vector<std::vector<uint8_t>> res(tiles.size());
+
+    // only cache misses go to openslide
+    std::vector<size_t> misses;
+    misses.reserve(tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        auto const& [dz_level, col, row] = tiles[i];
+        if (auto tile = _blank_tile(dz_level, col, row, with_icc_profile); tile)
         {
-            // C++ 23 can use `std::byteswap`
-            p = ((p & 0x000000FF) << 24) | ((p & 0x0000FF00) << 8) | ((p & 0x00FF0000) >> 8) | ((p & 0xFF000000) >> 24);
+            res[i] = *tile;
+            continue;
         }
-        data.push_back(p >> 24); // a
-        data.push_back(p >> 16); // r
-        data.push_back(p >> 8);  // g
-        data.push_back(p);       // b
+        if (m_tile_cache)
+            if (auto tile = m_tile_cache->get(_tile_key(dz_level, col, row, with_icc_profile)); tile)
+            {
+                res[i] = std::move(*tile);
+                continue;
+            }
+        misses.push_back(i);
     }
-    return std::make_tuple(width, height, std::move(data));
+    if (misses.empty()) return res;
+
+    // row major order, so that horizontally adjacent tiles follow each other
+    std::sort(misses.begin(), misses.end(), [&tiles](size_t a, size_t b) {
+        auto const& [la, ca, ra] = tiles[a];
+        auto const& [lb, cb, rb] = tiles[b];
+        return std::tie(la, ra, ca) < std::tie(lb, rb, cb);
+    });
+
+    struct Region
+    {
+        std::pair<int64_t, int64_t> l0_location;
+        int slide_level;
+        std::pair<int64_t, int64_t> l_size;
+        bool synthesized = false; // built from child tiles, never part of a run
+        std::pair<int64_t, int64_t> z_size{};
+    };
+    std::vector<Region> regions;
+    regions.reserve(misses.size());
+    for (auto i : misses)
+    {
+        auto const& [dz_level, col, row] = tiles[i];
+        if (_is_synthesized(dz_level))
+        {
+            auto const z_size = get_tile_dimensions(dz_level, col, row);
+            regions.push_back({{}, -1, z_size, true, z_size});
+            continue;
+        }
+        auto const& [coordinates, z_size] = _get_tile_info(dz_level, col, row);
+        auto const& [l0_location, slide_level, l_size] = coordinates;
+        regions.push_back({l0_location, slide_level, l_size, false, z_size});
+    }
+
+    // coalesce runs of adjacent tiles of the same row into one region
+    // a tile joins the run only if it starts on a whole pixel of the run's slide level, so that slicing the run gives
+    // exactly the pixels a separate read would give
+    struct Run
+    {
+        size_t begin = 0; // [begin, end) of `misses`
+        size_t end = 0;
+        int64_t width = 0;            // run width at slide level
+        std::vector<int64_t> offsets; // x offset of each tile inside the run
+    };
+    constexpr int64_t max_run_width = 4096;
+    std::vector<Run> runs;
+    for (size_t k = 0; k < misses.size(); k++)
+    {
+        auto const& region = regions[k];
+        if (!runs.empty() && !region.synthesized && !regions[runs.back().begin].synthesized)
+        {
+            auto& run = runs.back();
+            auto const& first = regions[run.begin];
+            auto const& [level, col, row] = tiles[misses[k]];
+            auto const& [prev_level, prev_col, prev_row] = tiles[misses[k - 1]];
+            auto const l_downsample = m_level_downsamples[region.slide_level];
+            auto const dx = std::llround((region.l0_location.first - first.l0_location.first) / l_downsample);
+            if (level == prev_level && row == prev_row && col == prev_col + 1 &&
+                region.slide_level == first.slide_level && region.l0_location.second == first.l0_location.second &&
+                region.l_size.second == first.l_size.second &&
+                std::abs(first.l0_location.first + dx * l_downsample - region.l0_location.first) < 1e-6 &&
+                dx + region.l_size.first <= max_run_width)
+            {
+                run.end = k + 1;
+                run.offsets.push_back(dx);
+                run.width = dx + region.l_size.first;
+                continue;
+            }
+        }
+        runs.push_back(Run{k, k + 1, region.l_size.first, {0}});
+    }
+
+    auto& pool = dz_common::ThreadPool::shared();
+
+    std::vector<dz_common::PixelBuffer> pixels(misses.size());
+    pool.parallel_for(runs.size(), [&](size_t r) {
+        auto const& run = runs[r];
+        auto const& first = regions[run.begin];
+        if (first.synthesized)
+        {
+            auto const& [dz_level, col, row] = tiles[misses[run.begin]];
+            pixels[run.begin] = _synthesize_tile_pixels(dz_level, col, row);
+            return;
+        }
+        auto const& [xx, yy] = first.l0_location;
+        auto const height = first.l_size.second;
+        if (run.end - run.begin == 1)
+        {
+            pixels[run.begin] = dz_common::PixelBuffer(first.l_size.first * height);
+            _read_region(pixels[run.begin].data(), xx, yy, first.slide_level, first.l_size.first, height);
+            return;
+        }
+
+        dz_common::PixelBuffer buf(run.width * height);
+        _read_region(buf.data(), xx, yy, first.slide_level, run.width, height);
+        for (auto k = run.begin; k < run.end; k++)
+        {
+            auto const width = regions[k].l_size.first;
+            auto const offset = run.offsets[k - run.begin];
+            pixels[k] = dz_common::PixelBuffer(width * height);
+            for (int64_t y = 0; y < height; y++)
+                std::copy_n(buf.data() + y * run.width + offset, width, pixels[k].data() + y * width);
+        }
+    });
+
+    pool.parallel_for(misses.size(), [&](size_t k) {
+        auto const i = misses[k];
+        auto const& region = regions[k];
+        auto [width, height] = region.l_size;
+        if (m_resize_tiles && !region.synthesized)
+        {
+            pixels[k] = _resize_region(std::move(pixels[k]), width, height, region.z_size.first, region.z_size.second);
+            std::tie(width, height) = region.z_size;
+        }
+        res[i] = encode_tile(pixels[k], width, height, with_icc_profile);
+        pixels[k].release();
+        if (m_tile_cache && !res[i].empty())
+        {
+            auto const& [dz_level, col, row] = tiles[i];
+            m_tile_cache->put(_tile_key(dz_level, col, row, with_icc_profile), res[i]);
+        }
+    });
+
+    return res;
 }
 
-std::vector<uint8_t> DeepZoomGenerator::get_tile(int dz_level, int col, int row, bool with_icc_profile) const
+std::vector<uint8_t> DeepZoomGenerator::_render_tile(int dz_level, int col, int row, bool with_icc_profile) const
+{
+    auto const& [width, height, pixels] = get_tile_pixel_buffer(dz_level, col, row);
+    return encode_tile(pixels, width, height, with_icc_profile);
+}
+
+std::vector<uint8_t> DeepZoomGenerator::encode_tile(std::span<uint32_t const> pixels, int64_t width,
+                                                    int64_t height, bool with_icc_profile) const
+{
+    if (pixels.size() < static_cast<size_t>(width * height)) return {};
+    if (auto tile = _uniform_tile(pixels, width, height, with_icc_profile); tile) return *tile;
+    return _encode_tile(pixels, width, height, with_icc_profile);
+}
+
+std::vector<uint8_t> DeepZoomGenerator::_encode_tile(std::span<uint32_t const> pixels, int64_t width, int64_t height,
+                                                     bool with_icc_profile) const
 {
-    auto const& [width, height, pixels] = get_tile_pixels(dz_level, col, row);
     auto const quality = static_cast<int>(m_quality * 100);
+    auto const& icc_profile = with_icc_profile ? _icc_profile() : no_icc_profile;
     if (m_format == ImageFormat::JPG)
-        return encode_pixels_to_jpeg(pixels, static_cast<int>(width), static_cast<int>(height), quality,
-                                     with_icc_profile ? m_icc_profile : std::vector<uint8_t>{});
+        return encode_pixels_to_jpeg(pixels, static_cast<int>(width), static_cast<int>(height), quality, icc_profile,
+                                     m_jpeg_optimize_coding);
     else if (m_format == ImageFormat::PNG)
         return encode_pixels_to_png(pixels, static_cast<int>(width), static_cast<int>(height),
-                                    std::clamp((100 - quality) / 10, 0, 9),
-                                    with_icc_profile ? m_icc_profile : std::vector<uint8_t>{});
-    return {};
+                                    std::clamp((100 - quality) / 10, 0, 9), icc_profile);
+
+    dz_common::PixelBuffer converted;
+    auto const* bgrx = as_bgrx(pixels, converted);
+    auto const stride = static_cast<int>(width * 4);
+    if (m_format == ImageFormat::AVIF)
+        return dz_common::encode_avif(bgrx, static_cast<int>(width), static_cast<int>(height), stride,
+                                      dz_common::PixelLayout::BGRX, quality, m_avif_speed);
+    // like for PNG, a higher quality means less compression effort when lossless
+    auto const lossless = m_format == ImageFormat::WEBP_LOSSLESS;
+    return dz_common::encode_webp(bgrx, static_cast<int>(width), static_cast<int>(height), stride,
+                                  dz_common::PixelLayout::BGRX, lossless ? 100.f - quality : quality, lossless,
+                                  m_webp_method);
+}
+
+size_t DeepZoomGenerator::encode_tile(std::span<uint32_t const> pixels, int64_t width, int64_t height,
+                                      std::span<uint8_t> dest, bool with_icc_profile) const
+{
+    if (pixels.size() < static_cast<size_t>(width * height)) return 0;
+    if (auto tile = _uniform_tile(pixels, width, height, with_icc_profile); tile)
+    {
+        if (tile->size() > dest.size()) return 0;
+        std::copy(tile->cbegin(), tile->cend(), dest.begin());
+        return tile->size();
+    }
+    auto const quality = static_cast<int>(m_quality * 100);
+    auto const& icc_profile = with_icc_profile ? _icc_profile() : no_icc_profile;
+    if (m_format == ImageFormat::JPG)
+        return encode_pixels_to_jpeg(pixels, static_cast<int>(width), static_cast<int>(height), dest, quality,
+                                     icc_profile, m_jpeg_optimize_coding);
+    else if (m_format == ImageFormat::PNG)
+        return encode_pixels_to_png(pixels, static_cast<int>(width), static_cast<int>(height), dest,
+                                    std::clamp((100 - quality) / 10, 0, 9), icc_profile);
+
+    dz_common::PixelBuffer converted;
+    auto const* bgrx = as_bgrx(pixels, converted);
+    auto const stride = static_cast<int>(width * 4);
+    if (m_format == ImageFormat::AVIF)
+        return dz_common::encode_avif(bgrx, static_cast<int>(width), static_cast<int>(height), stride,
+                                      dz_common::PixelLayout::BGRX, quality, m_avif_speed, dest);
+    auto const lossless = m_format == ImageFormat::WEBP_LOSSLESS;
+    return dz_common::encode_webp(bgrx, static_cast<int>(width), static_cast<int>(height), stride,
+                                  dz_common::PixelLayout::BGRX, lossless ? 100.f - quality : quality, lossless,
+                                  m_webp_method, dest);
 }
 
 std::tuple<std::pair<int64_t, int64_t>, int, std::pair<int64_t, int64_t>> DeepZoomGenerator::get_tile_coordinates(
@@ -205,7 +627,7 @@ std::string DeepZoomGenerator::get_dzi() const
     return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n \
 <Image xmlns = \"http://schemas.microsoft.com/deepzoom/2008\"\n \
   Format=\"" +
-           std::string((m_format == ImageFormat::PNG) ? "png" : "jpg") + "\"\n \
+           std::string(format_extension(m_format)) + "\"\n \
   Overlap=\"" +
            std::to_string(m_overlap) + "\"\n \
   TileSize=\"" +
@@ -220,144 +642,326 @@ std::string DeepZoomGenerator::get_dzi() const
 </Image>";
 }
 
+int64_t DeepZoomGenerator::tile_size() const
+{
+    return m_tile_size;
+}
+
+int DeepZoomGenerator::overlap() const
+{
+    return m_overlap;
+}
+
+DeepZoomGenerator::ImageFormat DeepZoomGenerator::format() const
+{
+    return m_format;
+}
+
+char const* DeepZoomGenerator::format_extension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::PNG:
+        return "png";
+    case ImageFormat::JPG:
+        return "jpg";
+    case ImageFormat::WEBP:
+    case ImageFormat::WEBP_LOSSLESS:
+        return "webp";
+    case ImageFormat::AVIF:
+        return "avif";
+    }
+    return "jpg";
+}
+
+void DeepZoomGenerator::set_webp_method(int method)
+{
+    m_webp_method = std::clamp(method, 0, 6);
+}
+
+int DeepZoomGenerator::webp_method() const
+{
+    return m_webp_method;
+}
+
+void DeepZoomGenerator::set_avif_speed(int speed)
+{
+    m_avif_speed = std::clamp(speed, 0, 10);
+}
+
+int DeepZoomGenerator::avif_speed() const
+{
+    return m_avif_speed;
+}
+
 double DeepZoomGenerator::get_mpp() const
 {
-    return m_mpp;
+    return _metadata().mpp;
 }
 
 std::vector<uint8_t> dz_openslide::DeepZoomGenerator::get_icc_profile() const
 {
-    return m_icc_profile;
+    return _icc_profile();
 }
 
-std::vector<uint8_t> dz_openslide::DeepZoomGenerator::encode_pixels_to_jpeg(std::vector<uint32_t> const& pixels,
-                                                                            int width, int height, int quality,
-                                                                            std::vector<uint8_t> const& icc_profile)
-{
-    jpeg_compress_struct cinfo;
-    jpeg_error_mgr jerr;
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-
-    unsigned char* mem_buffer = nullptr;
-    unsigned long encoded_size;
-    jpeg_mem_dest(&cinfo, &mem_buffer, &encoded_size);
-
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-    // may consumes more time and memory but with better quality and smaller size
-    cinfo.optimize_coding = TRUE;
-
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-    // disable chroma subsampling for very high quality
-    if (quality > 90)
-    {
-        cinfo.comp_info[0].v_samp_factor = 1;
-        cinfo.comp_info[0].h_samp_factor = 1;
-    }
+void DeepZoomGenerator::set_tile_cache(std::shared_ptr<dz_common::TileCache> cache)
+{
+    m_tile_cache = std::move(cache);
+}
+
+std::shared_ptr<dz_common::TileCache> DeepZoomGenerator::tile_cache() const
+{
+    return m_tile_cache;
+}
+
+bool DeepZoomGenerator::is_cached(int dz_level, int col, int row, bool with_icc_profile) const
+{
+    return m_tile_cache && m_tile_cache->contains(_tile_key(dz_level, col, row, with_icc_profile));
+}
+
+void DeepZoomGenerator::set_max_handles(int max_handles)
+{
+    m_max_handles = std::max(1, max_handles);
+    // not opened yet (sidecar): the pool is set up with the slide
+    if (!m_slide) return;
+    // the primary handle is shared with the pool, drop the pool before it can be destroyed twice
+    m_pool = nullptr;
+    if (m_max_handles > 1) m_pool = std::make_unique<HandlePool>(m_filepath, m_slide.get(), m_max_handles);
+}
+
+void DeepZoomGenerator::set_synthesis(double min_downsample, Resampling resampling)
+{
+    m_synthesis_min_downsample = std::max(0., min_downsample);
+    m_resampling = resampling;
+}
+
+double DeepZoomGenerator::synthesis_min_downsample() const
+{
+    return m_synthesis_min_downsample;
+}
 
-    jpeg_start_compress(&cinfo, TRUE);
+void DeepZoomGenerator::set_resize_tiles(bool resize, Resampling resampling)
+{
+    m_resize_tiles = resize;
+    m_tile_resampling = resampling;
+}
 
-    if (!icc_profile.empty())
-        jpeg_write_icc_profile(&cinfo, reinterpret_cast<const JOCTET*>(icc_profile.data()),
-                               static_cast<unsigned int>(icc_profile.size()));
+bool DeepZoomGenerator::resize_tiles() const
+{
+    return m_resize_tiles;
+}
+
+void DeepZoomGenerator::set_blank_detection(int tolerance)
+{
+    m_blank = nullptr;
+    if (tolerance < 0 || !is_valid()) return;
+    m_blank = std::make_unique<Blank>();
+    m_blank->tolerance = std::min(tolerance, 255);
+    // not opened yet (sidecar): scanned when it is, tiles read until then are only checked for uniformity
+    if (m_slide) _scan_blank(m_slide.get());
+}
+
+void DeepZoomGenerator::_scan_blank(_openslide* slide) const
+{
+    // the whole lowest level, in slide coordinates whatever `limit_bounds`
+    auto const level = m_levels - 1;
+    int64_t level_width = 0, level_height = 0;
+    openslide_get_level_dimensions(slide, level, &level_width, &level_height);
+    if (level_width <= 0 || level_height <= 0 ||
+        level_width * level_height > dz_common::BlankIndex::max_picture_pixels)
+        return;
+    dz_common::PixelBuffer pixels(level_width * level_height);
+    // straight from `slide`: the pool may not be set up yet
+    openslide_read_region(slide, pixels.data(), 0, 0, level, level_width, level_height);
+    // a failed read is all transparent, which would look blank
+    if (openslide_get_error(slide)) return;
+
+    auto const downsample = m_level_downsamples[level];
+    m_blank->index = dz_common::BlankIndex::from_picture(
+        pixels.data(), static_cast<int>(level_width), static_cast<int>(level_height),
+        std::llround(level_width * downsample), std::llround(level_height * downsample), m_blank->tolerance,
+        m_t_dimensions, [this](int dz_level, int64_t col, int64_t row) {
+            auto const& [l0_location, slide_level, l_size] =
+                get_tile_coordinates(dz_level, static_cast<int>(col), static_cast<int>(row));
+            auto const l_downsample = m_level_downsamples[slide_level];
+            return std::make_tuple(l0_location.first, l0_location.second,
+                                   static_cast<int64_t>(std::ceil(l_size.first * l_downsample)),
+                                   static_cast<int64_t>(std::ceil(l_size.second * l_downsample)));
+        });
+    m_blank->scanned.store(true, std::memory_order_release);
+}
 
-    std::vector<uint8_t> rgb(width * 3);
-    for (int j = 0; j < height; j++)
+int DeepZoomGenerator::blank_tolerance() const
+{
+    return m_blank ? m_blank->tolerance : -1;
+}
+
+bool DeepZoomGenerator::is_blank(int dz_level, int col, int row) const
+{
+    return m_blank && m_blank->blank(dz_level, col, row, nullptr);
+}
+
+bool DeepZoomGenerator::build_tissue_index(std::string const& index_path)
+{
+    m_tissue = {};
+    auto* slide = _slide();
+    if (!slide) return false;
+    // the mask covers the whole level 0, whatever `limit_bounds`
+    int64_t l0_width = 0, l0_height = 0;
+    openslide_get_level_dimensions(slide, 0, &l0_width, &l0_height);
+
+    if (!index_path.empty())
+        if (auto index = dz_common::TissueIndex::load(index_path);
+            !index.empty() && index.l0_dimensions() == std::make_pair(l0_width, l0_height))
+            m_tissue = std::move(index);
+    if (m_tissue.empty())
     {
-        uint32_t const* argb = pixels.data() + j * width;
-        uint8_t* dest = rgb.data();
-        for (int i = 0; i < width; i++)
+        auto const level = m_levels - 1;
+        int64_t level_width = 0, level_height = 0;
+        openslide_get_level_dimensions(slide, level, &level_width, &level_height);
+        if (level_width <= 0 || level_height <= 0 || level_width * level_height > (int64_t{64} << 20))
         {
-            uint32_t p = argb[i];
-            dest[0] = p >> 16;
-            dest[1] = p >> 8;
-            dest[2] = p;
-            dest += 3;
+            printf("No level small enough for a tissue index: %s\n", m_filepath.c_str());
+            return false;
         }
+        dz_common::PixelBuffer pixels(level_width * level_height);
+        _read_region(pixels.data(), 0, 0, level, level_width, level_height);
+        if (openslide_get_error(slide)) return false;
 
-        JSAMPROW row_ptr = rgb.data();
-        jpeg_write_scanlines(&cinfo, &row_ptr, 1);
+        auto const scale = std::min(1., static_cast<double>(dz_common::TissueIndex::thumbnail_size) /
+                                            std::max(level_width, level_height));
+        auto const width = std::max<int64_t>(1, std::llround(level_width * scale));
+        auto const height = std::max<int64_t>(1, std::llround(level_height * scale));
+        if (width != level_width || height != level_height)
+        {
+            dz_common::PixelBuffer thumbnail(width * height);
+            dz_common::resample(pixels.data(), level_width, level_height, level_width, thumbnail.data(), width,
+                                height, width, dz_common::ResampleFilter::AREA);
+            pixels = std::move(thumbnail);
+        }
+        m_tissue = dz_common::TissueIndex::from_thumbnail(reinterpret_cast<uint8_t const*>(pixels.data()),
+                                                          static_cast<int>(width), static_cast<int>(height),
+                                                          static_cast<int>(width * 4), dz_common::PixelLayout::BGRX,
+                                                          l0_width, l0_height);
+        if (!index_path.empty()) m_tissue.save(index_path);
     }
 
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
+    m_tissue.index_levels(m_t_dimensions, [this](int dz_level, int64_t col, int64_t row) {
+        auto const& [l0_location, slide_level, l_size] =
+            get_tile_coordinates(dz_level, static_cast<int>(col), static_cast<int>(row));
+        auto const downsample = m_level_downsamples[slide_level];
+        return std::make_tuple(l0_location.first, l0_location.second,
+                               static_cast<int64_t>(std::ceil(l_size.first * downsample)),
+                               static_cast<int64_t>(std::ceil(l_size.second * downsample)));
+    });
+    return true;
+}
 
-    std::vector<uint8_t> res(mem_buffer, mem_buffer + encoded_size);
+dz_common::TissueIndex const& DeepZoomGenerator::tissue_index() const
+{
+    return m_tissue;
+}
 
-    free(mem_buffer);
+bool DeepZoomGenerator::has_tissue(int dz_level, int col, int row) const
+{
+    return m_tissue.has_tissue(dz_level, col, row);
+}
 
-    return res;
+int DeepZoomGenerator::max_handles() const
+{
+    return m_pool ? m_pool->max_handles() : m_max_handles;
 }
 
-std::vector<uint8_t> dz_openslide::DeepZoomGenerator::encode_pixels_to_png(std::vector<uint32_t> const& pixels,
+void DeepZoomGenerator::set_jpeg_optimize_coding(bool optimize_coding)
+{
+    m_jpeg_optimize_coding = optimize_coding;
+}
+
+bool DeepZoomGenerator::jpeg_optimize_coding() const
+{
+    return m_jpeg_optimize_coding;
+}
+
+std::vector<uint8_t> dz_openslide::DeepZoomGenerator::encode_pixels_to_jpeg(std::span<uint32_t const> pixels,
+                                                                            int width, int height, int quality,
+                                                                            std::vector<uint8_t> const& icc_profile,
+                                                                            bool optimize_coding)
+{
+    return dz_common::encode_jpeg(pixels, width, height, quality, icc_profile, optimize_coding);
+}
+
+size_t dz_openslide::DeepZoomGenerator::encode_pixels_to_jpeg(std::span<uint32_t const> pixels, int width,
+                                                              int height, std::span<uint8_t> dest, int quality,
+                                                              std::vector<uint8_t> const& icc_profile,
+                                                              bool optimize_coding)
+{
+    return dz_common::encode_jpeg(pixels, width, height, dest, quality, icc_profile, optimize_coding);
+}
+
+std::vector<uint8_t> dz_openslide::DeepZoomGenerator::encode_pixels_to_png(std::span<uint32_t const> pixels,
                                                                            int width, int height, int compression_level,
                                                                            std::vector<uint8_t> const& icc_profile)
 {
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr) return {};
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr)
+    return dz_common::encode_png(pixels, width, height, compression_level, icc_profile);
+}
+
+size_t dz_openslide::DeepZoomGenerator::encode_pixels_to_png(std::span<uint32_t const> pixels, int width,
+                                                             int height, std::span<uint8_t> dest,
+                                                             int compression_level,
+                                                             std::vector<uint8_t> const& icc_profile)
+{
+    return dz_common::encode_png(pixels, width, height, dest, compression_level, icc_profile);
+}
+
+size_t DeepZoomGenerator::max_encoded_size(ImageFormat format, int64_t width, int64_t height,
+                                           size_t icc_profile_size)
+{
+    switch (format)
     {
-        png_destroy_write_struct(&png_ptr, NULL);
-        return {};
-    }
-    if (setjmp(png_jmpbuf(png_ptr)))
+    case ImageFormat::JPG:
     {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        return {};
+        // `tjBufSize` of 4:4:4 (6 bytes per pixel of 8x8 MCUs) or 4:2:0 (3 bytes per pixel of 16x16 MCUs, larger
+        // for tiles of 8 pixels or less), 2 KiB of headers, plus the ICC profile in APP2 markers of up to 65519
+        // bytes with 18 bytes of overhead each
+        auto const padded = [&](int64_t mcu) {
+            return static_cast<size_t>((width + mcu - 1) / mcu * mcu) *
+                   static_cast<size_t>((height + mcu - 1) / mcu * mcu);
+        };
+        return std::max(padded(8) * 6, padded(16) * 3) + 2048 + icc_profile_size +
+               (icc_profile_size + 65518) / 65519 * 18;
     }
-
-    // since the argb_bytes is premultiplied ARGB, we can just discard the alpha and convert it to RGB
-    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    png_set_compression_level(png_ptr, compression_level);
-
-#ifdef PNG_iCCP_SUPPORTED
-    if (!icc_profile.empty())
+    case ImageFormat::PNG:
     {
-        png_set_iCCP(png_ptr, info_ptr, "ICC Profile", PNG_COMPRESSION_TYPE_DEFAULT, icc_profile.data(),
-                     icc_profile.size());
+        // zlib's `compressBound` of the filtered rows in IDAT chunks of 8 KiB, signature, IHDR, IEND
+        // and the (compressed) ICC profile in iCCP
+        auto const compress_bound = [](size_t n) { return n + (n >> 12) + (n >> 14) + (n >> 25) + 13; };
+        auto const idat = compress_bound(static_cast<size_t>(height) * (1 + static_cast<size_t>(width) * 3));
+        auto const iccp = icc_profile_size ? compress_bound(icc_profile_size) + 12 + 13 : 0;
+        return idat + (idat / 8192 + 1) * 12 + 8 + 25 + 12 + iccp;
     }
-#endif
-
-    std::vector<uint8_t> buffer;
-    buffer.reserve(static_cast<size_t>(width) * height * 4);
-    auto write_callback = [](png_structp png_ptr, png_bytep data, png_size_t length) {
-        auto* p = static_cast<std::vector<uint8_t>*>(png_get_io_ptr(png_ptr));
-        //p->insert(p->end(), data, data + length);
-        std::copy(data, data + length, std::back_inserter(*p));
-    };
-    png_set_write_fn(png_ptr, &buffer, write_callback, nullptr);
-
-    png_write_info(png_ptr, info_ptr);
-    png_set_packing(png_ptr);
+    case ImageFormat::WEBP:
+    case ImageFormat::WEBP_LOSSLESS:
+    case ImageFormat::AVIF:
+        break;
+    }
+    return dz_common::max_webp_avif_size(width, height);
+}
 
-    std::vector<uint8_t> rgb(width * 3);
-    for (int j = 0; j < height; j++)
+size_t DeepZoomGenerator::max_tile_size(bool with_icc_profile) const
+{
+    // tiles read from the slide have the size of their region on the slide level, which is larger than
+    // `get_tile_dimensions` when the level's downsample does not match the deepzoom one
+    auto const z_size = m_tile_size + 2 * m_overlap;
+    int64_t width = z_size, height = z_size;
+    for (auto l = 0; l < m_dz_levels; l++)
     {
-        uint32_t const* argb = pixels.data() + j * width;
-        uint8_t* dest = rgb.data();
-        for (int i = 0; i < width; i++)
-        {
-            uint32_t p = argb[i];
-            dest[0] = p >> 16;
-            dest[1] = p >> 8;
-            dest[2] = p;
-            dest += 3;
-        }
-        png_write_row(png_ptr, rgb.data());
+        if (_is_synthesized(l)) continue;
+        auto const l_size = static_cast<int64_t>(std::ceil(z_size * m_level_dz_downsamples[l])) + 1;
+        auto const& [level_width, level_height] = m_l_dimensions[m_preferred_slide_levels[l]];
+        width = std::max(width, std::min(l_size, level_width));
+        height = std::max(height, std::min(l_size, level_height));
     }
-
-    png_write_end(png_ptr, info_ptr);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-
-    buffer.shrink_to_fit();
-
-    return buffer;
+    return max_encoded_size(m_format, width, height, with_icc_profile ? _metadata().icc_profile_size : 0);
 }
 
 std::pair<std::tuple<std::pair<int64_t, int64_t>, // l0_location
@@ -395,10 +999,254 @@ DeepZoomGenerator::_get_tile_info(int dz_level, int col, int row) const
     return std::make_pair(std::make_tuple(l0_location, slide_level, l_size), z_size);
 }
 
-std::vector<uint8_t> dz_openslide::DeepZoomGenerator::_get_icc_profile() const
+void DeepZoomGenerator::_read_region(uint32_t* dest, int64_t x, int64_t y, int slide_level, int64_t width,
+                                     int64_t height) const
+{
+    auto* slide = _slide();
+    if (!slide)
+    {
+        // as openslide does for a slide in error: transparent
+        std::fill_n(dest, width * height, 0u);
+        return;
+    }
+    if (m_pool)
+    {
+        auto handle = m_pool->acquire();
+        openslide_read_region(handle.get(), dest, x, y, slide_level, width, height);
+    }
+    else
+        openslide_read_region(slide, dest, x, y, slide_level, width, height);
+}
+
+bool DeepZoomGenerator::_is_synthesized(int dz_level) const
+{
+    // the highest level has no children
+    return m_synthesis_min_downsample > 0. && dz_level + 1 < m_dz_levels &&
+           m_level_dz_downsamples[dz_level] >= m_synthesis_min_downsample;
+}
+
+dz_common::PixelBuffer DeepZoomGenerator::_synthesize_tile_pixels(int dz_level, int col, int row) const
 {
-    auto icc_profile_size = openslide_get_icc_profile_size(m_slide);
-    std::vector<uint8_t> icc_profile(icc_profile_size);
-    openslide_read_icc_profile(m_slide, icc_profile.data());
-    return icc_profile;
-}
\ No newline at end of file
+    auto const [width, height] = get_tile_dimensions(dz_level, col, row);
+    // tile origin at its level, then the area it covers at the child level
+    auto const x = col * m_tile_size - (col == 0 ? 0 : m_overlap);
+    auto const y = row * m_tile_size - (row == 0 ? 0 : m_overlap);
+    auto const child_level = dz_level + 1;
+    auto const& [child_level_width, child_level_height] = m_dzl_dimensions[child_level];
+    auto const region_x = 2 * x;
+    auto const region_y = 2 * y;
+    auto const region_width = std::min(2 * width, child_level_width - region_x);
+    auto const region_height = std::min(2 * height, child_level_height - region_y);
+
+    auto const& [child_cols, child_rows] = m_t_dimensions[child_level];
+    std::vector<std::pair<int, int>> children;
+    for (auto r = 2 * row; r <= std::min<int64_t>(2 * row + 1, child_rows - 1); r++)
+        for (auto c = 2 * col; c <= std::min<int64_t>(2 * col + 1, child_cols - 1); c++)
+            children.emplace_back(c, r);
+
+    dz_common::PixelBuffer region(region_width * region_height);
+    // bounds of the region covered by the children
+    auto covered_x0 = region_width, covered_y0 = region_height;
+    int64_t covered_x1 = 0, covered_y1 = 0;
+    std::mutex covered_mutex;
+    dz_common::ThreadPool::shared().parallel_for(children.size(), [&](size_t i) {
+        auto const [c, r] = children[i];
+        auto const pixels = _child_tile_pixels(child_level, c, r);
+        auto const [child_width, child_height] = get_tile_dimensions(child_level, c, r);
+        // child origin inside the region
+        auto const cx = c * m_tile_size - (c == 0 ? 0 : m_overlap) - region_x;
+        auto const cy = r * m_tile_size - (r == 0 ? 0 : m_overlap) - region_y;
+        auto const x0 = std::max<int64_t>(0, cx), x1 = std::min(region_width, cx + child_width);
+        auto const y0 = std::max<int64_t>(0, cy), y1 = std::min(region_height, cy + child_height);
+        if (pixels.empty() || x1 <= x0 || y1 <= y0) return;
+        for (auto yy = y0; yy < y1; yy++)
+            std::copy_n(pixels.data() + (yy - cy) * child_width + (x0 - cx), x1 - x0,
+                        region.data() + yy * region_width + x0);
+        std::lock_guard lock(covered_mutex);
+        covered_x0 = std::min(covered_x0, x0);
+        covered_x1 = std::max(covered_x1, x1);
+        covered_y0 = std::min(covered_y0, y0);
+        covered_y1 = std::max(covered_y1, y1);
+    });
+
+    // the outer overlap ring lies in the neighbours' children, replicate the edge instead of reading them
+    if (covered_x1 > covered_x0 && covered_y1 > covered_y0)
+    {
+        for (auto yy = covered_y0; yy < covered_y1; yy++)
+        {
+            auto* line = region.data() + yy * region_width;
+            std::fill(line, line + covered_x0, line[covered_x0]);
+            std::fill(line + covered_x1, line + region_width, line[covered_x1 - 1]);
+        }
+        for (int64_t yy = 0; yy < covered_y0; yy++)
+            std::copy_n(region.data() + covered_y0 * region_width, region_width, region.data() + yy * region_width);
+        for (auto yy = covered_y1; yy < region_height; yy++)
+            std::copy_n(region.data() + (covered_y1 - 1) * region_width, region_width,
+                        region.data() + yy * region_width);
+    }
+    else
+        std::fill(region.begin(), region.end(), 0u);
+
+    dz_common::PixelBuffer pixels(width * height);
+    if (m_resampling == Resampling::BILINEAR)
+        dz_common::resample(region.data(), region_width, region_height, region_width, pixels.data(), width, height,
+                            width, dz_common::ResampleFilter::BILINEAR);
+    else if (m_resampling == Resampling::LANCZOS)
+        dz_common::reduce_2x2_lanczos(region.data(), region_width, region_height, region_width, pixels.data(), width);
+    else
+        dz_common::reduce_2x2(region.data(), region_width, region_height, region_width, pixels.data(), width);
+    return pixels;
+}
+
+dz_common::PixelBuffer DeepZoomGenerator::_child_tile_pixels(int dz_level, int col, int row) const
+{
+    auto key = _tile_key(dz_level, col, row, false);
+    key.format = dz_common::TileKey::pixels_format;
+    key.quality = 0.f;
+    if (m_tile_cache)
+        if (auto bytes = m_tile_cache->get(key); bytes)
+        {
+            dz_common::PixelBuffer pixels(bytes->size() / sizeof(uint32_t));
+            std::memcpy(pixels.data(), bytes->data(), pixels.size() * sizeof(uint32_t));
+            return pixels;
+        }
+
+    auto [width, height, pixels] = get_tile_pixel_buffer(dz_level, col, row);
+    auto const [z_width, z_height] = get_tile_dimensions(dz_level, col, row);
+    if (!pixels.empty() && (width != z_width || height != z_height))
+    {
+        dz_common::PixelBuffer resized(z_width * z_height);
+        dz_common::resize_area(pixels.data(), width, height, width, resized.data(), z_width, z_height, z_width);
+        pixels = std::move(resized);
+    }
+    if (m_tile_cache && !pixels.empty())
+    {
+        std::vector<uint8_t> bytes(pixels.size() * sizeof(uint32_t));
+        std::memcpy(bytes.data(), pixels.data(), bytes.size());
+        m_tile_cache->put(key, std::move(bytes));
+    }
+    return std::move(pixels);
+}
+
+std::pair<int64_t, int64_t> DeepZoomGenerator::_pixel_dimensions(int dz_level, int col, int row) const
+{
+    auto const& [coordinates, z_size] = _get_tile_info(dz_level, col, row);
+    return m_resize_tiles || _is_synthesized(dz_level) ? z_size : std::get<2>(coordinates);
+}
+
+std::shared_ptr<std::vector<uint8_t> const> DeepZoomGenerator::_blank_tile(int dz_level, int col, int row,
+                                                                           bool with_icc_profile) const
+{
+    uint32_t color = 0;
+    if (!m_blank || !m_blank->blank(dz_level, col, row, &color)) return nullptr;
+    auto const [width, height] = _pixel_dimensions(dz_level, col, row);
+    return _encoded_blank_tile(color, width, height, with_icc_profile);
+}
+
+std::shared_ptr<std::vector<uint8_t> const> DeepZoomGenerator::_uniform_tile(std::span<uint32_t const> pixels,
+                                                                             int64_t width, int64_t height,
+                                                                             bool with_icc_profile) const
+{
+    if (!m_blank || width <= 0 || height <= 0) return nullptr;
+    uint32_t color = 0;
+    if (!dz_common::BlankIndex::uniform(pixels.data(), static_cast<size_t>(width * height), m_blank->tolerance,
+                                        &color))
+        return nullptr;
+    return _encoded_blank_tile(color, width, height, with_icc_profile);
+}
+
+std::shared_ptr<std::vector<uint8_t> const> DeepZoomGenerator::_encoded_blank_tile(uint32_t color, int64_t width,
+                                                                                   int64_t height,
+                                                                                   bool with_icc_profile) const
+{
+    return m_blank->tiles.get(color, width, height, with_icc_profile, [&]() {
+        dz_common::PixelBuffer pixels(width * height);
+        std::fill(pixels.begin(), pixels.end(), color);
+        return _encode_tile(pixels, width, height, with_icc_profile);
+    });
+}
+
+dz_common::PixelBuffer DeepZoomGenerator::_resize_region(dz_common::PixelBuffer pixels, int64_t width,
+                                                        int64_t height, int64_t z_width, int64_t z_height) const
+{
+    if (!m_resize_tiles || pixels.empty() || (width == z_width && height == z_height)) return pixels;
+
+    // integer ratios (levels halfway between slide levels) are plain area averages whatever the filter
+    auto filter = m_tile_resampling == Resampling::LANCZOS    ? dz_common::ResampleFilter::LANCZOS
+                  : m_tile_resampling == Resampling::BILINEAR ? dz_common::ResampleFilter::BILINEAR
+                                                              : dz_common::ResampleFilter::AREA;
+    if (width % z_width == 0 && height % z_height == 0 && width / z_width == height / z_height)
+        filter = dz_common::ResampleFilter::AREA;
+
+    dz_common::PixelBuffer resized(z_width * z_height);
+    dz_common::resample(pixels.data(), width, height, width, resized.data(), z_width, z_height, z_width, filter);
+    return resized;
+}
+
+dz_common::TileKey DeepZoomGenerator::_tile_key(int dz_level, int col, int row, bool with_icc_profile) const
+{
+    // `limit_bounds` shifts every tile and resizing changes its pixels, so they are part of the slide identity
+    auto slide = m_limit_bounds ? m_filepath + "?limit_bounds" : m_filepath;
+    if (!m_resize_tiles)
+        slide += "?raw";
+    else if (m_tile_resampling != Resampling::BILINEAR)
+        slide += "?resampling=" + std::to_string(static_cast<int>(m_tile_resampling));
+    // uniform tiles are flattened to one color within the tolerance
+    if (m_blank) slide += "?blank=" + std::to_string(m_blank->tolerance);
+    // `icc` is the flag as asked: whether the slide has a profile is not known before it is opened (lazy open modes),
+    // a slide without one caches its tiles twice if asked both ways
+    return dz_common::TileKey{.slide = std::move(slide),
+                              .format = static_cast<int>(m_format),
+                              .quality = m_quality,
+                              .tile_size = m_tile_size,
+                              .overlap = m_overlap,
+                              .dz_level = dz_level,
+                              .col = col,
+                              .row = row,
+                              .icc = with_icc_profile};
+}
+
+DeepZoomGenerator::Metadata const& DeepZoomGenerator::_metadata() const
+{
+    std::call_once(*m_metadata_once, [this]() {
+        auto* slide = _slide();
+        if (!slide) return;
+        if (auto mpp_x = openslide_get_property_value(slide, OPENSLIDE_PROPERTY_NAME_MPP_X); mpp_x)
+            if (auto mpp_y = openslide_get_property_value(slide, OPENSLIDE_PROPERTY_NAME_MPP_Y); mpp_y)
+                m_metadata.mpp = (std::strtod(mpp_x, nullptr) + std::strtod(mpp_y, nullptr)) / 2.;
+        if (auto bg_color = openslide_get_property_value(slide, OPENSLIDE_PROPERTY_NAME_BACKGROUND_COLOR); bg_color)
+            m_metadata.background_color = std::string("#") + bg_color;
+        auto const& icc_profile = _icc_profile();
+        m_metadata.icc_profile_size = icc_profile.size();
+        m_metadata.icc_profile_hash = dz_common::SlideMetadata::hash(icc_profile);
+    });
+    return m_metadata;
+}
+
+std::vector<uint8_t> const& DeepZoomGenerator::_icc_profile() const
+{
+    std::call_once(*m_icc_profile_once, [this]() {
+        auto* slide = _slide();
+        if (!slide) return;
+        auto const size = openslide_get_icc_profile_size(slide);
+        if (size <= 0) return;
+        m_icc_profile.resize(static_cast<size_t>(size));
+        openslide_read_icc_profile(slide, m_icc_profile.data());
+    });
+    return m_icc_profile;
+}
+
+_openslide* DeepZoomGenerator::_slide() const
+{
+    std::call_once(*m_slide_once, [this]() {
+        m_slide.reset(openslide_open(m_filepath.c_str()));
+        if (!m_slide)
+        {
+            printf("Failed to open slide: %s\n", m_filepath.c_str());
+            return;
+        }
+        if (m_max_handles > 1) m_pool = std::make_unique<HandlePool>(m_filepath, m_slide.get(), m_max_handles);
+        if (m_blank) _scan_blank(m_slide.get());
+    });
+    return m_slide.get();
+}
@@ -4,28 +4,67 @@
 #include <vector>
 #include <string>
 #include <utility>
+#include <memory>
+#include <tuple>
+#include <span>
+#include <mutex>
+
+#include "dz_common/pixelbuffer.hpp"
+#include "dz_common/tissueindex.hpp"
 
 struct _openslide;
+namespace dz_common
+{
+    class TileCache;
+    struct TileKey;
+    struct SlideMetadata;
+} // namespace dz_common
+
 namespace dz_openslide
 {
     class DeepZoomGenerator
     {
     public:
+        // WEBP/WEBP_LOSSLESS/AVIF need `dz_common` built with libwebp/libavif
         enum class ImageFormat : int
         {
             PNG = 0,
-            JPG
+            JPG,
+            WEBP,
+            WEBP_LOSSLESS,
+            AVIF
+        };
+
+        // filter used to build a tile out of its child tiles, or to resize a slide region to its tile
+        enum class Resampling : int
+        {
+            BOX = 0, // area average
+            LANCZOS,
+            BILINEAR
         };
 
+        // what the constructor reads besides the level tables
+        enum class OpenMode : int
+        {
+            EAGER = 0, // everything: MPP, background color and the ICC profile
+            LAZY       // only what `get_dzi` and the tiles need, the rest is read on first use (thread-safe)
+        };
+
+        // with a `metadata_path` the levels, bounds, MPP, background color and ICC profile size/hash are loaded from
+        // that sidecar (see `dz_common::SlideMetadata`) if it was written for this very file, and the slide itself is
+        // then only opened by the first call that reads from it (a tile that is not cached, the ICC profile, blank
+        // detection, the tissue index). otherwise they are read from the slide and saved there.
+        // `dz_common::SlideMetadata::sidecar_path` gives the usual path, an empty one does not use a sidecar
         DeepZoomGenerator(std::string filepath, int tile_size = 254, int overlap = 1, bool limit_bounds = false,
-                          ImageFormat format = ImageFormat::JPG, float quality = 0.75f);
+                          ImageFormat format = ImageFormat::JPG, float quality = 0.75f,
+                          OpenMode open_mode = OpenMode::EAGER, std::string const& metadata_path = {});
         ~DeepZoomGenerator();
 
         DeepZoomGenerator(DeepZoomGenerator const&) = delete;
         DeepZoomGenerator& operator=(DeepZoomGenerator const&) = delete;
 
-        DeepZoomGenerator(DeepZoomGenerator&&) = default;
-        DeepZoomGenerator& operator=(DeepZoomGenerator&&) = default;
+        DeepZoomGenerator(DeepZoomGenerator&&) noexcept;
+        DeepZoomGenerator& operator=(DeepZoomGenerator&&) noexcept;
 
         bool is_valid() const;
 
@@ -36,12 +75,24 @@ namespace dz_openslide
         // deepzoom level dimensions <x, y>
         std::vector<std::pair<int64_t, int64_t>> level_dimensions() const;
         int64_t tile_count() const;
-        // <width, height, ARGB_Premultiplied_pixels>
+        // <width, height, ARGB_Premultiplied_pixels>, of `get_tile_dimensions` unless tile resizing is disabled
         std::tuple<int64_t, int64_t, std::vector<uint32_t>> get_tile_pixels(int dz_level, int col, int row) const;
+        // same, in a pooled buffer of the calling thread that goes back to the pool when released
+        // no heap allocation once the pool is warm, what `get_tile` and `get_tiles` use
+        std::tuple<int64_t, int64_t, dz_common::PixelBuffer> get_tile_pixel_buffer(int dz_level, int col,
+                                                                                   int row) const;
         // <width, height, ARGB_Premultiplied_bytes>
         std::tuple<int64_t, int64_t, std::vector<uint8_t>> get_tile_bytes(int dz_level, int col, int row) const;
-        // PNG/JPG bytes
+        // encoded bytes
         std::vector<uint8_t> get_tile(int dz_level, int col, int row, bool with_icc_profile = false) const;
+        // encodes into `dest` (e.g. a socket send buffer) instead of allocating, returns the encoded size,
+        // 0 on failure or if `dest` is too small; `max_tile_size` bytes are always enough
+        size_t get_tile(int dz_level, int col, int row, std::span<uint8_t> dest, bool with_icc_profile = false) const;
+        // encoded bytes for a batch of <dz_level, col, row>, in the same order
+        // cache misses are read and encoded in parallel, horizontally adjacent tiles are read with a single
+        // `openslide_read_region` and sliced afterwards
+        std::vector<std::vector<uint8_t>> get_tiles(std::span<std::tuple<int, int, int> const> tiles,
+                                                    bool with_icc_profile = false) const;
         // <<x, y>, slide_level, <width, height>>
         std::tuple<std::pair<int64_t, int64_t>, int, std::pair<int64_t, int64_t>> get_tile_coordinates(int dz_level,
                                                                                                        int col,
@@ -50,17 +101,117 @@ namespace dz_openslide
         std::pair<int64_t, int64_t> get_tile_dimensions(int dz_level, int col, int row) const;
         // XML
         std::string get_dzi() const;
+        int64_t tile_size() const;
+        int overlap() const;
+        ImageFormat format() const;
+        // file extension and DZI `Format` of `format`
+        static char const* format_extension(ImageFormat format);
+        // encoded bytes of ARGB_Premultiplied pixels, with the generator's format and quality
+        std::vector<uint8_t> encode_tile(std::span<uint32_t const> pixels, int64_t width, int64_t height,
+                                         bool with_icc_profile = false) const;
+        size_t encode_tile(std::span<uint32_t const> pixels, int64_t width, int64_t height, std::span<uint8_t> dest,
+                           bool with_icc_profile = false) const;
+        // upper bound of the encoded size of any tile, for buffers handed to `get_tile`
+        size_t max_tile_size(bool with_icc_profile = false) const;
+        // upper bound of the encoded size of a `width` x `height` tile, exact bounds of the libraries for JPG/PNG,
+        // a generous one for WEBP/AVIF
+        static size_t max_encoded_size(ImageFormat format, int64_t width, int64_t height, size_t icc_profile_size = 0);
 
         double get_mpp() const;
 
         // ICC profile
         std::vector<uint8_t> get_icc_profile() const;
 
-        static std::vector<uint8_t> encode_pixels_to_jpeg(std::vector<uint32_t> const& pixels, int width, int height,
-                                                          int quality, std::vector<uint8_t> const& icc_profile = {});
-        static std::vector<uint8_t> encode_pixels_to_png(std::vector<uint32_t> const& pixels, int width, int height,
+        // encoded tiles are looked up in / stored to the cache by `get_tile`
+        // the same cache can be shared by several generators, nullptr disables caching
+        void set_tile_cache(std::shared_ptr<dz_common::TileCache> cache);
+        std::shared_ptr<dz_common::TileCache> tile_cache() const;
+        // true if the cache holds the encoded tile, without counting as a lookup
+        bool is_cached(int dz_level, int col, int row, bool with_icc_profile = false) const;
+
+        // concurrency
+        // `openslide` itself is thread-safe, so all const methods can be called from several threads at once.
+        // by default every thread reads through the same `openslide_t` handle, which serializes on its internal locks;
+        // with `max_handles` > 1 reads are spread over a bounded pool of handles opened on demand (sharing one
+        // `openslide` tile cache), a thread waits when all of them are busy. 0 or 1 goes back to the single handle
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_max_handles(int max_handles);
+        int max_handles() const;
+
+        // synthesis of low resolution levels
+        // a deepzoom level whose preferred slide level is at least `min_downsample` times larger is not read from the
+        // slide, each of its tiles is built from its (up to) four child tiles of the next level with `resampling`,
+        // recursively, so that no tile reads more than ~(`tile_size` * `min_downsample`)^2 slide pixels and all tiles
+        // have the size given by `get_tile_dimensions`. child pixels are taken from / kept in the tile cache if one is
+        // set. pixels of the outer overlap ring that no child covers are the replicated edge. 0 disables (default)
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_synthesis(double min_downsample, Resampling resampling = Resampling::BOX);
+        double synthesis_min_downsample() const;
+
+        // resizing of slide regions to their tiles
+        // the region a tile is read from is `get_tile_coordinates`' size, larger than `get_tile_dimensions` whenever
+        // the deepzoom level falls between two slide levels. with `resize` (default) it is scaled down to the tile:
+        // area averaged when it is an integer multiple of the tile, with `resampling` otherwise (SIMD, see
+        // `dz_common::resample`). without, tiles are the raw regions, as `openslide_read_region` returns them
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_resize_tiles(bool resize, Resampling resampling = Resampling::BILINEAR);
+        bool resize_tiles() const;
+
+        // blank tiles
+        // with `tolerance` >= 0 the lowest slide level is read once into an occupancy bitmap of every deepzoom level:
+        // a tile whose area there stays within `tolerance` levels of one color on every channel (glass, or the
+        // transparent outside of the scan) is blank. blank tiles are never read, `get_tile`/`get_tiles` answer them
+        // with a tile of that color and size encoded once, `get_tile_pixels` fills them. tiles that are read and turn
+        // out uniform all the same skip the encoder the same way. tissue smaller than a pixel of the lowest level is
+        // not seen by the bitmap; a lowest level over 64 Mpx is not scanned (read tiles are still checked).
+        // -1 disables (default)
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_blank_detection(int tolerance = 2);
+        int blank_tolerance() const;
+        // true if the bitmap says the tile is blank, exporters and viewers can skip it
+        bool is_blank(int dz_level, int col, int row) const;
+
+        // tissue index
+        // tissue mask of the slide and the tiles of every deepzoom level intersecting it (see
+        // `dz_common::TissueIndex`), so that export, prefetch and sampling can skip glass without reading it.
+        // loaded from `index_path` if it holds the index of a slide of this size, computed from the lowest slide level
+        // otherwise and then saved there; `dz_common::TissueIndex::sidecar_path` gives the usual path next to the
+        // slide, an empty one keeps the index in memory only. false if it could not be loaded nor computed
+        // not thread-safe itself, call it before handing the generator to other threads
+        bool build_tissue_index(std::string const& index_path = {});
+        dz_common::TissueIndex const& tissue_index() const;
+        // true if the tile intersects tissue, or if no index was built
+        bool has_tissue(int dz_level, int col, int row) const;
+
+        // JPEG encoding
+        // optimized Huffman tables make tiles ~5% smaller for ~20-30% more encoding time, off by default.
+        // both kinds decode to the same pixels, so they share cache entries
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_jpeg_optimize_coding(bool optimize_coding);
+        bool jpeg_optimize_coding() const;
+
+        // WebP/AVIF encoding effort
+        // WebP `method` [0, 6], 0 is the fastest (default 4); AVIF `speed` [0, 10], 10 is the fastest (default 8)
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_webp_method(int method);
+        int webp_method() const;
+        void set_avif_speed(int speed);
+        int avif_speed() const;
+
+        // `dz_common::encode_jpeg` and `dz_common::encode_png`, which the other backends share
+        static std::vector<uint8_t> encode_pixels_to_jpeg(std::span<uint32_t const> pixels, int width, int height,
+                                                          int quality, std::vector<uint8_t> const& icc_profile = {},
+                                                          bool optimize_coding = false);
+        static std::vector<uint8_t> encode_pixels_to_png(std::span<uint32_t const> pixels, int width, int height,
                                                          int compression_level = 3,
                                                          std::vector<uint8_t> const& icc_profile = {});
+        // into `dest`, returning the encoded size, 0 on failure or if `dest` is too small
+        static size_t encode_pixels_to_jpeg(std::span<uint32_t const> pixels, int width, int height,
+                                            std::span<uint8_t> dest, int quality,
+                                            std::vector<uint8_t> const& icc_profile = {}, bool optimize_coding = false);
+        static size_t encode_pixels_to_png(std::span<uint32_t const> pixels, int width, int height,
+                                           std::span<uint8_t> dest, int compression_level = 3,
+                                           std::vector<uint8_t> const& icc_profile = {});
 
     private:
         auto _get_tile_info(int dz_level, int col, int row) const
@@ -70,18 +221,72 @@ namespace dz_openslide
                                     >,
                          std::pair<int64_t, int64_t> // z_size
                          >;
-        std::vector<uint8_t> _get_icc_profile() const;
+        // slide metadata the tiles do not need
+        struct Metadata
+        {
+            double mpp = 1e-6;
+            std::string background_color = "#ffffff";
+            size_t icc_profile_size = 0;
+            uint64_t icc_profile_hash = 0;
+        };
+        // read once, by the constructor, from the sidecar or by the first caller
+        Metadata const& _metadata() const;
+        // ICC profile data, read once from the slide
+        std::vector<uint8_t> const& _icc_profile() const;
+        // the metadata handle, the slide is opened (and the handle pool and blank bitmap set up) by the first caller
+        // null if it cannot be opened
+        _openslide* _slide() const;
+        void _scan_blank(_openslide* slide) const;
+        class HandlePool;
+        struct Blank;
+        struct SlideCloser
+        {
+            void operator()(_openslide* slide) const;
+        };
+
+        std::vector<uint8_t> _render_tile(int dz_level, int col, int row, bool with_icc_profile) const;
+        void _read_region(uint32_t* dest, int64_t x, int64_t y, int slide_level, int64_t width, int64_t height) const;
+        bool _is_synthesized(int dz_level) const;
+        dz_common::PixelBuffer _synthesize_tile_pixels(int dz_level, int col, int row) const;
+        // pixels of a child tile, resized to `get_tile_dimensions` if its level is read from the slide as it is
+        dz_common::PixelBuffer _child_tile_pixels(int dz_level, int col, int row) const;
+        // <width, height> of the pixels `get_tile_pixels` returns
+        std::pair<int64_t, int64_t> _pixel_dimensions(int dz_level, int col, int row) const;
+        // encoded blank tile if the bitmap says the tile is blank, else null
+        std::shared_ptr<std::vector<uint8_t> const> _blank_tile(int dz_level, int col, int row,
+                                                                bool with_icc_profile) const;
+        // encoded blank tile if `pixels` are uniform, else null
+        std::shared_ptr<std::vector<uint8_t> const> _uniform_tile(std::span<uint32_t const> pixels, int64_t width,
+                                                                  int64_t height, bool with_icc_profile) const;
+        // a `color` tile, encoded once
+        std::shared_ptr<std::vector<uint8_t> const> _encoded_blank_tile(uint32_t color, int64_t width, int64_t height,
+                                                                        bool with_icc_profile) const;
+        std::vector<uint8_t> _encode_tile(std::span<uint32_t const> pixels, int64_t width, int64_t height,
+                                          bool with_icc_profile) const;
+        // `pixels` of a `width` x `height` region brought to `z_width` x `z_height` if tiles are resized
+        dz_common::PixelBuffer _resize_region(dz_common::PixelBuffer pixels, int64_t width, int64_t height,
+                                              int64_t z_width, int64_t z_height) const;
+        dz_common::TileKey _tile_key(int dz_level, int col, int row, bool with_icc_profile) const;
 
     private:
-        _openslide* m_slide = nullptr;
+        // metadata handle, also the first pooled one
+        mutable std::unique_ptr<_openslide, SlideCloser> m_slide = nullptr;
+        std::unique_ptr<std::once_flag> m_slide_once = std::make_unique<std::once_flag>();
+        mutable std::unique_ptr<HandlePool> m_pool;
+        int m_max_handles = 1;
+        std::unique_ptr<Blank> m_blank; // null: blank detection disabled
+        dz_common::TissueIndex m_tissue;
+        std::string m_filepath;
         int64_t m_tile_size =
             512; // the width and height of a single tile, for best viewer performance, tile_size + 2 * overlap should be a power of two
         int m_overlap = 1;           // the number of extra pixels to add to each interior edge of a tile
         bool m_limit_bounds = false; // true to render only the non-empty slide region
         std::pair<int64_t, int64_t> m_l0_offset{0, 0}; // level 0 coordinate offset
-        double m_mpp = 1e-6;
         ImageFormat m_format = ImageFormat::JPG;
         float m_quality = 0.75f;
+        bool m_jpeg_optimize_coding = false;
+        int m_webp_method = 4;
+        int m_avif_speed = 8;
         int m_levels = 0;                                          // slide levels
         int m_dz_levels = 0;                                       // deepzoom levels
         std::vector<std::pair<int64_t, int64_t>> m_l_dimensions;   // slide level dimensions
@@ -90,7 +295,14 @@ namespace dz_openslide
         std::vector<int> m_preferred_slide_levels;                 // preferred slide levels for each deepzoom level
         std::vector<double> m_level_downsamples;                   // slide level downsample factors
         std::vector<double> m_level_dz_downsamples;                // deepzoom level downsample factors
-        std::string m_background_color = "#ffffff";
-        std::vector<uint8_t> m_icc_profile{}; // ICC profile data
+        std::unique_ptr<std::once_flag> m_metadata_once = std::make_unique<std::once_flag>();
+        mutable Metadata m_metadata;
+        std::unique_ptr<std::once_flag> m_icc_profile_once = std::make_unique<std::once_flag>();
+        mutable std::vector<uint8_t> m_icc_profile;
+        std::shared_ptr<dz_common::TileCache> m_tile_cache = nullptr;
+        double m_synthesis_min_downsample = 0.; // 0: every level is read from the slide
+        Resampling m_resampling = Resampling::BOX;
+        bool m_resize_tiles = true;
+        Resampling m_tile_resampling = Resampling::BILINEAR;
     };
 } // namespace dz_openslide
\ No newline at end of file
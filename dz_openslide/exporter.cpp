@@ -0,0 +1,556 @@
+#include "exporter.hpp"
+#include "deepzoom.hpp"
+#include "flatimage.hpp"
+
+#include "dz_common/boundedqueue.hpp"
+#include "dz_common/downsample.hpp"
+#include "dz_common/pixelbuffer.hpp"
+#include "dz_common/threadpool.hpp"
+#include "dz_common/tilepack.hpp"
+#include "dz_common/tiffwriter.hpp"
+#include "dz_common/zarrwriter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace dz_openslide;
+
+namespace
+{
+    // the non-overlapping `tile_size` square of a tile, the unit lower levels are built from
+    struct Block
+    {
+        int64_t width = 0;
+        int64_t height = 0;
+        std::vector<uint32_t> pixels;
+    };
+
+    struct EncodedTile
+    {
+        int level = 0;
+        int64_t col = 0;
+        int64_t row = 0;
+        std::vector<uint8_t> bytes;
+    };
+
+    // a tile of the highest level as read, with its overlap
+    struct Pixels
+    {
+        int64_t width = 0;
+        int64_t height = 0;
+        dz_common::PixelBuffer pixels;
+    };
+
+    // what a pyramid is built from: the deepzoom geometry, the tiles of the highest level and the encoder
+    struct Source
+    {
+        int64_t tile_size = 0;
+        int64_t overlap = 0;
+        std::vector<std::pair<int64_t, int64_t>> dimensions; // of every level, lowest resolution first
+        int lowest_level = 0;                                // levels below are neither built nor written
+        // the tiles of a row of the highest level, rows are asked for in order; no pixels where a read failed
+        std::function<std::vector<Pixels>(int64_t row)> read_row;
+        std::function<std::vector<uint8_t>(std::span<uint32_t const> pixels, int64_t width, int64_t height)> encode;
+    };
+
+    std::vector<std::pair<int64_t, int64_t>> level_tiles(Source const& source)
+    {
+        std::vector<std::pair<int64_t, int64_t>> tiles;
+        for (auto const& [width, height] : source.dimensions)
+            tiles.emplace_back((width + source.tile_size - 1) / source.tile_size,
+                               (height + source.tile_size - 1) / source.tile_size);
+        return tiles;
+    }
+
+    class Pyramid
+    {
+    public:
+        Pyramid(Source const& source, dz_common::BoundedQueue<EncodedTile>& queue)
+            : m_source(source), m_queue(queue), m_tile_size(source.tile_size), m_overlap(source.overlap),
+              m_dimensions(source.dimensions), m_tiles(level_tiles(source)), m_rows(m_dimensions.size())
+        {
+        }
+
+        void run(std::atomic<int64_t>& tiles_read, std::atomic<int64_t>& failures)
+        {
+            auto const top = static_cast<int>(m_dimensions.size()) - 1;
+            auto const [cols, rows] = m_tiles[top];
+            for (int64_t row = 0; row < rows; row++)
+            {
+                std::vector<Block> blocks(cols);
+                auto tiles = m_source.read_row(row);
+                dz_common::ThreadPool::shared().parallel_for(cols, [&](size_t col) {
+                    auto const& [width, height, pixels] = tiles[col];
+                    tiles_read.fetch_add(1, std::memory_order_relaxed);
+                    if (pixels.empty())
+                    {
+                        failures.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
+                    _write(top, col, row, m_source.encode(pixels, width, height));
+
+                    // strip the overlap, pad with zeros if the read came back short
+                    auto& block = blocks[col];
+                    std::tie(block.width, block.height) = _block_size(top, col, row);
+                    block.pixels.assign(block.width * block.height, 0);
+                    auto const dx = col == 0 ? 0 : m_overlap;
+                    auto const dy = row == 0 ? 0 : m_overlap;
+                    auto const w = std::clamp<int64_t>(width - dx, 0, block.width);
+                    for (int64_t y = 0; y < std::min(block.height, height - dy); y++)
+                        std::copy_n(pixels.data() + (y + dy) * width + dx, w, block.pixels.data() + y * block.width);
+                });
+                tiles.clear();
+                _push_row(top, row, std::move(blocks));
+            }
+        }
+
+    private:
+        // blocks of `level` in `row` are complete: write the tiles they finish and feed the level below
+        void _push_row(int level, int64_t row, std::vector<Block> blocks)
+        {
+            auto const top = static_cast<int>(m_dimensions.size()) - 1;
+            auto const [cols, rows] = m_tiles[level];
+            auto& level_rows = m_rows[level];
+            level_rows[row] = std::move(blocks);
+            auto const last = row == rows - 1;
+
+            // tiles of the highest level were written straight from the slide
+            // others need the block rows around them for the overlap
+            if (level != top)
+            {
+                for (auto r = std::max<int64_t>(0, row - 1); r <= row; r++)
+                {
+                    if (r == row && !last) break;
+                    dz_common::ThreadPool::shared().parallel_for(cols, [&](size_t col) {
+                        auto const [width, height] = _tile_dimensions(level, static_cast<int64_t>(col), r);
+                        auto const x = static_cast<int64_t>(col) * m_tile_size - (col == 0 ? 0 : m_overlap);
+                        auto const y = r * m_tile_size - (r == 0 ? 0 : m_overlap);
+                        // blocks of failed reads are skipped, their pixels stay black
+                        dz_common::PixelBuffer pixels(width * height);
+                        std::fill(pixels.begin(), pixels.end(), 0u);
+                        _copy_region(level, x, y, width, height, pixels.data());
+                        _write(level, col, r, m_source.encode(pixels, width, height));
+                    });
+                }
+            }
+
+            if (level > m_source.lowest_level && (row % 2 == 1 || last))
+            {
+                auto const lower_row = row / 2;
+                auto const lower_cols = m_tiles[level - 1].first;
+                auto const [level_width, level_height] = m_dimensions[level];
+                std::vector<Block> lower(lower_cols);
+                dz_common::ThreadPool::shared().parallel_for(lower_cols, [&](size_t col) {
+                    auto const x = 2 * static_cast<int64_t>(col) * m_tile_size;
+                    auto const y = 2 * lower_row * m_tile_size;
+                    auto const width = std::min(2 * m_tile_size, level_width - x);
+                    auto const height = std::min(2 * m_tile_size, level_height - y);
+                    dz_common::PixelBuffer region(width * height);
+                    std::fill(region.begin(), region.end(), 0u);
+                    _copy_region(level, x, y, width, height, region.data());
+
+                    auto& block = lower[col];
+                    std::tie(block.width, block.height) = _block_size(level - 1, col, lower_row);
+                    block.pixels.resize(block.width * block.height);
+                    dz_common::reduce_2x2(region.data(), width, height, width, block.pixels.data(), block.width);
+                });
+                // the highest level is only kept for downsampling
+                if (level == top) level_rows.erase(level_rows.begin(), level_rows.upper_bound(row));
+                _push_row(level - 1, lower_row, std::move(lower));
+            }
+
+            level_rows.erase(level_rows.begin(), level_rows.lower_bound(row - 1));
+        }
+
+        // what `DeepZoomGenerator::get_tile_dimensions` gives
+        std::pair<int64_t, int64_t> _tile_dimensions(int level, int64_t col, int64_t row) const
+        {
+            auto const [width, height] = m_dimensions[level];
+            auto const [cols, rows] = m_tiles[level];
+            return {std::min(m_tile_size, width - col * m_tile_size) + (col != 0 ? m_overlap : 0) +
+                        (col != cols - 1 ? m_overlap : 0),
+                    std::min(m_tile_size, height - row * m_tile_size) + (row != 0 ? m_overlap : 0) +
+                        (row != rows - 1 ? m_overlap : 0)};
+        }
+
+        std::pair<int64_t, int64_t> _block_size(int level, int64_t col, int64_t row) const
+        {
+            auto const [width, height] = m_dimensions[level];
+            return {std::min(m_tile_size, width - col * m_tile_size),
+                    std::min(m_tile_size, height - row * m_tile_size)};
+        }
+
+        // copies a region of `level` out of the blocks that cover it, all of them must be present
+        void _copy_region(int level, int64_t x, int64_t y, int64_t width, int64_t height, uint32_t* dest) const
+        {
+            auto const& level_rows = m_rows[level];
+            for (auto row = y / m_tile_size; row <= (y + height - 1) / m_tile_size; row++)
+            {
+                auto const& blocks = level_rows.at(row);
+                for (auto col = x / m_tile_size; col <= (x + width - 1) / m_tile_size; col++)
+                {
+                    auto const& block = blocks[col];
+                    auto const bx = col * m_tile_size;
+                    auto const by = row * m_tile_size;
+                    auto const x0 = std::max(x, bx);
+                    auto const x1 = std::min(x + width, bx + block.width);
+                    auto const y0 = std::max(y, by);
+                    auto const y1 = std::min(y + height, by + block.height);
+                    if (x1 <= x0 || block.pixels.empty()) continue;
+                    for (auto yy = y0; yy < y1; yy++)
+                        std::copy_n(block.pixels.data() + (yy - by) * block.width + (x0 - bx), x1 - x0,
+                                    dest + (yy - y) * width + (x0 - x));
+                }
+            }
+        }
+
+        void _write(int level, int64_t col, int64_t row, std::vector<uint8_t> bytes)
+        {
+            m_queue.push(EncodedTile{level, col, row, std::move(bytes)});
+        }
+
+    private:
+        Source const& m_source;
+        dz_common::BoundedQueue<EncodedTile>& m_queue;
+        int64_t m_tile_size;
+        int64_t m_overlap;
+        std::vector<std::pair<int64_t, int64_t>> m_dimensions;
+        std::vector<std::pair<int64_t, int64_t>> m_tiles;
+        std::vector<std::map<int64_t, std::vector<Block>>> m_rows; // block rows still needed, per level
+    };
+
+    // the highest level straight from the generator, its tiles read in parallel
+    Source generator_source(DeepZoomGenerator const& generator)
+    {
+        Source source;
+        source.tile_size = generator.tile_size();
+        source.overlap = generator.overlap();
+        source.dimensions = generator.level_dimensions();
+        auto const top = generator.level_count() - 1;
+        auto const cols = generator.level_tiles()[top].first;
+        source.read_row = [&generator, top, cols](int64_t row) {
+            std::vector<Pixels> tiles(cols);
+            dz_common::ThreadPool::shared().parallel_for(cols, [&](size_t col) {
+                auto [width, height, pixels] =
+                    generator.get_tile_pixel_buffer(top, static_cast<int>(col), static_cast<int>(row));
+                tiles[col] = Pixels{width, height, std::move(pixels)};
+            });
+            return tiles;
+        };
+        source.encode = [&generator](std::span<uint32_t const> pixels, int64_t width, int64_t height) {
+            return generator.encode_tile(pixels, width, height);
+        };
+        return source;
+    }
+
+    // the highest level is the image itself, decoded a strip of `tile_size` rows at a time, without overlap
+    Source image_source(FlatImage& image, int64_t tile_size)
+    {
+        Source source;
+        source.tile_size = tile_size;
+        auto width = image.width(), height = image.height();
+        source.dimensions.emplace_back(width, height);
+        while (width > 1 || height > 1)
+        {
+            width = std::max<int64_t>(1, (width + 1) / 2);
+            height = std::max<int64_t>(1, (height + 1) / 2);
+            source.dimensions.emplace_back(width, height);
+        }
+        std::reverse(source.dimensions.begin(), source.dimensions.end());
+        source.read_row = [&image, tile_size](int64_t row) {
+            auto const width = image.width();
+            auto const height = std::min(tile_size, image.height() - row * tile_size);
+            auto const cols = (width + tile_size - 1) / tile_size;
+            std::vector<Pixels> tiles(cols);
+            std::vector<uint32_t> strip(static_cast<size_t>(width * height));
+            if (!image.read_rows(height, strip.data())) return tiles;
+            dz_common::ThreadPool::shared().parallel_for(cols, [&](size_t col) {
+                auto& tile = tiles[col];
+                auto const x = static_cast<int64_t>(col) * tile_size;
+                tile.width = std::min(tile_size, width - x);
+                tile.height = height;
+                tile.pixels = dz_common::PixelBuffer(tile.width * tile.height);
+                for (int64_t y = 0; y < height; y++)
+                    std::copy_n(strip.data() + y * width + x, tile.width, tile.pixels.data() + y * tile.width);
+            });
+            return tiles;
+        };
+        return source;
+    }
+
+    // the highest level of a slide of another backend, its tiles read in parallel; not encoded by a generator
+    Source slide_source(PyramidExporter::SlideSource const& slide)
+    {
+        Source source;
+        source.tile_size = slide.tile_size;
+        source.overlap = slide.overlap;
+        source.dimensions = slide.dimensions;
+        auto const cols = slide.dimensions.empty()
+                              ? int64_t{0}
+                              : (slide.dimensions.back().first + slide.tile_size - 1) / slide.tile_size;
+        source.read_row = [&slide, cols](int64_t row) {
+            std::vector<Pixels> tiles(cols);
+            dz_common::ThreadPool::shared().parallel_for(cols, [&](size_t col) {
+                auto [width, height, pixels] = slide.read_tile(static_cast<int64_t>(col), row);
+                if (pixels.size() != static_cast<size_t>(width * height)) return;
+                tiles[col] = Pixels{width, height, dz_common::PixelBuffer(pixels.size())};
+                std::copy(pixels.begin(), pixels.end(), tiles[col].pixels.data());
+            });
+            return tiles;
+        };
+        return source;
+    }
+
+    // the source of whichever the exporter was made for
+    Source exporter_source(DeepZoomGenerator const* generator, FlatImage* image, int64_t tile_size,
+                           PyramidExporter::SlideSource const& slide)
+    {
+        if (generator) return generator_source(*generator);
+        if (image) return image_source(*image, tile_size);
+        return slide_source(slide);
+    }
+
+    // the lowest level worth writing for formats that stop at the first level which fits in a tile
+    int single_tile_level(Source const& source)
+    {
+        auto level = static_cast<int>(source.dimensions.size()) - 1;
+        while (level > 0 && (source.dimensions[level].first > source.tile_size ||
+                             source.dimensions[level].second > source.tile_size))
+            level--;
+        return level;
+    }
+
+    // runs the pyramid, `write` stores every encoded tile on `writer_count` writer threads, in the order they come
+    // (it must be thread-safe with more than one); true if every tile of the levels built was written
+    bool write_pyramid(Source const& source, size_t queue_capacity,
+                       std::function<void(int64_t, int64_t)> const& progress,
+                       std::function<bool(EncodedTile const&)> const& write, PyramidExporter::Stats& stats,
+                       size_t writer_count = 1)
+    {
+        auto const tiles = level_tiles(source);
+        int64_t total = 0;
+        for (auto level = source.lowest_level; level < static_cast<int>(tiles.size()); level++)
+            total += tiles[level].first * tiles[level].second;
+
+        std::atomic<int64_t> tiles_read{0}, tiles_written{0}, bytes_written{0}, failures{0};
+        dz_common::BoundedQueue<EncodedTile> queue(queue_capacity);
+        std::mutex progress_mutex;
+        std::vector<std::thread> writers;
+        for (size_t i = 0; i < std::max<size_t>(1, writer_count); i++)
+        {
+            writers.emplace_back([&]() {
+                while (auto tile = queue.pop())
+                {
+                    if (tile->bytes.empty() || !write(*tile))
+                    {
+                        failures.fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                    bytes_written.fetch_add(tile->bytes.size(), std::memory_order_relaxed);
+                    auto const done = tiles_written.fetch_add(1, std::memory_order_relaxed) + 1;
+                    if (!progress) continue;
+                    // one call at a time, `done` may come out of order with several writers
+                    std::lock_guard lock(progress_mutex);
+                    progress(done, total);
+                }
+            });
+        }
+
+        Pyramid(source, queue).run(tiles_read, failures);
+        queue.close();
+        for (auto& writer : writers)
+            writer.join();
+
+        stats.tiles_read = tiles_read;
+        stats.tiles_written = tiles_written;
+        stats.bytes_written = bytes_written;
+        stats.failures = failures;
+        return stats.failures == 0 && stats.tiles_written == total;
+    }
+} // namespace
+
+PyramidExporter::PyramidExporter(DeepZoomGenerator const& generator, size_t queue_capacity)
+    : m_generator(&generator), m_queue_capacity(queue_capacity)
+{
+}
+
+PyramidExporter::PyramidExporter(FlatImage& image, int64_t tile_size, size_t queue_capacity)
+    : m_image(&image), m_tile_size(tile_size), m_queue_capacity(queue_capacity)
+{
+}
+
+PyramidExporter::PyramidExporter(SlideSource source, size_t queue_capacity)
+    : m_slide(std::move(source)), m_queue_capacity(queue_capacity)
+{
+}
+
+void PyramidExporter::set_progress_callback(std::function<void(int64_t done, int64_t total)> callback)
+{
+    m_progress = std::move(callback);
+}
+
+PyramidExporter::Stats PyramidExporter::stats() const
+{
+    return m_stats;
+}
+
+bool PyramidExporter::export_to(std::string const& name)
+{
+    m_stats = {};
+    if (!m_generator || !m_generator->is_valid()) return false;
+
+    auto const dzi_path = std::filesystem::path(name + ".dzi");
+    auto const files_dir = std::filesystem::path(name + "_files");
+    std::error_code ec;
+    for (auto level = 0; level < m_generator->level_count(); level++)
+    {
+        std::filesystem::create_directories(files_dir / std::to_string(level), ec);
+        if (ec)
+        {
+            printf("Failed to create directory %s: %s\n", (files_dir / std::to_string(level)).string().c_str(),
+                   ec.message().c_str());
+            return false;
+        }
+    }
+    {
+        std::ofstream dzi(dzi_path, std::ios::binary);
+        dzi << m_generator->get_dzi();
+        if (!dzi)
+        {
+            printf("Failed to write %s\n", dzi_path.string().c_str());
+            return false;
+        }
+    }
+
+    auto const extension = std::string(".") + DeepZoomGenerator::format_extension(m_generator->format());
+    return write_pyramid(
+        generator_source(*m_generator), m_queue_capacity, m_progress,
+        [&](EncodedTile const& tile) {
+            auto const path = files_dir / std::to_string(tile.level) /
+                              (std::to_string(tile.col) + "_" + std::to_string(tile.row) + extension);
+            std::ofstream out(path, std::ios::binary);
+            out.write(reinterpret_cast<char const*>(tile.bytes.data()), tile.bytes.size());
+            if (!out) printf("Failed to write %s\n", path.string().c_str());
+            return static_cast<bool>(out);
+        },
+        m_stats);
+}
+
+bool PyramidExporter::export_pack(std::string const& path)
+{
+    m_stats = {};
+    if (!m_generator || !m_generator->is_valid()) return false;
+
+    dz_common::TilePackWriter pack(path, m_generator->get_dzi(),
+                                   DeepZoomGenerator::format_extension(m_generator->format()),
+                                   m_generator->level_tiles());
+    if (!pack.is_open()) return false;
+    auto const complete = write_pyramid(
+        generator_source(*m_generator), m_queue_capacity, m_progress,
+        [&pack](EncodedTile const& tile) { return pack.add(tile.level, tile.col, tile.row, tile.bytes); }, m_stats);
+    // an incomplete pack is not published, its temporary file is removed
+    return complete && pack.finish();
+}
+
+bool PyramidExporter::export_tiff(std::string const& path, int quality)
+{
+    m_stats = {};
+    if (m_generator && (!m_generator->is_valid() || m_generator->overlap() != 0 || m_generator->tile_size() % 16))
+    {
+        printf("TIFF pyramids need a generator without overlap and tiles of a multiple of 16 pixels\n");
+        return false;
+    }
+    if (m_slide.read_tile && (m_slide.overlap != 0 || m_slide.tile_size <= 0 || m_slide.tile_size % 16))
+    {
+        printf("TIFF pyramids need a slide without overlap and tiles of a multiple of 16 pixels\n");
+        return false;
+    }
+    if (m_image && !m_image->is_valid()) return false;
+    if (!m_generator && !m_image && !m_slide.read_tile) return false;
+
+    auto source = exporter_source(m_generator, m_image, m_tile_size, m_slide);
+    auto const tile_size = source.tile_size;
+    // a page per level, largest first, down to the first one that fits in a tile
+    auto const top = static_cast<int>(source.dimensions.size()) - 1;
+    source.lowest_level = single_tile_level(source);
+    std::vector<std::pair<int64_t, int64_t>> pages(source.dimensions.rbegin(),
+                                                   source.dimensions.rend() - source.lowest_level);
+    // TIFF tiles all have the full size: edge tiles are padded by repeating their last column and row, which
+    // compresses better than a flat color and is cropped away by readers
+    source.encode = [tile_size, quality](std::span<uint32_t const> pixels, int64_t width, int64_t height) {
+        dz_common::PixelBuffer tile(tile_size * tile_size);
+        for (int64_t y = 0; y < tile_size; y++)
+        {
+            auto const* src = pixels.data() + std::min(y, height - 1) * width;
+            auto* dest = tile.data() + y * tile_size;
+            std::copy_n(src, width, dest);
+            std::fill(dest + width, dest + tile_size, src[width - 1]);
+        }
+        return DeepZoomGenerator::encode_pixels_to_jpeg(tile, static_cast<int>(tile_size),
+                                                        static_cast<int>(tile_size), quality);
+    };
+
+    dz_common::TiffWriter tiff(path, pages, tile_size);
+    if (!tiff.is_open()) return false;
+    if (m_generator)
+    {
+        // the generator's MPP is 1e-6 when the slide has none
+        if (auto const mpp = m_generator->get_mpp(); mpp > 1e-3) tiff.set_mpp(mpp);
+        tiff.set_icc_profile(m_generator->get_icc_profile());
+    }
+    else if (m_image)
+        tiff.set_icc_profile(m_image->icc_profile());
+    else if (m_slide.mpp > 0.)
+        tiff.set_mpp(m_slide.mpp);
+    auto const complete = write_pyramid(
+        source, m_queue_capacity, m_progress,
+        [&tiff, top](EncodedTile const& tile) { return tiff.add(top - tile.level, tile.col, tile.row, tile.bytes); },
+        m_stats);
+    // an incomplete TIFF is not published, its temporary file is removed
+    return complete && tiff.finish();
+}
+
+bool PyramidExporter::export_zarr(std::string const& path)
+{
+    m_stats = {};
+    if (m_generator && (!m_generator->is_valid() || m_generator->overlap() != 0))
+    {
+        printf("OME-Zarr stores need a generator without overlap\n");
+        return false;
+    }
+    if (m_slide.read_tile && (m_slide.overlap != 0 || m_slide.tile_size <= 0))
+    {
+        printf("OME-Zarr stores need a slide without overlap\n");
+        return false;
+    }
+    if (m_image && !m_image->is_valid()) return false;
+    if (!m_generator && !m_image && !m_slide.read_tile) return false;
+
+    auto source = exporter_source(m_generator, m_image, m_tile_size, m_slide);
+    // an array per level, largest first, down to the first one that fits in a chunk
+    auto const top = static_cast<int>(source.dimensions.size()) - 1;
+    source.lowest_level = single_tile_level(source);
+    std::vector<std::pair<int64_t, int64_t>> levels(source.dimensions.rbegin(),
+                                                    source.dimensions.rend() - source.lowest_level);
+    // the generator's MPP is 1e-6 when the slide has none
+    auto const mpp = m_generator ? (m_generator->get_mpp() > 1e-3 ? m_generator->get_mpp() : 0.) : m_slide.mpp;
+    dz_common::ZarrWriter zarr(path, levels, source.tile_size, mpp);
+    if (!zarr.is_open()) return false;
+    // chunks are compressed by the encoding tasks, and written by several threads: every chunk is a file
+    source.encode = [&zarr](std::span<uint32_t const> pixels, int64_t width, int64_t height) {
+        return zarr.encode_chunk(pixels, width, height);
+    };
+    auto const writer_count = std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, 8);
+    auto const complete = write_pyramid(
+        source, m_queue_capacity, m_progress,
+        [&zarr, top](EncodedTile const& tile) { return zarr.add(top - tile.level, tile.col, tile.row, tile.bytes); },
+        m_stats, writer_count);
+    // an incomplete store is not published, its temporary directory is removed
+    return complete && zarr.finish();
+}
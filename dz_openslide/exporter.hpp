@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace dz_openslide
+{
+    class DeepZoomGenerator;
+    class FlatImage;
+
+    // writes a complete DeepZoom pyramid: `<name>.dzi` and `<name>_files/<level>/<col>_<row>.<format>`, a single
+    // `dz_common::TilePackWriter` file, a pyramidal BigTIFF (`dz_common::TiffWriter`) or an OME-Zarr store
+    // (`dz_common::ZarrWriter`)
+    // only the highest deepzoom level is read from the slide, row by row; every lower level is built by
+    // downsampling (2x2 average) the level above, so openslide is never asked for the same area twice.
+    // reading and encoding run on `dz_common::ThreadPool::shared()`, a writer thread (several for OME-Zarr) drains a
+    // bounded queue of encoded tiles so that slow disks apply back pressure instead of buffering the whole pyramid
+    class PyramidExporter
+    {
+    public:
+        struct Stats
+        {
+            int64_t tiles_read = 0;    // tiles read from the slide
+            int64_t tiles_written = 0; // tiles written to disk
+            int64_t bytes_written = 0;
+            int64_t failures = 0; // tiles that could not be encoded or written
+        };
+
+        // the highest deepzoom level of a slide any generator reads (`dz_slideio`, `dz_qupath`), which this library
+        // does not depend on: `slide_source` builds it from a generator
+        struct SlideSource
+        {
+            int64_t tile_size = 0;
+            int overlap = 0;
+            std::vector<std::pair<int64_t, int64_t>> dimensions; // of every deepzoom level, lowest resolution first
+            double mpp = 0.;                                     // microns per pixel, 0 if unknown
+            // <width, height, ARGB_Premultiplied_pixels> of a tile of the highest level, called from several threads
+            // at once; no pixels if it could not be read
+            std::function<std::tuple<int64_t, int64_t, std::vector<uint32_t>>(int64_t col, int64_t row)> read_tile;
+        };
+        // `generator` has the interface of the deepzoom generators (`tile_size`, `overlap`, `level_dimensions`,
+        // `get_mpp` and a thread-safe `get_tile_pixels`), it must outlive the exporter
+        template <typename Generator> static SlideSource slide_source(Generator const& generator);
+
+        // `generator` must outlive the exporter, its format/quality/tile size/overlap are used as they are
+        explicit PyramidExporter(DeepZoomGenerator const& generator, size_t queue_capacity = 256);
+        // a flat image, read once top to bottom: `export_tiff` and `export_zarr` only; `image` must outlive it
+        explicit PyramidExporter(FlatImage& image, int64_t tile_size = 256, size_t queue_capacity = 256);
+        // a slide of another backend: `export_tiff` and `export_zarr` only, its tiles are not encoded by a generator
+        explicit PyramidExporter(SlideSource source, size_t queue_capacity = 256);
+
+        // `name` is the output path without extension, its parent directory must exist
+        bool export_to(std::string const& name);
+        // the same pyramid as a single `dz_common::TilePack` file at `path`, written only if every tile was
+        bool export_pack(std::string const& path);
+        // a BigTIFF of JPEG tiles of `quality` (whatever the generator's format) that openslide, QuPath and vips open:
+        // one page per deepzoom level, from the highest down to the first that fits in a tile. the generator's tile
+        // size must be a multiple of 16 and its overlap 0. written only if every tile was
+        bool export_tiff(std::string const& path, int quality = 90);
+        // a multiscale OME-Zarr store (NGFF 0.4, zarr v2) at `path`, which must not exist: an RGB uint8 array per
+        // deepzoom level, from the highest down to the first that fits in a chunk, chunked by the tile size, the MPP
+        // of the generator as pixel size. the generator's overlap must be 0. published only if every chunk was written
+        bool export_zarr(std::string const& path);
+
+        // called from a writer thread after every written tile (or added to the pack), one call at a time
+        void set_progress_callback(std::function<void(int64_t done, int64_t total)> callback);
+
+        Stats stats() const;
+
+    private:
+        DeepZoomGenerator const* m_generator = nullptr;
+        FlatImage* m_image = nullptr;
+        SlideSource m_slide;       // used if `read_tile` is set
+        int64_t m_tile_size = 256; // of the image
+        size_t m_queue_capacity = 256;
+        std::function<void(int64_t, int64_t)> m_progress;
+        Stats m_stats;
+    };
+
+    template <typename Generator>
+    PyramidExporter::SlideSource PyramidExporter::slide_source(Generator const& generator)
+    {
+        SlideSource source;
+        source.tile_size = generator.tile_size();
+        source.overlap = generator.overlap();
+        for (auto const& [width, height] : generator.level_dimensions())
+            source.dimensions.emplace_back(width, height);
+        // the generators' MPP is 1e-6 when the slide has none
+        source.mpp = generator.get_mpp() > 1e-3 ? generator.get_mpp() : 0.;
+        auto const top = static_cast<int>(source.dimensions.size()) - 1;
+        source.read_tile = [&generator, top](int64_t col, int64_t row) {
+            auto [width, height, pixels] = generator.get_tile_pixels(top, static_cast<int>(col), static_cast<int>(row));
+            return std::make_tuple(int64_t{width}, int64_t{height}, std::move(pixels));
+        };
+        return source;
+    }
+} // namespace dz_openslide
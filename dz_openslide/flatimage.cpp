@@ -0,0 +1,260 @@
+#include "flatimage.hpp"
+
+extern "C"
+{
+#define XMD_H
+#include <jpeglib.h>
+#ifdef const
+#undef const
+#endif
+#include <png.h>
+}
+
+#include <algorithm>
+#include <cctype>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+using namespace dz_openslide;
+
+namespace
+{
+    // libjpeg's default error handler exits the process, this one jumps back to the decoder
+    struct JpegError
+    {
+        jpeg_error_mgr manager;
+        jmp_buf jump;
+    };
+
+    void on_jpeg_error(j_common_ptr cinfo)
+    {
+        char message[JMSG_LENGTH_MAX];
+        (*cinfo->err->format_message)(cinfo, message);
+        printf("Failed to decode JPEG: %s\n", message);
+        longjmp(reinterpret_cast<JpegError*>(cinfo->err)->jump, 1);
+    }
+
+    std::string lower_extension(std::string const& path)
+    {
+        auto extension = std::filesystem::path(path).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return extension;
+    }
+
+    // r, g, b, a bytes to premultiplied 0xAARRGGBB, `components` 3 (opaque) or 4
+    void to_argb(uint8_t const* src, int components, uint32_t* dst, int64_t count)
+    {
+        for (int64_t i = 0; i < count; i++, src += components)
+        {
+            uint32_t const a = components == 4 ? src[3] : 0xff;
+            uint32_t r = src[0], g = src[1], b = src[2];
+            if (a != 0xff)
+            {
+                r = (r * a + 127) / 255;
+                g = (g * a + 127) / 255;
+                b = (b * a + 127) / 255;
+            }
+            dst[i] = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+} // namespace
+
+struct FlatImage::Decoder
+{
+    virtual ~Decoder() = default;
+    virtual bool read_row(uint32_t* dest) = 0;
+
+    int64_t width = 0;
+    int64_t height = 0;
+    int64_t next_row = 0;
+    bool failed = false;
+    std::vector<uint8_t> icc_profile;
+};
+
+struct FlatImage::JpegDecoder : FlatImage::Decoder
+{
+    ~JpegDecoder() override
+    {
+        if (created) jpeg_destroy_decompress(&cinfo);
+        if (file) fclose(file);
+    }
+
+    bool open(std::string const& path)
+    {
+        file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        cinfo.err = jpeg_std_error(&error.manager);
+        error.manager.error_exit = on_jpeg_error;
+        if (setjmp(error.jump)) return false;
+        jpeg_create_decompress(&cinfo);
+        created = true;
+        jpeg_stdio_src(&cinfo, file);
+        jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xffff);
+        jpeg_read_header(&cinfo, TRUE);
+        JOCTET* profile = nullptr;
+        unsigned int profile_size = 0;
+        if (jpeg_read_icc_profile(&cinfo, &profile, &profile_size))
+        {
+            icc_profile.assign(profile, profile + profile_size);
+            free(profile);
+        }
+        // grayscale and YCbCr come out as RGB, CMYK fails here
+        cinfo.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&cinfo);
+        width = cinfo.output_width;
+        height = cinfo.output_height;
+        row.resize(static_cast<size_t>(width) * 3);
+        return true;
+    }
+
+    bool read_row(uint32_t* dest) override
+    {
+        if (setjmp(error.jump)) return false;
+        JSAMPROW rows[1] = {row.data()};
+        if (jpeg_read_scanlines(&cinfo, rows, 1) != 1) return false;
+        to_argb(row.data(), 3, dest, width);
+        return true;
+    }
+
+    FILE* file = nullptr;
+    jpeg_decompress_struct cinfo = {};
+    JpegError error = {};
+    bool created = false;
+    std::vector<uint8_t> row;
+};
+
+struct FlatImage::PngDecoder : FlatImage::Decoder
+{
+    ~PngDecoder() override
+    {
+        if (png_ptr) png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : nullptr, nullptr);
+        if (file) fclose(file);
+    }
+
+    bool open(std::string const& path)
+    {
+        file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if (!png_ptr) return false;
+        info_ptr = png_create_info_struct(png_ptr);
+        if (!info_ptr) return false;
+        if (setjmp(png_jmpbuf(png_ptr))) return false;
+        png_init_io(png_ptr, file);
+        png_read_info(png_ptr, info_ptr);
+
+        // everything to 8 bit RGBA
+        png_set_expand(png_ptr);
+        png_set_strip_16(png_ptr);
+        png_set_gray_to_rgb(png_ptr);
+        png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+        auto const passes = png_set_interlace_handling(png_ptr);
+        png_read_update_info(png_ptr, info_ptr);
+        width = png_get_image_width(png_ptr, info_ptr);
+        height = png_get_image_height(png_ptr, info_ptr);
+        row.resize(png_get_rowbytes(png_ptr, info_ptr));
+#ifdef PNG_iCCP_SUPPORTED
+        png_charp name = nullptr;
+        int compression = 0;
+        png_bytep profile = nullptr;
+        png_uint_32 profile_size = 0;
+        if (png_get_iCCP(png_ptr, info_ptr, &name, &compression, &profile, &profile_size))
+            icc_profile.assign(profile, profile + profile_size);
+#endif
+        if (passes > 1)
+        {
+            // every pass goes over all the rows, the image is decoded whole
+            image.resize(static_cast<size_t>(height) * row.size());
+            std::vector<png_bytep> rows(height);
+            for (int64_t y = 0; y < height; y++)
+                rows[y] = image.data() + y * row.size();
+            png_read_image(png_ptr, rows.data());
+        }
+        return true;
+    }
+
+    bool read_row(uint32_t* dest) override
+    {
+        if (!image.empty())
+        {
+            to_argb(image.data() + next_row * row.size(), 4, dest, width);
+            return true;
+        }
+        if (setjmp(png_jmpbuf(png_ptr))) return false;
+        png_read_row(png_ptr, row.data(), nullptr);
+        to_argb(row.data(), 4, dest, width);
+        return true;
+    }
+
+    FILE* file = nullptr;
+    png_structp png_ptr = nullptr;
+    png_infop info_ptr = nullptr;
+    std::vector<uint8_t> row;
+    std::vector<uint8_t> image; // interlaced images only
+};
+
+FlatImage::FlatImage(std::string const& path)
+{
+    auto const extension = lower_extension(path);
+    if (extension == ".png")
+    {
+        auto decoder = std::make_unique<PngDecoder>();
+        if (decoder->open(path)) m_decoder = std::move(decoder);
+    }
+    else if (extension == ".jpg" || extension == ".jpeg")
+    {
+        auto decoder = std::make_unique<JpegDecoder>();
+        if (decoder->open(path)) m_decoder = std::move(decoder);
+    }
+    if (!m_decoder || m_decoder->width <= 0 || m_decoder->height <= 0)
+    {
+        printf("Failed to open image: %s\n", path.c_str());
+        m_decoder.reset();
+    }
+}
+
+FlatImage::~FlatImage() = default;
+
+bool FlatImage::is_flat_image(std::string const& path)
+{
+    auto const extension = lower_extension(path);
+    return extension == ".png" || extension == ".jpg" || extension == ".jpeg";
+}
+
+bool FlatImage::is_valid() const
+{
+    return m_decoder != nullptr;
+}
+
+int64_t FlatImage::width() const
+{
+    return m_decoder ? m_decoder->width : 0;
+}
+
+int64_t FlatImage::height() const
+{
+    return m_decoder ? m_decoder->height : 0;
+}
+
+std::vector<uint8_t> const& FlatImage::icc_profile() const
+{
+    static std::vector<uint8_t> const none;
+    return m_decoder ? m_decoder->icc_profile : none;
+}
+
+bool FlatImage::read_rows(int64_t count, uint32_t* dest)
+{
+    if (!m_decoder || m_decoder->failed || count < 0 || m_decoder->next_row + count > m_decoder->height) return false;
+    for (int64_t y = 0; y < count; y++, m_decoder->next_row++)
+    {
+        if (!m_decoder->read_row(dest + y * m_decoder->width))
+        {
+            m_decoder->failed = true;
+            return false;
+        }
+    }
+    return true;
+}
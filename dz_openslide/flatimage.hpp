@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dz_openslide
+{
+    // a plain JPEG or PNG image (a stitched capture, a scanned photograph), which openslide does not open, decoded
+    // top to bottom a strip at a time: converting one to a pyramid holds a strip, not the image.
+    // interlaced PNGs cannot be decoded by rows, they are decoded whole when opened
+    // not thread-safe
+    class FlatImage
+    {
+    public:
+        explicit FlatImage(std::string const& path);
+        ~FlatImage();
+
+        FlatImage(FlatImage const&) = delete;
+        FlatImage& operator=(FlatImage const&) = delete;
+
+        // true for the extensions of the images `FlatImage` decodes: .jpg, .jpeg and .png, any case
+        static bool is_flat_image(std::string const& path);
+
+        bool is_valid() const;
+        int64_t width() const;
+        int64_t height() const;
+        // embedded ICC profile, empty if there is none
+        std::vector<uint8_t> const& icc_profile() const;
+
+        // the next `count` rows as ARGB_Premultiplied pixels, `width` per row
+        // false on a decoding error or past the last row, the image cannot be read further then
+        bool read_rows(int64_t count, uint32_t* dest);
+
+    private:
+        struct Decoder;
+        struct JpegDecoder;
+        struct PngDecoder;
+        std::unique_ptr<Decoder> m_decoder;
+    };
+} // namespace dz_openslide
@@ -0,0 +1,340 @@
+#include "prefetcher.hpp"
+#include "deepzoom.hpp"
+#include "dz_common/threadpool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+using namespace dz_openslide;
+
+namespace
+{
+    // requests kept, more than a screen of tiles
+    constexpr size_t history = 64;
+    // fewest requests the viewport is taken from
+    constexpr size_t min_screen_requests = 4;
+    // bands of tiles ahead of a pan
+    constexpr int64_t lookahead = 2;
+    // requests closer than it belong to the same burst: a viewer asks for what a frame or a move uncovers at once
+    constexpr auto burst_gap = std::chrono::milliseconds(50);
+    // smoothed motion under it is standing still, in tiles per burst
+    constexpr double min_velocity = 0.25;
+
+    std::pair<double, double> center(std::tuple<int64_t, int64_t, int64_t, int64_t> const& box)
+    {
+        auto const& [col0, row0, col1, row1] = box;
+        return {(col0 + col1) / 2., (row0 + row1) / 2.};
+    }
+
+    void extend(std::tuple<int64_t, int64_t, int64_t, int64_t>& box, int64_t col, int64_t row)
+    {
+        auto& [col0, row0, col1, row1] = box;
+        if (col1 < col0)
+        {
+            box = {col, row, col, row};
+            return;
+        }
+        col0 = std::min(col0, col);
+        row0 = std::min(row0, row);
+        col1 = std::max(col1, col);
+        row1 = std::max(row1, row);
+    }
+} // namespace
+
+Prefetcher::Prefetcher(DeepZoomGenerator const& generator) : Prefetcher(generator, Budget{})
+{
+}
+
+Prefetcher::Prefetcher(DeepZoomGenerator const& generator, Budget budget, bool with_icc_profile)
+    : m_generator(generator), m_budget(budget), m_with_icc_profile(with_icc_profile),
+      m_level_tiles(generator.level_tiles())
+{
+    m_budget.max_in_flight = std::max(1, m_budget.max_in_flight);
+    m_budget.max_queued = std::max(0, m_budget.max_queued);
+}
+
+Prefetcher::~Prefetcher()
+{
+    cancel();
+    std::unique_lock lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_in_flight.empty(); });
+}
+
+void Prefetcher::observe(int dz_level, int col, int row)
+{
+    std::lock_guard lock(m_mutex);
+    Tile const tile{dz_level, col, row};
+    m_stats.requests++;
+    if (auto it = m_prefetched.find(tile); it != m_prefetched.end())
+    {
+        m_stats.hits++;
+        m_outstanding_bytes -= it->second;
+        m_prefetched.erase(it);
+    }
+    else if (m_in_flight.count(tile))
+        m_stats.late++;
+
+    auto const now = std::chrono::steady_clock::now();
+    if (dz_level != m_level)
+    {
+        // a new level: its viewport starts over, the direction of the change is the zoom intent
+        if (m_level >= 0) m_zoom = dz_level > m_level ? 1 : -1;
+        m_level = dz_level;
+        m_recent.clear();
+        m_velocity_x = m_velocity_y = 0.;
+        m_burst = m_last_burst = {0, 0, -1, -1};
+        m_burst_requests = m_screen_requests = 0;
+    }
+    else if (now - m_last_request > burst_gap)
+    {
+        // the motion from burst to burst is the pan
+        if (std::get<2>(m_last_burst) >= std::get<0>(m_last_burst))
+        {
+            auto const [x, y] = center(m_burst);
+            auto const [last_x, last_y] = center(m_last_burst);
+            m_velocity_x = (m_velocity_x + x - last_x) / 2.;
+            m_velocity_y = (m_velocity_y + y - last_y) / 2.;
+        }
+        m_last_burst = m_burst;
+        m_burst = {0, 0, -1, -1};
+        m_burst_requests = 0;
+    }
+    m_last_request = now;
+    extend(m_burst, col, row);
+    m_screen_requests = std::max(m_screen_requests, ++m_burst_requests);
+    m_recent.push_back(tile);
+    if (m_recent.size() > history) m_recent.pop_front();
+    _plan();
+}
+
+std::vector<uint8_t> Prefetcher::get_tile(int dz_level, int col, int row)
+{
+    observe(dz_level, col, row);
+    return m_generator.get_tile(dz_level, col, row, m_with_icc_profile);
+}
+
+void Prefetcher::cancel()
+{
+    std::lock_guard lock(m_mutex);
+    m_stats.cancelled += m_queue.size();
+    m_queue.clear();
+    m_planned.clear();
+    m_recent.clear();
+    m_level = -1;
+    m_zoom = 0;
+    m_velocity_x = m_velocity_y = 0.;
+    m_viewport = m_burst = m_last_burst = {0, 0, -1, -1};
+    m_burst_requests = m_screen_requests = 0;
+    m_pan = {0, 0};
+    m_idle.notify_all();
+}
+
+void Prefetcher::wait_idle()
+{
+    std::unique_lock lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_queue.empty() && m_in_flight.empty(); });
+}
+
+Prefetcher::Stats Prefetcher::stats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+void Prefetcher::reset_stats()
+{
+    std::lock_guard lock(m_mutex);
+    m_stats = {};
+}
+
+void Prefetcher::_plan()
+{
+    if (!m_generator.tile_cache() || m_level < 0 || m_level >= static_cast<int>(m_level_tiles.size())) return;
+
+    // the viewport: bounding box of the last screenful of requests, the largest burst is the viewer filling it
+    std::tuple<int64_t, int64_t, int64_t, int64_t> viewport{0, 0, -1, -1};
+    auto const count = std::min(m_recent.size(), std::max(m_screen_requests, min_screen_requests));
+    for (auto it = m_recent.cend() - count; it != m_recent.cend(); ++it)
+        extend(viewport, std::get<1>(*it), std::get<2>(*it));
+    auto const pan = std::make_pair(m_velocity_x > min_velocity ? 1 : m_velocity_x < -min_velocity ? -1 : 0,
+                                    m_velocity_y > min_velocity ? 1 : m_velocity_y < -min_velocity ? -1 : 0);
+    if (viewport == m_viewport && pan == m_pan) return;
+    m_viewport = viewport;
+    m_pan = pan;
+    auto const [col0, row0, col1, row1] = viewport;
+    auto const [pan_x, pan_y] = pan;
+
+    // prefetched tiles the cache evicted in the meantime no longer count against the budget
+    if (m_outstanding_bytes >= m_budget.max_bytes)
+        for (auto it = m_prefetched.begin(); it != m_prefetched.end();)
+        {
+            auto const& [dz_level, col, row] = it->first;
+            if (m_generator.is_cached(dz_level, static_cast<int>(col), static_cast<int>(row), m_with_icc_profile))
+            {
+                ++it;
+                continue;
+            }
+            m_stats.evicted++;
+            m_outstanding_bytes -= it->second;
+            it = m_prefetched.erase(it);
+        }
+
+    std::vector<Tile> plan;
+    std::set<Tile> planned;
+    auto const add = [&](int dz_level, int64_t col, int64_t row) {
+        if (dz_level < 0 || dz_level >= static_cast<int>(m_level_tiles.size())) return;
+        auto const [cols, rows] = m_level_tiles[dz_level];
+        if (col < 0 || col >= cols || row < 0 || row >= rows) return;
+        Tile const tile{dz_level, col, row};
+        if (m_prefetched.count(tile) || !planned.insert(tile).second) return;
+        plan.push_back(tile);
+    };
+
+    auto const neighbours = [&]() {
+        if (pan_x == 0 && pan_y == 0)
+        {
+            for (auto col = col0 - 1; col <= col1 + 1; col++)
+            {
+                add(m_level, col, row0 - 1);
+                add(m_level, col, row1 + 1);
+            }
+            for (auto row = row0; row <= row1; row++)
+            {
+                add(m_level, col0 - 1, row);
+                add(m_level, col1 + 1, row);
+            }
+            return;
+        }
+        // nearest band first, widened along the other direction of a diagonal pan
+        for (int64_t band = 1; band <= lookahead; band++)
+        {
+            if (pan_x != 0)
+            {
+                auto const col = pan_x > 0 ? col1 + band : col0 - band;
+                for (auto row = row0 - (pan_y < 0 ? band : 0); row <= row1 + (pan_y > 0 ? band : 0); row++)
+                    add(m_level, col, row);
+            }
+            if (pan_y != 0)
+            {
+                auto const row = pan_y > 0 ? row1 + band : row0 - band;
+                for (auto col = col0 - (pan_x < 0 ? band : 0); col <= col1 + (pan_x > 0 ? band : 0); col++)
+                    add(m_level, col, row);
+            }
+        }
+    };
+    auto const parents = [&]() {
+        for (auto row = row0 / 2; row <= row1 / 2; row++)
+            for (auto col = col0 / 2; col <= col1 / 2; col++)
+                add(m_level - 1, col, row);
+    };
+    // zooming in halves the viewport around its center, so only the children of its middle, center first
+    auto const children = [&]() {
+        auto const center_col = (col0 + col1) / 2., center_row = (row0 + row1) / 2.;
+        auto const half_width = (col1 - col0 + 1) / 4., half_height = (row1 - row0 + 1) / 4.;
+        std::vector<std::pair<double, std::pair<int64_t, int64_t>>> tiles;
+        for (auto row = static_cast<int64_t>(std::floor(center_row - half_height));
+             row <= static_cast<int64_t>(std::ceil(center_row + half_height)); row++)
+            for (auto col = static_cast<int64_t>(std::floor(center_col - half_width));
+                 col <= static_cast<int64_t>(std::ceil(center_col + half_width)); col++)
+            {
+                auto const distance = std::hypot(col - center_col, row - center_row);
+                for (auto child = 0; child < 4; child++)
+                    tiles.push_back({distance, {col * 2 + child % 2, row * 2 + child / 2}});
+            }
+        std::stable_sort(tiles.begin(), tiles.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+        for (auto const& [distance, tile] : tiles)
+            add(m_level + 1, tile.first, tile.second);
+    };
+
+    // children are four times as many tiles, a viewer seldom zooms in while it pans
+    auto const panning = pan_x != 0 || pan_y != 0;
+    if (m_zoom > 0 && !panning)
+    {
+        children();
+        neighbours();
+        parents();
+    }
+    else if (m_zoom < 0)
+    {
+        parents();
+        neighbours();
+        if (!panning) children();
+    }
+    else
+    {
+        neighbours();
+        parents();
+        if (!panning) children();
+    }
+    if (plan.size() > static_cast<size_t>(m_budget.max_queued)) plan.resize(m_budget.max_queued);
+
+    // the viewport moved on: queued tiles out of the new plan are dropped, and so are those waiting in the pool
+    m_planned = std::set<Tile>(plan.cbegin(), plan.cend());
+    for (auto const& tile : m_queue)
+        m_stats.cancelled += m_planned.count(tile) == 0;
+    m_queue.clear();
+    for (auto const& tile : plan)
+        if (!m_in_flight.count(tile)) m_queue.push_back(tile);
+    _pump();
+}
+
+void Prefetcher::_pump()
+{
+    while (m_in_flight.size() < static_cast<size_t>(m_budget.max_in_flight) && !m_queue.empty() &&
+           m_outstanding_bytes < m_budget.max_bytes)
+    {
+        auto const tile = m_queue.front();
+        m_queue.pop_front();
+        auto const& [dz_level, col, row] = tile;
+        auto const c = static_cast<int>(col), r = static_cast<int>(row);
+        if (m_generator.is_cached(dz_level, c, r, m_with_icc_profile) || m_generator.is_blank(dz_level, c, r) ||
+            !m_generator.has_tissue(dz_level, c, r))
+        {
+            m_stats.skipped++;
+            continue;
+        }
+        m_in_flight.insert(tile);
+        m_stats.issued++;
+        dz_common::ThreadPool::shared().submit([this, tile]() { _render(tile); });
+    }
+    if (m_queue.empty() && m_in_flight.empty()) m_idle.notify_all();
+}
+
+void Prefetcher::_render(Tile tile)
+{
+    auto const& [dz_level, col, row] = tile;
+    {
+        // planned for a viewport the viewer has left while it waited in the pool
+        std::lock_guard lock(m_mutex);
+        if (!m_planned.count(tile))
+        {
+            m_stats.cancelled++;
+            m_in_flight.erase(tile);
+            _pump();
+            m_idle.notify_all();
+            return;
+        }
+    }
+
+    auto const size =
+        m_generator.get_tile(dz_level, static_cast<int>(col), static_cast<int>(row), m_with_icc_profile).size();
+
+    std::lock_guard lock(m_mutex);
+    m_in_flight.erase(tile);
+    m_stats.completed++;
+    if (size > 0)
+    {
+        m_prefetched[tile] = size;
+        m_outstanding_bytes += size;
+        m_stats.bytes += size;
+    }
+    _pump();
+    // the pan plan is done and no request came meanwhile: the viewer has stopped, plan around it on the idle threads
+    if (m_queue.empty() && m_in_flight.empty() && m_pan != std::make_pair(0, 0))
+    {
+        m_velocity_x = m_velocity_y = 0.;
+        _plan();
+    }
+    m_idle.notify_all();
+}
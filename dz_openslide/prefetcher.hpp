@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <utility>
+
+namespace dz_openslide
+{
+    class DeepZoomGenerator;
+
+    // warms the tile cache of a generator with the tiles a viewer is likely to ask for next.
+    // it watches the requests, takes the bounding box of the recent ones on the current level as the viewport, the
+    // motion between bursts of requests as the pan direction and level changes as the zoom intent, and queues the
+    // band of tiles ahead of the pan (a ring around the viewport when it stands still), the parent tiles and the
+    // children of its middle, in the order the zoom intent suggests. tiles are rendered with `get_tile` on
+    // `dz_common::ThreadPool::shared()`, which puts them into the generator's cache; tiles already cached, blank or
+    // without tissue are skipped. a new viewport drops whatever is still queued, rendering tiles finish.
+    // all methods are thread-safe
+    class Prefetcher
+    {
+    public:
+        struct Budget
+        {
+            int max_in_flight = 2;               // tiles rendered at once
+            int max_queued = 64;                 // tiles planned per viewport
+            size_t max_bytes = size_t{32} << 20; // prefetched bytes the viewer has not asked for yet
+        };
+
+        struct Stats
+        {
+            uint64_t requests = 0;  // tiles the viewer asked for
+            uint64_t hits = 0;      // of which prefetched before
+            uint64_t late = 0;      // of which still being prefetched
+            uint64_t issued = 0;    // tiles handed to the pool
+            uint64_t completed = 0; // tiles prefetched
+            uint64_t cancelled = 0; // planned tiles dropped because the viewport moved on
+            uint64_t skipped = 0;   // planned tiles cached already, blank or without tissue
+            uint64_t evicted = 0;   // prefetched tiles evicted before being asked for
+            uint64_t bytes = 0;     // encoded bytes prefetched
+
+            // share of the requests served by prefetching
+            double hit_rate() const { return requests ? static_cast<double>(hits) / requests : 0.; }
+            // share of the prefetched tiles that were asked for
+            double accuracy() const { return completed ? static_cast<double>(hits) / completed : 0.; }
+        };
+
+        // `generator` must outlive the prefetcher and have a tile cache, nothing is prefetched without one
+        explicit Prefetcher(DeepZoomGenerator const& generator);
+        Prefetcher(DeepZoomGenerator const& generator, Budget budget, bool with_icc_profile = false);
+        // drops the queue and waits for the tiles being rendered
+        ~Prefetcher();
+
+        Prefetcher(Prefetcher const&) = delete;
+        Prefetcher& operator=(Prefetcher const&) = delete;
+
+        // records a request of the viewer and plans the next tiles
+        void observe(int dz_level, int col, int row);
+        // `observe` then the generator's `get_tile`
+        std::vector<uint8_t> get_tile(int dz_level, int col, int row);
+        // drops the queued tiles and forgets the viewport
+        void cancel();
+        // waits until nothing is queued nor being rendered
+        void wait_idle();
+
+        Stats stats() const;
+        void reset_stats();
+
+    private:
+        using Tile = std::tuple<int, int64_t, int64_t>; // <dz_level, col, row>
+
+        void _plan();
+        void _pump();
+        void _render(Tile tile);
+
+    private:
+        DeepZoomGenerator const& m_generator;
+        Budget m_budget;
+        bool m_with_icc_profile = false;
+        std::vector<std::pair<int64_t, int64_t>> m_level_tiles;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_idle;
+        std::deque<Tile> m_recent; // last requests, newest at the back
+        int m_level = -1;          // level of the last request
+        int m_zoom = 0;            // 1: zooming in, -1: zooming out
+        std::chrono::steady_clock::time_point m_last_request;
+        // <col0, row0, col1, row1> of the requests of the current and of the last burst
+        std::tuple<int64_t, int64_t, int64_t, int64_t> m_burst{0, 0, -1, -1};
+        std::tuple<int64_t, int64_t, int64_t, int64_t> m_last_burst{0, 0, -1, -1};
+        size_t m_burst_requests = 0;  // in the current burst
+        size_t m_screen_requests = 0; // in the largest burst of the level
+        double m_velocity_x = 0.; // smoothed motion of the bursts, in tiles
+        double m_velocity_y = 0.;
+        // what the current plan was made for
+        std::tuple<int64_t, int64_t, int64_t, int64_t> m_viewport{0, 0, -1, -1};
+        std::pair<int, int> m_pan{0, 0};
+        std::set<Tile> m_planned; // tiles of the current plan, queued or handed to the pool
+        std::deque<Tile> m_queue;
+        std::set<Tile> m_in_flight;
+        std::map<Tile, size_t> m_prefetched; // prefetched, not asked for yet: encoded size
+        size_t m_outstanding_bytes = 0;
+        Stats m_stats;
+    };
+} // namespace dz_openslide
@@ -1,14 +1,38 @@
 #include "deepzoom.hpp"
 #include "reader.hpp"
+#include "dz_common/codec.hpp"
+#include "dz_common/pixelconv.hpp"
+#include "dz_common/pixelbuffer.hpp"
+#include "dz_common/threadpool.hpp"
+#include "dz_common/tilecache.hpp"
 
 #include <numeric>
 #include <cmath>
+#include <algorithm>
+#include <bit>
 
 using namespace dz_qupath;
 
+namespace
+{
+    Reader::ImageFormat reader_format(DeepZoomGenerator::ImageFormat format)
+    {
+        switch (format)
+        {
+        case DeepZoomGenerator::ImageFormat::PNG:
+            return Reader::ImageFormat::PNG;
+        case DeepZoomGenerator::ImageFormat::JPG:
+            return Reader::ImageFormat::JPEG;
+        default:
+            return Reader::ImageFormat::RGB;
+        }
+    }
+} // namespace
+
 DeepZoomGenerator::DeepZoomGenerator(std::string filepath, int tile_size, int overlap, ImageFormat format,
-                                     float quality)
-    : m_tile_size(tile_size), m_overlap(overlap), m_format(format), m_quality(quality)
+                                     float quality, OpenMode open_mode)
+    : m_tile_size(tile_size), m_overlap(overlap), m_format(format), m_quality(std::clamp(quality, 0.f, 1.f)),
+      m_filepath(filepath)
 {
     m_reader = std::make_unique<Reader>(filepath);
     if (!m_reader->isValid())
@@ -18,7 +42,12 @@ DeepZoomGenerator::DeepZoomGenerator(std::string filepath, int tile_size, int ov
         return;
     }
 
-    m_reader->open();
+    if (!m_reader->open(open_mode == OpenMode::LAZY))
+    {
+        printf("Failed to read metadata of: %s\n", filepath.c_str());
+        m_reader = nullptr;
+        return;
+    }
 
     m_mpp = (m_reader->getPhysSizeX() / m_reader->getSizeX() + m_reader->getPhysSizeY() / m_reader->getSizeY()) *
             1000. / 2.;
@@ -79,22 +108,167 @@ std::vector<std::pair<int, int>> DeepZoomGenerator::level_dimensions() const
 
 int DeepZoomGenerator::tile_count() const
 {
-    return std::reduce(m_t_dimensions.cbegin(), m_t_dimensions.cend(), int{1},
-                       [](auto s, auto const& d) { return s + d.first * d.second; });
+    return std::accumulate(m_t_dimensions.cbegin(), m_t_dimensions.cend(), int{0},
+                           [](auto s, auto const& d) { return s + d.first * d.second; });
 }
 
-std::vector<unsigned char> DeepZoomGenerator::get_tile(int dz_level, int col, int row) const
+std::tuple<int64_t, int64_t, std::vector<uint32_t>> DeepZoomGenerator::get_tile_pixels(int dz_level, int col,
+                                                                                      int row) const
 {
     auto [info, z_size] = _get_tile_info(dz_level, col, row);
     auto const& [l0_location, slide_level, l_size] = info;
     auto const& [width, height] = l_size;
     auto const& [xx, yy] = l0_location;
     auto level_downsample = m_level_downsamples[slide_level];
+    auto pixels = m_reader->readRegionPixels(m_level_0_dz_downsamples[dz_level], xx, yy,
+                                             static_cast<int>(std::ceil(width * level_downsample)),
+                                             static_cast<int>(std::ceil(height * level_downsample)), 0, 0);
+    return std::make_tuple(int64_t{pixels.width}, int64_t{pixels.height}, std::move(pixels.data));
+}
+
+std::vector<unsigned char> DeepZoomGenerator::get_tile(int dz_level, int col, int row) const
+{
+    if (auto tile = _blank_tile(dz_level, col, row); tile) return *tile;
+    auto const render = [&]() {
+        if (m_native_encoding)
+        {
+            auto const [width, height, pixels] = get_tile_pixels(dz_level, col, row);
+            return _encode_pixels(pixels, static_cast<int>(width), static_cast<int>(height));
+        }
+        auto [info, z_size] = _get_tile_info(dz_level, col, row);
+        auto const& [l0_location, slide_level, l_size] = info;
+        auto const& [width, height] = l_size;
+        auto const& [xx, yy] = l0_location;
+        auto level_downsample = m_level_downsamples[slide_level];
+        return _encode_tile(m_reader->readRegion(m_level_0_dz_downsamples[dz_level], xx, yy,
+                                                 static_cast<int>(std::ceil(width * level_downsample)),
+                                                 static_cast<int>(std::ceil(height * level_downsample)), 0, 0,
+                                                 reader_format(m_format), m_quality));
+    };
+    // a hit does not cross JNI at all
+    if (!m_tile_cache) return render();
+
+    auto const key = _tile_key(dz_level, col, row);
+    if (auto tile = m_tile_cache->get(key); tile) return std::move(*tile);
+
+    auto tile = render();
+    if (!tile.empty()) m_tile_cache->put(key, tile);
+    return tile;
+}
+
+std::vector<std::vector<unsigned char>> DeepZoomGenerator::get_tiles(
+    std::span<std::tuple<int, int, int> const> tiles) const
+{
+    std::vector<std::vector<unsigned char>> res(tiles.size());
+
+    // only cache misses cross JNI
+    std::vector<size_t> misses;
+    misses.reserve(tiles.size());
+    std::vector<std::tuple<double, int, int, int, int>> regions;
+    regions.reserve(tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        auto const& [dz_level, col, row] = tiles[i];
+        if (auto tile = _blank_tile(dz_level, col, row); tile)
+        {
+            res[i] = *tile;
+            continue;
+        }
+        if (m_tile_cache)
+            if (auto tile = m_tile_cache->get(_tile_key(dz_level, col, row)); tile)
+            {
+                res[i] = std::move(*tile);
+                continue;
+            }
+        misses.push_back(i);
+
+        auto [info, z_size] = _get_tile_info(dz_level, col, row);
+        auto const& [l0_location, slide_level, l_size] = info;
+        auto const& [width, height] = l_size;
+        auto const& [xx, yy] = l0_location;
+        auto level_downsample = m_level_downsamples[slide_level];
+        regions.emplace_back(m_level_0_dz_downsamples[dz_level], xx, yy,
+                             static_cast<int>(std::ceil(width * level_downsample)),
+                             static_cast<int>(std::ceil(height * level_downsample)));
+    }
+    if (misses.empty()) return res;
+
+    auto const store = [&](size_t k, std::vector<unsigned char> tile) {
+        auto const i = misses[k];
+        res[i] = std::move(tile);
+        if (m_tile_cache && !res[i].empty())
+        {
+            auto const& [dz_level, col, row] = tiles[i];
+            m_tile_cache->put(_tile_key(dz_level, col, row), res[i]);
+        }
+    };
+    if (m_native_encoding)
+    {
+        auto const pixels = m_reader->readRegionsPixels(regions, 0, 0);
+        dz_common::ThreadPool::shared().parallel_for(std::min(pixels.size(), misses.size()), [&](size_t k) {
+            store(k, _encode_pixels(pixels[k].data, pixels[k].width, pixels[k].height));
+        });
+        return res;
+    }
+    auto regions_tiles = m_reader->readRegions(regions, 0, 0, reader_format(m_format), m_quality);
+    auto const raw = reader_format(m_format) == Reader::ImageFormat::RGB;
+    dz_common::ThreadPool::shared().parallel_for(std::min(regions_tiles.size(), misses.size()), [&](size_t k) {
+        store(k, raw ? _encode_tile(regions_tiles[k]) : std::move(regions_tiles[k]));
+    });
+    return res;
+}
+
+std::vector<unsigned char> DeepZoomGenerator::_encode_tile(std::vector<unsigned char> const& region) const
+{
+    if (reader_format(m_format) != Reader::ImageFormat::RGB || region.empty()) return region;
+
+    auto const read_int = [&](size_t i) {
+        return static_cast<int>(region[i]) << 24 | region[i + 1] << 16 | region[i + 2] << 8 | region[i + 3];
+    };
+    auto const width = region.size() >= 8 ? read_int(0) : 0;
+    auto const height = region.size() >= 8 ? read_int(4) : 0;
+    if (width <= 0 || height <= 0 || region.size() != 8 + static_cast<size_t>(width) * height * 3)
+    {
+        printf("Invalid raw region of %zu bytes\n", region.size());
+        return {};
+    }
 
-    return m_reader->readRegion(m_level_0_dz_downsamples[dz_level], xx, yy,
-                                static_cast<int>(std::ceil(width * level_downsample)),
-                                static_cast<int>(std::ceil(height * level_downsample)), 0, 0,
-                                static_cast<Reader::ImageFormat>(m_format), m_quality);
+    auto const quality = static_cast<int>(m_quality * 100);
+    if (m_format == ImageFormat::AVIF)
+        return dz_common::encode_avif(region.data() + 8, width, height, width * 3, dz_common::PixelLayout::RGB,
+                                      quality, m_avif_speed);
+    // a higher quality means less compression effort when lossless, like for PNG in the other generators
+    auto const lossless = m_format == ImageFormat::WEBP_LOSSLESS;
+    return dz_common::encode_webp(region.data() + 8, width, height, width * 3, dz_common::PixelLayout::RGB,
+                                  lossless ? 100.f - quality : quality, lossless, m_webp_method);
+}
+
+std::vector<unsigned char> DeepZoomGenerator::_encode_pixels(std::span<uint32_t const> pixels, int width,
+                                                             int height) const
+{
+    if (width <= 0 || height <= 0 || pixels.size() < static_cast<size_t>(width) * height) return {};
+
+    // the same encoders and settings as `dz_openslide`, tiles of a slide do not depend on the backend reading it
+    auto const quality = static_cast<int>(m_quality * 100);
+    if (m_format == ImageFormat::JPG) return dz_common::encode_jpeg(pixels, width, height, quality);
+    if (m_format == ImageFormat::PNG)
+        return dz_common::encode_png(pixels, width, height, std::clamp((100 - quality) / 10, 0, 9));
+
+    // premultiplied ARGB is BGRX bytes on little endian hosts
+    dz_common::PixelBuffer converted;
+    auto const* bgrx = reinterpret_cast<uint8_t const*>(pixels.data());
+    if constexpr (std::endian::native == std::endian::big)
+    {
+        converted = dz_common::PixelBuffer(pixels.size());
+        dz_common::argb_to_bgrx(pixels.data(), reinterpret_cast<uint8_t*>(converted.data()), pixels.size());
+        bgrx = reinterpret_cast<uint8_t const*>(converted.data());
+    }
+    if (m_format == ImageFormat::AVIF)
+        return dz_common::encode_avif(bgrx, width, height, width * 4, dz_common::PixelLayout::BGRX, quality,
+                                      m_avif_speed);
+    auto const lossless = m_format == ImageFormat::WEBP_LOSSLESS;
+    return dz_common::encode_webp(bgrx, width, height, width * 4, dz_common::PixelLayout::BGRX,
+                                  lossless ? 100.f - quality : quality, lossless, m_webp_method);
 }
 
 std::tuple<std::pair<int, int>, int, std::pair<int, int>> DeepZoomGenerator::get_tile_coordinates(int dz_level, int col,
@@ -114,7 +288,7 @@ std::string DeepZoomGenerator::get_dzi() const
     return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n \
 <Image xmlns = \"http://schemas.microsoft.com/deepzoom/2008\"\n \
   Format=\"" +
-           std::string((m_format == ImageFormat::PNG) ? "png" : "jpg") + "\"\n \
+           std::string(format_extension(m_format)) + "\"\n \
   Overlap=\"" +
            std::to_string(m_overlap) + "\"\n \
   TileSize=\"" +
@@ -129,11 +303,214 @@ std::string DeepZoomGenerator::get_dzi() const
 </Image>";
 }
 
+int DeepZoomGenerator::tile_size() const
+{
+    return m_tile_size;
+}
+
+int DeepZoomGenerator::overlap() const
+{
+    return m_overlap;
+}
+
 double DeepZoomGenerator::get_mpp() const
 {
     return m_mpp;
 }
 
+bool DeepZoomGenerator::build_tissue_index(std::string const& index_path)
+{
+    m_tissue = {};
+    if (!is_valid()) return false;
+    auto const [l0_width, l0_height] = m_l_dimensions[0];
+
+    if (!index_path.empty())
+        if (auto index = dz_common::TissueIndex::load(index_path);
+            !index.empty() && index.l0_dimensions() == std::make_pair(int64_t{l0_width}, int64_t{l0_height}))
+            m_tissue = std::move(index);
+    if (m_tissue.empty())
+    {
+        auto const downsample =
+            std::max(1., static_cast<double>(std::max(l0_width, l0_height)) / dz_common::TissueIndex::thumbnail_size);
+        auto const [width, height, thumbnail] = _read_picture(downsample);
+        if (thumbnail.empty()) return false;
+        m_tissue = dz_common::TissueIndex::from_thumbnail(thumbnail.data(), width, height, width * 3,
+                                                          dz_common::PixelLayout::RGB, l0_width, l0_height);
+        if (!index_path.empty()) m_tissue.save(index_path);
+    }
+
+    std::vector<std::pair<int64_t, int64_t>> level_tiles(m_t_dimensions.cbegin(), m_t_dimensions.cend());
+    m_tissue.index_levels(level_tiles, [this](int dz_level, int64_t col, int64_t row) {
+        return _l0_tile_rect(dz_level, col, row);
+    });
+    return true;
+}
+
+dz_common::TissueIndex const& DeepZoomGenerator::tissue_index() const
+{
+    return m_tissue;
+}
+
+bool DeepZoomGenerator::has_tissue(int dz_level, int col, int row) const
+{
+    return m_tissue.has_tissue(dz_level, col, row);
+}
+
+void DeepZoomGenerator::set_blank_detection(int tolerance)
+{
+    m_blank = {};
+    m_blank_tiles->clear();
+    if (tolerance < 0 || !is_valid()) return;
+    auto const [l0_width, l0_height] = m_l_dimensions[0];
+    auto const [low_width, low_height] = m_l_dimensions[m_levels - 1];
+
+    // the resolution of the lowest level, within the pixel budget
+    auto const downsample =
+        m_level_downsamples[m_levels - 1] *
+        std::max(1., std::sqrt(static_cast<double>(low_width) * low_height /
+                               static_cast<double>(dz_common::BlankIndex::max_picture_pixels)));
+    auto const [width, height, picture] = _read_picture(downsample);
+    if (picture.empty()) return;
+    std::vector<std::pair<int64_t, int64_t>> level_tiles(m_t_dimensions.cbegin(), m_t_dimensions.cend());
+    m_blank = dz_common::BlankIndex::from_picture(
+        picture.data(), width, height, width * 3, dz_common::PixelLayout::RGB, l0_width, l0_height, tolerance,
+        level_tiles, [this](int dz_level, int64_t col, int64_t row) { return _l0_tile_rect(dz_level, col, row); });
+}
+
+int DeepZoomGenerator::blank_tolerance() const
+{
+    return m_blank.tolerance();
+}
+
+bool DeepZoomGenerator::is_blank(int dz_level, int col, int row) const
+{
+    return m_blank.is_blank(dz_level, col, row);
+}
+
+std::shared_ptr<std::vector<uint8_t> const> DeepZoomGenerator::_blank_tile(int dz_level, int col, int row) const
+{
+    uint32_t color = 0;
+    if (!m_blank.is_blank(dz_level, col, row, &color)) return nullptr;
+    auto const [width, height] = get_tile_dimensions(dz_level, col, row);
+    // with the native encoders whatever `native_encoding`, there are no pixels to hand to QuPath
+    return m_blank_tiles->get(color, width, height, false, [&]() {
+        std::vector<uint32_t> pixels(static_cast<size_t>(width) * height, color);
+        return _encode_pixels(pixels, width, height);
+    });
+}
+
+std::tuple<int64_t, int64_t, int64_t, int64_t> DeepZoomGenerator::_l0_tile_rect(int dz_level, int64_t col,
+                                                                                 int64_t row) const
+{
+    auto const& [l0_location, slide_level, l_size] =
+        get_tile_coordinates(dz_level, static_cast<int>(col), static_cast<int>(row));
+    auto const downsample = m_level_downsamples[slide_level];
+    return std::make_tuple(int64_t{l0_location.first}, int64_t{l0_location.second},
+                           static_cast<int64_t>(std::ceil(l_size.first * downsample)),
+                           static_cast<int64_t>(std::ceil(l_size.second * downsample)));
+}
+
+std::tuple<int, int, std::vector<unsigned char>> DeepZoomGenerator::_read_picture(double downsample) const
+{
+    auto const [l0_width, l0_height] = m_l_dimensions[0];
+    auto region = m_reader->readRegion(downsample, 0, 0, l0_width, l0_height, 0, 0, Reader::ImageFormat::RGB);
+    // width and height (big endian int32), then r, g, b rows
+    auto const read_int = [&](size_t i) {
+        return static_cast<int>(region[i]) << 24 | region[i + 1] << 16 | region[i + 2] << 8 | region[i + 3];
+    };
+    auto const width = region.size() >= 8 ? read_int(0) : 0;
+    auto const height = region.size() >= 8 ? read_int(4) : 0;
+    if (width <= 0 || height <= 0 || region.size() != 8 + static_cast<size_t>(width) * height * 3)
+    {
+        printf("Invalid picture of %zu bytes\n", region.size());
+        return {};
+    }
+    region.erase(region.begin(), region.begin() + 8);
+    return {width, height, std::move(region)};
+}
+
+char const* DeepZoomGenerator::format_extension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::PNG:
+        return "png";
+    case ImageFormat::JPG:
+        return "jpg";
+    case ImageFormat::WEBP:
+    case ImageFormat::WEBP_LOSSLESS:
+        return "webp";
+    case ImageFormat::AVIF:
+        return "avif";
+    }
+    return "jpg";
+}
+
+void DeepZoomGenerator::set_webp_method(int method)
+{
+    m_webp_method = std::clamp(method, 0, 6);
+}
+
+int DeepZoomGenerator::webp_method() const
+{
+    return m_webp_method;
+}
+
+void DeepZoomGenerator::set_avif_speed(int speed)
+{
+    m_avif_speed = std::clamp(speed, 0, 10);
+}
+
+int DeepZoomGenerator::avif_speed() const
+{
+    return m_avif_speed;
+}
+
+void DeepZoomGenerator::set_max_readers(int max_readers)
+{
+    if (!is_valid()) return;
+    m_max_readers = std::max(1, max_readers);
+    m_reader->setMaxServers(m_max_readers);
+}
+
+int DeepZoomGenerator::max_readers() const
+{
+    return m_max_readers;
+}
+
+void DeepZoomGenerator::set_native_encoding(bool native)
+{
+    m_native_encoding = native;
+}
+
+bool DeepZoomGenerator::native_encoding() const
+{
+    return m_native_encoding;
+}
+
+void DeepZoomGenerator::set_tile_cache(std::shared_ptr<dz_common::TileCache> cache)
+{
+    m_tile_cache = std::move(cache);
+}
+
+std::shared_ptr<dz_common::TileCache> DeepZoomGenerator::tile_cache() const
+{
+    return m_tile_cache;
+}
+
+dz_common::TileKey DeepZoomGenerator::_tile_key(int dz_level, int col, int row) const
+{
+    // QuPath's tiles differ from openslide's, the backend (and ImageIO's encoders) is part of the slide identity
+    return dz_common::TileKey{.slide = m_filepath + (m_native_encoding ? "?qupath" : "?qupath-imageio"),
+                              .format = static_cast<int>(m_format),
+                              .quality = m_quality,
+                              .tile_size = m_tile_size,
+                              .overlap = m_overlap,
+                              .dz_level = dz_level,
+                              .col = col,
+                              .row = row};
+}
+
 std::pair<std::tuple<std::pair<int, int>, // l0_location
                      int,                 // slide_level
                      std::pair<int, int>  // l_size
@@ -4,6 +4,18 @@
 #include <vector>
 #include <string>
 #include <utility>
+#include <tuple>
+#include <span>
+#include <cstdint>
+
+#include "dz_common/blankindex.hpp"
+#include "dz_common/tissueindex.hpp"
+
+namespace dz_common
+{
+    class TileCache;
+    struct TileKey;
+} // namespace dz_common
 
 namespace dz_qupath
 {
@@ -14,14 +26,28 @@ namespace dz_qupath
     class DeepZoomGenerator
     {
     public:
+        // all formats are encoded on the native side from the pixels QuPath reads, with the encoders
+        // `dz_openslide` uses (see `set_native_encoding`); WEBP/WEBP_LOSSLESS/AVIF need `dz_common` built with
+        // libwebp/libavif
         enum class ImageFormat : int
         {
             PNG = 0,
-            JPG
+            JPG,
+            WEBP,
+            WEBP_LOSSLESS,
+            AVIF
+        };
+
+        // what the constructor pulls from QuPath over JNI
+        enum class OpenMode : int
+        {
+            EAGER = 0, // all the metadata of the reader: channels, pixel type, OME-XML...
+            LAZY       // all but the channel names and the OME-XML, read on first use by the reader
         };
 
         DeepZoomGenerator(std::string filepath, int tile_size = 254, int overlap = 1,
-                          ImageFormat format = ImageFormat::PNG, float quality = 0.75f);
+                          ImageFormat format = ImageFormat::PNG, float quality = 0.75f,
+                          OpenMode open_mode = OpenMode::EAGER);
         ~DeepZoomGenerator();
 
         DeepZoomGenerator(DeepZoomGenerator const&) = delete;
@@ -39,8 +65,13 @@ namespace dz_qupath
         // deepzoom level dimensions <x, y>
         std::vector<std::pair<int, int>> level_dimensions() const;
         int tile_count() const;
-        // PNG/JPG bytes
+        // <width, height, ARGB_Premultiplied_pixels> as QuPath reads them, what `dz_openslide::PyramidExporter` reads
+        std::tuple<int64_t, int64_t, std::vector<uint32_t>> get_tile_pixels(int dz_level, int col, int row) const;
+        // encoded bytes
         std::vector<unsigned char> get_tile(int dz_level, int col, int row) const;
+        // encoded bytes for a batch of <dz_level, col, row>, in the same order
+        // the batch crosses JNI once and is read in parallel by QuPath, then encoded in parallel here
+        std::vector<std::vector<unsigned char>> get_tiles(std::span<std::tuple<int, int, int> const> tiles) const;
         // <<x, y>, slide_level, <width, height>>
         std::tuple<std::pair<int, int>, int, std::pair<int, int>> get_tile_coordinates(int dz_level, int col,
                                                                                        int row) const;
@@ -48,7 +79,59 @@ namespace dz_qupath
         std::pair<int, int> get_tile_dimensions(int dz_level, int col, int row) const;
         // XML
         std::string get_dzi() const;
+        int tile_size() const;
+        int overlap() const;
         double get_mpp() const;
+        // file extension and DZI `Format` of `format`
+        static char const* format_extension(ImageFormat format);
+
+        // tissue index, as in `dz_openslide::DeepZoomGenerator`
+        // computed from a thumbnail QuPath reads of the whole image (one JNI call), unless `index_path` holds one
+        // not thread-safe itself, call it before handing the generator to other threads
+        bool build_tissue_index(std::string const& index_path = {});
+        dz_common::TissueIndex const& tissue_index() const;
+        // true if the tile intersects tissue, or if no index was built
+        bool has_tissue(int dz_level, int col, int row) const;
+
+        // blank tiles, as in `dz_openslide::DeepZoomGenerator`: `get_tile`/`get_tiles` answer the tiles the bitmap
+        // says are blank with a tile of their color and size encoded once, without reading them
+        // with `tolerance` >= 0 a picture of the whole image at the resolution of the lowest level (at most
+        // `dz_common::BlankIndex::max_picture_pixels`) is read once over JNI. -1 disables (default)
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_blank_detection(int tolerance = 2);
+        int blank_tolerance() const;
+        // true if the bitmap says the tile is blank, exporters and viewers can skip it
+        bool is_blank(int dz_level, int col, int row) const;
+
+        // WebP/AVIF encoding effort
+        // WebP `method` [0, 6], 0 is the fastest (default 4); AVIF `speed` [0, 10], 10 is the fastest (default 8)
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_webp_method(int method);
+        int webp_method() const;
+        void set_avif_speed(int speed);
+        int avif_speed() const;
+
+        // concurrency
+        // the const methods can be called from several threads at once, each thread is attached to the JVM on its
+        // first call. by default all reads go through the slide's single QuPath `ImageServer`, whose Bio-Formats
+        // reader serializes them; with `max_readers` > 1 they are spread over a pool of servers QuPath opens on
+        // demand, a thread waits when all of them are busy
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_max_readers(int max_readers);
+        int max_readers() const;
+
+        // true (the default): tiles cross JNI as raw pixels written to native memory and are encoded here
+        // false: PNG/JPG are encoded by QuPath's ImageIO and cross JNI as Java byte arrays, WEBP/AVIF as RGB bytes,
+        // kept to compare against. ImageIO's PNGs keep the alpha, the native ones are RGB like `dz_openslide`'s
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_native_encoding(bool native);
+        bool native_encoding() const;
+
+        // encoded tiles are looked up in / stored to the cache by `get_tile`, keyed as `dz_openslide`'s but for
+        // this backend, so that one cache (and its disk tier) can be shared by all generators; nullptr disables
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_tile_cache(std::shared_ptr<dz_common::TileCache> cache);
+        std::shared_ptr<dz_common::TileCache> tile_cache() const;
 
     private:
         auto _get_tile_info(int dz_level, int col, int row) const
@@ -59,15 +142,31 @@ namespace dz_qupath
                          std::pair<int, int> // z_size
                          >;
         auto _get_best_level_for_downsample(double downsample) const -> int;
+        dz_common::TileKey _tile_key(int dz_level, int col, int row) const;
+        // level 0 <x, y, width, height> of a tile, for the tissue and blank indexes
+        std::tuple<int64_t, int64_t, int64_t, int64_t> _l0_tile_rect(int dz_level, int64_t col, int64_t row) const;
+        // encoded blank tile if the bitmap says the tile is blank, else null
+        std::shared_ptr<std::vector<uint8_t> const> _blank_tile(int dz_level, int col, int row) const;
+        // RGB picture of the whole level 0 downsampled by `downsample` (one JNI call): <width, height, rgb rows>,
+        // empty if QuPath could not read it
+        std::tuple<int, int, std::vector<unsigned char>> _read_picture(double downsample) const;
+        // WEBP/AVIF bytes of a region QuPath returned as `Reader::ImageFormat::RGB`, other formats as they are
+        std::vector<unsigned char> _encode_tile(std::vector<unsigned char> const& region) const;
+        // bytes of a region QuPath returned as ARGB_Premultiplied pixels, in any format
+        std::vector<unsigned char> _encode_pixels(std::span<uint32_t const> pixels, int width, int height) const;
 
     private:
-        std::unique_ptr<Reader> m_reader = nullptr;
+        std::unique_ptr<Reader> m_reader;
         int m_tile_size =
             512; // the width and height of a single tile, for best viewer performance, tile_size + 2 * overlap should be a power of two
         int m_overlap = 1; // the number of extra pixels to add to each interior edge of a tile
         double m_mpp = 1e-6;
         ImageFormat m_format = ImageFormat::PNG;
         float m_quality = 0.75f;
+        int m_webp_method = 4;
+        int m_avif_speed = 8;
+        bool m_native_encoding = true;
+        int m_max_readers = 1;
         int m_levels = 0;                                  // slide levels
         int m_dz_levels = 0;                               // deepzoom levels
         std::vector<std::pair<int, int>> m_l_dimensions;   // slide level dimensions
@@ -78,5 +177,10 @@ namespace dz_qupath
         std::vector<double>
             m_level_dz_downsamples; // deepzoom level downsample factors (ratio of deepzoom level to slide level)
         std::vector<double> m_level_0_dz_downsamples; // total downsamples for each Deep Zoom level (2 ** x)
+        dz_common::TissueIndex m_tissue;
+        dz_common::BlankIndex m_blank;
+        std::unique_ptr<dz_common::BlankTiles> m_blank_tiles = std::make_unique<dz_common::BlankTiles>();
+        std::string m_filepath;
+        std::shared_ptr<dz_common::TileCache> m_tile_cache = nullptr;
     };
 } // namespace dz_qupath
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <cassert>
+#include <mutex>
 
 #ifdef _WIN32
 #else
@@ -12,6 +13,22 @@
 
 //#define DEBUG_GC
 
+namespace
+{
+    // detaches a thread `getJNIEnv` attached when it exits, which frees whatever local references it leaked
+    // `jvm` points to `JVMWrapper::m_jvm_ptr`, null once `destroyJVM` ran: there is nothing to detach from then
+    struct ThreadAttachment
+    {
+        ~ThreadAttachment()
+        {
+            if (jvm && *jvm) (*jvm)->DetachCurrentThread();
+        }
+
+        JavaVM* const* jvm = nullptr;
+    };
+    thread_local ThreadAttachment thread_attachment;
+} // namespace
+
 JVMWrapper* JVMWrapper::m_jvm_wrapper_instance_ptr = nullptr;
 JVMWrapper::JNI_CreateJavaVMFuncPtr JVMWrapper::m_jni_create_jvm_func_ptr = nullptr;
 JavaVM* JVMWrapper::m_jvm_ptr = nullptr;
@@ -71,6 +88,9 @@ jmethodID JVMWrapper::throwableGetMessageMethod = nullptr;
 
 JVMWrapper* JVMWrapper::getInstance(std::vector<std::string> args)
 {
+    // readers may be opened on several threads at once, the JVM is created once
+    static std::mutex mutex;
+    std::lock_guard lock(mutex);
     if (m_jvm_wrapper_instance_ptr == nullptr && createJVM(args)) m_jvm_wrapper_instance_ptr = new JVMWrapper();
     return m_jvm_wrapper_instance_ptr;
 }
@@ -182,32 +202,49 @@ bool JVMWrapper::createJVM(std::vector<std::string> args)
 void JVMWrapper::destroyJVM()
 {
     if (m_jvm_ptr) m_jvm_ptr->DestroyJavaVM();
+    // the threads still attached must not detach from it when they exit
+    m_jvm_ptr = nullptr;
+    m_jni_env_ptr = nullptr;
 #ifdef _WIN32
     if (m_jvm_dll) FreeLibrary(m_jvm_dll);
 #else
     if (m_jvm_dll) dlclose(m_jvm_dll);
 #endif
+    m_jvm_dll = nullptr;
 }
 
 void JVMWrapper::checkException()
 {
-    if (m_jni_env_ptr->ExceptionCheck())
+    auto* env = getJNIEnv();
+    if (env && env->ExceptionCheck())
     {
-        m_jni_env_ptr->ExceptionDescribe();
-        m_jni_env_ptr->ExceptionClear();
+        env->ExceptionDescribe();
+        env->ExceptionClear();
     }
 }
 
 JNIEnv* JVMWrapper::getJNIEnv()
 {
-    return m_jni_env_ptr;
+    if (!m_jvm_ptr) return nullptr;
+    JNIEnv* env = nullptr;
+    if (m_jvm_ptr->GetEnv((void**)&env, JNI_VERSION_1_8) == JNI_OK) return env;
+
+    // a daemon thread does not keep the JVM alive, the process exits whatever threads are still attached
+    if (m_jvm_ptr->AttachCurrentThreadAsDaemon((void**)&env, nullptr) != JNI_OK)
+    {
+        std::cerr << "Error attaching thread to JVM" << std::endl;
+        return nullptr;
+    }
+    thread_attachment.jvm = &m_jvm_ptr;
+    return env;
 }
 
 jclass JVMWrapper::findClass(const char* className)
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
-    jclass javaClass = m_jni_env_ptr->FindClass(className);
+    jclass javaClass = env->FindClass(className);
     if (!javaClass)
     {
         std::cerr << "Couldn't find Java class: " << className << std::endl;
@@ -216,18 +253,19 @@ jclass JVMWrapper::findClass(const char* className)
     }
     else
     {
-        jclass globalClass = (jclass)m_jni_env_ptr->NewGlobalRef(javaClass);
-        m_jni_env_ptr->DeleteLocalRef(javaClass);
+        jclass globalClass = (jclass)env->NewGlobalRef(javaClass);
+        env->DeleteLocalRef(javaClass);
         return globalClass;
     }
 }
 
 jmethodID JVMWrapper::getMethodID(jclass javaClass, const char* methodName, const char* signature, bool isStatic)
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
-    jmethodID javaMethodID = isStatic ? m_jni_env_ptr->GetStaticMethodID(javaClass, methodName, signature) :
-                                        javaMethodID = m_jni_env_ptr->GetMethodID(javaClass, methodName, signature);
+    jmethodID javaMethodID = isStatic ? env->GetStaticMethodID(javaClass, methodName, signature) :
+                                        javaMethodID = env->GetMethodID(javaClass, methodName, signature);
     if (!javaMethodID)
     {
         std::cerr << "Couldn't find Java method ID: " << methodName << " " << signature << std::endl;
@@ -238,9 +276,10 @@ jmethodID JVMWrapper::getMethodID(jclass javaClass, const char* methodName, cons
 
 jfieldID JVMWrapper::getFieldID(jclass javaClass, const char* fieldName, const char* signature)
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
-    jfieldID javaFieldID = m_jni_env_ptr->GetFieldID(javaClass, fieldName, signature);
+    jfieldID javaFieldID = env->GetFieldID(javaClass, fieldName, signature);
     if (!javaFieldID)
     {
         std::cerr << "Couldn't find Java field ID: " << fieldName << " " << signature << std::endl;
@@ -251,41 +290,45 @@ jfieldID JVMWrapper::getFieldID(jclass javaClass, const char* fieldName, const c
 
 jstring JVMWrapper::getClassName(jclass javaClass)
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
     if (!classClass) classClass = findClass("java/lang/Class");
-    return (jstring)m_jni_env_ptr->CallObjectMethod(javaClass,
-                                                    getMethodID(classClass, "getName", "()Ljava/lang/String;", false));
+    return (jstring)env->CallObjectMethod(javaClass, getMethodID(classClass, "getName", "()Ljava/lang/String;", false));
 }
 
 jobjectArray JVMWrapper::newObjectArray(int length, jobject initial)
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
     if (!objectClass) objectClass = findClass("java/lang/Object");
-    return m_jni_env_ptr->NewObjectArray(length, objectClass, initial);
+    return env->NewObjectArray(length, objectClass, initial);
 }
 
 void JVMWrapper::throwException(jclass clazz, const char* message)
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
-    m_jni_env_ptr->ExceptionClear();
-    m_jni_env_ptr->ThrowNew(clazz, message);
+    env->ExceptionClear();
+    env->ThrowNew(clazz, message);
 }
 
 void JVMWrapper::throwException(const char* className, const char* message)
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
     jclass clazz = findClass(className);
     throwException(clazz, message);
-    m_jni_env_ptr->DeleteLocalRef(clazz);
+    env->DeleteLocalRef(clazz);
 }
 
 void JVMWrapper::initCache()
 {
-    assert(m_jni_env_ptr);
+    auto* env = getJNIEnv();
+    assert(env);
 
     classClass = findClass("java/lang/Class");
     objectClass = findClass("java/lang/Object");
@@ -16,6 +16,9 @@ public:
     static JVMWrapper* getInstance(std::vector<std::string> args = {});
     static void destroyJVM();
 
+    // the calling thread's: a JNIEnv is only valid on its own thread. threads other than the one that created the
+    // JVM are attached (as daemons) on first use and detached when they exit
+    // class/method/field IDs and global references can be shared between threads, local references cannot
     static JNIEnv* getJNIEnv();
     //\note: global reference
     static jclass findClass(const char* className);
@@ -44,7 +47,7 @@ private:
 
 private:
     static JavaVM* m_jvm_ptr;
-    static JNIEnv* m_jni_env_ptr;
+    static JNIEnv* m_jni_env_ptr; // of the thread that created the JVM
 
 private:
     static JVMWrapper* m_jvm_wrapper_instance_ptr;
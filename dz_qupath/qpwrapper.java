@@ -1,4 +1,6 @@
 import java.awt.image.BufferedImage;
+import java.awt.image.DataBufferInt;
+import java.awt.image.SinglePixelPackedSampleModel;
 import java.awt.Graphics2D;
 import java.awt.Image;
 import java.io.ByteArrayOutputStream;
@@ -6,11 +8,16 @@ import java.io.Closeable;
 import java.io.IOException;
 import java.net.URI;
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.IntBuffer;
 import java.nio.file.Paths;
+import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.Collections;
 import java.util.List;
 import java.util.Locale;
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.stream.IntStream;
 
 import javax.imageio.IIOImage;
 import javax.imageio.ImageIO;
@@ -34,13 +41,22 @@ public class qpwrapper implements AutoCloseable {
     private ImageServer<BufferedImage> server; // https://github.com/qupath/qupath/blob/main/qupath-core/src/main/java/qupath/lib/images/servers/ImageServer.java
     private ImageServerMetadata meta;
     private PixelCalibration pixcal;
+    private final String path;
+    // servers on the same image for the reads, `server` included: a Bio-Formats reader serializes its reads
+    private final LinkedBlockingQueue<ImageServer<BufferedImage>> idleServers = new LinkedBlockingQueue<>();
+    private final List<ImageServer<BufferedImage>> servers = new ArrayList<>();
+    private volatile int maxServers = 1;
+    private int openingServers = 0; // guarded by `servers`
 
     public qpwrapper(String path) {
+        this.path = path;
         try {
             server = new ImageServerProvider().buildServer(path,
                     BufferedImage.class);
             meta = server.getMetadata();
             pixcal = server.getPixelCalibration();
+            servers.add(server);
+            idleServers.add(server);
         } catch (Exception e) {
             e.printStackTrace();
         }
@@ -48,9 +64,62 @@ public class qpwrapper implements AutoCloseable {
 
     @Override
     public void close() throws Exception {
+        synchronized (servers) {
+            for (var s : servers)
+                if (s != server)
+                    s.close();
+            servers.clear();
+            idleServers.clear();
+        }
         server.close();
     }
 
+    /**
+     * Set how many servers the reads are spread over: up to {@code max} servers are opened on the image as
+     * concurrent reads need them, a read waits for one when all of them are busy.
+     * 
+     * @param max at least 1, the server of the metadata
+     */
+    public void setMaxServers(int max) {
+        maxServers = Math.max(1, max);
+    }
+
+    public int getMaxServers() {
+        return maxServers;
+    }
+
+    // an idle server, a new one if all of them are busy and there can be more, otherwise the next released one
+    private ImageServer<BufferedImage> acquireServer() throws Exception {
+        var s = idleServers.poll();
+        if (s != null)
+            return s;
+        boolean open;
+        synchronized (servers) {
+            if (servers.isEmpty())
+                throw new IOException("No server for " + path);
+            open = servers.size() + openingServers < maxServers;
+            if (open)
+                openingServers++;
+        }
+        if (!open)
+            return idleServers.take();
+        // opening takes a while, the servers released meanwhile go to the other reads
+        try {
+            s = new ImageServerProvider().buildServer(path, BufferedImage.class);
+        } finally {
+            synchronized (servers) {
+                openingServers--;
+                if (s != null)
+                    servers.add(s);
+            }
+        }
+        return s;
+    }
+
+    private void releaseServer(ImageServer<BufferedImage> s) {
+        idleServers.add(s);
+    }
+
     // https://github.com/qupath/qupath/blob/main/qupath-core/src/main/java/qupath/lib/images/servers/ImageServerMetadata.java#L822
     public String getMetadata() {
         try {
@@ -222,6 +291,67 @@ public class qpwrapper implements AutoCloseable {
         return server.getChannel(channel).getName();
     }
 
+    /**
+     * Request the names of all channels at once.
+     * 
+     * @return
+     * @see #getChannelName(int)
+     */
+    public String[] getChannelNames() {
+        String[] names = new String[server.nChannels()];
+        for (int c = 0; c < names.length; c++)
+            names[c] = server.getChannel(c).getName();
+        return names;
+    }
+
+    /**
+     * All the numeric metadata in one array, so that native code opens an image in a single call instead of one
+     * per value, channel and level:
+     * <ul>
+     * <li>getSizeX, getSizeY, getSizeZ, getSizeC, getSizeT</li>
+     * <li>getPhysSizeX, getPhysSizeY, getPhysSizeZ, getPhysSizeT</li>
+     * <li>getPixelType, getBitsPerPixel, getPreferredTileWidth, getPreferredTileHeight</li>
+     * <li>nResolutions, then width, height (getSizeForResolution) and downsample (getPreferredDownsamples) of each
+     * resolution</li>
+     * <li>getChannelColor of each channel</li>
+     * </ul>
+     * Integers are exact in a double.
+     * 
+     * @return null if the image could not be opened
+     */
+    public double[] getMetadataSnapshot() {
+        if (server == null)
+            return null;
+        int levels = server.nResolutions();
+        int channels = server.nChannels();
+        double[] downsamples = server.getPreferredDownsamples();
+        double[] res = new double[14 + 3 * levels + channels];
+        int i = 0;
+        res[i++] = getSizeX();
+        res[i++] = getSizeY();
+        res[i++] = getSizeZ();
+        res[i++] = channels;
+        res[i++] = getSizeT();
+        res[i++] = getPhysSizeX();
+        res[i++] = getPhysSizeY();
+        res[i++] = getPhysSizeZ();
+        res[i++] = getPhysSizeT();
+        res[i++] = getPixelType();
+        res[i++] = getBitsPerPixel();
+        res[i++] = getPreferredTileWidth();
+        res[i++] = getPreferredTileHeight();
+        res[i++] = levels;
+        for (int l = 0; l < levels; l++) {
+            ImageServerMetadata.ImageResolutionLevel irl = meta.getLevel(l);
+            res[i++] = irl.getWidth();
+            res[i++] = irl.getHeight();
+            res[i++] = l < downsamples.length ? downsamples[l] : server.getDownsampleForResolution(l);
+        }
+        for (int c = 0; c < channels; c++)
+            res[i++] = getChannelColor(c);
+        return res;
+    }
+
     /**
      * Get a list of 'associated images', e.g. thumbnails or slide overview images.
      * <p>
@@ -385,8 +515,14 @@ public class qpwrapper implements AutoCloseable {
         // height: %d, z: %d, t: %d]",
         // downsample, x, y, width, height, z, t));
         try {
-            BufferedImage image = server.readRegion(downsample, x, y, width, height, z,
-                    t);
+            // the server is released before encoding, only reads need one
+            BufferedImage image;
+            var s = acquireServer();
+            try {
+                image = s.readRegion(downsample, x, y, width, height, z, t);
+            } finally {
+                releaseServer(s);
+            }
             return bufferedImageToBytes(image, format, quality);
         } catch (Exception e) {
             e.printStackTrace();
@@ -419,6 +555,74 @@ public class qpwrapper implements AutoCloseable {
         return readRegion(getDownsampleForResolution(level), x, y, width, height, z, t, format, quality);
     }
 
+    /**
+     * Read a batch of regions for a specified z-plane and timepoint in one call.
+     * <p>
+     * Regions are read and encoded in parallel, the server's own tile cache is
+     * shared between them.
+     * 
+     * @param downsamples downsample factor for each region
+     * @param xs          x coordinate of the top left of each region
+     * @param ys          y coordinate of the top left of each region
+     * @param widths      width of each region
+     * @param heights     height of each region
+     * @param z           index for the z-position
+     * @param t           index for the timepoint
+     * @return PNG/JPG byte array for each region, null for a failed one
+     * @see #readRegion(double, int, int, int, int, int, int, String, float)
+     */
+    public byte[][] readRegions(double[] downsamples, int[] xs, int[] ys, int[] widths, int[] heights, int z, int t,
+            String format, float quality) {
+        byte[][] res = new byte[downsamples.length][];
+        IntStream.range(0, downsamples.length).parallel().forEach(i -> res[i] = readRegion(downsamples[i], xs[i],
+                ys[i], widths[i], heights[i], z, t, format, quality));
+        return res;
+    }
+
+    /**
+     * Read a region like {@link #readRegion(double, int, int, int, int, int, int, String, float)}, as raw pixels
+     * for the encoders on the native side.
+     * <p>
+     * The pixels are written to {@code dest}, a direct buffer over native memory, as native order ARGB ints:
+     * straight from the image's {@code DataBufferInt} when it has one, without any encoding or copy into a Java
+     * array. Opaque images come with an alpha of 0xff, others are not premultiplied. Nothing is written if they do
+     * not fit, the caller can retry with the size returned.
+     * 
+     * @param dest direct buffer of at least width * height * 4 bytes of the region read
+     * @return width &lt;&lt; 32 | height of the region read, 0 if it could not be read
+     */
+    public long readRegionPixels(double downsample, int x, int y, int width, int height, int z, int t,
+            ByteBuffer dest) {
+        try {
+            BufferedImage image;
+            var s = acquireServer();
+            try {
+                image = s.readRegion(downsample, x, y, width, height, z, t);
+            } finally {
+                releaseServer(s);
+            }
+            return bufferedImageToPixels(image, dest);
+        } catch (Exception e) {
+            e.printStackTrace();
+        }
+        return 0;
+    }
+
+    /**
+     * Read a batch of regions as raw pixels, in parallel.
+     * 
+     * @param dests a direct buffer for each region
+     * @return width &lt;&lt; 32 | height of each region, 0 for a failed one
+     * @see #readRegionPixels(double, int, int, int, int, int, int, ByteBuffer)
+     */
+    public long[] readRegionsPixels(double[] downsamples, int[] xs, int[] ys, int[] widths, int[] heights, int z,
+            int t, ByteBuffer[] dests) {
+        long[] res = new long[downsamples.length];
+        IntStream.range(0, downsamples.length).parallel().forEach(i -> res[i] = readRegionPixels(downsamples[i],
+                xs[i], ys[i], widths[i], heights[i], z, t, dests[i]));
+        return res;
+    }
+
     /**
      * Get a tile for the request - no cache since it called `bioformats`'s'
      * `openBytes`
@@ -460,6 +664,8 @@ public class qpwrapper implements AutoCloseable {
     private static byte[] bufferedImageToBytes(BufferedImage image, String format, float quality) {
         if (image == null)
             return null;
+        if (format.equals("RGB"))
+            return bufferedImageToRGB(image);
 
         ByteArrayOutputStream baos = new ByteArrayOutputStream();
         try {
@@ -494,6 +700,57 @@ public class qpwrapper implements AutoCloseable {
         return baos.toByteArray();
     }
 
+    // width, height (big endian) followed by packed r, g, b rows, for formats
+    // ImageIO can not write (WebP, AVIF) and that are encoded on the native side
+    private static byte[] bufferedImageToRGB(BufferedImage image) {
+        int width = image.getWidth();
+        int height = image.getHeight();
+        int[] argb = image.getRGB(0, 0, width, height, null, 0, width);
+        ByteBuffer buffer = ByteBuffer.allocate(8 + argb.length * 3);
+        buffer.putInt(width).putInt(height);
+        for (int p : argb)
+            buffer.put((byte) (p >> 16)).put((byte) (p >> 8)).put((byte) p);
+        return buffer.array();
+    }
+
+    // see `readRegionPixels`
+    private static long bufferedImageToPixels(BufferedImage image, ByteBuffer dest) {
+        if (image == null)
+            return 0;
+        int width = image.getWidth();
+        int height = image.getHeight();
+        if (dest == null || (long) width * height * 4 > dest.capacity())
+            return (long) width << 32 | height;
+
+        IntBuffer pixels = dest.order(ByteOrder.nativeOrder()).asIntBuffer();
+        int type = image.getType();
+        var raster = image.getRaster();
+        // the RGB/ARGB images QuPath reads are packed ints, their rows back to back
+        if ((type == BufferedImage.TYPE_INT_RGB || type == BufferedImage.TYPE_INT_ARGB)
+                && raster.getDataBuffer() instanceof DataBufferInt
+                && raster.getSampleModel() instanceof SinglePixelPackedSampleModel
+                && ((SinglePixelPackedSampleModel) raster.getSampleModel()).getScanlineStride() == width
+                && raster.getSampleModelTranslateX() == 0 && raster.getSampleModelTranslateY() == 0) {
+            DataBufferInt buffer = (DataBufferInt) raster.getDataBuffer();
+            int[] data = buffer.getData();
+            int offset = buffer.getOffset();
+            int count = width * height;
+            if (type == BufferedImage.TYPE_INT_ARGB)
+                pixels.put(data, offset, count);
+            else
+                for (int i = 0; i < count; i++)
+                    pixels.put(i, data[offset + i] | 0xff000000);
+        } else {
+            // anything else (8 bit, indexed, multichannel rendered as RGB...) through the color model
+            int[] row = new int[width];
+            for (int y = 0; y < height; y++) {
+                image.getRGB(0, y, width, 1, row, 0, width);
+                pixels.put(row);
+            }
+        }
+        return (long) width << 32 | height;
+    }
+
     public static BufferedImage resize(BufferedImage img, int newW, int newH) {
         Image tmp = img.getScaledInstance(newW, newH, Image.SCALE_SMOOTH);
         BufferedImage dimg = new BufferedImage(newW, newH, BufferedImage.TYPE_INT_ARGB);
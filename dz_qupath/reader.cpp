@@ -2,18 +2,114 @@
 
 #include "jvmwrapper.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 
 using namespace dz_qupath;
 
+namespace
+{
+    // QuPath may round the size of a downsampled region either way, one more pixel a side fits all of them
+    size_t pixel_capacity(double downsample, int w, int h)
+    {
+        auto const ds = downsample > 0. ? downsample : 1.;
+        return static_cast<size_t>(std::ceil(w / ds) + 1) * static_cast<size_t>(std::ceil(h / ds) + 1);
+    }
+
+    // <width, height> packed in the long `readRegionPixels` returns
+    std::pair<int, int> unpack_size(jlong size)
+    {
+        return {static_cast<int>(size >> 32), static_cast<int>(size & 0xffffffff)};
+    }
+
+    // Java's ARGB is not premultiplied, only the translucent pixels need it
+    void premultiply(std::vector<uint32_t>& pixels)
+    {
+        for (auto& pixel : pixels)
+        {
+            uint32_t const a = pixel >> 24;
+            if (a == 0xff) continue;
+            uint32_t const r = ((pixel >> 16 & 0xff) * a + 127) / 255;
+            uint32_t const g = ((pixel >> 8 & 0xff) * a + 127) / 255;
+            uint32_t const b = ((pixel & 0xff) * a + 127) / 255;
+            pixel = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+
+    // the classes and methods readers call, looked up once for all of them rather than by name on every call
+    // IDs stay valid as long as their class is loaded, these global references are never released
+    struct JavaApi
+    {
+        jclass wrapper_cls = nullptr;
+        jclass system_cls = nullptr;
+        jclass byte_buffer_cls = nullptr;
+
+        jmethodID init = nullptr;
+        jmethodID close = nullptr;
+        jmethodID get_omexml = nullptr;
+        jmethodID get_metadata_snapshot = nullptr;
+        jmethodID get_channel_names = nullptr;
+        jmethodID get_preferred_resolution_level = nullptr;
+        jmethodID get_preferred_downsample_factor = nullptr;
+        jmethodID read_region_downsample = nullptr;
+        jmethodID read_region_level = nullptr;
+        jmethodID read_regions = nullptr;
+        jmethodID read_region_pixels = nullptr;
+        jmethodID read_regions_pixels = nullptr;
+        jmethodID read_tile = nullptr;
+        jmethodID get_default_thumbnail = nullptr;
+        jmethodID get_associated_image_names = nullptr;
+        jmethodID get_associated_image = nullptr;
+        jmethodID set_max_servers = nullptr;
+        jmethodID get_max_servers = nullptr;
+        jmethodID system_gc = nullptr;
+    };
+
+    // nullptr if `qpwrapper` cannot be loaded
+    JavaApi const* java_api()
+    {
+        static JavaApi const api = []() {
+            JavaApi api;
+            api.wrapper_cls = JVMWrapper::findClass("qpwrapper");
+            if (!api.wrapper_cls) return api;
+            api.system_cls = JVMWrapper::findClass("java/lang/System");
+            api.byte_buffer_cls = JVMWrapper::findClass("java/nio/ByteBuffer");
+
+            auto const method = [&api](char const* name, char const* signature) {
+                return JVMWrapper::getMethodID(api.wrapper_cls, name, signature);
+            };
+            api.init = method("<init>", "(Ljava/lang/String;)V");
+            api.close = method("close", "()V");
+            api.get_omexml = method("getOMEXML", "()Ljava/lang/String;");
+            api.get_metadata_snapshot = method("getMetadataSnapshot", "()[D");
+            api.get_channel_names = method("getChannelNames", "()[Ljava/lang/String;");
+            api.get_preferred_resolution_level = method("getPreferredResolutionLevel", "(D)I");
+            api.get_preferred_downsample_factor = method("getPreferredDownsampleFactor", "(D)D");
+            api.read_region_downsample = method("readRegion", "(DIIIIIILjava/lang/String;F)[B");
+            api.read_region_level = method("readRegion", "(IIIIIIILjava/lang/String;F)[B");
+            api.read_regions = method("readRegions", "([D[I[I[I[IIILjava/lang/String;F)[[B");
+            api.read_region_pixels = method("readRegionPixels", "(DIIIIIILjava/nio/ByteBuffer;)J");
+            api.read_regions_pixels = method("readRegionsPixels", "([D[I[I[I[III[Ljava/nio/ByteBuffer;)[J");
+            api.read_tile = method("readTile", "(IIIIIIILjava/lang/String;F)[B");
+            api.get_default_thumbnail = method("getDefaultThumbnail", "(IILjava/lang/String;F)[B");
+            api.get_associated_image_names = method("getAssociatedImageNames", "()[Ljava/lang/String;");
+            api.get_associated_image = method("getAssociatedImage", "(Ljava/lang/String;Ljava/lang/String;F)[B");
+            api.set_max_servers = method("setMaxServers", "(I)V");
+            api.get_max_servers = method("getMaxServers", "()I");
+            if (api.system_cls) api.system_gc = JVMWrapper::getMethodID(api.system_cls, "gc", "()V", true);
+            return api;
+        }();
+        return api.wrapper_cls ? &api : nullptr;
+    }
+} // namespace
+
 struct Reader::impl
 {
     JVMWrapper* jvm_wrapper = nullptr;
-    JNIEnv* jvm_env = nullptr;
-    jclass wrapper_cls = nullptr;       // global reference
+    JavaApi const* api = nullptr;
     jobject wrapper_instance = nullptr; // global reference
-    jclass system_cls = nullptr;        // global reference
 
     struct meta
     {
@@ -36,39 +132,23 @@ struct Reader::impl
         std::vector<std::pair<int, int>> level_dimensions;
         std::vector<double> level_downsamples;
         std::string xml;
+        bool has_channel_names = false;
+        bool has_xml = false;
 
         void PrintSelf() const;
     };
     meta m_meta{};
 
-    void open();
+    bool open(bool lazy);
+    // all the numeric metadata, in one call
+    bool loadSnapshot();
+    // the metadata a lazy `open` left out
+    void loadChannelNames();
+    void loadXML();
     void close();
     std::string getXML();
-    int getSizeX();
-    int getSizeY();
-    int getSizeZ();
-    int getSizeC();
-    int getSizeT();
-    // mm
-    double getPhysSizeX();
-    // mm
-    double getPhysSizeY();
-    // mm
-    double getPhysSizeZ();
-    // s
-    double getPhysSizeT();
-    PixelType getPixelType();
-    int getBitsPerPixel();
-    // ARGB
-    std::optional<std::array<int, 4>> getChannelColor(int channel);
-    std::string getChannelName(int channel);
-
-    int getOptimalTileWidth();
-    int getOptimalTileHeight();
-
-    int getLevelCount();
-    std::vector<std::pair<int, int>> getLevelDimensions();
-    std::vector<double> getLevelDownsamples();
+    std::vector<std::string> getChannelNames();
+
     int getPreferredResolutionLevel(double downsample);
     double getPreferredDownsampleFactor(double downsample);
     // PNG bytes
@@ -76,37 +156,49 @@ struct Reader::impl
                                           ImageFormat format, float quality);
     std::vector<unsigned char> readRegion(int level, int x, int y, int w, int h, int z, int t, ImageFormat format,
                                           float quality);
+    std::vector<std::vector<unsigned char>> readRegions(
+        std::vector<std::tuple<double, int, int, int, int>> const& regions, int z, int t, ImageFormat format,
+        float quality);
+    Pixels readRegionPixels(double downsample, int x, int y, int w, int h, int z, int t);
+    std::vector<Pixels> readRegionsPixels(std::vector<std::tuple<double, int, int, int, int>> const& regions, int z,
+                                          int t);
     std::vector<unsigned char> readTile(int level, int x, int y, int w, int h, int z, int t, ImageFormat format,
                                         float quality);
     std::vector<unsigned char> getDefaultThumbnail(int z, int t, ImageFormat format, float quality);
     std::vector<std::string> getAssociatedImageNames();
     std::vector<unsigned char> getAssociatedImage(std::string const& name, ImageFormat format, float quality);
 
+    void setMaxServers(int maxServers);
+    int getMaxServers();
+
     void force_gc();
+
+    // of the calling thread, the reader can be used from any thread
+    JNIEnv* env() const
+    {
+        return JVMWrapper::getJNIEnv();
+    }
 };
 
 Reader::Reader(std::string filePath)
 {
     pimpl = std::make_unique<impl>();
     pimpl->jvm_wrapper = JVMWrapper::getInstance();
-    pimpl->jvm_env = pimpl->jvm_wrapper->getJNIEnv();
-    pimpl->wrapper_cls = pimpl->jvm_wrapper->findClass("qpwrapper");
-    if (pimpl->wrapper_cls == nullptr)
+    pimpl->api = java_api();
+    if (pimpl->api == nullptr)
     {
         std::cerr << "Error: bfwrapper Class not found." << std::endl;
         pimpl->jvm_wrapper->destroyJVM();
         pimpl = nullptr;
         return;
     }
-    pimpl->system_cls = pimpl->jvm_wrapper->findClass("java/lang/System");
-    jstring filepath = pimpl->jvm_env->NewStringUTF(filePath.c_str());
-    if (auto local_ref = pimpl->jvm_env->NewObject(
-            pimpl->wrapper_cls, pimpl->jvm_wrapper->getMethodID(pimpl->wrapper_cls, "<init>", "(Ljava/lang/String;)V"),
-            filepath);
-        local_ref)
+    jstring filepath = pimpl->env()->NewStringUTF(filePath.c_str());
+    auto local_ref = pimpl->env()->NewObject(pimpl->api->wrapper_cls, pimpl->api->init, filepath);
+    pimpl->env()->DeleteLocalRef(filepath);
+    if (local_ref)
     {
-        pimpl->wrapper_instance = pimpl->jvm_env->NewGlobalRef(local_ref);
-        pimpl->jvm_env->DeleteLocalRef(local_ref);
+        pimpl->wrapper_instance = pimpl->env()->NewGlobalRef(local_ref);
+        pimpl->env()->DeleteLocalRef(local_ref);
     }
     else
     {
@@ -114,7 +206,6 @@ Reader::Reader(std::string filePath)
         pimpl->jvm_wrapper->destroyJVM();
         pimpl = nullptr;
     }
-    pimpl->jvm_env->DeleteLocalRef(filepath);
 }
 
 Reader::~Reader()
@@ -122,12 +213,8 @@ Reader::~Reader()
     if (pimpl)
     {
         close();
-        pimpl->jvm_env->DeleteGlobalRef(pimpl->wrapper_cls);
-        pimpl->jvm_env->DeleteGlobalRef(pimpl->wrapper_instance);
-        pimpl->jvm_env->DeleteGlobalRef(pimpl->system_cls);
-        pimpl->wrapper_cls = nullptr;
+        pimpl->env()->DeleteGlobalRef(pimpl->wrapper_instance);
         pimpl->wrapper_instance = nullptr;
-        pimpl->system_cls = nullptr;
     }
     pimpl = nullptr;
 }
@@ -137,9 +224,9 @@ bool Reader::isValid() const
     return pimpl != nullptr;
 }
 
-void Reader::open()
+bool Reader::open(bool lazy)
 {
-    if (pimpl) pimpl->open();
+    return pimpl && pimpl->open(lazy);
 }
 
 void Reader::close()
@@ -149,6 +236,7 @@ void Reader::close()
 
 std::string Reader::getMetaXML() const
 {
+    pimpl->loadXML();
     return pimpl->m_meta.xml;
 }
 
@@ -219,6 +307,7 @@ std::optional<std::array<int, 4>> Reader::getChannelColor(int channel) const
 
 std::string Reader::getChannelName(int channel) const
 {
+    pimpl->loadChannelNames();
     return pimpl->m_meta.channel_names[channel];
 }
 
@@ -242,6 +331,20 @@ std::string Reader::pixelTypeStr(PixelType pt)
     return typeStr[pixelType];
 }
 
+std::string Reader::imageFormatStr(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::PNG:
+        return "PNG";
+    case ImageFormat::RGB:
+        return "RGB";
+    case ImageFormat::JPEG:
+        break;
+    }
+    return "JPG";
+}
+
 int Reader::getBytesPerPixel(PixelType pixelType)
 {
     switch (pixelType)
@@ -303,6 +406,24 @@ std::vector<unsigned char> Reader::readRegion(int level, int x, int y, int w, in
     return pimpl->readRegion(level, x, y, w, h, z, t, format, quality);
 }
 
+std::vector<std::vector<unsigned char>> Reader::readRegions(
+    std::vector<std::tuple<double, int, int, int, int>> const& regions, int z, int t, ImageFormat format,
+    float quality) const
+{
+    return pimpl->readRegions(regions, z, t, format, quality);
+}
+
+Reader::Pixels Reader::readRegionPixels(double downsample, int x, int y, int w, int h, int z, int t) const
+{
+    return pimpl->readRegionPixels(downsample, x, y, w, h, z, t);
+}
+
+std::vector<Reader::Pixels> Reader::readRegionsPixels(
+    std::vector<std::tuple<double, int, int, int, int>> const& regions, int z, int t) const
+{
+    return pimpl->readRegionsPixels(regions, z, t);
+}
+
 std::vector<unsigned char> Reader::readTile(int level, int x, int y, int w, int h, int z, int t, ImageFormat format,
                                             float quality) const
 {
@@ -314,6 +435,16 @@ std::vector<unsigned char> Reader::getDefaultThumbnail(int z, int t, ImageFormat
     return pimpl->getDefaultThumbnail(z, t, format, quality);
 }
 
+void Reader::setMaxServers(int maxServers)
+{
+    pimpl->setMaxServers(maxServers);
+}
+
+int Reader::getMaxServers() const
+{
+    return pimpl->getMaxServers();
+}
+
 std::vector<std::string> Reader::getAssociatedImageNames() const
 {
     return pimpl->getAssociatedImageNames();
@@ -340,206 +471,147 @@ void Reader::impl::meta::PrintSelf() const
               << "\nphysical_size_t: " << physical_size_t << "\npixel_type: " << pixelTypeStr(pixel_type) << "\n";
 }
 
-void Reader::impl::open()
-{
-    m_meta.size_x = getSizeX();
-    m_meta.size_y = getSizeY();
-    m_meta.size_z = getSizeZ();
-    m_meta.size_t = getSizeT();
-    m_meta.size_c = getSizeC();
-    m_meta.physical_size_x = getPhysSizeX();
-    m_meta.physical_size_y = getPhysSizeY();
-    m_meta.physical_size_z = getPhysSizeZ();
-    m_meta.physical_size_t = getPhysSizeT();
-    m_meta.pixel_type = getPixelType();
-    m_meta.bits_per_pixel = getBitsPerPixel();
-    m_meta.channel_colors.resize(m_meta.size_c);
-    m_meta.channel_names.resize(m_meta.size_c);
-    for (auto c = 0; c < m_meta.size_c; c++)
+bool Reader::impl::open(bool lazy)
+{
+    m_meta.has_channel_names = false;
+    m_meta.has_xml = false;
+    if (!loadSnapshot())
     {
-        m_meta.channel_colors[c] = getChannelColor(c);
-        m_meta.channel_names[c] = getChannelName(c);
+        std::cerr << "Error retrieving metadata" << std::endl;
+        return false;
     }
-    m_meta.optimal_tile_width = getOptimalTileWidth();
-    m_meta.optimal_tile_height = getOptimalTileHeight();
-    m_meta.level_count = getLevelCount();
-    m_meta.level_dimensions = getLevelDimensions();
-    m_meta.level_downsamples = getLevelDownsamples();
-    m_meta.xml = getXML();
+    if (lazy) return true;
+    loadChannelNames();
+    loadXML();
+    return true;
 }
 
-void Reader::impl::close()
+bool Reader::impl::loadSnapshot()
 {
-    jvm_env->CallVoidMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "close", "()V"));
-}
-
-std::string Reader::impl::getXML()
-{
-    jstring xmldata = (jstring)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_env->GetMethodID(wrapper_cls, "getOMEXML", "()Ljava/lang/String;"));
-    if (xmldata != nullptr)
+    // see `qpwrapper.getMetadataSnapshot` for the layout
+    constexpr jsize header_size = 14;
+    std::vector<double> snapshot;
+    jdoubleArray values = (jdoubleArray)env()->CallObjectMethod(wrapper_instance, api->get_metadata_snapshot);
+    if (values)
     {
-        const char* xmldataChars = jvm_env->GetStringUTFChars(xmldata, nullptr);
-        std::string xml = std::string(xmldataChars);
-        jvm_env->ReleaseStringUTFChars(xmldata, xmldataChars);
-        return xml;
+        snapshot.resize(env()->GetArrayLength(values));
+        env()->GetDoubleArrayRegion(values, 0, static_cast<jsize>(snapshot.size()), snapshot.data());
     }
-    else
-        std::cerr << "Error retrieving xmldata" << std::endl;
-    jvm_env->DeleteLocalRef(xmldata);
-    return {};
-}
-
-int Reader::impl::getSizeX()
-{
-    return jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getSizeX", "()I"));
-}
-
-int Reader::impl::getSizeY()
-{
-    return jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getSizeY", "()I"));
-}
-
-int Reader::impl::getSizeZ()
-{
-    return jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getSizeZ", "()I"));
-}
-
-int Reader::impl::getSizeC()
-{
-    return jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getSizeC", "()I"));
-}
-
-int Reader::impl::getSizeT()
-{
-    return jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getSizeT", "()I"));
-}
-
-double Reader::impl::getPhysSizeX()
-{
-    return jvm_env->CallDoubleMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPhysSizeX", "()D"));
-}
-
-double Reader::impl::getPhysSizeY()
-{
-    return jvm_env->CallDoubleMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPhysSizeY", "()D"));
-}
-
-double Reader::impl::getPhysSizeZ()
-{
-    return jvm_env->CallDoubleMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPhysSizeZ", "()D"));
-}
-
-double Reader::impl::getPhysSizeT()
-{
-    return jvm_env->CallDoubleMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPhysSizeT", "()D"));
-}
-
-Reader::PixelType Reader::impl::getPixelType()
-{
-    return static_cast<Reader::PixelType>(
-        jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPixelType", "()I")));
-}
-
-std::optional<std::array<int, 4>> Reader::impl::getChannelColor(int channel)
-{
-    assert(channel >= 0 && channel < getSizeC());
-
-    std::optional<std::array<int, 4>> res;
-
-    jint channelColor = jvm_env->CallIntMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getChannelColor", "(I)I"), channel);
-    if (channelColor != -1)
-        // https://github.com/qupath/qupath/blob/main/qupath-core/src/main/java/qupath/lib/common/ColorTools.java#L321
-        // RGBA
-        res = std::array<int, 4>{(channelColor >> 16) & 0xff, (channelColor >> 8) & 0xff, channelColor & 0xff,
-                                 (channelColor >> 24) & 0xff};
-    return res;
-}
-
-std::string Reader::impl::getChannelName(int channel)
-{
-    assert(channel >= 0 && channel < getSizeC());
-
-    std::string channelName;
-    jstring name = (jstring)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getChannelName", "(I)Ljava/lang/String;"), channel);
-    if (name != nullptr)
+    env()->DeleteLocalRef(values);
+    if (snapshot.size() < header_size) return false;
+
+    auto const level_count = static_cast<int>(snapshot[13]);
+    auto const size_c = static_cast<int>(snapshot[3]);
+    if (level_count < 1 || size_c < 0 || snapshot.size() != header_size + 3 * size_t(level_count) + size_c)
+        return false;
+    // a slide without pixels cannot be tiled
+    if (snapshot[0] < 1 || snapshot[1] < 1 || snapshot[header_size] < 1 || snapshot[header_size + 1] < 1)
+        return false;
+
+    m_meta.size_x = static_cast<int>(snapshot[0]);
+    m_meta.size_y = static_cast<int>(snapshot[1]);
+    m_meta.size_z = static_cast<int>(snapshot[2]);
+    m_meta.size_c = size_c;
+    m_meta.size_t = static_cast<int>(snapshot[4]);
+    m_meta.physical_size_x = snapshot[5];
+    m_meta.physical_size_y = snapshot[6];
+    m_meta.physical_size_z = snapshot[7];
+    m_meta.physical_size_t = snapshot[8];
+    m_meta.pixel_type = static_cast<Reader::PixelType>(static_cast<int>(snapshot[9]));
+    m_meta.bits_per_pixel = static_cast<int>(snapshot[10]);
+    m_meta.optimal_tile_width = static_cast<int>(snapshot[11]);
+    m_meta.optimal_tile_height = static_cast<int>(snapshot[12]);
+    m_meta.level_count = level_count;
+    m_meta.level_dimensions.resize(level_count);
+    m_meta.level_downsamples.resize(level_count);
+    auto const* level = snapshot.data() + header_size;
+    for (auto l = 0; l < level_count; l++, level += 3)
     {
-        const char* nameChars = jvm_env->GetStringUTFChars(name, nullptr);
-        channelName = std::string(nameChars);
-        jvm_env->ReleaseStringUTFChars(name, nameChars);
+        m_meta.level_dimensions[l] = {static_cast<int>(level[0]), static_cast<int>(level[1])};
+        m_meta.level_downsamples[l] = level[2];
     }
-    jvm_env->DeleteLocalRef(name);
-    return channelName;
-}
-
-int Reader::impl::getBitsPerPixel()
-{
-    return jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getBitsPerPixel", "()I"));
+    m_meta.channel_colors.assign(size_c, std::nullopt);
+    m_meta.channel_names.assign(size_c, {});
+    for (auto c = 0; c < size_c; c++)
+    {
+        auto const color = static_cast<jint>(static_cast<int64_t>(level[c]));
+        if (color != -1)
+            // https://github.com/qupath/qupath/blob/main/qupath-core/src/main/java/qupath/lib/common/ColorTools.java#L321
+            // RGBA
+            m_meta.channel_colors[c] =
+                std::array<int, 4>{(color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff, (color >> 24) & 0xff};
+    }
+    return true;
 }
 
-int Reader::impl::getOptimalTileWidth()
+void Reader::impl::loadChannelNames()
 {
-    return jvm_env->CallIntMethod(wrapper_instance,
-                                  jvm_wrapper->getMethodID(wrapper_cls, "getPreferredTileWidth", "()I"));
+    if (m_meta.has_channel_names) return;
+    m_meta.has_channel_names = true;
+    auto names = getChannelNames();
+    names.resize(m_meta.size_c);
+    m_meta.channel_names = std::move(names);
 }
 
-int Reader::impl::getOptimalTileHeight()
+void Reader::impl::loadXML()
 {
-    return jvm_env->CallIntMethod(wrapper_instance,
-                                  jvm_wrapper->getMethodID(wrapper_cls, "getPreferredTileHeight", "()I"));
+    if (m_meta.has_xml) return;
+    m_meta.has_xml = true;
+    m_meta.xml = getXML();
 }
 
-int Reader::impl::getLevelCount()
+void Reader::impl::close()
 {
-    return jvm_env->CallIntMethod(wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "nResolutions", "()I"));
+    env()->CallVoidMethod(wrapper_instance, api->close);
 }
 
-std::vector<std::pair<int, int>> Reader::impl::getLevelDimensions()
+std::string Reader::impl::getXML()
 {
-    std::vector<std::pair<int, int>> res;
-    for (auto i = 0; i < getLevelCount(); i++)
+    jstring xmldata = (jstring)env()->CallObjectMethod(wrapper_instance, api->get_omexml);
+    if (xmldata != nullptr)
     {
-        jintArray dims = (jintArray)jvm_env->CallObjectMethod(
-            wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getSizeForResolution", "(I)[I"), i);
-        if (dims)
-        {
-            jint* dims_ptr = jvm_env->GetIntArrayElements(dims, nullptr);
-            res.push_back(std::make_pair(dims_ptr[0], dims_ptr[1]));
-            jvm_env->ReleaseIntArrayElements(dims, dims_ptr, 0);
-            jvm_env->DeleteLocalRef(dims);
-        }
-        else
-            res.push_back(std::make_pair(-1, -1));
+        const char* xmldataChars = env()->GetStringUTFChars(xmldata, nullptr);
+        std::string xml = std::string(xmldataChars);
+        env()->ReleaseStringUTFChars(xmldata, xmldataChars);
+        env()->DeleteLocalRef(xmldata);
+        return xml;
     }
-    return res;
+    else
+        std::cerr << "Error retrieving xmldata" << std::endl;
+    return {};
 }
 
-std::vector<double> Reader::impl::getLevelDownsamples()
+std::vector<std::string> Reader::impl::getChannelNames()
 {
-    std::vector<double> res;
-    jdoubleArray downsamples = (jdoubleArray)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPreferredDownsamples", "()[D"));
-    if (downsamples)
+    std::vector<std::string> res;
+    jobjectArray names = (jobjectArray)env()->CallObjectMethod(wrapper_instance, api->get_channel_names);
+    if (names != nullptr)
     {
-        jsize length = jvm_env->GetArrayLength(downsamples);
+        jsize length = env()->GetArrayLength(names);
         res.resize(length);
-        jvm_env->GetDoubleArrayRegion(downsamples, 0, length, (jdouble*)res.data());
+        for (jsize i = 0; i < length; i++)
+        {
+            jstring name = (jstring)env()->GetObjectArrayElement(names, i);
+            if (name == nullptr) continue;
+            if (auto* nameChars = env()->GetStringUTFChars(name, nullptr); nameChars)
+            {
+                res[i] = nameChars;
+                env()->ReleaseStringUTFChars(name, nameChars);
+            }
+            env()->DeleteLocalRef(name);
+        }
     }
-    jvm_env->DeleteLocalRef(downsamples);
+    env()->DeleteLocalRef(names);
     return res;
 }
 
 int Reader::impl::getPreferredResolutionLevel(double downsample)
 {
-    return jvm_env->CallIntMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPreferredResolutionLevel", "(D)I"), downsample);
+    return env()->CallIntMethod(wrapper_instance, api->get_preferred_resolution_level, downsample);
 }
 double Reader::impl::getPreferredDownsampleFactor(double downsample)
 {
-    return jvm_env->CallDoubleMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getPreferredDownsampleFactor", "(D)D"), downsample);
+    return env()->CallDoubleMethod(wrapper_instance, api->get_preferred_downsample_factor, downsample);
 }
 
 std::vector<unsigned char> Reader::impl::readRegion(double downsample, int x, int y, int w, int h, int z, int t,
@@ -547,18 +619,17 @@ std::vector<unsigned char> Reader::impl::readRegion(double downsample, int x, in
 {
     std::vector<unsigned char> bytes;
 
-    jstring formatStr = jvm_env->NewStringUTF((format == ImageFormat::PNG) ? "PNG" : "JPG");
-    jbyteArray byteArray = (jbyteArray)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "readRegion", "(DIIIIIILjava/lang/String;F)[B"),
-        downsample, x, y, w, h, z, t, formatStr, quality);
+    jstring formatStr = env()->NewStringUTF(imageFormatStr(format).c_str());
+    jbyteArray byteArray = (jbyteArray)env()->CallObjectMethod(wrapper_instance, api->read_region_downsample,
+                                                               downsample, x, y, w, h, z, t, formatStr, quality);
     if (byteArray != nullptr)
     {
-        jsize len = jvm_env->GetArrayLength(byteArray);
+        jsize len = env()->GetArrayLength(byteArray);
         bytes.resize(len);
-        jvm_env->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
+        env()->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
     }
-    jvm_env->DeleteLocalRef(byteArray);
-    jvm_env->DeleteLocalRef(formatStr);
+    env()->DeleteLocalRef(byteArray);
+    env()->DeleteLocalRef(formatStr);
 
     return bytes;
 }
@@ -568,39 +639,181 @@ std::vector<unsigned char> Reader::impl::readRegion(int level, int x, int y, int
 {
     std::vector<unsigned char> bytes;
 
-    jstring formatStr = jvm_env->NewStringUTF((format == ImageFormat::PNG) ? "PNG" : "JPG");
-    jbyteArray byteArray = (jbyteArray)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "readRegion", "(IIIIIIILjava/lang/String;F)[B"), level,
-        x, y, w, h, z, t, formatStr, quality);
+    jstring formatStr = env()->NewStringUTF(imageFormatStr(format).c_str());
+    jbyteArray byteArray = (jbyteArray)env()->CallObjectMethod(wrapper_instance, api->read_region_level, level, x, y,
+                                                               w, h, z, t, formatStr, quality);
     if (byteArray != nullptr)
     {
-        jsize len = jvm_env->GetArrayLength(byteArray);
+        jsize len = env()->GetArrayLength(byteArray);
         bytes.resize(len);
-        jvm_env->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
+        env()->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
     }
-    jvm_env->DeleteLocalRef(byteArray);
-    jvm_env->DeleteLocalRef(formatStr);
+    env()->DeleteLocalRef(byteArray);
+    env()->DeleteLocalRef(formatStr);
 
     return bytes;
 }
 
+std::vector<std::vector<unsigned char>> Reader::impl::readRegions(
+    std::vector<std::tuple<double, int, int, int, int>> const& regions, int z, int t, ImageFormat format,
+    float quality)
+{
+    std::vector<std::vector<unsigned char>> res(regions.size());
+    if (regions.empty()) return res;
+
+    auto const n = static_cast<jsize>(regions.size());
+    std::vector<jdouble> downsamples(n);
+    std::vector<jint> xs(n), ys(n), ws(n), hs(n);
+    for (jsize i = 0; i < n; i++)
+        std::tie(downsamples[i], xs[i], ys[i], ws[i], hs[i]) = regions[i];
+
+    jdoubleArray dsArray = env()->NewDoubleArray(n);
+    jintArray xArray = env()->NewIntArray(n);
+    jintArray yArray = env()->NewIntArray(n);
+    jintArray wArray = env()->NewIntArray(n);
+    jintArray hArray = env()->NewIntArray(n);
+    env()->SetDoubleArrayRegion(dsArray, 0, n, downsamples.data());
+    env()->SetIntArrayRegion(xArray, 0, n, xs.data());
+    env()->SetIntArrayRegion(yArray, 0, n, ys.data());
+    env()->SetIntArrayRegion(wArray, 0, n, ws.data());
+    env()->SetIntArrayRegion(hArray, 0, n, hs.data());
+
+    jstring formatStr = env()->NewStringUTF(imageFormatStr(format).c_str());
+    jobjectArray byteArrays = (jobjectArray)env()->CallObjectMethod(
+        wrapper_instance, api->read_regions, dsArray, xArray, yArray, wArray, hArray, z, t, formatStr, quality);
+    if (byteArrays != nullptr)
+    {
+        for (jsize i = 0; i < n; i++)
+        {
+            jbyteArray byteArray = (jbyteArray)env()->GetObjectArrayElement(byteArrays, i);
+            if (byteArray != nullptr)
+            {
+                jsize len = env()->GetArrayLength(byteArray);
+                res[i].resize(len);
+                env()->GetByteArrayRegion(byteArray, 0, len, (jbyte*)res[i].data());
+            }
+            env()->DeleteLocalRef(byteArray);
+        }
+    }
+    env()->DeleteLocalRef(byteArrays);
+    env()->DeleteLocalRef(formatStr);
+    env()->DeleteLocalRef(hArray);
+    env()->DeleteLocalRef(wArray);
+    env()->DeleteLocalRef(yArray);
+    env()->DeleteLocalRef(xArray);
+    env()->DeleteLocalRef(dsArray);
+
+    return res;
+}
+
+Reader::Pixels Reader::impl::readRegionPixels(double downsample, int x, int y, int w, int h, int z, int t)
+{
+    Pixels pixels;
+    pixels.data.resize(pixel_capacity(downsample, w, h));
+    for (auto attempt = 0; attempt < 2; attempt++)
+    {
+        jobject buffer = env()->NewDirectByteBuffer(pixels.data.data(), pixels.data.size() * sizeof(uint32_t));
+        auto const size =
+            env()->CallLongMethod(wrapper_instance, api->read_region_pixels, downsample, x, y, w, h, z, t, buffer);
+        env()->DeleteLocalRef(buffer);
+
+        auto const [width, height] = unpack_size(size);
+        if (width <= 0 || height <= 0) break;
+        auto const count = static_cast<size_t>(width) * height;
+        if (count > pixels.data.size())
+        {
+            // nothing was written, read again into a buffer of the size QuPath returned
+            pixels.data.resize(count);
+            continue;
+        }
+        pixels.width = width;
+        pixels.height = height;
+        pixels.data.resize(count);
+        premultiply(pixels.data);
+        return pixels;
+    }
+    return {};
+}
+
+std::vector<Reader::Pixels> Reader::impl::readRegionsPixels(
+    std::vector<std::tuple<double, int, int, int, int>> const& regions, int z, int t)
+{
+    std::vector<Pixels> res(regions.size());
+    if (regions.empty()) return res;
+
+    auto const n = static_cast<jsize>(regions.size());
+    std::vector<jdouble> downsamples(n);
+    std::vector<jint> xs(n), ys(n), ws(n), hs(n);
+    for (jsize i = 0; i < n; i++)
+        std::tie(downsamples[i], xs[i], ys[i], ws[i], hs[i]) = regions[i];
+
+    jdoubleArray dsArray = env()->NewDoubleArray(n);
+    jintArray xArray = env()->NewIntArray(n);
+    jintArray yArray = env()->NewIntArray(n);
+    jintArray wArray = env()->NewIntArray(n);
+    jintArray hArray = env()->NewIntArray(n);
+    env()->SetDoubleArrayRegion(dsArray, 0, n, downsamples.data());
+    env()->SetIntArrayRegion(xArray, 0, n, xs.data());
+    env()->SetIntArrayRegion(yArray, 0, n, ys.data());
+    env()->SetIntArrayRegion(wArray, 0, n, ws.data());
+    env()->SetIntArrayRegion(hArray, 0, n, hs.data());
+    jobjectArray buffers = env()->NewObjectArray(n, api->byte_buffer_cls, nullptr);
+    for (jsize i = 0; i < n; i++)
+    {
+        res[i].data.resize(pixel_capacity(downsamples[i], ws[i], hs[i]));
+        jobject buffer = env()->NewDirectByteBuffer(res[i].data.data(), res[i].data.size() * sizeof(uint32_t));
+        env()->SetObjectArrayElement(buffers, i, buffer);
+        env()->DeleteLocalRef(buffer);
+    }
+
+    std::vector<jlong> sizes(n, 0);
+    jlongArray sizeArray = (jlongArray)env()->CallObjectMethod(wrapper_instance, api->read_regions_pixels, dsArray,
+                                                               xArray, yArray, wArray, hArray, z, t, buffers);
+    if (sizeArray != nullptr) env()->GetLongArrayRegion(sizeArray, 0, n, sizes.data());
+    env()->DeleteLocalRef(sizeArray);
+    env()->DeleteLocalRef(buffers);
+    env()->DeleteLocalRef(hArray);
+    env()->DeleteLocalRef(wArray);
+    env()->DeleteLocalRef(yArray);
+    env()->DeleteLocalRef(xArray);
+    env()->DeleteLocalRef(dsArray);
+
+    for (jsize i = 0; i < n; i++)
+    {
+        auto const [width, height] = unpack_size(sizes[i]);
+        auto const count = static_cast<size_t>(std::max(width, 0)) * std::max(height, 0);
+        if (count == 0)
+            res[i] = {};
+        else if (count > res[i].data.size())
+            // did not fit, read on its own
+            res[i] = readRegionPixels(downsamples[i], xs[i], ys[i], ws[i], hs[i], z, t);
+        else
+        {
+            res[i].width = width;
+            res[i].height = height;
+            res[i].data.resize(count);
+            premultiply(res[i].data);
+        }
+    }
+    return res;
+}
+
 std::vector<unsigned char> Reader::impl::readTile(int level, int x, int y, int w, int h, int z, int t,
                                                   ImageFormat format, float quality)
 {
     std::vector<unsigned char> bytes;
 
-    jstring formatStr = jvm_env->NewStringUTF((format == ImageFormat::PNG) ? "PNG" : "JPG");
-    jbyteArray byteArray = (jbyteArray)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "readTile", "(IIIIIIILjava/lang/String;F)[B"), level, x,
-        y, w, h, z, t, formatStr, quality);
+    jstring formatStr = env()->NewStringUTF(imageFormatStr(format).c_str());
+    jbyteArray byteArray = (jbyteArray)env()->CallObjectMethod(wrapper_instance, api->read_tile, level, x, y, w, h, z,
+                                                               t, formatStr, quality);
     if (byteArray != nullptr)
     {
-        jsize len = jvm_env->GetArrayLength(byteArray);
+        jsize len = env()->GetArrayLength(byteArray);
         bytes.resize(len);
-        jvm_env->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
+        env()->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
     }
-    jvm_env->DeleteLocalRef(byteArray);
-    jvm_env->DeleteLocalRef(formatStr);
+    env()->DeleteLocalRef(byteArray);
+    env()->DeleteLocalRef(formatStr);
 
     return bytes;
 }
@@ -609,18 +822,17 @@ std::vector<unsigned char> Reader::impl::getDefaultThumbnail(int z, int t, Image
 {
     std::vector<unsigned char> bytes;
 
-    jstring formatStr = jvm_env->NewStringUTF((format == ImageFormat::PNG) ? "PNG" : "JPG");
-    jbyteArray byteArray = (jbyteArray)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_wrapper->getMethodID(wrapper_cls, "getDefaultThumbnail", "(IILjava/lang/String;F)[B"), z,
-        t);
+    jstring formatStr = env()->NewStringUTF(imageFormatStr(format).c_str());
+    jbyteArray byteArray =
+        (jbyteArray)env()->CallObjectMethod(wrapper_instance, api->get_default_thumbnail, z, t, formatStr, quality);
     if (byteArray != nullptr)
     {
-        jsize len = jvm_env->GetArrayLength(byteArray);
+        jsize len = env()->GetArrayLength(byteArray);
         bytes.resize(len);
-        jvm_env->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
+        env()->GetByteArrayRegion(byteArray, 0, len, (jbyte*)bytes.data());
     }
-    jvm_env->DeleteLocalRef(byteArray);
-    jvm_env->DeleteLocalRef(formatStr);
+    env()->DeleteLocalRef(byteArray);
+    env()->DeleteLocalRef(formatStr);
 
     return bytes;
 }
@@ -629,24 +841,24 @@ std::vector<std::string> Reader::impl::getAssociatedImageNames()
 {
     std::vector<std::string> associatedImageNamesVec;
 
-    jobjectArray associatedImageNames = (jobjectArray)jvm_env->CallObjectMethod(
-        wrapper_instance, jvm_env->GetMethodID(wrapper_cls, "getAssociatedImageNames", "()[Ljava/lang/String;"));
+    jobjectArray associatedImageNames =
+        (jobjectArray)env()->CallObjectMethod(wrapper_instance, api->get_associated_image_names);
     if (associatedImageNames != nullptr)
     {
-        jsize length = jvm_env->GetArrayLength(associatedImageNames);
+        jsize length = env()->GetArrayLength(associatedImageNames);
         associatedImageNamesVec.reserve(length);
         for (jsize i = 0; i < length; i++)
         {
-            jstring name = (jstring)jvm_env->GetObjectArrayElement(associatedImageNames, i);
-            if (auto* nameChars = jvm_env->GetStringUTFChars(name, nullptr); nameChars)
+            jstring name = (jstring)env()->GetObjectArrayElement(associatedImageNames, i);
+            if (auto* nameChars = env()->GetStringUTFChars(name, nullptr); nameChars)
             {
                 associatedImageNamesVec.emplace_back(nameChars);
-                jvm_env->ReleaseStringUTFChars(name, nameChars);
-                jvm_env->DeleteLocalRef(name);
+                env()->ReleaseStringUTFChars(name, nameChars);
+                env()->DeleteLocalRef(name);
             }
         }
     }
-    jvm_env->DeleteLocalRef(associatedImageNames);
+    env()->DeleteLocalRef(associatedImageNames);
 
     return associatedImageNamesVec;
 }
@@ -655,26 +867,34 @@ std::vector<unsigned char> Reader::impl::getAssociatedImage(std::string const& n
 {
     std::vector<unsigned char> bytes;
 
-    jstring nameStr = jvm_env->NewStringUTF(name.c_str());
-    jstring formatStr = jvm_env->NewStringUTF((format == ImageFormat::PNG) ? "PNG" : "JPG");
-    jbyteArray byteArray = (jbyteArray)jvm_env->CallObjectMethod(
-        wrapper_instance,
-        jvm_env->GetMethodID(wrapper_cls, "getAssociatedImage", "(Ljava/lang/String;Ljava/lang/String;F)[B"), nameStr,
-        formatStr, quality);
+    jstring nameStr = env()->NewStringUTF(name.c_str());
+    jstring formatStr = env()->NewStringUTF(imageFormatStr(format).c_str());
+    jbyteArray byteArray =
+        (jbyteArray)env()->CallObjectMethod(wrapper_instance, api->get_associated_image, nameStr, formatStr, quality);
     if (byteArray != nullptr)
     {
-        jsize length = jvm_env->GetArrayLength(byteArray);
+        jsize length = env()->GetArrayLength(byteArray);
         bytes.resize(length);
-        jvm_env->GetByteArrayRegion(byteArray, 0, length, (jbyte*)bytes.data());
+        env()->GetByteArrayRegion(byteArray, 0, length, (jbyte*)bytes.data());
     }
-    jvm_env->DeleteLocalRef(byteArray);
-    jvm_env->DeleteLocalRef(formatStr);
-    jvm_env->DeleteLocalRef(nameStr);
+    env()->DeleteLocalRef(byteArray);
+    env()->DeleteLocalRef(formatStr);
+    env()->DeleteLocalRef(nameStr);
 
     return bytes;
 }
 
+void Reader::impl::setMaxServers(int maxServers)
+{
+    env()->CallVoidMethod(wrapper_instance, api->set_max_servers, maxServers);
+}
+
+int Reader::impl::getMaxServers()
+{
+    return env()->CallIntMethod(wrapper_instance, api->get_max_servers);
+}
+
 void Reader::impl::force_gc()
 {
-    jvm_env->CallStaticVoidMethod(system_cls, jvm_env->GetStaticMethodID(system_cls, "gc", "()V"));
+    if (api->system_gc) env()->CallStaticVoidMethod(api->system_cls, api->system_gc);
 }
@@ -2,12 +2,17 @@
 
 #include <string>
 #include <array>
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <optional>
+#include <tuple>
 
 namespace dz_qupath
 {
+    // a slide opened by QuPath in the JVM of `JVMWrapper`
+    // the reads (`readRegion*`) can run on several threads at once, each one through its own JNIEnv, and are spread
+    // over QuPath's pool of `ImageServer`s (see `setMaxServers`); the rest is not thread-safe
     class Reader
     {
     public:
@@ -27,9 +32,20 @@ namespace dz_qupath
         {
             PNG = 0,
             JPEG,
+            // raw pixels for encoders on the native side: width and height (big endian int32), then r, g, b rows
+            RGB,
+        };
+
+        // a region QuPath read, as ARGB_Premultiplied pixels (`uint32_t` 0xAARRGGBB, like `openslide_read_region`)
+        struct Pixels
+        {
+            int width = 0;
+            int height = 0;
+            std::vector<uint32_t> data; // empty if the region could not be read
         };
 
         static std::string pixelTypeStr(PixelType pixelType);
+        static std::string imageFormatStr(ImageFormat format);
         static int getBytesPerPixel(PixelType pixelType);
 
     public:
@@ -38,7 +54,10 @@ namespace dz_qupath
 
         bool isValid() const;
 
-        void open();
+        // reads the metadata: every number (sizes, levels, pixel type, tile sizes, channel colors) in a single call,
+        // then the channel names and the OME-XML, which `lazy` leaves to the first getter that needs them
+        // false if the metadata cannot be read, the getters are not to be used then
+        bool open(bool lazy = false);
         void close();
 
         std::string getMetaXML() const;
@@ -77,10 +96,27 @@ namespace dz_qupath
                                               ImageFormat format = ImageFormat::PNG, float quality = 0.75f) const;
         std::vector<unsigned char> readRegion(int level, int x, int y, int w, int h, int z, int t,
                                               ImageFormat format = ImageFormat::PNG, float quality = 0.75f) const;
+        // PNG bytes for each <downsample, x, y, w, h>, read and encoded in parallel on the Java side
+        std::vector<std::vector<unsigned char>> readRegions(
+            std::vector<std::tuple<double, int, int, int, int>> const& regions, int z, int t,
+            ImageFormat format = ImageFormat::PNG, float quality = 0.75f) const;
+        // the region as pixels for the native encoders: QuPath writes them straight to native memory, nothing is
+        // encoded nor copied to a Java array
+        Pixels readRegionPixels(double downsample, int x, int y, int w, int h, int z, int t) const;
+        // pixels for each <downsample, x, y, w, h>, read in parallel on the Java side
+        std::vector<Pixels> readRegionsPixels(std::vector<std::tuple<double, int, int, int, int>> const& regions, int z,
+                                              int t) const;
         std::vector<unsigned char> readTile(int level, int x, int y, int w, int h, int z, int t,
                                             ImageFormat format = ImageFormat::PNG, float quality = 0.75f) const;
         std::vector<unsigned char> getDefaultThumbnail(int z, int t, ImageFormat format = ImageFormat::PNG,
                                                        float quality = 0.75f) const;
+        // reads go through a pool of up to `maxServers` `ImageServer`s on the slide, opened on demand by QuPath (the
+        // first one is the reader's own), since a Bio-Formats reader serializes its reads; a thread waits when all
+        // of them are busy. 1 (the default) reads through the reader's own server only
+        // not thread-safe itself, call it before reading from other threads
+        void setMaxServers(int maxServers);
+        int getMaxServers() const;
+
         std::vector<std::string> getAssociatedImageNames() const;
         std::vector<unsigned char> getAssociatedImage(std::string const& name, ImageFormat format = ImageFormat::PNG,
                                                       float quality = 0.75f) const;
@@ -19,7 +19,11 @@ int main(int argc, char* argv[])
         return -1;
     }
 
-    reader.open();
+    if (!reader.open())
+    {
+        std::cerr << "Failed to read metadata" << std::endl;
+        return -1;
+    }
     std::cout << "Image size: " << reader.getSizeX() << "x" << reader.getSizeY() << "x" << reader.getSizeZ() << "x"
               << reader.getSizeC() << "x" << reader.getSizeT() << std::endl;
     std::cout << "Image physical size: " << reader.getPhysSizeX() << "x" << reader.getPhysSizeY() << "x"
@@ -0,0 +1,279 @@
+// loopback load generator for `dz_server`: keep-alive connections on their own threads, each sending one request at
+// a time, reports the throughput and the latency percentiles
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        std::string host = "127.0.0.1";
+        uint16_t port = 8080;
+        int connections = 8;
+        double seconds = 10;
+        // random: any tile of any level, level: the tiles of one level in turn, revalidate: as random but with the
+        // ETag of the previous response of the same tile (304s)
+        std::string mode = "random";
+        int level = -1; // for `level`, the highest one by default
+        std::string slide;
+    };
+
+    struct Response
+    {
+        int status = 0;
+        std::string etag;
+        size_t body_size = 0;
+    };
+
+    class Connection
+    {
+    public:
+        ~Connection()
+        {
+            if (m_fd >= 0) close(m_fd);
+        }
+
+        bool connect(std::string const& host, uint16_t port)
+        {
+            m_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (m_fd < 0) return false;
+            int one = 1;
+            setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) return false;
+            return ::connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        }
+
+        // false if the connection broke
+        bool get(std::string const& path, std::string const& if_none_match, Response& response, std::string* body)
+        {
+            auto request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n";
+            if (!if_none_match.empty()) request += "If-None-Match: " + if_none_match + "\r\n";
+            request += "\r\n";
+            for (size_t sent = 0; sent < request.size();)
+            {
+                auto const n = send(m_fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) return false;
+                sent += static_cast<size_t>(n);
+            }
+
+            size_t head_end = std::string::npos;
+            while ((head_end = m_buffer.find("\r\n\r\n")) == std::string::npos)
+                if (!_fill()) return false;
+            auto const head = m_buffer.substr(0, head_end);
+            m_buffer.erase(0, head_end + 4);
+
+            response = {};
+            if (head.size() < 12) return false;
+            response.status = std::atoi(head.c_str() + 9);
+            response.etag = _header(head, "ETag");
+            auto const length = _header(head, "Content-Length");
+            response.body_size = length.empty() ? 0 : std::stoull(length);
+            while (m_buffer.size() < response.body_size)
+                if (!_fill()) return false;
+            if (body) *body = m_buffer.substr(0, response.body_size);
+            m_buffer.erase(0, response.body_size);
+            return true;
+        }
+
+    private:
+        bool _fill()
+        {
+            char buf[65536];
+            auto const n = recv(m_fd, buf, sizeof(buf), 0);
+            if (n <= 0) return false;
+            m_buffer.append(buf, static_cast<size_t>(n));
+            return true;
+        }
+
+        static std::string _header(std::string const& head, std::string const& name)
+        {
+            auto const at = head.find("\r\n" + name + ": ");
+            if (at == std::string::npos) return {};
+            auto const start = at + name.size() + 4;
+            return head.substr(start, head.find("\r\n", start) - start);
+        }
+
+        int m_fd = -1;
+        std::string m_buffer;
+    };
+
+    int64_t dzi_attribute(std::string const& dzi, std::string const& name)
+    {
+        auto const at = dzi.find(name + "=\"");
+        return at == std::string::npos ? -1 : std::stoll(dzi.substr(at + name.size() + 2));
+    }
+
+    std::string dzi_format(std::string const& dzi)
+    {
+        auto const at = dzi.find("Format=\"");
+        if (at == std::string::npos) return {};
+        return dzi.substr(at + 8, dzi.find('"', at + 8) - at - 8);
+    }
+} // namespace
+
+// ./dz_server_bench --port 8080 --connections 8 --seconds 10 --mode random <slide name>
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string const arg = argv[i];
+        auto const value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : std::string("0"); };
+        if (arg == "--host")
+            options.host = value();
+        else if (arg == "--port")
+            options.port = static_cast<uint16_t>(std::stoi(value()));
+        else if (arg == "--connections")
+            options.connections = std::max(1, std::stoi(value()));
+        else if (arg == "--seconds")
+            options.seconds = std::stod(value());
+        else if (arg == "--mode")
+            options.mode = value();
+        else if (arg == "--level")
+            options.level = std::stoi(value());
+        else
+            options.slide = arg;
+    }
+    if (options.slide.empty() ||
+        (options.mode != "random" && options.mode != "level" && options.mode != "revalidate"))
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--host 127.0.0.1] [--port 8080] [--connections 8] [--seconds 10]"
+                     " [--mode random/level/revalidate] [--level <dz level, default=highest>] <slide name>"
+                  << std::endl;
+        return -1;
+    }
+
+    // pyramid geometry from the DZI
+    std::string dzi;
+    {
+        Connection connection;
+        Response response;
+        if (!connection.connect(options.host, options.port) ||
+            !connection.get("/" + options.slide + ".dzi", {}, response, &dzi) || response.status != 200)
+        {
+            std::cerr << "Failed to fetch /" << options.slide << ".dzi" << std::endl;
+            return -1;
+        }
+    }
+    auto const width = dzi_attribute(dzi, "Width");
+    auto const height = dzi_attribute(dzi, "Height");
+    auto const tile_size = dzi_attribute(dzi, "TileSize");
+    auto const format = dzi_format(dzi);
+    if (width <= 0 || height <= 0 || tile_size <= 0 || format.empty())
+    {
+        std::cerr << "Invalid DZI:\n" << dzi << std::endl;
+        return -1;
+    }
+    std::vector<std::pair<int64_t, int64_t>> level_tiles;
+    for (auto w = width, h = height;; w = (w + 1) / 2, h = (h + 1) / 2)
+    {
+        level_tiles.emplace_back((w + tile_size - 1) / tile_size, (h + tile_size - 1) / tile_size);
+        if (w == 1 && h == 1) break;
+    }
+    std::reverse(level_tiles.begin(), level_tiles.end());
+    auto const level_count = static_cast<int>(level_tiles.size());
+    auto const level = options.level < 0 ? level_count - 1 : std::min(options.level, level_count - 1);
+    auto const tile_path = [&](int dz_level, int64_t col, int64_t row) {
+        return "/" + options.slide + "_files/" + std::to_string(dz_level) + "/" + std::to_string(col) + "_" +
+               std::to_string(row) + "." + format;
+    };
+
+    std::mutex mutex;
+    std::vector<double> latencies; // ms
+    std::map<int, uint64_t> statuses;
+    uint64_t bytes = 0;
+    std::atomic<uint64_t> next_tile{0};
+    std::atomic<bool> failed{false};
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(options.seconds);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.connections; t++)
+        threads.emplace_back([&, t]() {
+            Connection connection;
+            if (!connection.connect(options.host, options.port))
+            {
+                failed = true;
+                return;
+            }
+            std::mt19937_64 rng(static_cast<uint64_t>(t) * 7919 + 1);
+            std::map<std::string, std::string> etags;
+            std::vector<double> thread_latencies;
+            std::map<int, uint64_t> thread_statuses;
+            uint64_t thread_bytes = 0;
+            while (std::chrono::steady_clock::now() < deadline)
+            {
+                std::string path;
+                if (options.mode == "level")
+                {
+                    auto const [cols, rows] = level_tiles[level];
+                    auto const i = static_cast<int64_t>(next_tile++ % static_cast<uint64_t>(cols * rows));
+                    path = tile_path(level, i % cols, i / cols);
+                }
+                else
+                {
+                    auto const dz_level = static_cast<int>(rng() % level_count);
+                    auto const [cols, rows] = level_tiles[dz_level];
+                    path = tile_path(dz_level, static_cast<int64_t>(rng() % cols), static_cast<int64_t>(rng() % rows));
+                }
+                auto const& if_none_match = options.mode == "revalidate" ? etags[path] : std::string();
+
+                Response response;
+                auto const start = std::chrono::steady_clock::now();
+                if (!connection.get(path, if_none_match, response, nullptr))
+                {
+                    failed = true;
+                    break;
+                }
+                thread_latencies.push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                thread_statuses[response.status]++;
+                thread_bytes += response.body_size;
+                if (options.mode == "revalidate" && !response.etag.empty()) etags[path] = response.etag;
+            }
+            std::lock_guard lock(mutex);
+            latencies.insert(latencies.end(), thread_latencies.begin(), thread_latencies.end());
+            for (auto const& [status, count] : thread_statuses)
+                statuses[status] += count;
+            bytes += thread_bytes;
+        });
+    auto const start = std::chrono::steady_clock::now();
+    for (auto& thread : threads)
+        thread.join();
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (failed) std::cerr << "some connections failed" << std::endl;
+    if (latencies.empty()) return -1;
+    std::sort(latencies.begin(), latencies.end());
+    auto const percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(std::ceil(p * latencies.size())) - 1)];
+    };
+    std::cout << "requests: " << latencies.size() << ", req/s: " << latencies.size() / elapsed
+              << ", MB/s: " << bytes / 1e6 / elapsed << std::endl;
+    std::cout << "latency ms p50: " << percentile(0.5) << ", p90: " << percentile(0.9)
+              << ", p99: " << percentile(0.99) << ", max: " << latencies.back() << std::endl;
+    std::cout << "status:";
+    for (auto const& [status, count] : statuses)
+        std::cout << " " << status << "=" << count;
+    std::cout << std::endl;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,326 @@
+#include "server.hpp"
+#include "../dz_openslide/deepzoom.hpp"
+#include "../dz_slideio/deepzoom.hpp"
+#include "../dz_qupath/deepzoom.hpp"
+#include "../dz_common/tilecache.hpp"
+#include "../dz_common/disktilecache.hpp"
+#include "../dz_common/slideregistry.hpp"
+#include "../dz_common/slidemetadata.hpp"
+#include "../dz_common/tilepack.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <csignal>
+#include <filesystem>
+#include <thread>
+
+namespace
+{
+    dz_server::Server* g_server = nullptr;
+
+    void on_signal(int)
+    {
+        if (g_server) g_server->stop();
+    }
+
+    struct Options
+    {
+        std::string backend = "openslide";
+        std::string format = "jpg";
+        int quality = 75;
+        int tile_size = 254;
+        int overlap = 1;
+        bool limit_bounds = false;
+        size_t cache_mb = 256;
+        std::string root;      // slides opened on demand from there
+        size_t max_open = 256; // handles of the slides opened on demand
+        size_t max_memory_mb = 4096;
+        std::string metadata_dir; // openslide metadata sidecars, restarts skip the slide headers
+        std::string disk_cache;   // encoded tiles kept across restarts, below the memory cache
+        size_t disk_cache_mb = 10240;
+        std::vector<std::string> slides;
+    };
+
+    using Registry = dz_common::SlideRegistry<dz_server::TileSource>;
+
+    template <typename ImageFormat> bool parse_format(std::string const& format, ImageFormat& image_format)
+    {
+        if (format == "jpg")
+            image_format = ImageFormat::JPG;
+        else if (format == "png")
+            image_format = ImageFormat::PNG;
+        else if (format == "webp")
+            image_format = ImageFormat::WEBP;
+        else if (format == "webp_lossless")
+            image_format = ImageFormat::WEBP_LOSSLESS;
+        else if (format == "avif")
+            image_format = ImageFormat::AVIF;
+        else
+            return false;
+        return true;
+    }
+
+    // the tiles of a slide change with the file and with the generator parameters
+    std::string identity(std::string const& path, Options const& options)
+    {
+        std::error_code ec;
+        auto const size = std::filesystem::file_size(path, ec);
+        auto const mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+        return std::filesystem::absolute(path, ec).string() + "|" + std::to_string(ec ? 0 : size) + "|" +
+               std::to_string(mtime) + "|" + options.backend + "|" + options.format + "|" +
+               std::to_string(options.quality) + "|" + std::to_string(options.tile_size) + "|" +
+               std::to_string(options.overlap) + "|" + std::to_string(options.limit_bounds);
+    }
+
+    // an exported pyramid, whatever the backend: nothing is rendered, tiles are copied out of the mapping
+    class PackSource : public dz_server::TileSource
+    {
+    public:
+        PackSource(std::unique_ptr<dz_common::TilePack> pack, std::string identity)
+            : m_pack(std::move(pack)), m_identity(std::move(identity))
+        {
+        }
+
+        std::string dzi() const override { return m_pack->dzi(); }
+        std::string extension() const override { return m_pack->extension(); }
+        std::string content_type() const override
+        {
+            auto const ext = extension();
+            return ext == "jpg" ? "image/jpeg" : "image/" + ext;
+        }
+        bool has_tile(int dz_level, int col, int row) const override
+        {
+            if (dz_level < 0 || dz_level >= m_pack->level_count()) return false;
+            auto const [cols, rows] = m_pack->level_tiles()[dz_level];
+            return col >= 0 && col < cols && row >= 0 && row < rows;
+        }
+        std::vector<uint8_t> tile(int dz_level, int col, int row) const override
+        {
+            auto const tile = m_pack->tile(dz_level, col, row);
+            return std::vector<uint8_t>(tile.begin(), tile.end());
+        }
+        std::string identity() const override { return m_identity; }
+
+    private:
+        std::unique_ptr<dz_common::TilePack> m_pack;
+        std::string m_identity;
+    };
+
+    // the tiles of the slide at `path` with the generator of `options.backend`, nullptr if it cannot be opened
+    // `.dzpack` files written by `dz_export` are served as they are
+    std::shared_ptr<dz_server::TileSource> open_source(std::string const& path, Options const& options,
+                                                       std::shared_ptr<dz_common::TileCache> const& cache,
+                                                       Registry::Footprint& footprint)
+    {
+        if (std::filesystem::path(path).extension() == ".dzpack")
+        {
+            auto pack = std::make_unique<dz_common::TilePack>(path);
+            if (!pack->is_open()) return nullptr;
+            // the mapping is page cache, not process memory: the default footprint of one handle
+            auto const stamp = dz_common::FileStamp::of(path);
+            return std::make_shared<PackSource>(std::move(pack), stamp.path + "|" + std::to_string(stamp.size) + "|" +
+                                                                     std::to_string(stamp.mtime) + "|dzpack");
+        }
+        auto const quality = std::clamp(options.quality / 100.f, 0.f, 1.f);
+        if (options.backend == "openslide")
+        {
+            using Generator = dz_openslide::DeepZoomGenerator;
+            Generator::ImageFormat format{};
+            parse_format(options.format, format);
+            auto const metadata_path = options.metadata_dir.empty()
+                                           ? std::string()
+                                           : dz_common::SlideMetadata::sidecar_path(path, options.metadata_dir);
+            // lazy: slides opened for a single tile do not pay for the metadata nobody asks for
+            auto generator = std::make_shared<Generator>(path, options.tile_size, options.overlap,
+                                                         options.limit_bounds, format, quality,
+                                                         Generator::OpenMode::LAZY, metadata_path);
+            if (!generator->is_valid()) return nullptr;
+            generator->set_max_handles(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+            generator->set_tile_cache(cache);
+            generator->set_blank_detection();
+            // a pool of handles shares a 64 MiB openslide cache, a single handle has openslide's 32 MiB one
+            footprint.handles = static_cast<size_t>(generator->max_handles());
+            footprint.bytes = footprint.handles > 1 ? size_t{64} << 20 : size_t{32} << 20;
+            return std::make_shared<dz_server::GeneratorSource<Generator>>(generator, format,
+                                                                           identity(path, options));
+        }
+        if (options.backend == "slideio")
+        {
+            using Generator = dz_slideio::DeepZoomGenerator;
+            Generator::ImageFormat format{};
+            parse_format(options.format, format);
+            auto generator = std::make_shared<Generator>(path, options.tile_size, options.overlap, format, quality);
+            if (!generator->is_valid()) return nullptr;
+            generator->set_tile_cache(cache);
+            return std::make_shared<dz_server::GeneratorSource<Generator>>(generator, format,
+                                                                           identity(path, options));
+        }
+        if (options.backend == "qupath")
+        {
+            using Generator = dz_qupath::DeepZoomGenerator;
+            Generator::ImageFormat format{};
+            parse_format(options.format, format);
+            // the workers call QuPath on their own threads, each attached to the JVM on its first tile
+            auto generator = std::make_shared<Generator>(path, options.tile_size, options.overlap, format, quality,
+                                                         Generator::OpenMode::LAZY);
+            if (!generator->is_valid()) return nullptr;
+            generator->set_max_readers(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+            generator->set_tile_cache(cache);
+            return std::make_shared<dz_server::GeneratorSource<Generator>>(generator, format,
+                                                                           identity(path, options));
+        }
+        return nullptr;
+    }
+
+    // `name` as a path below `root`, empty if it would leave it
+    std::string path_below(std::string const& root, std::string const& name)
+    {
+        auto const relative = std::filesystem::path(name).lexically_normal();
+        if (relative.empty() || relative.is_absolute() || *relative.begin() == "..") return {};
+        return (std::filesystem::path(root) / relative).string();
+    }
+} // namespace
+
+// ./dz_server --port 8080 --backend openslide --format jpg 'a.svs' 'b.ndpi'
+// ./dz_server --root /data/slides --max-open 512 (urls: /<path below root, with extension>.dzi)
+int main(int argc, char* argv[])
+{
+    dz_server::Server::Options server_options;
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string const arg = argv[i];
+        auto const value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : std::string(); };
+        if (arg == "--host")
+            server_options.host = value();
+        else if (arg == "--port")
+            server_options.port = static_cast<uint16_t>(std::stoi(value()));
+        else if (arg == "--workers")
+            server_options.workers = static_cast<size_t>(std::stoul(value()));
+        else if (arg == "--backend")
+            options.backend = value();
+        else if (arg == "--format")
+            options.format = value();
+        else if (arg == "--quality")
+            options.quality = std::stoi(value());
+        else if (arg == "--tile-size")
+            options.tile_size = std::stoi(value());
+        else if (arg == "--overlap")
+            options.overlap = std::stoi(value());
+        else if (arg == "--limit-bounds")
+            options.limit_bounds = true;
+        else if (arg == "--cache")
+            options.cache_mb = static_cast<size_t>(std::stoul(value()));
+        else if (arg == "--root")
+            options.root = value();
+        else if (arg == "--max-open")
+            options.max_open = static_cast<size_t>(std::stoul(value()));
+        else if (arg == "--max-memory")
+            options.max_memory_mb = static_cast<size_t>(std::stoul(value()));
+        else if (arg == "--metadata-dir")
+            options.metadata_dir = value();
+        else if (arg == "--disk-cache")
+            options.disk_cache = value();
+        else if (arg == "--disk-cache-mb")
+            options.disk_cache_mb = static_cast<size_t>(std::stoul(value()));
+        else
+            options.slides.push_back(arg);
+    }
+    if (options.slides.empty() && options.root.empty())
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--host 127.0.0.1] [--port 8080] [--workers 0] [--backend openslide/slideio/qupath]"
+                     " [--format jpg/png/webp/webp_lossless/avif] [--quality 75] [--tile-size 254] [--overlap 1]"
+                     " [--limit-bounds] [--cache <MB, default=256>]"
+                     " [--disk-cache <directory> [--disk-cache-mb <MB, default=10240>]]"
+                     " [--root <directory of slides opened on demand> [--max-open <handles, default=256>]"
+                     " [--max-memory <MB, default=4096>]] [--metadata-dir <directory, openslide only>]"
+                     " <slide path>..."
+                  << std::endl;
+        return -1;
+    }
+    if (options.backend != "openslide" && options.backend != "slideio" && options.backend != "qupath")
+    {
+        std::cerr << "Unknown backend: " << options.backend << std::endl;
+        return -1;
+    }
+    dz_openslide::DeepZoomGenerator::ImageFormat format{};
+    if (!parse_format(options.format, format))
+    {
+        std::cerr << "Unknown format: " << options.format << std::endl;
+        return -1;
+    }
+
+    auto const cache = options.cache_mb || !options.disk_cache.empty()
+                           ? std::make_shared<dz_common::TileCache>(options.cache_mb << 20)
+                           : nullptr;
+    if (!options.disk_cache.empty())
+    {
+        auto disk_cache = std::make_shared<dz_common::DiskTileCache>(options.disk_cache, options.disk_cache_mb << 20);
+        if (!disk_cache->is_open()) return -1;
+        auto const disk = disk_cache->stats();
+        std::cout << "disk cache: " << disk.entries << " tiles, " << disk.bytes / 1e6 << " MB";
+        if (disk.recovered) std::cout << " (index rebuilt)";
+        std::cout << std::endl;
+        cache->set_disk_cache(std::move(disk_cache));
+    }
+    // outlives the server, whose workers resolve through it
+    std::unique_ptr<Registry> registry;
+    dz_server::Server server(server_options);
+    for (auto const& path : options.slides)
+    {
+        // urls use the file name without extension
+        auto const name = std::filesystem::path(path).stem().string();
+        Registry::Footprint footprint;
+        auto source = open_source(path, options, cache, footprint);
+        if (!source)
+        {
+            std::cerr << "Failed to open slide: " << path << std::endl;
+            return -1;
+        }
+        server.add_source(name, source);
+        std::cout << "/" << name << ".dzi <- " << path << std::endl;
+    }
+
+    // the other names are paths below the root, opened when first asked for and closed when cold
+    if (!options.root.empty())
+    {
+        registry = std::make_unique<Registry>(
+            [&](std::string const& path, Registry::Footprint& footprint) {
+                return open_source(path, options, cache, footprint);
+            },
+            Registry::Limits{options.max_open, options.max_memory_mb << 20});
+        server.set_resolver([&registry, &options](std::string const& name) -> std::shared_ptr<dz_server::TileSource> {
+            auto const path = path_below(options.root, name);
+            return path.empty() ? nullptr : registry->get(path);
+        });
+        std::cout << "/<path>.dzi <- " << options.root << "/<path>" << std::endl;
+    }
+
+    g_server = &server;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    std::cout << "serving on http://" << server_options.host << ":" << server_options.port << std::endl;
+    auto const ok = server.run();
+    g_server = nullptr;
+
+    auto const stats = server.stats();
+    std::cout << "connections: " << stats.connections << ", requests: " << stats.requests
+              << ", tiles: " << stats.tiles << ", not modified: " << stats.not_modified
+              << ", errors: " << stats.errors << ", MB sent: " << stats.bytes_sent / 1e6 << std::endl;
+    if (registry)
+    {
+        auto const slides = registry->stats();
+        std::cout << "slides opened: " << slides.misses << " (mean " << slides.open_ms_mean() << " ms, max "
+                  << slides.open_ms_max << " ms), hits: " << slides.hits << ", waits: " << slides.waits
+                  << ", failures: " << slides.failures << ", evictions: " << slides.evictions << std::endl;
+    }
+    if (auto const disk_cache = cache ? cache->disk_cache() : nullptr; disk_cache)
+    {
+        auto const disk = disk_cache->stats();
+        std::cout << "disk cache hits: " << disk.hits << ", misses: " << disk.misses
+                  << ", writes: " << disk.insertions << ", segments evicted: " << disk.evictions << std::endl;
+    }
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,755 @@
+#include "server.hpp"
+#include "dz_common/threadpool.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+
+using namespace dz_server;
+
+namespace
+{
+    constexpr size_t max_head_bytes = size_t{16} << 10;
+    // requests pipelined behind a tile being rendered, reading stops there until they are answered
+    constexpr size_t max_input_bytes = 4 * max_head_bytes;
+    constexpr int max_events = 256;
+    constexpr char cache_control[] = "public, max-age=31536000, immutable";
+
+    struct Request
+    {
+        std::string_view method;
+        std::string_view path;
+        bool keep_alive = true;
+        bool has_body = false;
+        std::string_view if_none_match;
+    };
+
+    struct Response
+    {
+        std::string head;
+        std::vector<uint8_t> body;
+        size_t offset = 0; // bytes of head + body sent
+    };
+
+    // what a request asks for, owning its strings so that it can be answered on a worker
+    struct Query
+    {
+        std::string name;      // of the source
+        std::string resource;  // "dzi" or "<level>/<col>_<row>.<extension>", part of the ETag
+        std::string extension; // of the tile
+        bool dzi = false;
+        int dz_level = 0;
+        int col = 0;
+        int row = 0;
+        std::string if_none_match;
+        bool keep_alive = true;
+        bool head_only = false;
+    };
+
+    bool iequals(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+                   return (x | 0x20) == (y | 0x20);
+               });
+    }
+
+    std::string_view trim(std::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    // `head` is the request line and the headers, without the blank line
+    bool parse_request(std::string_view head, Request& request)
+    {
+        auto line_end = head.find("\r\n");
+        auto const line = head.substr(0, line_end);
+        auto const sp1 = line.find(' ');
+        auto const sp2 = line.rfind(' ');
+        if (sp1 == std::string_view::npos || sp2 == sp1) return false;
+        request.method = line.substr(0, sp1);
+        request.path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        auto const version = line.substr(sp2 + 1);
+        if (version == "HTTP/1.1")
+            request.keep_alive = true;
+        else if (version == "HTTP/1.0")
+            request.keep_alive = false;
+        else
+            return false;
+
+        while (line_end != std::string_view::npos)
+        {
+            auto const start = line_end + 2;
+            line_end = head.find("\r\n", start);
+            auto const header = head.substr(start, line_end == std::string_view::npos ? head.npos : line_end - start);
+            auto const colon = header.find(':');
+            if (colon == std::string_view::npos) continue;
+            auto const name = trim(header.substr(0, colon));
+            auto const value = trim(header.substr(colon + 1));
+            if (iequals(name, "Connection"))
+            {
+                if (iequals(value, "close")) request.keep_alive = false;
+                if (iequals(value, "keep-alive")) request.keep_alive = true;
+            }
+            else if (iequals(name, "If-None-Match"))
+                request.if_none_match = value;
+            else if ((iequals(name, "Content-Length") && value != "0") || iequals(name, "Transfer-Encoding"))
+                request.has_body = true;
+        }
+        return true;
+    }
+
+    // the integer filling `s`
+    bool parse_int(std::string_view s, int& value)
+    {
+        auto const [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+        return ec == std::errc() && end == s.data() + s.size();
+    }
+
+    // `/<name>.dzi` or `/<name>_files/<level>/<col>_<row>.<extension>`, the query string is ignored
+    bool parse_query(std::string_view path, Query& query)
+    {
+        path = path.substr(0, path.find('?'));
+        if (path.empty() || path.front() != '/') return false;
+        path.remove_prefix(1);
+
+        if (path.size() > 4 && path.substr(path.size() - 4) == ".dzi")
+        {
+            query.name = path.substr(0, path.size() - 4);
+            query.resource = "dzi";
+            query.dzi = true;
+            return true;
+        }
+
+        auto const files = path.rfind("_files/");
+        if (files == std::string_view::npos || files == 0) return false;
+        auto const tile = path.substr(files + 7);
+        auto const slash = tile.find('/');
+        auto const underscore = tile.find('_', slash);
+        auto const dot = tile.find('.', underscore);
+        if (slash == std::string_view::npos || underscore == std::string_view::npos ||
+            dot == std::string_view::npos || !parse_int(tile.substr(0, slash), query.dz_level) ||
+            !parse_int(tile.substr(slash + 1, underscore - slash - 1), query.col) ||
+            !parse_int(tile.substr(underscore + 1, dot - underscore - 1), query.row))
+            return false;
+        query.name = path.substr(0, files);
+        query.resource = tile;
+        query.extension = tile.substr(dot + 1);
+        return true;
+    }
+
+    uint64_t fnv1a(std::string_view s, uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        for (auto c : s)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    // strong: a source's tiles only change with its identity
+    std::string etag(std::string const& identity, std::string_view resource)
+    {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "\"%016llx\"", static_cast<unsigned long long>(fnv1a(resource, fnv1a(identity))));
+        return buf;
+    }
+
+    bool etag_matches(std::string_view if_none_match, std::string_view tag)
+    {
+        return trim(if_none_match) == "*" || if_none_match.find(tag) != std::string_view::npos;
+    }
+
+    char const* reason(int status)
+    {
+        switch (status)
+        {
+        case 200:
+            return "OK";
+        case 304:
+            return "Not Modified";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 431:
+            return "Request Header Fields Too Large";
+        case 500:
+            return "Internal Server Error";
+        case 503:
+            return "Service Unavailable";
+        }
+        return "Error";
+    }
+
+    Response make_response(int status, std::string_view content_type, std::vector<uint8_t> body, bool keep_alive,
+                           std::string const& tag = {}, bool head_only = false)
+    {
+        Response response;
+        auto& head = response.head;
+        head.reserve(256);
+        head += "HTTP/1.1 ";
+        head += std::to_string(status);
+        head += ' ';
+        head += reason(status);
+        head += "\r\nServer: dz_server\r\n";
+        if (status != 304)
+        {
+            head += "Content-Type: ";
+            head += content_type;
+            head += "\r\nContent-Length: ";
+            head += std::to_string(body.size());
+            head += "\r\n";
+        }
+        if (!tag.empty())
+        {
+            head += "ETag: ";
+            head += tag;
+            head += "\r\nCache-Control: ";
+            head += cache_control;
+            head += "\r\n";
+        }
+        head += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        if (!head_only && status != 304) response.body = std::move(body);
+        return response;
+    }
+
+    Response error_response(int status, bool keep_alive)
+    {
+        std::string_view const text = reason(status);
+        return make_response(status, "text/plain", std::vector<uint8_t>(text.begin(), text.end()), keep_alive);
+    }
+} // namespace
+
+struct Server::Loop
+{
+    struct Connection
+    {
+        int fd = -1;
+        uint64_t id = 0; // fds are reused, ids are not
+        std::string input;
+        std::deque<Response> output;
+        bool busy = false;        // a tile is being rendered for it, later requests wait
+        bool close_after = false; // once the output is sent
+        bool writable = true;     // false while waiting for EPOLLOUT
+        bool reading = true;      // EPOLLIN watched
+        bool eof = false;         // the peer will send nothing more, what it sent is still answered
+        std::chrono::steady_clock::time_point last_active;
+    };
+
+    struct Done
+    {
+        int fd = -1;
+        uint64_t id = 0;
+        bool keep_alive = true;
+        Response response;
+    };
+
+    Server& server;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int event_fd = -1;
+    std::atomic<bool> stopping{false};
+    std::unordered_map<int, Connection> connections;
+    uint64_t next_id = 0;
+
+    std::mutex done_mutex;
+    std::vector<Done> done;
+
+    mutable std::mutex stats_mutex;
+    Stats stats;
+
+    // last, so that it is the first to go and no render task outlives the rest
+    std::unique_ptr<dz_common::ThreadPool> pool;
+
+    Loop(Server& server, size_t workers)
+        : server(server), pool(std::make_unique<dz_common::ThreadPool>(workers))
+    {
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~Loop()
+    {
+        pool.reset();
+        for (auto& [fd, connection] : connections)
+            ::close(fd);
+        if (listen_fd >= 0) ::close(listen_fd);
+        if (epoll_fd >= 0) ::close(epoll_fd);
+        if (event_fd >= 0) ::close(event_fd);
+    }
+
+    void wake()
+    {
+        uint64_t one = 1;
+        [[maybe_unused]] auto const n = ::write(event_fd, &one, sizeof(one));
+    }
+
+    void count(uint64_t Stats::* counter, uint64_t n = 1)
+    {
+        std::lock_guard lock(stats_mutex);
+        stats.*counter += n;
+    }
+
+    static bool want_read(Connection const& connection)
+    {
+        return !connection.eof && connection.input.size() < max_input_bytes;
+    }
+
+    void watch(Connection& connection, bool want_write)
+    {
+        auto const read = want_read(connection);
+        epoll_event event{};
+        event.events = (read ? EPOLLIN | EPOLLRDHUP : 0u) | (want_write ? EPOLLOUT : 0u);
+        event.data.fd = connection.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.writable = !want_write;
+        connection.reading = read;
+    }
+
+    // stops or resumes reading as the input fills up or drains
+    void rewatch(Connection& connection)
+    {
+        if (want_read(connection) != connection.reading) watch(connection, !connection.writable);
+    }
+
+    void close(int fd)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+    }
+
+    void accept_all()
+    {
+        while (true)
+        {
+            auto const fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR) continue;
+                return; // EAGAIN, or out of fds: the rest stays in the backlog
+            }
+            if (connections.size() >= server.m_options.max_connections)
+            {
+                ::close(fd);
+                continue;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            {
+                ::close(fd);
+                continue;
+            }
+            auto& connection = connections[fd];
+            connection.fd = fd;
+            connection.id = next_id++;
+            connection.last_active = std::chrono::steady_clock::now();
+            count(&Stats::connections);
+        }
+    }
+
+    // false if the connection was closed
+    bool read(Connection& connection)
+    {
+        char buf[16384];
+        while (connection.input.size() < max_input_bytes)
+        {
+            auto const n = ::recv(connection.fd, buf, sizeof(buf), 0);
+            if (n > 0)
+            {
+                connection.input.append(buf, static_cast<size_t>(n));
+                continue;
+            }
+            if (n == 0)
+            {
+                // closed once the requests already received are answered
+                connection.eof = true;
+                break;
+            }
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            close(connection.fd);
+            return false;
+        }
+        connection.last_active = std::chrono::steady_clock::now();
+        rewatch(connection);
+        return true;
+    }
+
+    // false if the connection was closed
+    bool write(Connection& connection)
+    {
+        while (!connection.output.empty())
+        {
+            auto& response = connection.output.front();
+            auto const total = response.head.size() + response.body.size();
+            iovec iov[2];
+            int parts = 0;
+            if (response.offset < response.head.size())
+                iov[parts++] = {response.head.data() + response.offset, response.head.size() - response.offset};
+            auto const body_offset =
+                response.offset > response.head.size() ? response.offset - response.head.size() : 0;
+            if (body_offset < response.body.size())
+                iov[parts++] = {response.body.data() + body_offset, response.body.size() - body_offset};
+            msghdr message{};
+            message.msg_iov = iov;
+            message.msg_iovlen = parts;
+            auto const n = ::sendmsg(connection.fd, &message, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if (connection.writable) watch(connection, true);
+                    return true;
+                }
+                close(connection.fd);
+                return false;
+            }
+            count(&Stats::bytes_sent, static_cast<uint64_t>(n));
+            response.offset += static_cast<size_t>(n);
+            if (response.offset == total) connection.output.pop_front();
+        }
+        if (!connection.writable) watch(connection, false);
+        connection.last_active = std::chrono::steady_clock::now();
+        if (connection.close_after && !connection.busy)
+        {
+            close(connection.fd);
+            return false;
+        }
+        return true;
+    }
+
+    void respond(Connection& connection, Response response, bool keep_alive)
+    {
+        if (!keep_alive) connection.close_after = true;
+        connection.output.push_back(std::move(response));
+    }
+
+    // answers the complete requests of the input in order, stops at the first tile to render
+    void process(Connection& connection)
+    {
+        while (!connection.busy && !connection.close_after)
+        {
+            auto const end = connection.input.find("\r\n\r\n");
+            if (end == std::string::npos)
+            {
+                if (connection.input.size() > max_head_bytes)
+                {
+                    count(&Stats::errors);
+                    respond(connection, error_response(431, false), false);
+                }
+                else if (connection.eof)
+                    connection.close_after = true;
+                return;
+            }
+
+            Request request;
+            std::string const head = connection.input.substr(0, end);
+            connection.input.erase(0, end + 4);
+            count(&Stats::requests);
+            if (!parse_request(head, request) || request.has_body)
+            {
+                // a body would have to be skipped, nothing here takes one
+                count(&Stats::errors);
+                respond(connection, error_response(400, false), false);
+                return;
+            }
+            auto const head_only = request.method == "HEAD";
+            if (request.method != "GET" && !head_only)
+            {
+                count(&Stats::errors);
+                respond(connection, error_response(405, false), false);
+                return;
+            }
+            Query query;
+            if (!parse_query(request.path, query))
+            {
+                count(&Stats::errors);
+                respond(connection, error_response(404, request.keep_alive), request.keep_alive);
+                continue;
+            }
+            query.if_none_match = request.if_none_match;
+            query.keep_alive = request.keep_alive;
+            query.head_only = head_only;
+            route(connection, std::move(query));
+        }
+    }
+
+    // the response to `query`, nullopt if it takes rendering a tile and `render` is false
+    std::optional<Response> answer(TileSource const* source, Query const& query, bool render)
+    {
+        auto const keep_alive = query.keep_alive;
+        if (!source ||
+            (!query.dzi && (query.extension != source->extension() ||
+                            !source->has_tile(query.dz_level, query.col, query.row))))
+        {
+            count(&Stats::errors);
+            return error_response(404, keep_alive);
+        }
+        auto const tag = etag(source->identity(), query.resource);
+        if (etag_matches(query.if_none_match, tag))
+        {
+            count(&Stats::not_modified);
+            return make_response(304, {}, {}, keep_alive, tag);
+        }
+        if (query.dzi)
+        {
+            auto const dzi = source->dzi();
+            return make_response(200, "application/xml", std::vector<uint8_t>(dzi.begin(), dzi.end()), keep_alive,
+                                 tag, query.head_only);
+        }
+        if (!render) return std::nullopt;
+
+        auto bytes = source->tile(query.dz_level, query.col, query.row);
+        if (bytes.empty())
+        {
+            count(&Stats::errors);
+            return error_response(500, keep_alive);
+        }
+        count(&Stats::tiles);
+        return make_response(200, source->content_type(), std::move(bytes), keep_alive, tag, query.head_only);
+    }
+
+    void route(Connection& connection, Query query)
+    {
+        auto const it = server.m_sources.find(query.name);
+        auto source = it == server.m_sources.end() ? nullptr : it->second;
+        if (source || !server.m_resolver)
+            if (auto response = answer(source.get(), query, false))
+                return respond(connection, std::move(*response), query.keep_alive);
+
+        // rendering, or resolving the source, happens on a worker
+        connection.busy = true;
+        pool->submit([this, source = std::move(source), fd = connection.fd, id = connection.id,
+                      query = std::move(query)]() {
+            // the connection waits for its `Done` whatever happens, the pool would swallow an exception
+            Done result{fd, id, query.keep_alive, {}};
+            try
+            {
+                auto const resolved = source ? source : server.m_resolver(query.name);
+                result.response = std::move(*answer(resolved.get(), query, true));
+            }
+            catch (std::exception const& e)
+            {
+                printf("Failed to answer %s/%s: %s\n", query.name.c_str(), query.resource.c_str(), e.what());
+                count(&Stats::errors);
+                result.response = error_response(500, query.keep_alive);
+            }
+            catch (...)
+            {
+                printf("Failed to answer %s/%s\n", query.name.c_str(), query.resource.c_str());
+                count(&Stats::errors);
+                result.response = error_response(500, query.keep_alive);
+            }
+            {
+                std::lock_guard lock(done_mutex);
+                done.push_back(std::move(result));
+            }
+            wake();
+        });
+    }
+
+    // hands the answers of the workers to their connections, if still open
+    void complete()
+    {
+        uint64_t value = 0;
+        [[maybe_unused]] auto const n = ::read(event_fd, &value, sizeof(value));
+        std::vector<Done> results;
+        {
+            std::lock_guard lock(done_mutex);
+            results.swap(done);
+        }
+        for (auto& result : results)
+        {
+            auto const it = connections.find(result.fd);
+            if (it == connections.end() || it->second.id != result.id) continue;
+            auto& connection = it->second;
+            connection.busy = false;
+            respond(connection, std::move(result.response), result.keep_alive);
+            if (write(connection))
+            {
+                process(connection);
+                if (write(connection)) rewatch(connection);
+            }
+        }
+    }
+
+    void expire()
+    {
+        auto const deadline = std::chrono::steady_clock::now() -
+                              std::chrono::seconds(server.m_options.idle_timeout_seconds);
+        std::vector<int> idle;
+        for (auto const& [fd, connection] : connections)
+            if (!connection.busy && connection.output.empty() && connection.last_active < deadline)
+                idle.push_back(fd);
+        for (auto fd : idle)
+            close(fd);
+    }
+};
+
+Server::Server(Options options) : m_options(std::move(options))
+{
+    m_loop = std::make_unique<Loop>(*this, m_options.workers);
+}
+
+Server::~Server()
+{
+    // the workers of the loop still running requests use the sources and the resolver
+    m_loop.reset();
+}
+
+void Server::add_source(std::string name, std::shared_ptr<TileSource> source)
+{
+    m_sources[std::move(name)] = std::move(source);
+}
+
+void Server::set_resolver(std::function<std::shared_ptr<TileSource>(std::string const& name)> resolver)
+{
+    m_resolver = std::move(resolver);
+}
+
+bool Server::run()
+{
+    auto& loop = *m_loop;
+    if (loop.event_fd < 0)
+    {
+        printf("Failed to create eventfd: %s\n", strerror(errno));
+        return false;
+    }
+
+    loop.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (loop.listen_fd < 0)
+    {
+        printf("Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+    int one = 1;
+    setsockopt(loop.listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(m_options.port);
+    if (inet_pton(AF_INET, m_options.host.c_str(), &address.sin_addr) != 1)
+    {
+        printf("Invalid IPv4 address: %s\n", m_options.host.c_str());
+        return false;
+    }
+    if (bind(loop.listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(loop.listen_fd, SOMAXCONN) != 0)
+    {
+        printf("Failed to listen on %s:%u: %s\n", m_options.host.c_str(), m_options.port, strerror(errno));
+        return false;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(loop.listen_fd, reinterpret_cast<sockaddr*>(&address), &length);
+    m_port = ntohs(address.sin_port);
+
+    loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = loop.listen_fd;
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.listen_fd, &event);
+    event.data.fd = loop.event_fd;
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.event_fd, &event);
+
+    epoll_event events[max_events];
+    auto last_expiry = std::chrono::steady_clock::now();
+    while (!loop.stopping.load())
+    {
+        auto const n = epoll_wait(loop.epoll_fd, events, max_events, 1000);
+        if (n < 0 && errno != EINTR)
+        {
+            printf("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            auto const fd = events[i].data.fd;
+            if (fd == loop.listen_fd)
+            {
+                loop.accept_all();
+                continue;
+            }
+            if (fd == loop.event_fd)
+            {
+                loop.complete();
+                continue;
+            }
+            auto const it = loop.connections.find(fd);
+            if (it == loop.connections.end()) continue;
+            auto& connection = it->second;
+            // a hang up in both directions leaves nobody to answer, a half close (EPOLLRDHUP) is read to the end
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                loop.close(fd);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !loop.write(connection)) continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+            {
+                if (!loop.read(connection)) continue;
+                loop.process(connection);
+                if (loop.write(connection)) loop.rewatch(connection);
+            }
+        }
+        if (auto const now = std::chrono::steady_clock::now(); now - last_expiry > std::chrono::seconds(1))
+        {
+            loop.expire();
+            last_expiry = now;
+        }
+    }
+
+    for (auto& [fd, connection] : loop.connections)
+    {
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+    }
+    loop.connections.clear();
+    return true;
+}
+
+void Server::stop()
+{
+    m_loop->stopping.store(true);
+    m_loop->wake();
+}
+
+uint16_t Server::port() const
+{
+    return m_port.load();
+}
+
+Server::Stats Server::stats() const
+{
+    std::lock_guard lock(m_loop->stats_mutex);
+    return m_loop->stats;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <memory>
+#include <map>
+#include <atomic>
+#include <functional>
+
+namespace dz_server
+{
+    // a slide as the server sees it, whatever the backend
+    class TileSource
+    {
+    public:
+        virtual ~TileSource() = default;
+
+        virtual std::string dzi() const = 0;
+        // extension of the tile urls, without the dot
+        virtual std::string extension() const = 0;
+        // MIME type of the tiles
+        virtual std::string content_type() const = 0;
+        virtual bool has_tile(int dz_level, int col, int row) const = 0;
+        // encoded bytes, empty on failure
+        virtual std::vector<uint8_t> tile(int dz_level, int col, int row) const = 0;
+        // changes whenever the tiles may change (slide file, generator parameters), the ETags are derived from it
+        virtual std::string identity() const = 0;
+    };
+
+    // any of the `DeepZoomGenerator`s
+    template <typename Generator>
+    class GeneratorSource : public TileSource
+    {
+    public:
+        GeneratorSource(std::shared_ptr<Generator> generator, typename Generator::ImageFormat format,
+                        std::string identity)
+            : m_generator(std::move(generator)), m_format(format), m_identity(std::move(identity))
+        {
+        }
+
+        std::string dzi() const override { return m_generator->get_dzi(); }
+        std::string extension() const override { return Generator::format_extension(m_format); }
+        std::string content_type() const override
+        {
+            auto const ext = extension();
+            return ext == "jpg" ? "image/jpeg" : "image/" + ext;
+        }
+        bool has_tile(int dz_level, int col, int row) const override
+        {
+            if (dz_level < 0 || dz_level >= m_generator->level_count()) return false;
+            auto const [cols, rows] = m_generator->level_tiles()[dz_level];
+            return col >= 0 && col < cols && row >= 0 && row < rows;
+        }
+        std::vector<uint8_t> tile(int dz_level, int col, int row) const override
+        {
+            auto tile = m_generator->get_tile(dz_level, col, row);
+            return std::vector<uint8_t>(tile.begin(), tile.end());
+        }
+        std::string identity() const override { return m_identity; }
+
+    private:
+        std::shared_ptr<Generator> m_generator;
+        typename Generator::ImageFormat m_format;
+        std::string m_identity;
+    };
+
+    // HTTP/1.1 server of DeepZoom pyramids: `/<name>.dzi` and `/<name>_files/<level>/<col>_<row>.<extension>`.
+    // one epoll thread accepts, parses and writes, keep-alive connections are the default; tiles are rendered on a
+    // worker pool that hands them back through an eventfd. responses carry a strong ETag derived from the source's
+    // identity and the tile, so a matching `If-None-Match` is answered 304 without rendering, and
+    // `Cache-Control: immutable`. GET and HEAD only. Linux only
+    class Server
+    {
+    public:
+        struct Options
+        {
+            std::string host = "127.0.0.1";
+            uint16_t port = 8080;
+            size_t workers = 0;           // render threads, 0 means `std::thread::hardware_concurrency()`
+            int idle_timeout_seconds = 60; // keep-alive connections idle for longer are closed
+            size_t max_connections = 4096;
+        };
+
+        struct Stats
+        {
+            uint64_t connections = 0; // accepted
+            uint64_t requests = 0;
+            uint64_t tiles = 0;       // rendered
+            uint64_t not_modified = 0;
+            uint64_t errors = 0;      // 4xx/5xx responses
+            uint64_t bytes_sent = 0;
+        };
+
+        explicit Server(Options options);
+        ~Server();
+
+        Server(Server const&) = delete;
+        Server& operator=(Server const&) = delete;
+
+        // `name` is the path of the slide in the urls, call before `run`
+        void add_source(std::string name, std::shared_ptr<TileSource> source);
+        // names not added with `add_source` are looked up with `resolver` (e.g. a `dz_common::SlideRegistry`), on
+        // the workers and possibly several at once; nullptr answers 404. call before `run`
+        void set_resolver(std::function<std::shared_ptr<TileSource>(std::string const& name)> resolver);
+
+        // binds and serves until `stop`, false if the socket could not be set up
+        bool run();
+        // thread-safe, also from a signal handler
+        void stop();
+        // port bound, once `run` has started (useful with port 0)
+        uint16_t port() const;
+
+        Stats stats() const;
+
+    private:
+        struct Loop;
+        std::unique_ptr<Loop> m_loop;
+        Options m_options;
+        std::map<std::string, std::shared_ptr<TileSource>> m_sources;
+        std::function<std::shared_ptr<TileSource>(std::string const& name)> m_resolver;
+        std::atomic<uint16_t> m_port{0};
+    };
+} // namespace dz_server
@@ -1,4 +1,7 @@
 #include "deepzoom.hpp"
+#include "dz_common/threadpool.hpp"
+#include "dz_common/codec.hpp"
+#include "dz_common/tilecache.hpp"
 
 #include <slideio/slideio/slideio.hpp>
 #include <slideio/core/levelinfo.hpp>
@@ -12,11 +15,6 @@
 
 extern "C"
 {
-#define XMD_H
-#include <jpeglib.h>
-#ifdef const
-#undef const
-#endif
 #include <png.h>
 }
 
@@ -24,7 +22,8 @@ using namespace dz_slideio;
 
 DeepZoomGenerator::DeepZoomGenerator(std::string filepath, int tile_size, int overlap, ImageFormat format,
                                      float quality)
-    : m_tile_size(tile_size), m_overlap(overlap), m_format(format), m_quality(std ::clamp(quality, 0.f, 1.f))
+    : m_tile_size(tile_size), m_overlap(overlap), m_format(format), m_quality(std ::clamp(quality, 0.f, 1.f)),
+      m_filepath(filepath)
 {
     try
     {
@@ -74,13 +73,14 @@ DeepZoomGenerator::DeepZoomGenerator(std::string filepath, int tile_size, int ov
         return;
     }
 
-    auto scene = m_slide->getScene(main_scene_index);
-    if (!scene)
+    m_scene = m_slide->getScene(main_scene_index);
+    if (!m_scene)
     {
         printf("Failed to get scene from slide: %s\n", filepath.c_str());
         m_slide = nullptr;
         return;
     }
+    auto const& scene = m_scene;
 
     auto [mpp_x, mpp_y] = scene->getResolution();
     m_mpp = (mpp_x + mpp_y) / 2. * 1e6; // convert to microns
@@ -146,14 +146,30 @@ std::vector<std::pair<int64_t, int64_t>> DeepZoomGenerator::level_dimensions() c
 
 int64_t DeepZoomGenerator::tile_count() const
 {
-    return std::reduce(m_t_dimensions.cbegin(), m_t_dimensions.cend(), int64_t{1},
-                       [](auto s, auto const& d) { return s + d.first * d.second; });
+    return std::accumulate(m_t_dimensions.cbegin(), m_t_dimensions.cend(), int64_t{0},
+                           [](auto s, auto const& d) { return s + d.first * d.second; });
 }
 
 std::tuple<int64_t, int64_t, std::vector<uint8_t>> DeepZoomGenerator::get_tile_bytes(int dz_level, int col,
                                                                                      int row) const
 {
     auto const& [l0_location, slide_level, l_size] = get_tile_coordinates(dz_level, col, row);
+    return std::make_tuple(l_size.first, l_size.second, _read_block(l0_location, slide_level, l_size));
+}
+
+std::tuple<int64_t, int64_t, std::vector<uint32_t>> DeepZoomGenerator::get_tile_pixels(int dz_level, int col,
+                                                                                      int row) const
+{
+    auto const [width, height, bytes] = get_tile_bytes(dz_level, col, row);
+    std::vector<uint32_t> pixels(bytes.size() / 3);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = 0xff000000u | uint32_t{bytes[i * 3]} << 16 | uint32_t{bytes[i * 3 + 1]} << 8 | bytes[i * 3 + 2];
+    return std::make_tuple(width, height, std::move(pixels));
+}
+
+std::vector<uint8_t> DeepZoomGenerator::_read_block(std::pair<int64_t, int64_t> l0_location, int slide_level,
+                                                    std::pair<int64_t, int64_t> l_size) const
+{
     int l_width = static_cast<int>(l_size.first);
     int l_height = static_cast<int>(l_size.second);
     auto xx = static_cast<int>(l0_location.first);
@@ -163,7 +179,7 @@ std::tuple<int64_t, int64_t, std::vector<uint8_t>> DeepZoomGenerator::get_tile_b
     auto ww = static_cast<int>(std::ceil(l_width * l_downsample));  // l0 width
     auto hh = static_cast<int>(std::ceil(l_height * l_downsample)); // l0 height
 
-    auto scene = m_slide->getScene(0);
+    auto const& scene = m_scene;
 
     // TODO: enumerate channel data types and channel numbers
     //auto channel_count = scene->getNumChannels();
@@ -175,18 +191,169 @@ std::tuple<int64_t, int64_t, std::vector<uint8_t>> DeepZoomGenerator::get_tile_b
     std::vector<uint8_t> block_buffer(buffer_size);
     scene->readResampledBlock(std::make_tuple(xx, yy, ww, hh), block_size, block_buffer.data(), buffer_size);
 
-    return std::make_tuple(static_cast<int64_t>(l_width), static_cast<int64_t>(l_height), std::move(block_buffer));
+    return block_buffer;
 }
 
 std::vector<uint8_t> DeepZoomGenerator::get_tile(int dz_level, int col, int row) const
 {
-    auto const& [width, height, bytes] = get_tile_bytes(dz_level, col, row);
+    if (auto tile = _blank_tile(dz_level, col, row); tile) return *tile;
+    auto const render = [&]() {
+        auto const& [width, height, bytes] = get_tile_bytes(dz_level, col, row);
+        return _encode_tile(bytes, width, height);
+    };
+    if (!m_tile_cache) return render();
+
+    auto const key = _tile_key(dz_level, col, row);
+    if (auto tile = m_tile_cache->get(key); tile) return std::move(*tile);
+
+    auto tile = render();
+    if (!tile.empty()) m_tile_cache->put(key, tile);
+    return tile;
+}
+
+std::vector<std::vector<uint8_t>> DeepZoomGenerator::get_tiles(std::span<std::tuple<int, int, int> const> tiles) const
+{
+    std::vector<std::vector<uint8_t>> res(tiles.size());
+
+    // only cache misses go to slideio
+    std::vector<size_t> order;
+    order.reserve(tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        auto const& [dz_level, col, row] = tiles[i];
+        if (auto tile = _blank_tile(dz_level, col, row); tile)
+        {
+            res[i] = *tile;
+            continue;
+        }
+        if (m_tile_cache)
+            if (auto tile = m_tile_cache->get(_tile_key(dz_level, col, row)); tile)
+            {
+                res[i] = std::move(*tile);
+                continue;
+            }
+        order.push_back(i);
+    }
+    if (order.empty()) return res;
+
+    // row major order, so that horizontally adjacent tiles follow each other
+    std::sort(order.begin(), order.end(), [&tiles](size_t a, size_t b) {
+        auto const& [la, ca, ra] = tiles[a];
+        auto const& [lb, cb, rb] = tiles[b];
+        return std::tie(la, ra, ca) < std::tie(lb, rb, cb);
+    });
+
+    struct Region
+    {
+        std::pair<int64_t, int64_t> l0_location;
+        int slide_level;
+        std::pair<int64_t, int64_t> l_size;
+    };
+    std::vector<Region> regions;
+    regions.reserve(order.size());
+    for (auto i : order)
+    {
+        auto const& [dz_level, col, row] = tiles[i];
+        auto const& [l0_location, slide_level, l_size] = get_tile_coordinates(dz_level, col, row);
+        regions.push_back({l0_location, slide_level, l_size});
+    }
+
+    // coalesce runs of adjacent tiles of the same row into one block
+    // a tile joins the run only if it starts on a whole pixel of the run's slide level, and only at integer
+    // downsamples: a fractional resampling of the whole run does not slice into what `get_tile` reads
+    struct Run
+    {
+        size_t begin = 0; // [begin, end) of `order`
+        size_t end = 0;
+        int64_t width = 0;            // run width at slide level
+        std::vector<int64_t> offsets; // x offset of each tile inside the run
+    };
+    constexpr int64_t max_run_width = 4096;
+    std::vector<Run> runs;
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        auto const& region = regions[k];
+        if (!runs.empty())
+        {
+            auto& run = runs.back();
+            auto const& first = regions[run.begin];
+            auto const& [level, col, row] = tiles[order[k]];
+            auto const& [prev_level, prev_col, prev_row] = tiles[order[k - 1]];
+            auto const l_downsample = m_level_downsamples[region.slide_level];
+            auto const dx = std::llround((region.l0_location.first - first.l0_location.first) / l_downsample);
+            if (level == prev_level && row == prev_row && col == prev_col + 1 &&
+                l_downsample == std::round(l_downsample) &&
+                region.slide_level == first.slide_level && region.l0_location.second == first.l0_location.second &&
+                region.l_size.second == first.l_size.second &&
+                std::abs(first.l0_location.first + dx * l_downsample - region.l0_location.first) < 1e-6 &&
+                dx + region.l_size.first <= max_run_width)
+            {
+                run.end = k + 1;
+                run.offsets.push_back(dx);
+                run.width = dx + region.l_size.first;
+                continue;
+            }
+        }
+        runs.push_back(Run{k, k + 1, region.l_size.first, {0}});
+    }
+
+    // slideio does not document its scenes as thread-safe, so blocks are read one after another
+    std::vector<std::vector<uint8_t>> bytes(order.size());
+    for (auto const& run : runs)
+    {
+        auto const& first = regions[run.begin];
+        auto const height = first.l_size.second;
+        auto block = _read_block(first.l0_location, first.slide_level, {run.width, height});
+        if (run.end - run.begin == 1)
+        {
+            bytes[run.begin] = std::move(block);
+            continue;
+        }
+        for (auto k = run.begin; k < run.end; k++)
+        {
+            auto const width = regions[k].l_size.first;
+            auto const offset = run.offsets[k - run.begin];
+            bytes[k].resize(width * height * 3);
+            for (int64_t y = 0; y < height; y++)
+                std::copy_n(block.data() + (y * run.width + offset) * 3, width * 3, bytes[k].data() + y * width * 3);
+        }
+    }
+
+    dz_common::ThreadPool::shared().parallel_for(order.size(), [&](size_t k) {
+        auto const& [width, height] = regions[k].l_size;
+        auto const i = order[k];
+        res[i] = _encode_tile(bytes[k], width, height);
+        std::vector<uint8_t>().swap(bytes[k]);
+        if (m_tile_cache && !res[i].empty())
+        {
+            auto const& [dz_level, col, row] = tiles[i];
+            m_tile_cache->put(_tile_key(dz_level, col, row), res[i]);
+        }
+    });
+
+    return res;
+}
+
+std::vector<uint8_t> DeepZoomGenerator::_encode_tile(std::vector<uint8_t> const& bytes, int64_t width,
+                                                     int64_t height) const
+{
     auto const quality = static_cast<int>(m_quality * 100);
     if (m_format == ImageFormat::JPG)
         return encode_bytes_to_jpeg(bytes, static_cast<int>(width), static_cast<int>(height), quality);
     else if (m_format == ImageFormat::PNG)
         return encode_bytes_to_png(bytes, static_cast<int>(width), static_cast<int>(height),
                                    std::clamp((100 - quality) / 10, 0, 9));
+    else if (m_format == ImageFormat::AVIF)
+        return dz_common::encode_avif(bytes.data(), static_cast<int>(width), static_cast<int>(height),
+                                      static_cast<int>(width * 3), dz_common::PixelLayout::RGB, quality, m_avif_speed);
+    else if (m_format == ImageFormat::WEBP || m_format == ImageFormat::WEBP_LOSSLESS)
+    {
+        // like for PNG, a higher quality means less compression effort when lossless
+        auto const lossless = m_format == ImageFormat::WEBP_LOSSLESS;
+        return dz_common::encode_webp(bytes.data(), static_cast<int>(width), static_cast<int>(height),
+                                      static_cast<int>(width * 3), dz_common::PixelLayout::RGB,
+                                      lossless ? 100.f - quality : quality, lossless, m_webp_method);
+    }
     return {};
 }
 
@@ -207,7 +374,7 @@ std::string DeepZoomGenerator::get_dzi() const
     return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n \
 <Image xmlns = \"http://schemas.microsoft.com/deepzoom/2008\"\n \
   Format=\"" +
-           std::string((m_format == ImageFormat::PNG) ? "png" : "jpg") + "\"\n \
+           std::string(format_extension(m_format)) + "\"\n \
   Overlap=\"" +
            std::to_string(m_overlap) + "\"\n \
   TileSize=\"" +
@@ -222,6 +389,199 @@ std::string DeepZoomGenerator::get_dzi() const
 </Image>";
 }
 
+char const* DeepZoomGenerator::format_extension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::PNG:
+        return "png";
+    case ImageFormat::JPG:
+        return "jpg";
+    case ImageFormat::WEBP:
+    case ImageFormat::WEBP_LOSSLESS:
+        return "webp";
+    case ImageFormat::AVIF:
+        return "avif";
+    }
+    return "jpg";
+}
+
+void DeepZoomGenerator::set_webp_method(int method)
+{
+    m_webp_method = std::clamp(method, 0, 6);
+}
+
+int DeepZoomGenerator::webp_method() const
+{
+    return m_webp_method;
+}
+
+void DeepZoomGenerator::set_avif_speed(int speed)
+{
+    m_avif_speed = std::clamp(speed, 0, 10);
+}
+
+int DeepZoomGenerator::avif_speed() const
+{
+    return m_avif_speed;
+}
+
+void DeepZoomGenerator::set_tile_cache(std::shared_ptr<dz_common::TileCache> cache)
+{
+    m_tile_cache = std::move(cache);
+}
+
+std::shared_ptr<dz_common::TileCache> DeepZoomGenerator::tile_cache() const
+{
+    return m_tile_cache;
+}
+
+dz_common::TileKey DeepZoomGenerator::_tile_key(int dz_level, int col, int row) const
+{
+    // slideio's tiles differ from openslide's, the backend is part of the slide identity
+    return dz_common::TileKey{.slide = m_filepath + "?slideio",
+                              .format = static_cast<int>(m_format),
+                              .quality = m_quality,
+                              .tile_size = m_tile_size,
+                              .overlap = m_overlap,
+                              .dz_level = dz_level,
+                              .col = col,
+                              .row = row};
+}
+
+bool DeepZoomGenerator::build_tissue_index(std::string const& index_path)
+{
+    m_tissue = {};
+    if (!m_slide) return false;
+    auto const [l0_width, l0_height] = m_l_dimensions[0];
+
+    if (!index_path.empty())
+        if (auto index = dz_common::TissueIndex::load(index_path);
+            !index.empty() && index.l0_dimensions() == std::make_pair(l0_width, l0_height))
+            m_tissue = std::move(index);
+    if (m_tissue.empty())
+    {
+        auto const scale = std::min(1., static_cast<double>(dz_common::TissueIndex::thumbnail_size) /
+                                            std::max(l0_width, l0_height));
+        auto const width = std::max(1, static_cast<int>(std::lround(l0_width * scale)));
+        auto const height = std::max(1, static_cast<int>(std::lround(l0_height * scale)));
+        std::vector<uint8_t> thumbnail;
+        try
+        {
+            auto const& scene = m_scene;
+            auto const block_size = std::make_tuple(width, height);
+            thumbnail.resize(scene->getBlockSize(block_size, 0, 3, 1, 1));
+            scene->readResampledBlock(
+                std::make_tuple(0, 0, static_cast<int>(l0_width), static_cast<int>(l0_height)), block_size,
+                thumbnail.data(), thumbnail.size());
+        }
+        catch (const std::exception& e)
+        {
+            printf("Error reading thumbnail: %s\n", e.what());
+            return false;
+        }
+        m_tissue = dz_common::TissueIndex::from_thumbnail(thumbnail.data(), width, height, width * 3,
+                                                          dz_common::PixelLayout::RGB, l0_width, l0_height);
+        if (!index_path.empty()) m_tissue.save(index_path);
+    }
+
+    m_tissue.index_levels(m_t_dimensions, [this](int dz_level, int64_t col, int64_t row) {
+        return _l0_tile_rect(dz_level, col, row);
+    });
+    return true;
+}
+
+std::tuple<int64_t, int64_t, int64_t, int64_t> DeepZoomGenerator::_l0_tile_rect(int dz_level, int64_t col,
+                                                                                 int64_t row) const
+{
+    auto const& [l0_location, slide_level, l_size] =
+        get_tile_coordinates(dz_level, static_cast<int>(col), static_cast<int>(row));
+    auto const downsample = m_level_downsamples[slide_level];
+    return std::make_tuple(l0_location.first, l0_location.second,
+                           static_cast<int64_t>(std::ceil(l_size.first * downsample)),
+                           static_cast<int64_t>(std::ceil(l_size.second * downsample)));
+}
+
+dz_common::TissueIndex const& DeepZoomGenerator::tissue_index() const
+{
+    return m_tissue;
+}
+
+bool DeepZoomGenerator::has_tissue(int dz_level, int col, int row) const
+{
+    return m_tissue.has_tissue(dz_level, col, row);
+}
+
+void DeepZoomGenerator::set_blank_detection(int tolerance)
+{
+    m_blank = {};
+    m_blank_tiles->clear();
+    if (tolerance < 0 || !m_slide) return;
+    auto const [l0_width, l0_height] = m_l_dimensions[0];
+    auto const [low_width, low_height] = m_l_dimensions[m_levels - 1];
+
+    // the resolution of the lowest level, within the pixel budget
+    auto const scale = std::min(1., std::sqrt(static_cast<double>(dz_common::BlankIndex::max_picture_pixels) /
+                                              (static_cast<double>(low_width) * low_height)));
+    auto const width = std::max(1, static_cast<int>(std::lround(low_width * scale)));
+    auto const height = std::max(1, static_cast<int>(std::lround(low_height * scale)));
+    std::vector<uint8_t> picture;
+    try
+    {
+        auto const& scene = m_scene;
+        auto const block_size = std::make_tuple(width, height);
+        picture.resize(scene->getBlockSize(block_size, 0, 3, 1, 1));
+        scene->readResampledBlock(std::make_tuple(0, 0, static_cast<int>(l0_width), static_cast<int>(l0_height)),
+                                  block_size, picture.data(), picture.size());
+    }
+    catch (const std::exception& e)
+    {
+        printf("Error reading blank detection picture: %s\n", e.what());
+        return;
+    }
+    m_blank = dz_common::BlankIndex::from_picture(
+        picture.data(), width, height, width * 3, dz_common::PixelLayout::RGB, l0_width, l0_height, tolerance,
+        m_t_dimensions, [this](int dz_level, int64_t col, int64_t row) { return _l0_tile_rect(dz_level, col, row); });
+}
+
+int DeepZoomGenerator::blank_tolerance() const
+{
+    return m_blank.tolerance();
+}
+
+bool DeepZoomGenerator::is_blank(int dz_level, int col, int row) const
+{
+    return m_blank.is_blank(dz_level, col, row);
+}
+
+std::shared_ptr<std::vector<uint8_t> const> DeepZoomGenerator::_blank_tile(int dz_level, int col, int row) const
+{
+    uint32_t color = 0;
+    if (!m_blank.is_blank(dz_level, col, row, &color)) return nullptr;
+    auto const& [l0_location, slide_level, l_size] = get_tile_coordinates(dz_level, col, row);
+    auto const& [width, height] = l_size;
+    return m_blank_tiles->get(color, width, height, false, [&]() {
+        std::vector<uint8_t> bytes(static_cast<size_t>(width * height) * 3);
+        for (size_t i = 0; i < bytes.size(); i += 3)
+        {
+            bytes[i] = static_cast<uint8_t>(color >> 16);
+            bytes[i + 1] = static_cast<uint8_t>(color >> 8);
+            bytes[i + 2] = static_cast<uint8_t>(color);
+        }
+        return _encode_tile(bytes, width, height);
+    });
+}
+
+int64_t DeepZoomGenerator::tile_size() const
+{
+    return m_tile_size;
+}
+
+int DeepZoomGenerator::overlap() const
+{
+    return m_overlap;
+}
+
 double DeepZoomGenerator::get_mpp() const
 {
     return m_mpp;
@@ -275,47 +635,7 @@ int DeepZoomGenerator::_get_best_level_for_downsample(double downsample) const
 std::vector<uint8_t> DeepZoomGenerator::encode_bytes_to_jpeg(std::vector<uint8_t> const& bytes, int width, int height,
                                                              int quality)
 {
-    jpeg_compress_struct cinfo;
-    jpeg_error_mgr jerr;
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-
-    unsigned char* mem_buffer = nullptr;
-    unsigned long encoded_size;
-    jpeg_mem_dest(&cinfo, &mem_buffer, &encoded_size);
-
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-    // may consumes more time and memory but with better quality and smaller size
-    cinfo.optimize_coding = TRUE;
-
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-    // disable chroma subsampling for very high quality
-    if (quality > 90)
-    {
-        cinfo.comp_info[0].v_samp_factor = 1;
-        cinfo.comp_info[0].h_samp_factor = 1;
-    }
-
-    jpeg_start_compress(&cinfo, TRUE);
-
-    for (int j = 0; j < height; j++)
-    {
-        JSAMPROW row_ptr = const_cast<JSAMPROW>(bytes.data()) + j * width * 3;
-        jpeg_write_scanlines(&cinfo, &row_ptr, 1);
-    }
-
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-
-    std::vector<uint8_t> res(mem_buffer, mem_buffer + encoded_size);
-
-    free(mem_buffer);
-
-    return res;
+    return dz_common::encode_jpeg(bytes.data(), width, height, width * 3, dz_common::PixelLayout::RGB, quality);
 }
 
 std::vector<uint8_t> DeepZoomGenerator::encode_bytes_to_png(std::vector<uint8_t> const& bytes, int width, int height,
@@ -5,10 +5,22 @@
 #include <string>
 #include <utility>
 #include <memory>
+#include <tuple>
+#include <span>
+
+#include "dz_common/blankindex.hpp"
+#include "dz_common/tissueindex.hpp"
+
+namespace dz_common
+{
+    class TileCache;
+    struct TileKey;
+} // namespace dz_common
 
 namespace slideio
 {
     class Slide;
+    class Scene;
 }
 
 namespace dz_slideio
@@ -16,10 +28,14 @@ namespace dz_slideio
     class DeepZoomGenerator
     {
     public:
+        // WEBP/WEBP_LOSSLESS/AVIF need `dz_common` built with libwebp/libavif
         enum class ImageFormat : int
         {
             PNG = 0,
-            JPG
+            JPG,
+            WEBP,
+            WEBP_LOSSLESS,
+            AVIF
         };
 
         DeepZoomGenerator(std::string filepath, int tile_size = 254, int overlap = 1,
@@ -43,8 +59,14 @@ namespace dz_slideio
         int64_t tile_count() const;
         // <width, height, bytes>
         std::tuple<int64_t, int64_t, std::vector<uint8_t>> get_tile_bytes(int dz_level, int col, int row) const;
-        // PNG/JPG bytes
+        // <width, height, ARGB_Premultiplied_pixels> (opaque), what `dz_openslide::PyramidExporter` reads
+        std::tuple<int64_t, int64_t, std::vector<uint32_t>> get_tile_pixels(int dz_level, int col, int row) const;
+        // encoded bytes
         std::vector<uint8_t> get_tile(int dz_level, int col, int row) const;
+        // encoded bytes for a batch of <dz_level, col, row>, in the same order
+        // horizontally adjacent tiles are read with a single `readResampledBlock` and sliced afterwards,
+        // encoding runs in parallel
+        std::vector<std::vector<uint8_t>> get_tiles(std::span<std::tuple<int, int, int> const> tiles) const;
         // <<x, y>, slide_level, <width, height>>
         std::tuple<std::pair<int64_t, int64_t>, int, std::pair<int64_t, int64_t>> get_tile_coordinates(int dz_level,
                                                                                                        int col,
@@ -53,7 +75,43 @@ namespace dz_slideio
         std::pair<int64_t, int64_t> get_tile_dimensions(int dz_level, int col, int row) const;
         // XML
         std::string get_dzi() const;
+        // file extension and DZI `Format` of `format`
+        static char const* format_extension(ImageFormat format);
+
+        // WebP/AVIF encoding effort
+        // WebP `method` [0, 6], 0 is the fastest (default 4); AVIF `speed` [0, 10], 10 is the fastest (default 8)
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_webp_method(int method);
+        int webp_method() const;
+        void set_avif_speed(int speed);
+        int avif_speed() const;
+
+        // encoded tiles are looked up in / stored to the cache by `get_tile`, keyed as `dz_openslide`'s but for
+        // this backend, so that one cache (and its disk tier) can be shared by all generators; nullptr disables
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_tile_cache(std::shared_ptr<dz_common::TileCache> cache);
+        std::shared_ptr<dz_common::TileCache> tile_cache() const;
+
+        // tissue index, as in `dz_openslide::DeepZoomGenerator`
+        // computed from a thumbnail `readResampledBlock` reads of the whole scene, unless `index_path` holds one
+        // not thread-safe itself, call it before handing the generator to other threads
+        bool build_tissue_index(std::string const& index_path = {});
+        dz_common::TissueIndex const& tissue_index() const;
+        // true if the tile intersects tissue, or if no index was built
+        bool has_tissue(int dz_level, int col, int row) const;
+
+        // blank tiles, as in `dz_openslide::DeepZoomGenerator`: `get_tile`/`get_tiles` answer the tiles the bitmap
+        // says are blank with a tile of their color and size encoded once, without reading them
+        // with `tolerance` >= 0 a picture of the whole scene at the resolution of the lowest level (at most
+        // `dz_common::BlankIndex::max_picture_pixels`) is read once with `readResampledBlock`. -1 disables (default)
+        // not thread-safe itself, call it before handing the generator to other threads
+        void set_blank_detection(int tolerance = 2);
+        int blank_tolerance() const;
+        // true if the bitmap says the tile is blank, exporters and viewers can skip it
+        bool is_blank(int dz_level, int col, int row) const;
 
+        int64_t tile_size() const;
+        int overlap() const;
         double get_mpp() const;
 
     private:
@@ -65,6 +123,15 @@ namespace dz_slideio
                          std::pair<int64_t, int64_t> // z_size
                          >;
         int _get_best_level_for_downsample(double downsample) const;
+        dz_common::TileKey _tile_key(int dz_level, int col, int row) const;
+        // level 0 <x, y, width, height> of a tile, for the tissue and blank indexes
+        std::tuple<int64_t, int64_t, int64_t, int64_t> _l0_tile_rect(int dz_level, int64_t col, int64_t row) const;
+        // encoded blank tile if the bitmap says the tile is blank, else null
+        std::shared_ptr<std::vector<uint8_t> const> _blank_tile(int dz_level, int col, int row) const;
+        // RGB bytes of `l_size` read from `l0_location` at `slide_level`
+        std::vector<uint8_t> _read_block(std::pair<int64_t, int64_t> l0_location, int slide_level,
+                                         std::pair<int64_t, int64_t> l_size) const;
+        std::vector<uint8_t> _encode_tile(std::vector<uint8_t> const& bytes, int64_t width, int64_t height) const;
 
         static std::vector<uint8_t> encode_bytes_to_jpeg(std::vector<uint8_t> const& bytes, int width, int height,
                                                          int quality);
@@ -73,6 +140,7 @@ namespace dz_slideio
 
     private:
         std::shared_ptr<slideio::Slide> m_slide = nullptr;
+        std::shared_ptr<slideio::Scene> m_scene = nullptr; // the largest scene, the one tiles are read from
         int64_t m_tile_size =
             512; // the width and height of a single tile, for best viewer performance, tile_size + 2 * overlap should be a power of two
         int m_overlap = 1; // the number of extra pixels to add to each interior edge of a tile
@@ -80,6 +148,8 @@ namespace dz_slideio
         double m_mpp = 1e-6;
         ImageFormat m_format = ImageFormat::JPG;
         float m_quality = 0.75f;
+        int m_webp_method = 4;
+        int m_avif_speed = 8;
         int m_levels = 0;                                          // slide levels
         int m_dz_levels = 0;                                       // deepzoom levels
         std::vector<std::pair<int64_t, int64_t>> m_l_dimensions;   // slide level dimensions
@@ -88,5 +158,10 @@ namespace dz_slideio
         std::vector<int> m_preferred_slide_levels;                 // preferred slide levels for each deepzoom level
         std::vector<double> m_level_downsamples;                   // slide level downsample factors
         std::vector<double> m_level_dz_downsamples;                // deepzoom level downsample factors
+        dz_common::TissueIndex m_tissue;
+        dz_common::BlankIndex m_blank;
+        std::unique_ptr<dz_common::BlankTiles> m_blank_tiles = std::make_unique<dz_common::BlankTiles>();
+        std::string m_filepath;
+        std::shared_ptr<dz_common::TileCache> m_tile_cache = nullptr;
     };
 } // namespace dz_slideio
\ No newline at end of file
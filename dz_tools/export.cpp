@@ -0,0 +1,118 @@
+#include "../dz_openslide/deepzoom.hpp"
+#include "../dz_openslide/exporter.hpp"
+#include "../dz_qupath/deepzoom.hpp"
+#include "../dz_slideio/deepzoom.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+// ./dz_export 'xxx.svs' 'out/xxx' jpg 75 254 1
+// ./dz_export 'xxx.svs' 'out/xxx.dzpack' jpg 75 254 1 (a single file, see `dz_common::TilePack`)
+// ./dz_export 'xxx.svs' 'out/xxx.zarr' jpg 75 512 (an OME-Zarr store of 512 pixel chunks, see `dz_common::ZarrWriter`)
+// ./dz_export 'xxx.czi' 'out/xxx.zarr' jpg 75 512 0 0 slideio (OME-Zarr only with the slideio and QuPath backends)
+int main(int argc, char* argv[])
+{
+    using namespace dz_openslide;
+
+    if (argc < 3)
+    {
+        std::cerr
+            << "Usage: " << argv[0]
+            << ": <slide path> <output name (writes <name>.dzi and <name>_files/, a single file if it ends with .dzpack, an OME-Zarr store if it ends with .zarr)> <format(jpg/png/webp/webp_lossless/avif, default=jpg)> <quality(0-100, default=75)> <tile_size(default=254)> <overlap(default=1)> <limit_bounds(0/1, default=0)> <backend(openslide/slideio/qupath, default=openslide)>"
+            << std::endl;
+        return -1;
+    }
+
+    std::string format = "jpg";
+    int quality = 75;
+    int tile_size = 254;
+    int overlap = 1;
+    bool limit_bounds = false;
+    if (argc > 3) format = argv[3];
+    if (argc > 4) quality = std::stoi(argv[4]);
+    if (argc > 5) tile_size = std::stoi(argv[5]);
+    if (argc > 6) overlap = std::stoi(argv[6]);
+    if (argc > 7) limit_bounds = std::stoi(argv[7]) != 0;
+    std::string const backend = argc > 8 ? argv[8] : "openslide";
+    std::string const output = argv[2];
+    auto const pack = output.ends_with(".dzpack");
+    auto const zarr = output.ends_with(".zarr");
+    // zarr chunks hold raw pixels and do not overlap, format and quality are not used
+    if (zarr) overlap = 0;
+    if (backend != "openslide" && ((backend != "slideio" && backend != "qupath") || !zarr))
+    {
+        std::cerr << "Unknown backend, or not an OME-Zarr output: " << backend << std::endl;
+        return -1;
+    }
+
+    auto image_format = DeepZoomGenerator::ImageFormat::JPG;
+    if (format == "png")
+        image_format = DeepZoomGenerator::ImageFormat::PNG;
+    else if (format == "webp")
+        image_format = DeepZoomGenerator::ImageFormat::WEBP;
+    else if (format == "webp_lossless")
+        image_format = DeepZoomGenerator::ImageFormat::WEBP_LOSSLESS;
+    else if (format == "avif")
+        image_format = DeepZoomGenerator::ImageFormat::AVIF;
+    else if (format != "jpg")
+    {
+        std::cerr << "Unknown format: " << format << std::endl;
+        return -1;
+    }
+
+    // the generator of the other backends only reads, the pyramid is built and written by the exporter
+    std::unique_ptr<DeepZoomGenerator> generator;
+    std::unique_ptr<dz_slideio::DeepZoomGenerator> slideio_generator;
+    std::unique_ptr<dz_qupath::DeepZoomGenerator> qupath_generator;
+    std::unique_ptr<PyramidExporter> exporter;
+    auto const readers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    if (backend == "slideio")
+    {
+        slideio_generator = std::make_unique<dz_slideio::DeepZoomGenerator>(argv[1], tile_size, overlap);
+        if (slideio_generator->is_valid())
+            exporter = std::make_unique<PyramidExporter>(PyramidExporter::slide_source(*slideio_generator));
+    }
+    else if (backend == "qupath")
+    {
+        qupath_generator = std::make_unique<dz_qupath::DeepZoomGenerator>(argv[1], tile_size, overlap);
+        qupath_generator->set_max_readers(readers);
+        if (qupath_generator->is_valid())
+            exporter = std::make_unique<PyramidExporter>(PyramidExporter::slide_source(*qupath_generator));
+    }
+    else
+    {
+        generator = std::make_unique<DeepZoomGenerator>(argv[1], tile_size, overlap, limit_bounds, image_format,
+                                                        std::clamp(quality / 100.f, 0.f, 1.f));
+        generator->set_max_handles(readers);
+        if (generator->is_valid()) exporter = std::make_unique<PyramidExporter>(*generator);
+    }
+    if (!exporter)
+    {
+        std::cerr << "Failed to open slide: " << argv[1] << std::endl;
+        return -1;
+    }
+
+    int last_percent = -1;
+    exporter->set_progress_callback([&last_percent](int64_t done, int64_t total) {
+        auto const percent = static_cast<int>(done * 100 / std::max(int64_t{1}, total));
+        if (percent != last_percent)
+        {
+            last_percent = percent;
+            std::cout << "\r" << percent << "% (" << done << "/" << total << ")" << std::flush;
+        }
+    });
+
+    auto const start = std::chrono::steady_clock::now();
+    auto const ok = zarr   ? exporter->export_zarr(output)
+                    : pack ? exporter->export_pack(output)
+                           : exporter->export_to(output);
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto const stats = exporter->stats();
+    std::cout << "\ntiles read: " << stats.tiles_read << ", tiles written: " << stats.tiles_written
+              << ", MB written: " << stats.bytes_written / 1e6 << ", failures: " << stats.failures
+              << ", seconds: " << elapsed << std::endl;
+    return ok ? 0 : -1;
+}
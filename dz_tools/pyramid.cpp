@@ -0,0 +1,93 @@
+#include "../dz_openslide/deepzoom.hpp"
+#include "../dz_openslide/exporter.hpp"
+#include "../dz_openslide/flatimage.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+// ./dz_pyramid 'in/' 'out/' 90 256 (every image/slide of `in/` to `out/<name>.tiff`)
+// ./dz_pyramid 'xxx.png' 'out/'
+int main(int argc, char* argv[])
+{
+    using namespace dz_openslide;
+
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << ": <input file or directory (flat jpg/png images, or slides openslide opens)> <output directory>"
+                     " <quality(0-100, default=90)> <tile_size(multiple of 16, default=256)>"
+                  << std::endl;
+        return -1;
+    }
+
+    std::filesystem::path const input = argv[1];
+    std::filesystem::path const output = argv[2];
+    int quality = 90;
+    int tile_size = 256;
+    if (argc > 3) quality = std::clamp(std::stoi(argv[3]), 0, 100);
+    if (argc > 4) tile_size = std::stoi(argv[4]);
+
+    std::error_code ec;
+    std::vector<std::filesystem::path> files;
+    if (std::filesystem::is_directory(input, ec))
+    {
+        for (auto const& entry : std::filesystem::directory_iterator(input, ec))
+            if (entry.is_regular_file()) files.push_back(entry.path());
+        std::sort(files.begin(), files.end());
+    }
+    else
+        files.push_back(input);
+    std::filesystem::create_directories(output, ec);
+
+    int failures = 0;
+    for (auto const& file : files)
+    {
+        auto const target = (output / file.stem()).string() + ".tiff";
+        std::cout << file.filename().string() << std::flush;
+        auto const start = std::chrono::steady_clock::now();
+
+        // slides are read through openslide with a handle per core, images are decoded a strip at a time
+        std::unique_ptr<FlatImage> image;
+        std::unique_ptr<DeepZoomGenerator> generator;
+        std::unique_ptr<PyramidExporter> exporter;
+        int64_t pixels = 0;
+        if (FlatImage::is_flat_image(file.string()))
+        {
+            image = std::make_unique<FlatImage>(file.string());
+            if (image->is_valid())
+            {
+                pixels = image->width() * image->height();
+                exporter = std::make_unique<PyramidExporter>(*image, tile_size);
+            }
+        }
+        else
+        {
+            generator = std::make_unique<DeepZoomGenerator>(file.string(), tile_size, 0, false,
+                                                            DeepZoomGenerator::ImageFormat::JPG, quality / 100.f);
+            if (generator->is_valid())
+            {
+                generator->set_max_handles(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+                auto const [width, height] = generator->level_dimensions().back();
+                pixels = width * height;
+                exporter = std::make_unique<PyramidExporter>(*generator);
+            }
+        }
+        if (!exporter)
+        {
+            std::cout << ": skipped, not an image or a slide" << std::endl;
+            continue;
+        }
+
+        auto const ok = exporter->export_tiff(target, quality);
+        auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto const stats = exporter->stats();
+        std::cout << " -> " << target << (ok ? "" : " FAILED") << ", tiles: " << stats.tiles_written
+                  << ", MB: " << stats.bytes_written / 1e6 << ", seconds: " << seconds
+                  << ", megapixels/s: " << pixels / 1e6 / std::max(seconds, 1e-9) << std::endl;
+        failures += ok ? 0 : 1;
+    }
+    return failures == 0 ? 0 : -1;
+}